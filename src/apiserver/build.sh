@@ -3,6 +3,14 @@ g++ --std=c++14 \
  src/main.cpp \
  src/utils/utils.cpp \
  src/utils/base64.cpp \
+ src/utils/SnapshotCache.cpp \
+ src/utils/HistoryStore.cpp \
+ src/utils/StatusStream.cpp \
+ src/utils/JsonWriter.cpp \
+ src/utils/CborWriter.cpp \
+ src/utils/Sha256.cpp \
+ src/utils/FirmwareUpload.cpp \
+ src/utils/StaticAssets.cpp \
  src/CrowMain.cpp \
  src/CgMinerMain.cpp \
  src/utils/CgMinerUtils.cpp \
@@ -12,10 +12,13 @@
 #include <boost/asio/write.hpp>
 #include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <algorithm>
 #include <iostream>
+#include <poll.h>
 #include <stdio.h>
 #include <string>
 #include <syslog.h>
+#include <unistd.h>
 
 using namespace boost::asio;
 using namespace boost::asio::ip;
@@ -24,9 +27,25 @@ using namespace crow;
 
 SafeQueue<CgMiner::Request> gRequestQueue;
 
+// Number of connections to cgminer, each served by its own thread, so a slow command (e.g. a
+// large stats reply) doesn't hold up every other request.
+#define CGMINER_CONNECTIONS 3
+
+// Connect attempts back off from the initial delay, doubling up to the max delay.
+#define CONNECT_ATTEMPTS 8
+#define CONNECT_INITIAL_DELAY_MS 50
+#define CONNECT_MAX_DELAY_MS 1000
+
+// How long to wait for cgminer to send more of a reply before giving up on the connection.
+#define READ_TIMEOUT_MS 10000
+
+// cgminer ends every reply with a NUL byte.
+#define REPLY_TERMINATOR '\0'
+
 class CgMinerClient {
 public:
-  CgMinerClient(string addr, string p) : address(addr), port(p), exit(false) {}
+  CgMinerClient(string addr, string p)
+      : address(addr), port(p), exit(false), reusable(false), pipelined(false) {}
 
   void start() {
     // Initialize syslog for this thread
@@ -35,35 +54,14 @@ public:
     syslog(LOG_NOTICE, "STARTING apiserver/cgminer thread");
 
     while (!exit) {
-    wait:
       CgMiner::Request req = gRequestQueue.dequeue();
-      CgMiner::Response lastResp(0, "", "");
 
       try {
-        for (auto cmd : req.commands) {
-          // CROW_LOG_DEBUG << "Connecting for cgminer command: " << cmd.first << ", " << cmd.second;
-          if (!resolveAndConnect()) {
-            CgMiner::Response resp = {CGMINER_ERROR, "Unable to connect to obelisk-miner", ""};
-            req.callback(resp);
-            goto wait;
-          }
-
-          // CROW_LOG_DEBUG << "Calling sendCommand(" << cmd.first << ", " << cmd.second << ")";
-          CgMiner::Response resp = sendCommand(cmd.first, cmd.second);
-          lastResp = resp;
-          // CROW_LOG_DEBUG << "Send/receive complete";
-          // CROW_LOG_DEBUG << "Data = " << resp.json;
-          // int i = 0;
-          // while (i < resp.json.length()) {
-          //   CROW_LOG_DEBUG << resp.json.substr(i, 80);
-          //   i += 80;
-          // }
-        }
-
         // Call the callback with the last response now that all commands are done
         // TODO: Could instead return an array of responses if we need access to the individual
         // resps.
-        req.callback(lastResp);
+        CgMiner::Response resp = runCommands(req.commands, req.plainText);
+        req.callback(resp);
       } catch (std::exception* exc) {
         // The callback probably generated an exception, so let's try again with an error
         CgMiner::Response resp = {CGMINER_ERROR, "Internal processing error", ""};
@@ -73,119 +71,244 @@ public:
   }
 
 private:
-#define MAX_RETRIES 5
-  bool resolveAndConnect() {
-    boost::system::error_code error;
-    tcp::resolver::iterator it;
-    tcp::resolver::query q{address, port};
+  CgMiner::Response runCommands(const CgMiner::Commands &commands, bool plainText) {
+    CgMiner::Response lastResp(0, "", "");
+    if (pipelined && commands.size() > 1) {
+      int rc = runPipelined(commands, plainText, lastResp);
+      if (rc <= 0) {
+        return rc == 0 ? lastResp : CgMiner::Response{CGMINER_ERROR, "Invalid response", ""};
+      }
+      // cgminer no longer keeps the connection open, so fall back to one command at a time
+      pipelined = false;
+    }
 
-    // Resolve
-    int retryCount = 0;
-    while (retryCount < MAX_RETRIES) {
-      it = resolv.resolve(q, error);
-      if (!error) {
-        break;
+    for (auto cmd : commands) {
+      string reply;
+      int rc = exchange(cmd.first, cmd.second, plainText, reply);
+      if (rc < 0) {
+        return CgMiner::Response{CGMINER_ERROR, "Unable to connect to obelisk-miner", ""};
+      }
+      if (rc > 0) {
+        return CgMiner::Response{CGMINER_ERROR, "Invalid response", ""};
+      }
+      lastResp = CgMiner::Response{CGMINER_SUCCESS, "", reply};
+    }
+    if (!reusable) {
+      closeConnection();
+    }
+    return lastResp;
+  }
+
+  // Send one command and read its reply. Returns 0 on success, -1 if cgminer can't be reached
+  // or 1 if the reply was lost.
+  int exchange(const string &command, const string &param, bool plainText, string &reply) {
+    // A command sent on a connection that cgminer had already closed is never seen by cgminer,
+    // so it is safe to send it again on a fresh connection, once.
+    for (int attempt = 0; attempt < 2; attempt++) {
+      bool reused = prepareConnection();
+      if (!tcp_socket.is_open()) {
+        return -1;
+      }
+      bool sent = sendCommand(command, param, plainText);
+      int rc = sent ? readReply(reply) : 1;
+      if (rc == 0) {
+        if (reused) {
+          // cgminer answered a second request on the same connection
+          pipelined = true;
+        }
+        return 0;
       }
+      closeConnection();
+      if (!reused || rc < 0) {
+        return 1;
+      }
+    }
+    return 1;
+  }
 
-      CROW_LOG_DEBUG << "Waiting to resolve...";
-      usleep(1000000);
-      retryCount++;
+  // Write all the commands up front and read the replies back in order, rather than waiting for
+  // each reply in turn. Returns 0 on success, 1 if the connection turned out to be closed before
+  // any command was seen, or -1 on any other failure.
+  int runPipelined(const CgMiner::Commands &commands, bool plainText,
+                   CgMiner::Response &lastResp) {
+    bool reused = prepareConnection();
+    if (!tcp_socket.is_open()) {
+      return -1;
     }
-    if (retryCount == MAX_RETRIES) {
+    for (auto cmd : commands) {
+      if (!sendCommand(cmd.first, cmd.second, plainText)) {
+        closeConnection();
+        return reused ? 1 : -1;
+      }
+    }
+    for (size_t received = 0; received < commands.size(); received++) {
+      string reply;
+      int rc = readReply(reply);
+      if (rc != 0) {
+        // Replies after a failure are lost, and later commands may depend on earlier ones, so
+        // don't try to pick up part way through.
+        closeConnection();
+        return (rc > 0 && received == 0 && reused) ? 1 : -1;
+      }
+      lastResp = CgMiner::Response{CGMINER_SUCCESS, "", reply};
+    }
+    if (!reusable) {
+      closeConnection();
+    }
+    return 0;
+  }
+
+  // Make sure there is a usable connection, reusing the current one if cgminer left it open.
+  // Returns true if an existing connection is being reused.
+  bool prepareConnection() {
+    if (tcp_socket.is_open()) {
+      if (reusable && !peerHasClosed()) {
+        return true;
+      }
+      closeConnection();
+    }
+    resolveAndConnect();
+    return false;
+  }
+
+  // Check, without blocking, whether cgminer has closed its end of the connection.
+  bool peerHasClosed() {
+    struct pollfd pfd = {tcp_socket.native_handle(), POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0) {
       return false;
     }
+    // Anything readable while no request is outstanding is either EOF or junk
+    return true;
+  }
+
+  void closeConnection() {
+    boost::system::error_code error;
+    tcp_socket.close(error);
+    pending.clear();
+  }
+
+  bool resolveAndConnect() {
+    boost::system::error_code error;
+    int delayMs = CONNECT_INITIAL_DELAY_MS;
+    for (int attempt = 0; attempt < CONNECT_ATTEMPTS; attempt++) {
+      if (attempt > 0) {
+        usleep(delayMs * 1000);
+        delayMs = std::min(delayMs * 2, CONNECT_MAX_DELAY_MS);
+      }
+
+      tcp::resolver::query q{address, port};
+      tcp::resolver::iterator it = resolv.resolve(q, error);
+      if (error) {
+        CROW_LOG_DEBUG << "Waiting to resolve...";
+        continue;
+      }
 
-    // Connect
-    retryCount = 0;
-    while (retryCount < MAX_RETRIES) {
       tcp_socket.connect(*it, error);
       if (!error) {
+        tcp_socket.set_option(tcp::no_delay(true), error);
+        reusable = true;
         return true;
       }
+      tcp_socket.close(error);
       CROW_LOG_DEBUG << "Waiting for miner API connection...";
-      usleep(1000000);
-      retryCount++;
     }
     return false;
   }
 
-  CgMiner::Response sendCommand(string command, string param) {
-    json::wvalue jsonReq = json::load("{}");
-    if (param.length() > 0) {
-      jsonReq["parameter"] = param;
+  bool sendCommand(string command, string param, bool plainText) {
+    string strReq;
+    if (plainText) {
+      // cgminer's plain form is the command, then '|' and the parameter if there is one
+      strReq = param.length() > 0 ? command + "|" + param : command;
+    } else {
+      json::wvalue jsonReq = json::load("{}");
+      if (param.length() > 0) {
+        jsonReq["parameter"] = param;
+      }
+      jsonReq["command"] = command;
+      strReq = json::dump(jsonReq);
     }
-    jsonReq["command"] = command;
-    string strReq = json::dump(jsonReq);
+    // The newline separates requests written back to back; cgminer ignores it
+    strReq += "\n";
     CROW_LOG_DEBUG << "Sending: " << strReq;
     boost::system::error_code error;
 
-    size_t bytesSent = tcp_socket.send(buffer(strReq.c_str(), strReq.length()), 0, error);
+    size_t bytesSent = write(tcp_socket, buffer(strReq), error);
     if (error || bytesSent != strReq.length()) {
       CROW_LOG_DEBUG << "error=" << error << " bytesSent=" << bytesSent;
-      CgMiner::Response resp{CGMINER_ERROR, "Invalid number of bytes sent", ""};
-      return resp;
+      return false;
     }
+    return true;
+  }
 
-    bool readComplete = false;
-    string partialResponse = "";
-    int numReadAttempts = 0;
-    while (!readComplete) {
-      size_t bytesRead = tcp_socket.read_some(buffer(responseArr), error);
-
-      string responseStr(responseArr.begin(), responseArr.begin() + bytesRead);
-      partialResponse += responseStr;
+  // Read one reply, up to cgminer's terminator. Returns 0 on success, 1 if cgminer closed the
+  // connection before sending anything, or -1 on any other failure.
+  int readReply(string &reply) {
+    // Only the newly read bytes are searched for the terminator
+    size_t scanned = 0;
+    while (true) {
+      size_t end = pending.find(REPLY_TERMINATOR, scanned);
+      if (end != string::npos) {
+        reply.assign(pending, 0, end);
+        pending.erase(0, end + 1);
+        return 0;
+      }
+      scanned = pending.length();
 
-      // CROW_LOG_DEBUG << "partialResponse: `" << partialResponse
-      //      << "`"
-      //         " bytesRead = "
-      //      << bytesRead << "  error = " << error;
+      struct pollfd pfd = {tcp_socket.native_handle(), POLLIN, 0};
+      if (poll(&pfd, 1, READ_TIMEOUT_MS) <= 0) {
+        CROW_LOG_DEBUG << "Timed out waiting for cgminer reply";
+        return -1;
+      }
 
-      try {
-        // Parse to check if it's valid JSON
-        json::rvalue json = json::load(partialResponse);
-
-        // The partialResponse is actually a full response, so return it
-        if (!error && json) {
-          CgMiner::Response resp{CGMINER_SUCCESS, "", partialResponse};
-          // Other side already closed, but cleanup our side too
-          tcp_socket.close();
-          return resp;
+      boost::system::error_code error;
+      size_t bytesRead = tcp_socket.read_some(buffer(responseArr), error);
+      // Writing to a connection cgminer has closed gets it reset rather than a clean EOF
+      if (error == error::eof || error == error::connection_reset) {
+        reusable = false;
+        if (pending.empty()) {
+          return 1;
         }
-
-        // Some error or invalid json
-        CgMiner::Response resp{CGMINER_ERROR, "Invalid JSON received", ""};
-        return resp;
-
-      } catch (const std::exception& exc) {
-        // Parsing exception means we still need to read more data
-        CROW_LOG_DEBUG << "Waiting for more JSON data...";
-        numReadAttempts++;
-        if (numReadAttempts > 5) {
-          readComplete = true;
+        // A reply without a terminator is complete once the connection closes, as long as it
+        // is whole JSON.
+        try {
+          if (json::load(pending)) {
+            reply.swap(pending);
+            pending.clear();
+            return 0;
+          }
+        } catch (const std::exception &exc) {
         }
+        return -1;
+      }
+      if (error) {
+        CROW_LOG_DEBUG << "Read error: " << error;
+        return -1;
       }
+      pending.append(responseArr.data(), bytesRead);
     }
-
-    // If we have tried this many times, but haven't read the json, we are probably
-    // out of sync somehow.
-    CgMiner::Response resp{CGMINER_ERROR, "Invalid response", ""};
-    return resp;
   }
 
 private:
   string address;
   string port;
   bool exit;
+  // True until cgminer is seen to close the connection after a reply
+  bool reusable;
+  // True once cgminer has answered more than one request on a connection
+  bool pipelined;
   io_service ioservice;
   tcp::resolver resolv{ioservice};
   tcp::socket tcp_socket{ioservice};
   std::array<char, 4096> responseArr;
+  // Bytes read past the end of the last reply
+  string pending;
 };
 
-void *runCgMiner(void *) {
+static void *runCgMinerConnection(void *) {
   while (true) {
     try {
-      CROW_LOG_DEBUG << "runCgMiner()";
+      CROW_LOG_DEBUG << "runCgMinerConnection()";
       CgMinerClient client("127.0.0.1", "4028");
       client.start();
     } catch(const std::exception& exc) {
@@ -194,3 +317,12 @@ void *runCgMiner(void *) {
   }
   return NULL;
 }
+
+void *runCgMiner(void *) {
+  // Each connection takes requests from the shared queue as soon as it is free
+  pthread_t threads[CGMINER_CONNECTIONS - 1];
+  for (int i = 0; i < CGMINER_CONNECTIONS - 1; i++) {
+    pthread_create(&threads[i], NULL, runCgMinerConnection, NULL);
+  }
+  return runCgMinerConnection(NULL);
+}
@@ -67,9 +67,12 @@ class Request {
 public:
   Commands commands;
   bool saveAfter;
+  // Send the commands in cgminer's plain text form rather than as JSON, for commands whose
+  // reply isn't JSON
+  bool plainText;
   // Use lambdas with closure to provide more context
   RequestCallback callback;
-  Request(Commands cmds, RequestCallback cb) : commands(cmds), callback(cb) {}
+  Request(Commands cmds, RequestCallback cb) : commands(cmds), plainText(false), callback(cb) {}
 };
 
 } // namespace CgMiner
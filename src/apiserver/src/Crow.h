@@ -4245,6 +4245,11 @@ namespace crow
 
 
 
+// Largest request body accepted; large uploads are sent in chunks below this
+#ifndef CROW_MAX_BODY_SIZE
+#define CROW_MAX_BODY_SIZE (2 * 1024 * 1024)
+#endif
+
 namespace crow
 {
     template <typename Handler>
@@ -4309,6 +4314,11 @@ namespace crow
         static int on_body(http_parser* self_, const char* at, size_t length)
         {
             HTTPParser* self = static_cast<HTTPParser*>(self_);
+            // The body is held in memory, so refuse (and drop the connection) past the limit
+            if (self->body.size() + length > CROW_MAX_BODY_SIZE)
+            {
+                return 1;
+            }
             self->body.insert(self->body.end(), at, at+length);
             return 0;
         }
@@ -4496,7 +4506,10 @@ namespace crow
 
                 void send_pong(const std::string& msg)
                 {
-                    dispatch([this, msg]{
+                    dispatch([this, msg, alive = alive_]{
+                        // Sends from other threads may be queued behind the close
+                        if (!*alive)
+                            return;
                         char buf[3] = "\x8A\x00";
                         buf[1] += msg.size();
                         write_buffers_.emplace_back(buf, buf+2);
@@ -4507,7 +4520,10 @@ namespace crow
 
                 void send_binary(const std::string& msg) override
                 {
-                    dispatch([this, msg]{
+                    dispatch([this, msg, alive = alive_]{
+                        // Sends from other threads may be queued behind the close
+                        if (!*alive)
+                            return;
                         auto header = build_header(2, msg.size());
                         write_buffers_.emplace_back(std::move(header));
                         write_buffers_.emplace_back(msg);
@@ -4517,7 +4533,10 @@ namespace crow
 
                 void send_text(const std::string& msg) override
                 {
-                    dispatch([this, msg]{
+                    dispatch([this, msg, alive = alive_]{
+                        // Sends from other threads may be queued behind the close
+                        if (!*alive)
+                            return;
                         auto header = build_header(1, msg.size());
                         write_buffers_.emplace_back(std::move(header));
                         write_buffers_.emplace_back(msg);
@@ -4527,7 +4546,10 @@ namespace crow
 
                 void close(const std::string& msg) override
                 {
-                    dispatch([this, msg]{
+                    dispatch([this, msg, alive = alive_]{
+                        // Sends from other threads may be queued behind the close
+                        if (!*alive)
+                            return;
                         has_sent_close_ = true;
                         if (has_recv_close_ && !is_close_handler_called_)
                         {
@@ -4892,6 +4914,11 @@ namespace crow
                     }
                 }
 
+                ~Connection()
+                {
+                    *alive_ = false;
+                }
+
                 void check_destroy()
                 {
                     //if (has_sent_close_ && has_recv_close_)
@@ -4923,6 +4950,8 @@ namespace crow
                 bool error_occured_{false};
                 bool pong_received_{false};
                 bool is_close_handler_called_{false};
+                // Cleared when the connection is deleted
+                std::shared_ptr<bool> alive_{std::make_shared<bool>(true)};
 
 				std::function<void(crow::websocket::connection&)> open_handler_;
 				std::function<void(crow::websocket::connection&, const std::string&, bool)> message_handler_;
@@ -8584,6 +8613,7 @@ namespace crow
                 {401, "HTTP/1.1 401 Unauthorized\r\n"},
                 {403, "HTTP/1.1 403 Forbidden\r\n"},
                 {404, "HTTP/1.1 404 Not Found\r\n"},
+                {409, "HTTP/1.1 409 Conflict\r\n"},
                 {413, "HTTP/1.1 413 Payload Too Large\r\n"},
                 {422, "HTTP/1.1 422 Unprocessable Entity\r\n"},
                 {429, "HTTP/1.1 429 Too Many Requests\r\n"},
@@ -16,13 +16,14 @@ typedef struct {
   time_t sessionExpirationTime;
 } SessionInfo;
 
-#define HASHRATE_POLL_PERIOD 1
+#define HISTORY_POLL_PERIOD 5s
 
 extern void sendCgMinerCmd(string command, string param, CgMiner::RequestCallback callback);
 
 static unordered_map<string, SessionInfo> activeSessions;
 
-extern void pollForHashrate();
+extern void loadHistory();
+extern void pollForHistory();
 
 struct AuthMW {
   struct context {
@@ -72,6 +73,36 @@ bool isAuthenticated(crow::App<crow::CookieParser, AuthMW> &app, const request &
   return ctx.isAuthenticated;
 }
 
+// Websocket upgrades don't go through the middleware, so check the session cookie directly
+bool hasActiveSession(const request &req) {
+  string cookies = req.get_header_value("Cookie");
+  string sessionId;
+  size_t pos = 0;
+  while (pos < cookies.length()) {
+    size_t end = cookies.find(';', pos);
+    if (end == string::npos) {
+      end = cookies.length();
+    }
+    string cookie = cookies.substr(pos, end - pos);
+    boost::trim(cookie);
+    if (boost::starts_with(cookie, "sessionid=")) {
+      sessionId = cookie.substr(strlen("sessionid="));
+    }
+    pos = end + 1;
+  }
+  if (sessionId.length() == 0) {
+    return false;
+  }
+
+  unordered_map<string, SessionInfo>::iterator it = activeSessions.find(sessionId);
+  if (it == activeSessions.end()) {
+    return false;
+  }
+  struct tm tmNow = getTimeNow();
+  time_t timeNow = mktime(&tmNow);
+  return difftime(timeNow, it->second.sessionExpirationTime) <= 0;
+}
+
 void runCrow(int port) {
   // Initialize syslog for this thread
   setlogmask(LOG_UPTO(LOG_NOTICE));
@@ -80,7 +111,18 @@ void runCrow(int port) {
 
   CROW_LOG_DEBUG << "runCrow()";
   App<CookieParser, AuthMW> app;
-  app.tick(60s, pollForHashrate);
+  loadHistory();
+  app.tick(HISTORY_POLL_PERIOD, pollForHistory);
+
+  // Live dashboard updates; see StatusStream for the message format
+  startStatusStream();
+  CROW_ROUTE(app, "/api/status/stream")
+      .websocket()
+      .onaccept([&](const request &req) { return hasActiveSession(req); })
+      .onopen([&](crow::websocket::connection &conn) { subscribeStatusStream(conn); })
+      .onclose([&](crow::websocket::connection &conn, const string &reason) {
+        unsubscribeStatusStream(conn);
+      });
 
   int counter = 0;
   CROW_ROUTE(app, "/api/counter")
@@ -206,6 +248,43 @@ void runCrow(int port) {
     }
   });
 
+  // Prometheus metrics, for collectors that can't log in. Like /api/info, nothing that
+  // identifies the owner (e.g. pool URLs or workers) may be added to them.
+  CROW_ROUTE(app, "/api/metrics").methods("GET"_method)([&](const request &req, crow::response &resp) {
+    try {
+      handleMetrics(req, resp);
+    } catch(const std::exception& exc) {
+      CROW_LOG_ERROR << "/api/metrics EXCEPTION: " << exc.what();
+      resp.code = HttpStatus_InternalServerError;
+      resp.end();
+      return;
+    }
+  });
+
+  // Resumable firmware upload; GET for how far an upload got, PUT to send the next chunk
+  CROW_ROUTE(app, "/api/firmware/upload")
+      .methods("GET"_method, "PUT"_method)([&](const request &req, crow::response &resp) {
+        try {
+          if (!isAuthenticated(app, req)) {
+            CROW_LOG_DEBUG << "NOT LOGGED IN";
+            resp.code = HttpStatus_Unauthorized;
+            resp.end();
+            return;
+          }
+
+          if (req.method == "PUT"_method) {
+            handleFirmwareUploadChunk(req, resp);
+          } else {
+            handleFirmwareUploadStatus(req, resp);
+          }
+        } catch(const std::exception& exc) {
+          CROW_LOG_ERROR << "/api/firmware/upload EXCEPTION: " << exc.what();
+          resp.code = HttpStatus_InternalServerError;
+          resp.end();
+          return;
+        }
+      });
+
   CROW_ROUTE(app, "/api/<path>")
       .methods("GET"_method)([&](const request &req, crow::response &resp, string path) {
         try {
@@ -269,5 +348,23 @@ void runCrow(int port) {
         }
       });
 
+  // The web UI. These come last so that every /api route above is matched first.
+  loadStaticAssets();
+  CROW_ROUTE(app, "/").methods("GET"_method)([&](const request &req, crow::response &resp) {
+    handleStaticAsset(req, resp, "/");
+  });
+
+  CROW_ROUTE(app, "/<path>")
+      .methods("GET"_method)([&](const request &req, crow::response &resp, string path) {
+        try {
+          handleStaticAsset(req, resp, "/" + path);
+        } catch(const std::exception& exc) {
+          CROW_LOG_ERROR << "handleStaticAsset() EXCEPTION: " << exc.what();
+          resp.code = HttpStatus_InternalServerError;
+          resp.end();
+          return;
+        }
+      });
+
   app.port(port).multithreaded().run();
 }
@@ -3,8 +3,17 @@
 #include "Handlers.h"
 #include "../CgMinerTypes.h"
 #include "../Crow.h" // Get the log levels
+#include "../utils/HistoryStore.h"
+#include "../utils/CborWriter.h"
+#include "../utils/CgMinerUtils.h"
+#include "../utils/FirmwareUpload.h"
 #include "../utils/HttpStatusCodes.h"
+#include "../utils/JsonWriter.h"
 #include "../utils/SafeQueue.h"
+#include "../utils/Sha256.h"
+#include "../utils/SnapshotCache.h"
+#include "../utils/StaticAssets.h"
+#include "../utils/StatusStream.h"
 #include "../utils/base64.h"
 #include "../utils/utils.h"
 #include <boost/bind.hpp>
@@ -24,12 +33,15 @@ extern SafeQueue<CgMiner::Request> gRequestQueue;
 
 string gModel = "";
 
+string errorJson(string error) {
+  JsonWriter jsonErr(64);
+  jsonErr.startObject().field("error", error).endObject();
+  return jsonErr.str();
+}
+
 void sendError(string error, int code, crow::response &resp) {
-  json::wvalue jsonErr = json::load("{}");
-  jsonErr["error"] = error;
-  string jsonStr = json::dump(jsonErr);
   resp.code = code;
-  resp.write(jsonStr);
+  resp.write(errorJson(error));
   resp.end();
 }
 
@@ -52,10 +64,17 @@ void sendCgMinerCmd(string command, string param, CgMiner::RequestCallback callb
   sendCgMinerCmds(cmds, callback);
 }
 
-bool isCgMinerError(json::rvalue json) { return json["STATUS"][0]["STATUS"].s() == "E"; }
+// For commands whose reply isn't JSON
+void sendCgMinerPlainCmd(string command, string param, CgMiner::RequestCallback callback) {
+  CgMiner::Commands cmds;
+  cmds.push_back({command, param});
 
-// TODO: This is stupid!
-json::rvalue to_rvalue(json::wvalue &v) { return json::load(json::dump(v)); }
+  CgMiner::Request cgMinerReq{cmds, callback};
+  cgMinerReq.plainText = true;
+  gRequestQueue.enqueue(cgMinerReq);
+}
+
+bool isCgMinerError(json::rvalue json) { return json["STATUS"][0]["STATUS"].s() == "E"; }
 
 // Find the index of the entry with the specified name
 // the jsonArr must be an array
@@ -83,67 +102,84 @@ int findIndexByFieldValue(json::rvalue jsonArr, string fieldName, int value) {
   return -1;
 }
 
-json::rvalue makeSystemInfoEntry(string name, string value) {
-  json::wvalue obj = json::load("{}");
-  obj["name"] = name;
-  obj["value"] = value;
-  return to_rvalue(obj);
+void writeSystemInfoEntry(JsonWriter &out, string name, string value) {
+  out.startObject().field("name", name).field("value", value).endObject();
 }
 
-// Structure to store data from cgminer
+// Per-board history of what cgminer reports
+HistoryStore gHistory(HISTORY_FILE);
 
-#define MAX_HASHRATE_HISTORY_ENTRIES (60) // We keep one hour of history for now
-hashrate_t hashrate_history_secs[MAX_HASHRATE_HISTORY_ENTRIES];
-int num_hashrate_entries = 0;
+// Share counts from the previous poll, to turn cgminer's running totals into per-sample counts
+int64_t prevAccepted[MAX_HASHBOARDS];
+int64_t prevRejected[MAX_HASHBOARDS];
+bool havePrevCounts = false;
 
-// Timer callback to poll for updated hashrates
+void loadHistory() { gHistory.load(); }
+
+uint32_t countSince(int64_t count, int64_t &prev) {
+  // The counts go back to zero when cgminer restarts or its stats are cleared
+  uint32_t delta = count >= prev ? count - prev : count;
+  prev = count;
+  return delta;
+}
+
+// Timer callback to poll for updated history
 bool isPollInProgress = false;
-void pollForHashrate() {
-  CROW_LOG_DEBUG << "Polling for hashrates";
+void pollForHistory() {
+  CROW_LOG_DEBUG << "Polling for history";
   if (isPollInProgress) {
     // Don't poll again if the last request has not completed
     return;
   }
   isPollInProgress = true;
 
-  sendCgMinerCmd("dashdevs", "", [&](CgMiner::Response cgMinerResp) {
+  sendCgMinerCmd("dashstats+dashdevs", "", [&](CgMiner::Response cgMinerResp) {
     if (cgMinerResp.error) {
       // No data to append - oh well
       isPollInProgress = false;
       return;
     }
 
-    // No error, so build up the response that the user is expecting
     try {
-      // CROW_LOG_DEBUG << "json = " << cgMinerResp.json;
-
-      json::rvalue cgMinerJson = json::load(cgMinerResp.json);
-      time_t now = time(0);
-      double values[MAX_HASHBOARDS];
-      json::rvalue devsArr = cgMinerJson["DEVS"];
-      for (int i = 0; i < devsArr.size(); i++) {
-        json::rvalue entry = devsArr[i];
-        values[i] = entry["mhs5m"].d();
-      }
-
-
-      // See if we need to move the old data
-      int entry_index = num_hashrate_entries;
-      if (num_hashrate_entries >= MAX_HASHRATE_HISTORY_ENTRIES) {
-        // Need to slide the other entries down first, then set new data into the last entry
-        memmove(hashrate_history_secs, &hashrate_history_secs[1],
-                sizeof(hashrate_t) * (MAX_HASHRATE_HISTORY_ENTRIES - 1));
-        entry_index = MAX_HASHRATE_HISTORY_ENTRIES - 1;
-      } else {
-        num_hashrate_entries++;
+      CgMiner::MinerStatus status;
+      if (!CgMiner::parseMinerStatus(cgMinerResp.json, status)) {
+        isPollInProgress = false;
+        return;
       }
 
-      // Record the new data
-      hashrate_history_secs[entry_index].time = now;
-      for (int i = 0; i < devsArr.size(); i++) {
-        hashrate_history_secs[entry_index].hashrates[i] = values[i]/1000.0;
+      HistorySample sample;
+      memset(&sample, 0, sizeof(sample));
+      sample.time = time(0);
+      for (auto &stats : status.boards) {
+        int boardId = stats.boardId;
+        if (boardId < 0 || boardId >= MAX_HASHBOARDS || boardId >= HISTORY_MAX_BOARDS) {
+          continue;
+        }
+        sample.numBoards = max<int>(sample.numBoards, boardId + 1);
+        sample.fanSpeed[0] = stats.fanSpeed0;
+        sample.fanSpeed[1] = stats.fanSpeed1;
+
+        HistoryBoard &board = sample.boards[boardId];
+        board.boardTemp = stats.boardTemp;
+        board.chipTemp = stats.chipTemp;
+        board.hotChipTemp = stats.hotChipTemp;
+        board.stringVoltage = stats.stringVoltage;
+
+        const CgMiner::DeviceStatus *dev = status.deviceFor(stats);
+        if (dev) {
+          board.hashrate = dev->mhs5m / 1000.0;
+          uint32_t accepted = countSince(dev->accepted, prevAccepted[boardId]);
+          uint32_t rejected = countSince(dev->rejected, prevRejected[boardId]);
+          if (havePrevCounts) {
+            board.accepted = accepted;
+            board.rejected = rejected;
+          }
+        }
       }
+      havePrevCounts = true;
 
+      gHistory.add(sample);
+      gHistory.flush(false);
     } catch (...) {
       // Unable to poll this time - just try again later
     }
@@ -157,21 +193,22 @@ void pollForHashrate() {
 
 void getInventoryVersions(string path, query_string &urlParams, const crow::request &req,
                           crow::response &resp) {
-    json::wvalue jsonResp;
-    jsonResp["cgminerVersion"] = "4.10.0";
-    jsonResp["firmwareVersion"] = getFirmwareVersion();
+    JsonWriter jsonResp;
+    jsonResp.startObject()
+        .field("cgminerVersion", "4.10.0")
+        .field("firmwareVersion", getFirmwareVersion())
+        .endObject();
 
-    sendJson(json::dump(jsonResp), resp);
+    sendJson(jsonResp.str(), resp);
 }
 
 void getInventorySystem(string path, query_string &urlParams, const crow::request &req,
                         crow::response &resp) {
   string osName = getOSName();
   string osVersion = getOSVersion();
-  json::wvalue jsonResp = json::load("{}");
-  jsonResp["osName"] = osName;
-  jsonResp["osVersion"] = osVersion;
-  sendJson(json::dump(jsonResp), resp);
+  JsonWriter jsonResp;
+  jsonResp.startObject().field("osName", osName).field("osVersion", osVersion).endObject();
+  sendJson(jsonResp.str(), resp);
 }
 
 void getInventoryAsicCount(string path, query_string &urlParams, const crow::request &req,
@@ -194,47 +231,45 @@ void getConfigPools(string path, query_string &urlParams, const crow::request &r
                     crow::response &resp) {
   json::rvalue conf = readCgMinerConfig();
 
-  if (!conf.has("pools")) {
-    json::rvalue result = json::load("[]");
-    sendJson(json::dump(result), resp);
-    return;
-  }
-
-  json::rvalue pools = conf["pools"];
-  json::wvalue result = json::load("[]");
-  for (int i = 0; i < pools.size(); i++) {
-    json::rvalue entry = pools[i];
-    json::wvalue resEntry = json::load("{}");
-    resEntry["worker"] = entry["user"].s();
-    resEntry["url"] = entry["url"].s();
-    resEntry["password"] = entry["pass"].s();
-    result[i] = to_rvalue(resEntry);
+  JsonWriter result;
+  result.startArray();
+  if (conf.has("pools")) {
+    const json::rvalue &pools = conf["pools"];
+    for (int i = 0; i < pools.size(); i++) {
+      const json::rvalue &entry = pools[i];
+      result.startObject()
+          .field("worker", string(entry["user"].s()))
+          .field("url", string(entry["url"].s()))
+          .field("password", string(entry["pass"].s()))
+          .endObject();
+    }
   }
-  sendJson(json::dump(result), resp);
+  result.endArray();
+  sendJson(result.str(), resp);
 }
 
 void getConfigNetwork(string path, query_string &urlParams, const crow::request &req,
                       crow::response &resp) {
-  json::wvalue jsonResp = json::load("{}");
-  jsonResp["hostname"] = getHostname(INTF_NAME);
-  jsonResp["ipAddress"] = getIpV4(INTF_NAME);
-  jsonResp["subnetMask"] = getSubnetMaskV4(INTF_NAME);
-  jsonResp["gateway"] = getDefaultGateway(INTF_NAME);
-  jsonResp["dnsServer"] = getDns(INTF_NAME);
-  jsonResp["dhcpEnabled"] = getDhcpEnabled(INTF_NAME);
-  jsonResp["macAddress"] = getMACAddr(INTF_NAME);
-  string jsonStr = json::dump(jsonResp);
-
-  sendJson(jsonStr, resp);
+  JsonWriter jsonResp;
+  jsonResp.startObject()
+      .field("hostname", getHostname(INTF_NAME))
+      .field("ipAddress", getIpV4(INTF_NAME))
+      .field("subnetMask", getSubnetMaskV4(INTF_NAME))
+      .field("gateway", getDefaultGateway(INTF_NAME))
+      .field("dnsServer", getDns(INTF_NAME))
+      .field("dhcpEnabled", getDhcpEnabled(INTF_NAME))
+      .field("macAddress", getMACAddr(INTF_NAME))
+      .endObject();
+
+  sendJson(jsonResp.str(), resp);
 }
 
 void getConfigSystem(string path, query_string &urlParams, const crow::request &req,
                      crow::response &resp) {
-  json::wvalue jsonResp = json::load("{}");
-  jsonResp["timezone"] = getTimezone();
-  string jsonStr = json::dump(jsonResp);
+  JsonWriter jsonResp;
+  jsonResp.startObject().field("timezone", getTimezone()).endObject();
 
-  sendJson(jsonStr, resp);
+  sendJson(jsonResp.str(), resp);
 }
 
 void getConfigMining(string path, query_string &urlParams, const crow::request &req,
@@ -244,43 +279,43 @@ void getConfigMining(string path, query_string &urlParams, const crow::request &
   // CROW_LOG_ERROR << json::dump(conf);
 
   // NOTE: This duplicates the default values as set in cgminer, which is not ideal
-  json::wvalue jsonResp = json::load("{}");
+  JsonWriter jsonResp;
+  jsonResp.startObject();
   if (conf.has("ob-optimization-mode")) {
-    jsonResp["optimizationMode"] = conf["ob-optimization-mode"].i();
+    jsonResp.field("optimizationMode", conf["ob-optimization-mode"].i());
   } else {
-    jsonResp["optimizationMode"] = 2;  // 2 means optimize for best hashrate
+    jsonResp.field("optimizationMode", 2);  // 2 means optimize for best hashrate
   }
 
   if (conf.has("ob-min-fan-speed-percent")) {
-    jsonResp["minFanSpeedPercent"] = conf["ob-min-fan-speed-percent"].i();
+    jsonResp.field("minFanSpeedPercent", conf["ob-min-fan-speed-percent"].i());
   } else {
-    jsonResp["minFanSpeedPercent"] = 100;
+    jsonResp.field("minFanSpeedPercent", 100);
   }
 
   if (conf.has("ob-max-hot-chip-temp-c")) {
-    jsonResp["maxHotChipTempC"] = conf["ob-max-hot-chip-temp-c"].i();
+    jsonResp.field("maxHotChipTempC", conf["ob-max-hot-chip-temp-c"].i());
   } else {
-    jsonResp["maxHotChipTempC"] = 105;
+    jsonResp.field("maxHotChipTempC", 105);
   }
   
-  jsonResp["rebootIntervalMins"] = getRebootInterval();
+  jsonResp.field("rebootIntervalMins", getRebootInterval());
   
   if (conf.has("ob-reboot-min-hashrate")) {
-    jsonResp["rebootMinHashrate"] = conf["ob-reboot-min-hashrate"].i();
+    jsonResp.field("rebootMinHashrate", conf["ob-reboot-min-hashrate"].i());
   } else {
-    jsonResp["rebootMinHashrate"] = 150; // TODO: Need to make this default depend on the model
+    jsonResp.field("rebootMinHashrate", 150); // TODO: Need to make this default depend on the model
     // DCR: 300, SC1: 150
   }
 
   if (conf.has("ob-disable-genetic-algo")) {
-    jsonResp["disableGeneticAlgo"] = conf["ob-disable-genetic-algo"].i() == 1;
+    jsonResp.field("disableGeneticAlgo", conf["ob-disable-genetic-algo"].i() == 1);
   } else {
-    jsonResp["disableGeneticAlgo"] = false;
+    jsonResp.field("disableGeneticAlgo", false);
   }
-  
-  string jsonStr = json::dump(jsonResp);
+  jsonResp.endObject();
 
-  sendJson(jsonStr, resp);
+  sendJson(jsonResp.str(), resp);
 }
 
 void getConfigConfig(string path, query_string &urlParams, const crow::request &req,
@@ -304,7 +339,7 @@ void setConfigPools(string path, json::rvalue &args, const crow::request &req,
   json::rvalue conf = readCgMinerConfig();
   // Create a wvalue from the rvalue
   json::wvalue newConf;
-  json::wvalue newPools = json::load("[]");
+  vector<json::wvalue> newPools;
   try {
     newConf = conf;
   } catch (...) {
@@ -312,7 +347,6 @@ void setConfigPools(string path, json::rvalue &args, const crow::request &req,
   }
 
   // Build up new pools entries as an array
-  int numEntries = 0;
   for (int i = 0; i < args.size(); i++) {
     json::rvalue poolEntry = args[i];
     string url = poolEntry["url"].s();
@@ -321,17 +355,15 @@ void setConfigPools(string path, json::rvalue &args, const crow::request &req,
 
     // Don't include entries that have empty URLs, because CGminer will crash, of course
     if (url.length() != 0) {
-      json::wvalue entry = json::load("{}");
-      entry["url"] = url;
-      entry["user"] = user;
-      entry["pass"] = pass;
-      newPools[numEntries] = to_rvalue(entry);
-      numEntries++;
+      newPools.emplace_back();
+      newPools.back()["url"] = url;
+      newPools.back()["user"] = user;
+      newPools.back()["pass"] = pass;
     }
   }
 
   // Set new pools entry into the wvalue
-  newConf["pools"] = to_rvalue(newPools);
+  newConf["pools"] = std::move(newPools);
 
   // Write out config file
   writeCgMinerConfig(newConf);
@@ -470,127 +502,378 @@ void setConfigAsic(string path, json::rvalue &args, const crow::request &req,
 // STATUS HANDLERS (CGMINER)
 //--------------------------------------------------------------------------------------------------
 
-void getStatusDashboard(string path, query_string &urlParams, const crow::request &req,
-                        crow::response &resp) {
+void writePoolStatus(JsonWriter &out, const CgMiner::PoolStatus &pool) {
+  out.startObject()
+      .field("pool", pool.pool)
+      .field("url", pool.url)
+      .field("worker", pool.worker)
+      .field("status", pool.status)
+      .field("priority", pool.priority)
+      .field("accepted", pool.accepted)
+      .field("rejected", pool.rejected)
+      .field("works", pool.works)
+      .field("discarded", pool.discarded)
+      .field("stale", pool.stale)
+      .field("lastShareTime", pool.lastShareTime)
+      .field("diff1Shares", pool.diff1Shares)
+      .field("duplicateShares", pool.duplicateShares)
+      .field("currBlockHeight", pool.currBlockHeight);
+  if (pool.hasNotifyLatency) {
+    out.field("notifyLatencyP50", pool.notifyLatencyP50)
+        .field("notifyLatencyP99", pool.notifyLatencyP99)
+        .field("notifyLatencyMax", pool.notifyLatencyMax);
+  }
+  out.endObject();
+}
 
-  sendCgMinerCmd("dashpools+dashstats+dashdevs", "", [&](CgMiner::Response cgMinerResp) {
-    // Prepare our JSON response outline
-    json::wvalue jsonResp = json::load("{}");
-    json::wvalue hashrateArr = json::load("[]");
-    json::wvalue hashboardArr = json::load("[]");
-    json::wvalue systemArr = json::load("[]");
-
-    // Fan speeds
-    int fanSpeed0 = 0;
-    int fanSpeed1 = 0;
-
-    if (!cgMinerResp.error) {
-      json::rvalue cgJsonResp = json::load(cgMinerResp.json);
-      if (!cgJsonResp.has("dashpools") || !cgJsonResp.has("dashstats") || !cgJsonResp.has("dashdevs")) {
-        sendError("Invalid response from mining app", HttpStatus_InternalServerError, resp);
-        return;
-      }
+void writeHashboardStatus(JsonWriter &out, const CgMiner::BoardStats &board,
+                          const CgMiner::DeviceStatus *dev) {
+  out.startObject()
+      .field("numChips", board.numChips)
+      .field("numCores", board.numCores)
+      .field("boardTemp", board.boardTemp)
+      .field("chipTemp", board.chipTemp)
+      .field("hotChipTemp", board.hotChipTemp)
+      .field("powerSupplyTemp", board.powerSupplyTemp)
+      .field("fanSpeed0", board.fanSpeed0)
+      .field("fanSpeed1", board.fanSpeed1);
+  if (board.hasSensorAge) {
+    out.field("sensorAgeMs", board.sensorAgeMs);
+  }
 
-      // CROW_LOG_DEBUG << "RESP=========================================";
-      // CROW_LOG_DEBUG << cgMinerResp.json;
-
-      json::rvalue poolsResp = cgJsonResp["dashpools"][0];
-      json::rvalue statsResp = cgJsonResp["dashstats"][0];
-      json::rvalue devsResp = cgJsonResp["dashdevs"][0];
-
-      // TODO: See why isCgMinerError() is failing
-      // Ensure that all requests succeeded
-      // if (isCgMinerError(poolsResp) || isCgMinerError(statsResp) || isCgMinerError(devsResp)) {
-      //   CROW_LOG_DEBUG << "Dashboard Error 1";
-      //   // sendError("Invalid response from mining app", HttpStatus_InternalServerError, resp);
-      //   return;
-      // }
-
-      // Handle the pools array - direct copy since it's a custom method in cgminer with just
-      // the info we want in the format we want.
-      jsonResp["poolStatus"] = poolsResp["POOLS"];
-
-      // Handle the hashboardStatus array
-      json::rvalue stats = statsResp["STATS"];
-      json::rvalue devs = devsResp["DEVS"];
-      json::wvalue hashStatus = json::load("[]");
-      int hashboardIndex = 0;
-      for (int i = 0; i < stats.size(); i++) {
-        json::rvalue statsEntry = stats[i];
-        if (statsEntry.has("boardId")) {
-          int boardId = statsEntry["boardId"].i();
-          json::wvalue entry = json::load("{}");
-
-          entry["numChips"] = statsEntry["numChips"].i();
-          entry["numCores"] = statsEntry["numCores"].i();
-          entry["boardTemp"] = statsEntry["boardTemp"].d();
-          entry["chipTemp"] = statsEntry["chipTemp"].d();
-          entry["hotChipTemp"] = statsEntry["hotChipTemp"].d();
-          entry["powerSupplyTemp"] = statsEntry["powerSupplyTemp"].d();
-          entry["fanSpeed0"] = statsEntry["fanSpeed0"].i();
-          entry["fanSpeed1"] = statsEntry["fanSpeed1"].i();
-
-          // Extract fan speed entry for system info
-          if (statsEntry.has("fanSpeed0")) {
-            fanSpeed0 = statsEntry["fanSpeed0"].i();
-          }
-          if (statsEntry.has("fanSpeed1")) {
-            fanSpeed1 = statsEntry["fanSpeed1"].i();
-          }
+  if (dev) {
+    out.field("status", dev->status)
+        .field("mhsAvg", dev->mhsAvg)
+        .field("mhs1m", dev->mhs1m)
+        .field("mhs5m", dev->mhs5m)
+        .field("mhs15m", dev->mhs15m)
+        .field("accepted", dev->accepted)
+        .field("rejected", dev->rejected);
+    if (dev->hasNotifyLatency) {
+      out.field("notifyLatencyP50", dev->notifyLatencyP50)
+          .field("notifyLatencyP99", dev->notifyLatencyP99)
+          .field("notifyLatencyMax", dev->notifyLatencyMax);
+    }
+  }
+  out.endObject();
+}
 
-          // Try to get corresponding entries from the 
-          int devIndex = findIndexByFieldValue(devs, "ASC", i);
-          if (devIndex >= 0) {
-            json::rvalue devEntry = devs[devIndex];
-            entry["status"] = devEntry["status"].s();
-            entry["mhsAvg"] = devEntry["mhsAvg"].d();
-            entry["mhs1m"] = devEntry["mhs1m"].d();
-            entry["mhs5m"] = devEntry["mhs5m"].d();
-            entry["mhs15m"] = devEntry["mhs15m"].d();
-            entry["accepted"] = devEntry["accepted"].i();
-            entry["rejected"] = devEntry["rejected"].i();
-          }
+Snapshot renderDashboard(CgMiner::Response &cgMinerResp) {
+  CgMiner::MinerStatus status;
+  if (!cgMinerResp.error) {
+    if (!CgMiner::parseMinerStatus(cgMinerResp.json, status) || !status.hasPools ||
+        !status.hasStats || !status.hasDevs) {
+      return Snapshot(HttpStatus_InternalServerError,
+                      "{\"error\":\"Invalid response from mining app\"}", 0);
+    }
+  }
 
-          hashboardArr[i] = to_rvalue(entry);
-        }
+  JsonWriter jsonResp(4096);
+  jsonResp.startObject();
+
+  // The pools are passed on as cgminer reports them, since 'dashpools' is a custom command with
+  // just the info we want in the format we want.
+  jsonResp.key("poolStatus").startArray();
+  for (auto &pool : status.pools) {
+    writePoolStatus(jsonResp, pool);
+  }
+  jsonResp.endArray();
+
+  // Fan speeds
+  int fanSpeed0 = 0;
+  int fanSpeed1 = 0;
+
+  jsonResp.key("hashboardStatus").startArray();
+  for (auto &board : status.boards) {
+    writeHashboardStatus(jsonResp, board, status.deviceFor(board));
+
+    // Extract fan speed entry for system info
+    fanSpeed0 = board.fanSpeed0;
+    fanSpeed1 = board.fanSpeed1;
+  }
+  jsonResp.endArray();
+
+  // Hashrate graph data, for the last hour
+  vector<HistorySample> history = gHistory.get(HISTORY_LEVEL_1M, time(0) - 60 * 60);
+  jsonResp.key("hashrateData").startArray();
+  for (int i = 0; i < history.size(); i++) {
+    jsonResp.startObject().field("time", history[i].time);
+    uint32_t total = 0;
+    for (int hb = 0; hb < history[i].numBoards; hb++) {
+
+      uint32_t value = history[i].boards[hb].hashrate;
+      if (value != 0) {
+        jsonResp.field(("Board " + to_string(hb + 1)).c_str(), value);
+        total += value;
       }
-      jsonResp["hashboardStatus"] = to_rvalue(hashboardArr);
+    }
+    jsonResp.field("Total", total).endObject();
+  }
+  jsonResp.endArray();
+
+  // Local system info
+  jsonResp.key("systemInfo").startArray();
+  writeSystemInfoEntry(jsonResp, "Free Memory", to_string(getFreeMemory()));
+  writeSystemInfoEntry(jsonResp, "Total Memory", to_string(getTotalMemory()));
+  writeSystemInfoEntry(jsonResp, "Uptime", getUptime());
+  writeSystemInfoEntry(jsonResp, "Fan 1 Speed", to_string(fanSpeed0) + " RPM");
+  writeSystemInfoEntry(jsonResp, "Fan 2 Speed", to_string(fanSpeed1) + " RPM");
+  writeSystemInfoEntry(jsonResp, "Firmware Version", getFirmwareVersion());
+  jsonResp.endArray();
+
+  jsonResp.endObject();
+  return Snapshot(HttpStatus_OK, jsonResp.str(), 0);
+}
+
+// Raw cgminer replies are passed straight through
+Snapshot renderCgMinerJson(CgMiner::Response &cgMinerResp) {
+  if (cgMinerResp.error) {
+    return Snapshot(HttpStatus_InternalServerError, errorJson(cgMinerResp.errorMsg), 0);
+  }
+  return Snapshot(HttpStatus_OK, cgMinerResp.json, 0);
+}
+
+SnapshotFetcher cgMinerFetcher(string commands) {
+  return [commands](CgMiner::RequestCallback callback) {
+    sendCgMinerCmd(commands, "", callback);
+  };
+}
+
+SnapshotCache gDashboardCache(cgMinerFetcher("dashpools+dashstats+dashdevs"), renderDashboard,
+                              DEFAULT_SNAPSHOT_TTL_MS);
+SnapshotCache gSummaryCache(cgMinerFetcher("summary"), renderCgMinerJson, DEFAULT_SNAPSHOT_TTL_MS);
+SnapshotCache gDevDetailsCache(cgMinerFetcher("devdetails"), renderCgMinerJson,
+                               DEFAULT_SNAPSHOT_TTL_MS);
+
+// cgminer's 'metrics' reply is already in the Prometheus text format, so it is passed through as
+// it is. Anything else it sends back is a STATUS section saying what went wrong.
+Snapshot renderMetrics(CgMiner::Response &cgMinerResp) {
+  if (cgMinerResp.error) {
+    return Snapshot(HttpStatus_ServiceUnavailable, cgMinerResp.errorMsg + "\n", 0);
+  }
+  if (cgMinerResp.json.compare(0, strlen("STATUS="), "STATUS=") == 0) {
+    return Snapshot(HttpStatus_BadGateway, cgMinerResp.json + "\n", 0);
+  }
+  return Snapshot(HttpStatus_OK, cgMinerResp.json, 0);
+}
+
+SnapshotCache gMetricsCache(
+    [](CgMiner::RequestCallback callback) { sendCgMinerPlainCmd("metrics", "", callback); },
+    renderMetrics, DEFAULT_SNAPSHOT_TTL_MS);
+
+// Copy a value from a cgminer reply into either writer
+template <typename Writer> void writeCgMinerValue(Writer &out, const json::rvalue &value) {
+  switch (value.t()) {
+  case json::type::False:
+    out.value(false);
+    break;
+  case json::type::True:
+    out.value(true);
+    break;
+  case json::type::String:
+    out.value(string(value.s()));
+    break;
+  case json::type::Number:
+    if (value.nt() == json::num_type::Floating_point) {
+      out.value(value.d());
+    } else if (value.nt() == json::num_type::Signed_integer) {
+      out.value((long long)value.i());
     } else {
-      jsonResp["poolStatus"] = json::load("[]");
-      jsonResp["hashboardStatus"] = json::load("[]");
+      out.value((unsigned long long)value.u());
+    }
+    break;
+  case json::type::List:
+    out.startArray();
+    for (auto &item : value) {
+      writeCgMinerValue(out, item);
+    }
+    out.endArray();
+    break;
+  case json::type::Object:
+    out.startObject();
+    for (auto &item : value) {
+      out.key(string(item.key()));
+      writeCgMinerValue(out, item);
     }
+    out.endObject();
+    break;
+  default:
+    out.null();
+    break;
+  }
+}
 
-    // Hashrate graph data
-    for (int i = 0; i < num_hashrate_entries; i++) {
-      json::wvalue entry = json::load("{}");
-      entry["time"] = hashrate_history_secs[i].time;
-      uint32_t total = 0;
-      for (int hb = 0; hb < MAX_HASHBOARDS; hb++) {
-
-        uint32_t value = hashrate_history_secs[i].hashrates[hb];
-        if (value != 0) {
-          entry["Board " + to_string(hb + 1)] = value;
-          total += value;
-        }
+struct SystemStatus {
+  string hostname;
+  string macAddress;
+  string ipAddress;
+  string firmwareVersion;
+  string uptime;
+  int freeMemory;
+  int totalMemory;
+};
+
+// Everything about the miner in one reply, for fleet tools polling many units. The cgminer
+// sections are passed on as cgminer sends them; 'boards' is the 'stats' reply, which has the
+// per-chip hashrates, sensors, thermal model and tuning state.
+template <typename Writer>
+void writeFleetStatus(Writer &out, const json::rvalue &reply, const SystemStatus &system) {
+  out.startObject();
+
+  out.key("system")
+      .startObject()
+      .field("hostname", system.hostname)
+      .field("macAddress", system.macAddress)
+      .field("ipAddress", system.ipAddress)
+      .field("firmwareVersion", system.firmwareVersion)
+      .field("uptime", system.uptime)
+      .field("freeMemory", system.freeMemory)
+      .field("totalMemory", system.totalMemory)
+      .endObject();
+
+  const json::rvalue *version = CgMiner::commandEntries(reply, "version", "VERSION");
+  out.key("version");
+  if (version && version->size() > 0) {
+    writeCgMinerValue(out, (*version)[0]);
+  } else {
+    out.null();
+  }
+
+  const json::rvalue *pools = CgMiner::commandEntries(reply, "dashpools", "POOLS");
+  out.key("pools");
+  if (pools) {
+    writeCgMinerValue(out, *pools);
+  } else {
+    out.null();
+  }
+
+  const json::rvalue *devs = CgMiner::commandEntries(reply, "dashdevs", "DEVS");
+  out.key("devices");
+  if (devs) {
+    writeCgMinerValue(out, *devs);
+  } else {
+    out.null();
+  }
+
+  // Only the hashboards' entries; cgminer adds others, e.g. for pools
+  const json::rvalue *stats = CgMiner::commandEntries(reply, "stats", "STATS");
+  out.key("boards").startArray();
+  if (stats) {
+    for (auto &entry : *stats) {
+      if (entry.t() == json::type::Object && entry.has("boardId")) {
+        writeCgMinerValue(out, entry);
       }
-      entry["Total"] = total;
-      hashrateArr[i] = to_rvalue(entry);
     }
-    jsonResp["hashrateData"] = to_rvalue(hashrateArr);
-
-    // Local system info
-    int i = 0;
-    systemArr[i++] = makeSystemInfoEntry("Free Memory", to_string(getFreeMemory()));
-    systemArr[i++] = makeSystemInfoEntry("Total Memory", to_string(getTotalMemory()));
-    systemArr[i++] = makeSystemInfoEntry("Uptime", getUptime());
-    systemArr[i++] = makeSystemInfoEntry("Fan 1 Speed", to_string(fanSpeed0) + " RPM");
-    systemArr[i++] = makeSystemInfoEntry("Fan 2 Speed", to_string(fanSpeed1) + " RPM");
-    systemArr[i++] = makeSystemInfoEntry("Firmware Version", getFirmwareVersion());
-    jsonResp["systemInfo"] = to_rvalue(systemArr);
-
-    string str = json::dump(jsonResp);
-    // CROW_LOG_DEBUG << "jsonStr=" << str;
-    sendJson(str, resp);
+  }
+  out.endArray();
+
+  out.endObject();
+}
+
+// Both encodings are made once per cgminer query, along with the hash for the ETag, so that each
+// poll is just a send.
+Snapshot renderFleetStatus(CgMiner::Response &cgMinerResp) {
+  if (cgMinerResp.error) {
+    return Snapshot(HttpStatus_InternalServerError, errorJson(cgMinerResp.errorMsg), 0);
+  }
+  json::rvalue reply = json::load(cgMinerResp.json);
+  if (!reply || reply.t() != json::type::Object) {
+    return Snapshot(HttpStatus_InternalServerError,
+                    "{\"error\":\"Invalid response from mining app\"}", 0);
+  }
+
+  SystemStatus system;
+  system.hostname = getHostname(INTF_NAME);
+  system.macAddress = getMACAddr(INTF_NAME);
+  system.ipAddress = getIpV4(INTF_NAME);
+  system.firmwareVersion = getFirmwareVersion();
+  system.uptime = getUptime();
+  system.freeMemory = getFreeMemory();
+  system.totalMemory = getTotalMemory();
+
+  JsonWriter jsonOut(16384);
+  writeFleetStatus(jsonOut, reply, system);
+  CborWriter cborOut(16384);
+  writeFleetStatus(cborOut, reply, system);
+
+  Snapshot snapshot(HttpStatus_OK, jsonOut.str(), 0);
+  Sha256 hash;
+  hash.update((const uint8_t *)snapshot.body.data(), snapshot.body.size());
+  snapshot.hash = hash.hexDigest().substr(0, 16);
+  snapshot.cbor = cborOut.str();
+  return snapshot;
+}
+
+SnapshotCache gFleetCache(cgMinerFetcher("version+dashpools+stats+dashdevs"), renderFleetStatus,
+                          DEFAULT_SNAPSHOT_TTL_MS);
+
+// Pushes the dashboard to websocket subscribers
+StatusStream gStatusStream(gDashboardCache, STATUS_STREAM_PERIOD_MS);
+
+void startStatusStream() { gStatusStream.start(); }
+
+void subscribeStatusStream(crow::websocket::connection &conn) { gStatusStream.subscribe(conn); }
+
+void unsubscribeStatusStream(crow::websocket::connection &conn) {
+  gStatusStream.unsubscribe(conn);
+}
+
+void setSnapshotTtl(int ttlMs) {
+  gDashboardCache.setTtl(ttlMs);
+  gSummaryCache.setTtl(ttlMs);
+  gDevDetailsCache.setTtl(ttlMs);
+  gMetricsCache.setTtl(ttlMs);
+  gFleetCache.setTtl(ttlMs);
+}
+
+void sendSnapshot(SnapshotPtr snapshot, crow::response &resp) {
+  if (snapshot->code != HttpStatus_OK) {
+    resp.code = snapshot->code;
+    resp.write(snapshot->body);
+    resp.end();
+    return;
+  }
+  sendJson(snapshot->body, resp);
+}
+
+void getStatusDashboard(string path, query_string &urlParams, const crow::request &req,
+                        crow::response &resp) {
+  gDashboardCache.get([&](SnapshotPtr snapshot) { sendSnapshot(snapshot, resp); });
+}
+
+// The whole machine state in one reply, as JSON or, with ?format=cbor or 'Accept:
+// application/cbor', as CBOR. A poller that sends back the ETag gets a 304 if nothing changed.
+void getStatusAll(string path, query_string &urlParams, const crow::request &req,
+                  crow::response &resp) {
+  const char *format = urlParams.get("format");
+  bool cbor = (format && strcmp(format, "cbor") == 0) ||
+              req.get_header_value("Accept").find("application/cbor") != string::npos;
+  string ifNoneMatch = req.get_header_value("If-None-Match");
+
+  gFleetCache.get([&resp, cbor, ifNoneMatch](SnapshotPtr snapshot) {
+    if (snapshot->code != HttpStatus_OK) {
+      sendSnapshot(snapshot, resp);
+      return;
+    }
+
+    string etag = "\"" + snapshot->hash + (cbor ? "-cbor" : "") + "\"";
+    resp.add_header("ETag", etag);
+    resp.add_header("Cache-Control", "no-cache");
+    resp.add_header("Vary", "Accept");
+    if (StaticAssets::etagMatches(ifNoneMatch, etag)) {
+      resp.code = HttpStatus_NotModified;
+      resp.end();
+      return;
+    }
+
+    if (cbor) {
+      resp.add_header("Content-Type", "application/cbor");
+      resp.code = HttpStatus_OK;
+      resp.write(snapshot->cbor);
+      resp.end();
+    } else {
+      sendJson(snapshot->body, resp);
+    }
   });
 }
 
@@ -603,14 +886,12 @@ void getStatusDiagnostics(string path, query_string &urlParams, const crow::requ
 
 void getStatusDeviceDetails(string path, query_string &urlParams, const crow::request &req,
                             crow::response &resp) {
-  sendCgMinerCmd("devdetails", "",
-                 [&](CgMiner::Response cgMinerResp) { sendJson(cgMinerResp.json, resp); });
+  gDevDetailsCache.get([&](SnapshotPtr snapshot) { sendSnapshot(snapshot, resp); });
 }
 
 void getStatusSummary(string path, query_string &urlParams, const crow::request &req,
                       crow::response &resp) {
-  sendCgMinerCmd("summary", "",
-                 [&](CgMiner::Response cgMinerResp) { sendJson(cgMinerResp.json, resp); });
+  gSummaryCache.get([&](SnapshotPtr snapshot) { sendSnapshot(snapshot, resp); });
 }
 
 void getStatusAsic(string path, query_string &urlParams, const crow::request &req,
@@ -637,6 +918,12 @@ void getStatusLockStats(string path, query_string &urlParams, const crow::reques
                  [&](CgMiner::Response cgMinerResp) { sendJson(cgMinerResp.json, resp); });
 }
 
+void getStatusLatency(string path, query_string &urlParams, const crow::request &req,
+                      crow::response &resp) {
+  sendCgMinerCmd("latency", "",
+                 [&](CgMiner::Response cgMinerResp) { sendJson(cgMinerResp.json, resp); });
+}
+
 //--------------------------------------------------------------------------------------------------
 // STATUS HANDLERS (API SERVER)
 //--------------------------------------------------------------------------------------------------
@@ -645,11 +932,67 @@ void getStatusMemory(string, query_string &urlParams, const crow::request &req,
                      crow::response &resp) {
   int freeMemory = getFreeMemory();
   int totalMemory = getTotalMemory();
-  json::wvalue jsonResp = json::load("{}");
-  jsonResp["freeMemory"] = freeMemory;
-  jsonResp["totalMemory"] = totalMemory;
-  string jsonStr = json::dump(jsonResp);
-  sendJson(jsonStr, resp);
+  JsonWriter jsonResp;
+  jsonResp.startObject()
+      .field("freeMemory", freeMemory)
+      .field("totalMemory", totalMemory)
+      .endObject();
+  sendJson(jsonResp.str(), resp);
+}
+
+/* History:
+ *   resolution: "5s", "1m" or "15m" (default "1m")
+ *   since: Unix time of the oldest sample wanted (default all)
+ */
+void getStatusHistory(string, query_string &urlParams, const crow::request &req,
+                      crow::response &resp) {
+  const char *resolutions[HISTORY_LEVELS] = {"5s", "1m", "15m"};
+  int level = HISTORY_LEVEL_1M;
+  if (urlParams.get("resolution") != nullptr) {
+    string resolution = urlParams.get("resolution");
+    level = -1;
+    for (int i = 0; i < HISTORY_LEVELS; i++) {
+      if (resolution == resolutions[i]) {
+        level = i;
+      }
+    }
+    if (level < 0) {
+      sendError("Unknown resolution", HttpStatus_BadRequest, resp);
+      return;
+    }
+  }
+  uint32_t since = urlParams.get("since") != nullptr ? atol(urlParams.get("since")) : 0;
+
+  vector<HistorySample> history = gHistory.get(level, since);
+  // Each sample is about 400 bytes
+  JsonWriter jsonResp(history.size() * 400 + 100);
+  jsonResp.startObject()
+      .field("resolution", resolutions[level])
+      .field("intervalSecs", HistoryStore::levelInterval(level));
+  jsonResp.key("samples").startArray();
+  for (int i = 0; i < history.size(); i++) {
+    HistorySample &sample = history[i];
+    jsonResp.startObject()
+        .field("time", sample.time)
+        .field("fanSpeed0", sample.fanSpeed[0])
+        .field("fanSpeed1", sample.fanSpeed[1]);
+    jsonResp.key("boards").startArray();
+    for (int hb = 0; hb < sample.numBoards; hb++) {
+      HistoryBoard &board = sample.boards[hb];
+      jsonResp.startObject()
+          .field("hashrate", board.hashrate)
+          .field("boardTemp", board.boardTemp)
+          .field("chipTemp", board.chipTemp)
+          .field("hotChipTemp", board.hotChipTemp)
+          .field("stringVoltage", board.stringVoltage)
+          .field("accepted", board.accepted)
+          .field("rejected", board.rejected)
+          .endObject();
+    }
+    jsonResp.endArray().endObject();
+  }
+  jsonResp.endArray().endObject();
+  sendJson(jsonResp.str(), resp);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -770,6 +1113,70 @@ void actionUploadFirmwareFileFragment(string path, json::rvalue &args, const cro
   resp.end();
 }
 
+FirmwareUpload gFirmwareUpload(FIRMWARE_UPGRADE_ARCHIVE_FILE_PATH_GZ);
+
+void sendFirmwareUploadStatus(int code, crow::response &resp) {
+  FirmwareUploadStatus status = gFirmwareUpload.status();
+  JsonWriter statusJson(256);
+  statusJson.startObject()
+      .field("offset", status.offset)
+      .field("totalSize", status.totalSize)
+      .field("sha256", status.sha256)
+      .field("complete", status.complete)
+      .endObject();
+  resp.add_header("Content-Type", "application/json");
+  resp.code = code;
+  resp.write(statusJson.str());
+  resp.end();
+}
+
+// How much of the firmware archive has arrived, so a client can resume an upload
+void handleFirmwareUploadStatus(const crow::request &req, crow::response &resp) {
+  sendFirmwareUploadStatus(HttpStatus_OK, resp);
+}
+
+/* Raw firmware upload:
+ *   body: the bytes of the archive from 'offset' on (application/octet-stream)
+ *   offset: query parameter, where in the archive the body starts
+ *   totalSize: query parameter, size of the whole archive
+ *   sha256: optional query parameter, checked once the whole archive is in
+ *
+ * Every reply carries the upload status. A 409 means the chunk didn't start where the archive
+ * ends, e.g. after a dropped connection; send again from the returned 'offset'.
+ */
+void handleFirmwareUploadChunk(const crow::request &req, crow::response &resp) {
+  const char *offsetParam = req.url_params.get("offset");
+  const char *totalSizeParam = req.url_params.get("totalSize");
+  const char *sha256Param = req.url_params.get("sha256");
+  if (!offsetParam || !totalSizeParam) {
+    sendError("offset and totalSize are required", HttpStatus_BadRequest, resp);
+    return;
+  }
+
+  uint64_t offset = strtoull(offsetParam, nullptr, 10);
+  uint64_t totalSize = strtoull(totalSizeParam, nullptr, 10);
+  FirmwareUploadResult result = gFirmwareUpload.write(
+      offset, totalSize, req.body.data(), req.body.size(), sha256Param ? sha256Param : "");
+
+  switch (result) {
+  case FirmwareUpload_OK:
+    sendFirmwareUploadStatus(HttpStatus_OK, resp);
+    break;
+  case FirmwareUpload_OffsetMismatch:
+    sendFirmwareUploadStatus(HttpStatus_Conflict, resp);
+    break;
+  case FirmwareUpload_TooLarge:
+    sendError("Chunk is too large or runs past totalSize", HttpStatus_PayloadTooLarge, resp);
+    break;
+  case FirmwareUpload_DigestMismatch:
+    sendError("SHA-256 of the uploaded file does not match", HttpStatus_UnprocessableEntity, resp);
+    break;
+  default:
+    sendError("Unable to write the firmware file", HttpStatus_InternalServerError, resp);
+    break;
+  }
+}
+
 void actionResetMinerConfig(string path, json::rvalue &args, const crow::request &req,
                             crow::response &resp) {
   CROW_LOG_DEBUG << "********** actionResetMinerConfig()";
@@ -791,9 +1198,9 @@ void actionRunUpgrade(string path, json::rvalue &args, const crow::request &req,
   // Read the upgrade_message.txt file and send its contents as the result
   string message = readFile(FIRMWARE_UPGRADE_MESSAGE_FILE_PATH);
 
-  json::wvalue jsonResp = json::load("{}");
-  jsonResp["message"] = message;
-  sendJson(json::dump(jsonResp), resp);
+  JsonWriter jsonResp;
+  jsonResp.startObject().field("message", message).endObject();
+  sendJson(jsonResp.str(), resp);
 
   // The watchdog will now see that the upgrade.sh file exists and will kill apiserver and cgminer
   // and start the upgrade by running upgrade.sh.
@@ -824,15 +1231,18 @@ map<string, PathHandlerForGet> pathHandlerMapForGet = {
     {"config/mining", getConfigMining},
 
     // Status
+    {"status/all", getStatusAll},
     {"status/dashboard", getStatusDashboard},
     {"status/diagnostics", getStatusDiagnostics},
     {"status/memory", getStatusMemory},
+    {"status/history", getStatusHistory},
     {"status/devDetails", getStatusDeviceDetails},
     {"status/summary", getStatusSummary},
     {"status/asic", getStatusAsic},
     {"status/stats", getStatusStats},
     {"status/coinMining", getStatusCoinMining},
     {"status/lockStats", getStatusLockStats},
+    {"status/latency", getStatusLatency},
 };
 
 map<string, PathHandlerForSet> pathHandlerMapForSet = {
@@ -901,14 +1311,71 @@ void sendInfoResp(crow::response &resp) {
     string ipAddress = getIpV4(INTF_NAME);
     string firmwareVersion = getFirmwareVersion();
 
-    json::wvalue respJson = json::load("{}");
-    respJson["macAddress"] = macAddress;
-    respJson["ipAddress"] = ipAddress;
-    respJson["model"] = gModel.length() == 0 ? "Obelisk" : gModel;
-    respJson["vendor"] = "Obelisk";
-    respJson["firmwareVersion"] = firmwareVersion;
+    JsonWriter respJson;
+    respJson.startObject()
+        .field("macAddress", macAddress)
+        .field("ipAddress", ipAddress)
+        .field("model", gModel.length() == 0 ? "Obelisk" : gModel)
+        .field("vendor", "Obelisk")
+        .field("firmwareVersion", firmwareVersion)
+        .endObject();
+
+    sendJson(respJson.str(), resp);
+}
+
+// Scrapes from several collectors inside the TTL share one cgminer query
+void handleMetrics(const crow::request &req, crow::response &resp) {
+  gMetricsCache.get([&](SnapshotPtr snapshot) {
+    resp.code = snapshot->code;
+    resp.add_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+    resp.write(snapshot->body);
+    resp.end();
+  });
+}
+
+StaticAssets gStaticAssets(WEB_ROOT);
+
+void loadStaticAssets() {
+  size_t count = gStaticAssets.load();
+  CROW_LOG_INFO << "Loaded " << count << " web assets from " << WEB_ROOT;
+}
+
+// The web UI. Hashed bundle files are cached by the browser for good; everything else, e.g.
+// index.html, is revalidated with its ETag on each visit, which costs a 304 when unchanged.
+void handleStaticAsset(const crow::request &req, crow::response &resp, const string &path) {
+  const StaticAsset *asset = gStaticAssets.find(path);
+  if (!asset && path.find('.', path.rfind('/') + 1) == string::npos) {
+    // A route inside the app rather than a file, so let the app handle it
+    asset = gStaticAssets.find("/");
+  }
+  if (!asset) {
+    resp.code = HttpStatus_NotFound;
+    resp.end();
+    return;
+  }
+
+  ContentEncoding encoding =
+      StaticAssets::chooseEncoding(req.get_header_value("Accept-Encoding"), *asset);
+  string etag = asset->etag(encoding);
+  resp.add_header("ETag", etag);
+  resp.add_header("Vary", "Accept-Encoding");
+  resp.add_header("Cache-Control",
+                  asset->immutable ? "public, max-age=31536000, immutable" : "no-cache");
+
+  if (StaticAssets::etagMatches(req.get_header_value("If-None-Match"), etag)) {
+    resp.code = HttpStatus_NotModified;
+    resp.end();
+    return;
+  }
 
-    sendJson(json::dump(respJson), resp);
+  resp.add_header("Content-Type", asset->contentType);
+  if (encoding == Encoding_Brotli) {
+    resp.add_header("Content-Encoding", "br");
+  } else if (encoding == Encoding_Gzip) {
+    resp.add_header("Content-Encoding", "gzip");
+  }
+  resp.write(asset->body(encoding));
+  resp.end();
 }
 
 void handleInfo(const crow::request &req, crow::response &resp) {
@@ -7,8 +7,12 @@ using namespace crow;
 
 #ifdef __APPLE__
 #define AUTH_FILE "./auth.json"
+#define HISTORY_FILE "./history.bin"
+#define WEB_ROOT "./www"
 #else
 #define AUTH_FILE "/root/auth.json"
+#define HISTORY_FILE "/root/history.bin"
+#define WEB_ROOT "/var/www"
 #endif
 #define INTF_NAME "eth0"
 
@@ -16,10 +20,11 @@ using namespace crow;
 #define MAX_POOLS 3
 #define MAX_HASHBOARDS 3
 
-typedef struct hashrate_t {
-  time_t time;
-  double hashrates[MAX_HASHBOARDS];
-} hashrate_t;
+// How long a cgminer status snapshot is reused before cgminer is asked again
+#define DEFAULT_SNAPSHOT_TTL_MS 2000
+
+// How often the status stream checks for a new snapshot to push
+#define STATUS_STREAM_PERIOD_MS 2000
 
 typedef std::function<void(std::string, query_string &, const crow::request &, crow::response &)>
     PathHandlerForGet;
@@ -38,6 +43,24 @@ void handleAction(string &path, const crow::request &req, crow::response &resp);
 
 void handleInfo(const crow::request &req, crow::response &resp);
 
+void loadStaticAssets();
+
+void handleStaticAsset(const crow::request &req, crow::response &resp, const string &path);
+
+void handleMetrics(const crow::request &req, crow::response &resp);
+
+void handleFirmwareUploadStatus(const crow::request &req, crow::response &resp);
+
+void handleFirmwareUploadChunk(const crow::request &req, crow::response &resp);
+
 void sendError(string error, int code, crow::response &resp);
 
 void sendJson(string json, crow::response &resp);
+
+void setSnapshotTtl(int ttlMs);
+
+void startStatusStream();
+
+void subscribeStatusStream(crow::websocket::connection &conn);
+
+void unsubscribeStatusStream(crow::websocket::connection &conn);
@@ -2,6 +2,7 @@
 
 #include "CgMinerTypes.h"
 #include "Crow.h"
+#include "handlers/Handlers.h"
 #include "utils/HttpStatusCodes.h"
 #include "utils/SafeQueue.h"
 #include "utils/utils.h"
@@ -14,8 +15,18 @@ extern void *runCgMiner(void *);
 extern void runCrow(int port);
 
 int main(int argc, char *argv[]) {
+  bool runAsDaemon = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--daemon") == 0) {
+      runAsDaemon = true;
+    } else if (strcmp(argv[i], "--snapshot-ttl-ms") == 0 && i + 1 < argc) {
+      // How long status replies from cgminer are reused; 0 asks cgminer every time
+      setSnapshotTtl(atoi(argv[++i]));
+    }
+  }
+
   // Check if we should run as a daemon
-  if (argc > 1 && strcmp(argv[1], "--daemon") == 0) {
+  if (runAsDaemon) {
     daemon(0, 0);
 
     // Since we daemonize ourselves, it is our responsibility to create the pid file for init.d
@@ -0,0 +1,51 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "../utils/CborWriter.h"
+#include "catch.h"
+#include <math.h>
+
+using namespace std;
+
+static string bytes(std::initializer_list<int> values) {
+  string s;
+  for (int v : values) {
+    s.push_back((char)v);
+  }
+  return s;
+}
+
+// The expected encodings are from the examples in RFC 7049, appendix A
+TEST_CASE("CborWriter encodes values as the RFC does", "[cbor]") {
+  SECTION("Integers take the fewest bytes") {
+    REQUIRE(CborWriter().value(0).str() == bytes({0x00}));
+    REQUIRE(CborWriter().value(23).str() == bytes({0x17}));
+    REQUIRE(CborWriter().value(24).str() == bytes({0x18, 0x18}));
+    REQUIRE(CborWriter().value(1000).str() == bytes({0x19, 0x03, 0xe8}));
+    REQUIRE(CborWriter().value(1000000).str() == bytes({0x1a, 0x00, 0x0f, 0x42, 0x40}));
+    REQUIRE(CborWriter().value(-1).str() == bytes({0x20}));
+    REQUIRE(CborWriter().value(-1000).str() == bytes({0x39, 0x03, 0xe7}));
+  }
+
+  SECTION("Doubles are floats when that loses nothing") {
+    REQUIRE(CborWriter().value(100000.0).str() == bytes({0xfa, 0x47, 0xc3, 0x50, 0x00}));
+    REQUIRE(CborWriter().value(1.1).str() ==
+            bytes({0xfb, 0x3f, 0xf1, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a}));
+    REQUIRE(CborWriter().value(NAN).str() == bytes({0xf6}));
+  }
+
+  SECTION("Simple values and strings") {
+    REQUIRE(CborWriter().value(false).str() == bytes({0xf4}));
+    REQUIRE(CborWriter().value(true).str() == bytes({0xf5}));
+    REQUIRE(CborWriter().null().str() == bytes({0xf6}));
+    REQUIRE(CborWriter().value("").str() == bytes({0x60}));
+    REQUIRE(CborWriter().value("IETF").str() == bytes({0x64, 0x49, 0x45, 0x54, 0x46}));
+  }
+
+  SECTION("Objects and arrays have indefinite lengths") {
+    CborWriter writer;
+    writer.startObject().field("a", 1).key("b").startArray().value(2).value(3).endArray();
+    writer.endObject();
+    REQUIRE(writer.str() ==
+            bytes({0xbf, 0x61, 0x61, 0x01, 0x61, 0x62, 0x9f, 0x02, 0x03, 0xff, 0xff}));
+  }
+}
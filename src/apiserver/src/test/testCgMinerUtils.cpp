@@ -0,0 +1,68 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "../utils/CgMinerUtils.h"
+#include "catch.h"
+
+using namespace std;
+
+SCENARIO("cgminer dashboard replies are parsed into typed status", "[cgminer]") {
+  GIVEN("A joined dashpools+dashstats+dashdevs reply") {
+    string reply = "{"
+                   "\"dashpools\":[{\"POOLS\":[{\"pool\":0,\"url\":\"stratum+tcp://pool\","
+                   "\"worker\":\"w\",\"status\":\"Alive\",\"accepted\":12,\"rejected\":1}]}],"
+                   "\"dashstats\":[{\"STATS\":[{\"boardId\":0,\"boardTemp\":40.5,\"fanSpeed0\":3000},"
+                   "{\"ID\":\"POOL0\"},"
+                   "{\"boardId\":1,\"boardTemp\":41,\"stringVoltage\":8.25}]}],"
+                   "\"dashdevs\":[{\"DEVS\":[{\"ASC\":2,\"status\":\"Alive\",\"mhs5m\":512.5,"
+                   "\"accepted\":7}]}]"
+                   "}";
+
+    WHEN("it is parsed") {
+      CgMiner::MinerStatus status;
+      REQUIRE(CgMiner::parseMinerStatus(reply, status));
+
+      THEN("each command's entries are filled in") {
+        REQUIRE(status.hasPools);
+        REQUIRE(status.hasStats);
+        REQUIRE(status.hasDevs);
+        REQUIRE(status.pools.size() == 1);
+        REQUIRE(status.pools[0].url == "stratum+tcp://pool");
+        REQUIRE(status.pools[0].accepted == 12);
+        REQUIRE(!status.pools[0].hasNotifyLatency);
+      }
+
+      THEN("only the hashboards are kept from the stats") {
+        REQUIRE(status.boards.size() == 2);
+        REQUIRE(status.boards[0].boardTemp == Approx(40.5));
+        REQUIRE(status.boards[0].fanSpeed0 == 3000);
+        REQUIRE(!status.boards[0].hasStringVoltage);
+        REQUIRE(status.boards[1].stringVoltage == Approx(8.25));
+      }
+
+      THEN("a board's device is found by its place in the stats") {
+        REQUIRE(status.deviceFor(status.boards[0]) == nullptr);
+        const CgMiner::DeviceStatus *dev = status.deviceFor(status.boards[1]);
+        REQUIRE(dev != nullptr);
+        REQUIRE(dev->mhs5m == Approx(512.5));
+        REQUIRE(dev->accepted == 7);
+      }
+    }
+  }
+
+  GIVEN("A reply to only some of the commands") {
+    CgMiner::MinerStatus status;
+    REQUIRE(CgMiner::parseMinerStatus("{\"dashdevs\":[{\"DEVS\":[]}]}", status));
+
+    THEN("the missing ones are marked as missing") {
+      REQUIRE(status.hasDevs);
+      REQUIRE(!status.hasPools);
+      REQUIRE(!status.hasStats);
+    }
+  }
+
+  GIVEN("A reply that isn't JSON") {
+    CgMiner::MinerStatus status;
+
+    THEN("it isn't parsed") { REQUIRE(!CgMiner::parseMinerStatus("STATUS=E", status)); }
+  }
+}
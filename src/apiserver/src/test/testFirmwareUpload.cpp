@@ -0,0 +1,112 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "../utils/FirmwareUpload.h"
+#include "../utils/Sha256.h"
+#include "catch.h"
+#include <stdio.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define TEST_UPLOAD_PATH "/tmp/obelisk-test-upload/firmware.bin"
+
+static string sha256Of(const string &data) {
+  Sha256 hash;
+  hash.update((const uint8_t *)data.data(), data.size());
+  return hash.hexDigest();
+}
+
+TEST_CASE("SHA-256 matches the standard test vectors", "[upload]") {
+  REQUIRE(sha256Of("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+  REQUIRE(sha256Of("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  REQUIRE(sha256Of("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+  SECTION("Hashing in pieces gives the same digest") {
+    string data(1000, 'x');
+    Sha256 hash;
+    for (size_t i = 0; i < data.size(); i += 37) {
+      hash.update((const uint8_t *)data.data() + i, min((size_t)37, data.size() - i));
+    }
+    REQUIRE(hash.hexDigest() == sha256Of(data));
+  }
+}
+
+SCENARIO("Firmware is uploaded in chunks", "[upload]") {
+  unlink(TEST_UPLOAD_PATH);
+  string data;
+  for (int i = 0; i < 3000; i++) {
+    data.push_back((char)(i * 7));
+  }
+  string digest = sha256Of(data);
+
+  GIVEN("An upload with its first chunk in") {
+    FirmwareUpload upload(TEST_UPLOAD_PATH);
+    REQUIRE(upload.write(0, data.size(), data.data(), 1000, "") == FirmwareUpload_OK);
+    REQUIRE(upload.status().offset == 1000);
+    REQUIRE(!upload.status().complete);
+
+    WHEN("a chunk doesn't start where the last one ended") {
+      THEN("it is refused") {
+        REQUIRE(upload.write(1500, data.size(), data.data() + 1500, 500, "") ==
+                FirmwareUpload_OffsetMismatch);
+        REQUIRE(upload.status().offset == 1000);
+      }
+    }
+
+    WHEN("a chunk runs past the total size") {
+      THEN("it is refused") {
+        REQUIRE(upload.write(1000, data.size(), data.data(), 2500, "") == FirmwareUpload_TooLarge);
+      }
+    }
+
+    WHEN("the rest is sent with the right digest") {
+      REQUIRE(upload.write(1000, data.size(), data.data() + 1000, 2000, digest) ==
+              FirmwareUpload_OK);
+
+      THEN("the upload is complete and the file holds the data") {
+        FirmwareUploadStatus status = upload.status();
+        REQUIRE(status.complete);
+        REQUIRE(status.sha256 == digest);
+
+        FILE *fp = fopen(TEST_UPLOAD_PATH, "rb");
+        REQUIRE(fp != nullptr);
+        string contents(data.size() + 1, 0);
+        size_t n = fread(&contents[0], 1, contents.size(), fp);
+        fclose(fp);
+        REQUIRE(n == data.size());
+        REQUIRE(contents.substr(0, n) == data);
+      }
+    }
+
+    WHEN("the rest is sent with the wrong digest") {
+      THEN("the upload is thrown away") {
+        REQUIRE(upload.write(1000, data.size(), data.data() + 1000, 2000, sha256Of("x")) ==
+                FirmwareUpload_DigestMismatch);
+        REQUIRE(upload.status().offset == 0);
+      }
+    }
+
+    WHEN("apiserver restarts part way through") {
+      FirmwareUpload restarted(TEST_UPLOAD_PATH);
+
+      THEN("the upload carries on from the file") {
+        REQUIRE(restarted.status().offset == 1000);
+        REQUIRE(restarted.write(1000, data.size(), data.data() + 1000, 2000, digest) ==
+                FirmwareUpload_OK);
+        REQUIRE(restarted.status().sha256 == digest);
+      }
+    }
+
+    WHEN("the file is removed") {
+      unlink(TEST_UPLOAD_PATH);
+
+      THEN("the upload has to start over") {
+        REQUIRE(upload.status().offset == 0);
+        REQUIRE(upload.write(1000, data.size(), data.data() + 1000, 2000, "") ==
+                FirmwareUpload_OffsetMismatch);
+      }
+    }
+  }
+  unlink(TEST_UPLOAD_PATH);
+}
@@ -0,0 +1,89 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "../utils/HistoryStore.h"
+#include "catch.h"
+#include <string.h>
+
+using namespace std;
+
+HistorySample makeSample(uint32_t time, float hashrate, uint32_t accepted) {
+  HistorySample sample;
+  memset(&sample, 0, sizeof(sample));
+  sample.time = time;
+  sample.numBoards = 2;
+  sample.fanSpeed[0] = 3000;
+  for (int i = 0; i < 2; i++) {
+    sample.boards[i].hashrate = hashrate;
+    sample.boards[i].chipTemp = 80.5;
+    sample.boards[i].stringVoltage = 8.25;
+    sample.boards[i].accepted = accepted;
+  }
+  return sample;
+}
+
+SCENARIO("History is kept at several resolutions", "[history]") {
+  const string historyFilename = "test_history.bin";
+  std::remove(historyFilename.c_str());
+
+  GIVEN("A store fed every 5 seconds for two hours") {
+    HistoryStore history(historyFilename);
+    history.load();
+    uint32_t start = 1500000000 - 1500000000 % 900;
+    for (uint32_t t = start; t < start + 2 * 60 * 60; t += 5) {
+      history.add(makeSample(t, t < start + 60 * 60 ? 500 : 600, 1));
+    }
+
+    WHEN("the 5 second level is read") {
+      vector<HistorySample> samples = history.get(HISTORY_LEVEL_5S, 0);
+
+      THEN("only the last hour is kept, oldest first") {
+        REQUIRE(samples.size() == HistoryStore::levelCapacity(HISTORY_LEVEL_5S));
+        REQUIRE(samples.front().time == start + 60 * 60);
+        REQUIRE(samples.back().time == start + 2 * 60 * 60 - 5);
+      }
+    }
+
+    WHEN("the 1 minute level is read") {
+      vector<HistorySample> samples = history.get(HISTORY_LEVEL_1M, 0);
+
+      THEN("each sample averages its minute and totals its shares") {
+        // The last minute is still being built
+        REQUIRE(samples.size() == 119);
+        REQUIRE(samples[0].time == start);
+        REQUIRE(samples[0].boards[1].hashrate == Approx(500));
+        REQUIRE(samples[0].boards[1].accepted == 12);
+        REQUIRE(samples[0].fanSpeed[0] == 3000);
+        REQUIRE(samples.back().boards[0].hashrate == Approx(600));
+      }
+    }
+
+    WHEN("the 15 minute level is read") {
+      vector<HistorySample> samples = history.get(HISTORY_LEVEL_15M, start + 15 * 60);
+
+      THEN("samples older than 'since' are left out") {
+        REQUIRE(samples.size() == 6);
+        REQUIRE(samples[0].time == start + 15 * 60);
+        REQUIRE(samples[0].boards[0].accepted == 180);
+      }
+    }
+
+    WHEN("the store is written out and loaded again") {
+      history.flush(true);
+      HistoryStore reloaded(historyFilename);
+      reloaded.load();
+
+      THEN("the saved levels come back") {
+        vector<HistorySample> before = history.get(HISTORY_LEVEL_1M, 0);
+        vector<HistorySample> after = reloaded.get(HISTORY_LEVEL_1M, 0);
+        REQUIRE(after.size() == before.size());
+        REQUIRE(after.back().time == before.back().time);
+        REQUIRE(after.back().boards[1].chipTemp == Approx(80.5));
+        REQUIRE(after.back().boards[1].stringVoltage == Approx(8.25));
+        REQUIRE(reloaded.get(HISTORY_LEVEL_15M, 0).size() == 7);
+        REQUIRE(reloaded.get(HISTORY_LEVEL_5S, 0).empty());
+      }
+    }
+  }
+
+  std::remove(historyFilename.c_str());
+}
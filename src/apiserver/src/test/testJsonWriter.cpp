@@ -0,0 +1,56 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "../Crow.h"
+#include "../utils/JsonWriter.h"
+#include "catch.h"
+#include <math.h>
+
+using namespace std;
+using namespace crow;
+
+SCENARIO("JsonWriter writes JSON in one pass", "[json]") {
+  GIVEN("A writer") {
+    JsonWriter writer;
+
+    WHEN("nested objects and arrays are written") {
+      writer.startObject().field("name", "board").field("temp", 80.5).field("count", 3);
+      writer.key("chips").startArray().value(1).value(2).startObject().endObject().endArray();
+      writer.field("ok", true).key("none").null().endObject();
+
+      THEN("the commas are in the right places") {
+        REQUIRE(writer.str() ==
+                "{\"name\":\"board\",\"temp\":80.5,\"count\":3,\"chips\":[1,2,{}],\"ok\":true,"
+                "\"none\":null}");
+      }
+    }
+
+    WHEN("strings that need escaping are written") {
+      writer.startObject().field("msg", "a \"quoted\"\nline\\").endObject();
+
+      THEN("they read back unchanged") {
+        json::rvalue parsed = json::load(writer.str());
+        REQUIRE(string(parsed["msg"].s()) == "a \"quoted\"\nline\\");
+      }
+    }
+
+    WHEN("a number with more than six significant digits is written") {
+      writer.startArray().value(12345678.9).value(0.1).endArray();
+
+      THEN("none of them are lost") { REQUIRE(writer.str() == "[12345678.9,0.1]"); }
+    }
+
+    WHEN("a number JSON can't hold is written") {
+      writer.startArray().value(NAN).value(INFINITY).endArray();
+
+      THEN("it is written as null") { REQUIRE(writer.str() == "[null,null]"); }
+    }
+
+    WHEN("values that are already JSON are copied in") {
+      writer.startArray().raw("{\"a\":1}").raw("[2]").endArray();
+
+      THEN("they are separated like any other value") {
+        REQUIRE(writer.str() == "[{\"a\":1},[2]]");
+      }
+    }
+  }
+}
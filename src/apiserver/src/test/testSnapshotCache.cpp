@@ -0,0 +1,95 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "../utils/HttpStatusCodes.h"
+#include "../utils/SnapshotCache.h"
+#include "catch.h"
+#include <unistd.h>
+
+using namespace std;
+
+Snapshot renderPassThrough(CgMiner::Response &resp) {
+  if (resp.error) {
+    return Snapshot(HttpStatus_InternalServerError, resp.errorMsg, 0);
+  }
+  return Snapshot(HttpStatus_OK, resp.json, 0);
+}
+
+SCENARIO("Snapshot cache coalesces cgminer queries", "[snapshot]") {
+  GIVEN("A cache whose fetches are completed by hand") {
+    vector<CgMiner::RequestCallback> pending;
+    SnapshotFetcher fetcher = [&](CgMiner::RequestCallback callback) {
+      pending.push_back(callback);
+    };
+    SnapshotCache cache(fetcher, renderPassThrough, 60000);
+
+    vector<SnapshotPtr> received;
+    SnapshotCallback collect = [&](SnapshotPtr snapshot) { received.push_back(snapshot); };
+
+    WHEN("several requests arrive before cgminer replies") {
+      cache.get(collect);
+      cache.get(collect);
+      cache.get(collect);
+
+      THEN("only one query is made and every request gets the same reply") {
+        REQUIRE(pending.size() == 1);
+        REQUIRE(received.empty());
+
+        CgMiner::Response resp(CGMINER_SUCCESS, "", "{\"a\":1}");
+        pending[0](resp);
+        REQUIRE(received.size() == 3);
+        REQUIRE(received[0] == received[1]);
+        REQUIRE(received[1] == received[2]);
+        REQUIRE(received[0]->body == "{\"a\":1}");
+      }
+    }
+
+    WHEN("a request arrives while the snapshot is fresh") {
+      cache.get(collect);
+      CgMiner::Response resp(CGMINER_SUCCESS, "", "{\"a\":1}");
+      pending[0](resp);
+      cache.get(collect);
+
+      THEN("it is answered without asking cgminer") {
+        REQUIRE(pending.size() == 1);
+        REQUIRE(received.size() == 2);
+        REQUIRE(received[0] == received[1]);
+      }
+    }
+
+    WHEN("cgminer returns an error") {
+      cache.get(collect);
+      CgMiner::Response resp(CGMINER_ERROR, "Unable to connect", "");
+      pending[0](resp);
+      cache.get(collect);
+
+      THEN("the error is not reused") {
+        REQUIRE(received.size() == 1);
+        REQUIRE(received[0]->code == HttpStatus_InternalServerError);
+        REQUIRE(pending.size() == 2);
+      }
+    }
+  }
+
+  GIVEN("A cache with a short TTL") {
+    int fetches = 0;
+    SnapshotFetcher fetcher = [&](CgMiner::RequestCallback callback) {
+      fetches++;
+      CgMiner::Response resp(CGMINER_SUCCESS, "", "{}");
+      callback(resp);
+    };
+    SnapshotCache cache(fetcher, renderPassThrough, 20);
+
+    WHEN("the snapshot expires") {
+      uint64_t firstVersion = 0;
+      uint64_t secondVersion = 0;
+      cache.get([&](SnapshotPtr snapshot) { firstVersion = snapshot->version; });
+      usleep(30000);
+      cache.get([&](SnapshotPtr snapshot) { secondVersion = snapshot->version; });
+
+      THEN("cgminer is asked again and the version changes") {
+        REQUIRE(fetches == 2);
+        REQUIRE(secondVersion > firstVersion);
+      }
+    }
+  }
+}
@@ -0,0 +1,76 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "../utils/StaticAssets.h"
+#include "catch.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+
+#define TEST_WEB_ROOT "/tmp/obelisk-test-www"
+
+static void writeTestFile(const string &path, const string &contents) {
+  FILE *fp = fopen(path.c_str(), "wb");
+  fwrite(contents.data(), 1, contents.size(), fp);
+  fclose(fp);
+}
+
+TEST_CASE("Hashed bundle filenames are recognized", "[static]") {
+  REQUIRE(StaticAssets::isHashedName("main.1a2b3c4d.js"));
+  REQUIRE(StaticAssets::isHashedName("2.0f9e8d7c.chunk.js"));
+  REQUIRE(!StaticAssets::isHashedName("index.html"));
+  REQUIRE(!StaticAssets::isHashedName("manifest.json"));
+  REQUIRE(!StaticAssets::isHashedName("favicon.ico"));
+}
+
+SCENARIO("Web assets are served in the best encoding the browser takes", "[static]") {
+  system("rm -rf " TEST_WEB_ROOT " && mkdir -p " TEST_WEB_ROOT "/static/js");
+  string js(2000, 'a');
+  writeTestFile(TEST_WEB_ROOT "/index.html", "<html></html>");
+  writeTestFile(TEST_WEB_ROOT "/static/js/main.1a2b3c4d.js", js);
+  writeTestFile(TEST_WEB_ROOT "/static/js/main.1a2b3c4d.js.gz", string(100, 'g'));
+  writeTestFile(TEST_WEB_ROOT "/static/js/main.1a2b3c4d.js.br", string(80, 'b'));
+  // Bigger than the original, so it should be ignored
+  writeTestFile(TEST_WEB_ROOT "/index.html.gz", string(100, 'g'));
+
+  GIVEN("The loaded bundle") {
+    StaticAssets assets(TEST_WEB_ROOT);
+    REQUIRE(assets.load() == 2);
+
+    const StaticAsset *index = assets.find("/");
+    const StaticAsset *main = assets.find("/static/js/main.1a2b3c4d.js");
+    REQUIRE(index != nullptr);
+    REQUIRE(main != nullptr);
+    REQUIRE(assets.find("/static/js/main.1a2b3c4d.js.gz") == nullptr);
+
+    THEN("files are typed and hashed names are immutable") {
+      REQUIRE(index->contentType == "text/html; charset=utf-8");
+      REQUIRE(!index->immutable);
+      REQUIRE(main->immutable);
+      REQUIRE(main->identity == js);
+      REQUIRE(index->gzip.empty());
+    }
+
+    THEN("the encoding follows Accept-Encoding") {
+      REQUIRE(StaticAssets::chooseEncoding("gzip, deflate, br", *main) == Encoding_Brotli);
+      REQUIRE(StaticAssets::chooseEncoding("gzip, deflate", *main) == Encoding_Gzip);
+      REQUIRE(StaticAssets::chooseEncoding("br;q=0, gzip", *main) == Encoding_Gzip);
+      REQUIRE(StaticAssets::chooseEncoding("br;q=0.5, gzip;q=1.0", *main) == Encoding_Gzip);
+      REQUIRE(StaticAssets::chooseEncoding("*", *main) == Encoding_Brotli);
+      REQUIRE(StaticAssets::chooseEncoding("", *main) == Encoding_Identity);
+      REQUIRE(StaticAssets::chooseEncoding("gzip, br", *index) == Encoding_Identity);
+    }
+
+    THEN("each encoding has its own ETag") {
+      string br = main->etag(Encoding_Brotli);
+      REQUIRE(br != main->etag(Encoding_Gzip));
+      REQUIRE(br != main->etag(Encoding_Identity));
+      REQUIRE(StaticAssets::etagMatches(br, br));
+      REQUIRE(StaticAssets::etagMatches("\"x\", W/" + br, br));
+      REQUIRE(StaticAssets::etagMatches("*", br));
+      REQUIRE(!StaticAssets::etagMatches(main->etag(Encoding_Gzip), br));
+      REQUIRE(!StaticAssets::etagMatches("", br));
+    }
+  }
+  system("rm -rf " TEST_WEB_ROOT);
+}
@@ -0,0 +1,76 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "../utils/HttpStatusCodes.h"
+#include "../utils/StatusStream.h"
+#include "catch.h"
+
+using namespace std;
+using namespace crow;
+
+class FakeConnection : public crow::websocket::connection {
+public:
+  vector<string> sent;
+  void send_binary(const std::string &msg) override { sent.push_back(msg); }
+  void send_text(const std::string &msg) override { sent.push_back(msg); }
+  void close(const std::string &msg) override {}
+};
+
+SCENARIO("Status stream pushes changes to subscribers", "[stream]") {
+  GIVEN("A stream with one subscriber") {
+    SnapshotCache cache([](CgMiner::RequestCallback) {},
+                        [](CgMiner::Response &resp) { return Snapshot(HttpStatus_OK, resp.json, 0); },
+                        0);
+    StatusStream stream(cache, 1000);
+    FakeConnection first;
+    stream.subscribe(first);
+
+    WHEN("the first snapshot is published") {
+      stream.publish(make_shared<const Snapshot>(HttpStatus_OK, "{\"a\":1,\"b\":[1,2]}", 1));
+
+      THEN("the subscriber gets the whole status") {
+        REQUIRE(first.sent.size() == 1);
+        json::rvalue msg = json::load(first.sent[0]);
+        REQUIRE(msg["full"].b());
+        REQUIRE(msg["version"].i() == 1);
+        REQUIRE(msg["status"]["a"].i() == 1);
+        REQUIRE(msg["status"]["b"].size() == 2);
+      }
+
+      AND_WHEN("a snapshot with one field changed is published") {
+        stream.publish(make_shared<const Snapshot>(HttpStatus_OK, "{\"a\":2,\"b\":[1,2]}", 2));
+
+        THEN("only that field is sent") {
+          REQUIRE(first.sent.size() == 2);
+          json::rvalue msg = json::load(first.sent[1]);
+          REQUIRE(!msg["full"].b());
+          REQUIRE(msg["status"]["a"].i() == 2);
+          REQUIRE(!msg["status"].has("b"));
+        }
+      }
+
+      AND_WHEN("the same snapshot is published again") {
+        stream.publish(make_shared<const Snapshot>(HttpStatus_OK, "{\"a\":1,\"b\":[1,2]}", 1));
+
+        THEN("nothing is sent") { REQUIRE(first.sent.size() == 1); }
+      }
+
+      AND_WHEN("another client subscribes") {
+        FakeConnection second;
+        stream.subscribe(second);
+
+        THEN("it is sent the whole status straight away") {
+          REQUIRE(second.sent.size() == 1);
+          REQUIRE(json::load(second.sent[0])["full"].b());
+        }
+        stream.unsubscribe(second);
+      }
+    }
+
+    WHEN("the subscriber leaves") {
+      stream.unsubscribe(first);
+      stream.publish(make_shared<const Snapshot>(HttpStatus_OK, "{\"a\":1}", 1));
+
+      THEN("it isn't sent anything") { REQUIRE(first.sent.empty()); }
+    }
+  }
+}
@@ -0,0 +1,144 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "CborWriter.h"
+#include <math.h>
+#include <string.h>
+
+using namespace std;
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+#define CBOR_FLOAT32 0xfa
+#define CBOR_FLOAT64 0xfb
+#define CBOR_INDEFINITE_ARRAY 0x9f
+#define CBOR_INDEFINITE_MAP 0xbf
+#define CBOR_BREAK 0xff
+
+CborWriter::CborWriter(size_t reserve) { out.reserve(reserve); }
+
+// The major type and its argument, in the fewest bytes that hold it
+void CborWriter::writeHead(uint8_t majorType, uint64_t n) {
+  uint8_t type = majorType << 5;
+  int bytes;
+  if (n < 24) {
+    out.push_back((char)(type | n));
+    return;
+  } else if (n <= 0xff) {
+    out.push_back((char)(type | 24));
+    bytes = 1;
+  } else if (n <= 0xffff) {
+    out.push_back((char)(type | 25));
+    bytes = 2;
+  } else if (n <= 0xffffffff) {
+    out.push_back((char)(type | 26));
+    bytes = 4;
+  } else {
+    out.push_back((char)(type | 27));
+    bytes = 8;
+  }
+  for (int i = bytes - 1; i >= 0; i--) {
+    out.push_back((char)(n >> (i * 8)));
+  }
+}
+
+CborWriter &CborWriter::startObject() {
+  out.push_back((char)CBOR_INDEFINITE_MAP);
+  return *this;
+}
+
+CborWriter &CborWriter::endObject() {
+  out.push_back((char)CBOR_BREAK);
+  return *this;
+}
+
+CborWriter &CborWriter::startArray() {
+  out.push_back((char)CBOR_INDEFINITE_ARRAY);
+  return *this;
+}
+
+CborWriter &CborWriter::endArray() {
+  out.push_back((char)CBOR_BREAK);
+  return *this;
+}
+
+CborWriter &CborWriter::key(const char *k) { return value(k); }
+
+CborWriter &CborWriter::key(const string &k) { return value(k); }
+
+CborWriter &CborWriter::value(const string &s) {
+  writeHead(CBOR_TEXT, s.length());
+  out += s;
+  return *this;
+}
+
+CborWriter &CborWriter::value(const char *s) {
+  size_t len = strlen(s);
+  writeHead(CBOR_TEXT, len);
+  out.append(s, len);
+  return *this;
+}
+
+CborWriter &CborWriter::value(bool b) {
+  out.push_back((char)(b ? CBOR_TRUE : CBOR_FALSE));
+  return *this;
+}
+
+CborWriter &CborWriter::value(double d) {
+  if (!isfinite(d)) {
+    return null();
+  }
+
+  uint64_t bits;
+  int bytes;
+  float f = (float)d;
+  if ((double)f == d) {
+    uint32_t fbits;
+    memcpy(&fbits, &f, sizeof(fbits));
+    bits = fbits;
+    bytes = 4;
+    out.push_back((char)CBOR_FLOAT32);
+  } else {
+    memcpy(&bits, &d, sizeof(bits));
+    bytes = 8;
+    out.push_back((char)CBOR_FLOAT64);
+  }
+  for (int i = bytes - 1; i >= 0; i--) {
+    out.push_back((char)(bits >> (i * 8)));
+  }
+  return *this;
+}
+
+CborWriter &CborWriter::value(int n) { return value((long long)n); }
+
+CborWriter &CborWriter::value(unsigned n) { return value((unsigned long long)n); }
+
+CborWriter &CborWriter::value(long n) { return value((long long)n); }
+
+CborWriter &CborWriter::value(unsigned long n) { return value((unsigned long long)n); }
+
+CborWriter &CborWriter::value(long long n) {
+  if (n < 0) {
+    // -1 - n, which can't overflow unlike -n
+    writeHead(CBOR_NEGATIVE, (uint64_t)(-(n + 1)));
+  } else {
+    writeHead(CBOR_UNSIGNED, (uint64_t)n);
+  }
+  return *this;
+}
+
+CborWriter &CborWriter::value(unsigned long long n) {
+  writeHead(CBOR_UNSIGNED, n);
+  return *this;
+}
+
+CborWriter &CborWriter::null() {
+  out.push_back((char)CBOR_NULL);
+  return *this;
+}
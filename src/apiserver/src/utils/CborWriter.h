@@ -0,0 +1,52 @@
+// Copyright 2018 Obelisk Inc.
+
+#ifndef CBORWRITER_H
+#define CBORWRITER_H
+
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+// CborWriter writes CBOR (RFC 7049) with the same calls as JsonWriter, so code templated on the
+// writer can produce either. Objects and arrays are written with indefinite lengths, so nothing
+// needs counting up front. Doubles that fit in a float exactly are written as floats.
+class CborWriter {
+public:
+  CborWriter(size_t reserve = 1024);
+
+  CborWriter &startObject();
+  CborWriter &endObject();
+  CborWriter &startArray();
+  CborWriter &endArray();
+
+  CborWriter &key(const char *k);
+  CborWriter &key(const string &k);
+
+  CborWriter &value(const string &s);
+  CborWriter &value(const char *s);
+  CborWriter &value(bool b);
+  // NaN and infinities are written as null, as JsonWriter does
+  CborWriter &value(double d);
+  CborWriter &value(int n);
+  CborWriter &value(unsigned n);
+  CborWriter &value(long n);
+  CborWriter &value(unsigned long n);
+  CborWriter &value(long long n);
+  CborWriter &value(unsigned long long n);
+  CborWriter &null();
+
+  template <typename T> CborWriter &field(const char *k, const T &v) {
+    key(k);
+    return value(v);
+  }
+
+  const string &str() const { return out; }
+
+private:
+  void writeHead(uint8_t majorType, uint64_t n);
+
+  string out;
+};
+
+#endif
@@ -9,5 +9,135 @@ using namespace std;
 using namespace crow;
 
 namespace CgMiner {
-// ???
+
+static int64_t intField(const json::rvalue &obj, const char *key) {
+  return obj.has(key) ? obj[key].i() : 0;
+}
+
+static double doubleField(const json::rvalue &obj, const char *key) {
+  return obj.has(key) ? obj[key].d() : 0;
+}
+
+static string stringField(const json::rvalue &obj, const char *key) {
+  return obj.has(key) ? string(obj[key].s()) : "";
+}
+
+const json::rvalue *commandEntries(const json::rvalue &reply, const char *command,
+                                   const char *section) {
+  if (!reply.has(command) || reply[command].t() != json::type::List ||
+      reply[command].size() == 0) {
+    return nullptr;
+  }
+  const json::rvalue &commandReply = reply[command][0];
+  if (commandReply.t() != json::type::Object || !commandReply.has(section) ||
+      commandReply[section].t() != json::type::List) {
+    return nullptr;
+  }
+  return &commandReply[section];
+}
+
+static void parsePool(const json::rvalue &entry, PoolStatus &pool) {
+  pool.pool = intField(entry, "pool");
+  pool.url = stringField(entry, "url");
+  pool.worker = stringField(entry, "worker");
+  pool.status = stringField(entry, "status");
+  pool.priority = intField(entry, "priority");
+  pool.accepted = intField(entry, "accepted");
+  pool.rejected = intField(entry, "rejected");
+  pool.works = intField(entry, "works");
+  pool.discarded = intField(entry, "discarded");
+  pool.stale = intField(entry, "stale");
+  pool.lastShareTime = intField(entry, "lastShareTime");
+  pool.diff1Shares = intField(entry, "diff1Shares");
+  pool.duplicateShares = intField(entry, "duplicateShares");
+  pool.currBlockHeight = intField(entry, "currBlockHeight");
+  pool.hasNotifyLatency = entry.has("notifyLatencyP50");
+  pool.notifyLatencyP50 = doubleField(entry, "notifyLatencyP50");
+  pool.notifyLatencyP99 = doubleField(entry, "notifyLatencyP99");
+  pool.notifyLatencyMax = doubleField(entry, "notifyLatencyMax");
+}
+
+static void parseDevice(const json::rvalue &entry, DeviceStatus &dev) {
+  dev.asc = intField(entry, "ASC");
+  dev.status = stringField(entry, "status");
+  dev.mhsAvg = doubleField(entry, "mhsAvg");
+  dev.mhs1m = doubleField(entry, "mhs1m");
+  dev.mhs5m = doubleField(entry, "mhs5m");
+  dev.mhs15m = doubleField(entry, "mhs15m");
+  dev.accepted = intField(entry, "accepted");
+  dev.rejected = intField(entry, "rejected");
+  dev.hasNotifyLatency = entry.has("notifyLatencyP50");
+  dev.notifyLatencyP50 = doubleField(entry, "notifyLatencyP50");
+  dev.notifyLatencyP99 = doubleField(entry, "notifyLatencyP99");
+  dev.notifyLatencyMax = doubleField(entry, "notifyLatencyMax");
+}
+
+static void parseBoard(const json::rvalue &entry, int statsIndex, BoardStats &board) {
+  board.statsIndex = statsIndex;
+  board.boardId = intField(entry, "boardId");
+  board.numChips = intField(entry, "numChips");
+  board.numCores = intField(entry, "numCores");
+  board.boardTemp = doubleField(entry, "boardTemp");
+  board.chipTemp = doubleField(entry, "chipTemp");
+  board.hotChipTemp = doubleField(entry, "hotChipTemp");
+  board.powerSupplyTemp = doubleField(entry, "powerSupplyTemp");
+  board.hasStringVoltage = entry.has("stringVoltage");
+  board.stringVoltage = doubleField(entry, "stringVoltage");
+  board.fanSpeed0 = intField(entry, "fanSpeed0");
+  board.fanSpeed1 = intField(entry, "fanSpeed1");
+  board.hasSensorAge = entry.has("sensorAgeMs");
+  board.sensorAgeMs = intField(entry, "sensorAgeMs");
+}
+
+bool parseMinerStatus(const string &text, MinerStatus &status) {
+  json::rvalue reply = json::load(text);
+  if (!reply || reply.t() != json::type::Object) {
+    return false;
+  }
+
+  const json::rvalue *entries = commandEntries(reply, "dashpools", "POOLS");
+  status.hasPools = entries != nullptr;
+  status.pools.clear();
+  if (entries) {
+    status.pools.resize(entries->size());
+    for (size_t i = 0; i < entries->size(); i++) {
+      parsePool((*entries)[i], status.pools[i]);
+    }
+  }
+
+  entries = commandEntries(reply, "dashdevs", "DEVS");
+  status.hasDevs = entries != nullptr;
+  status.devs.clear();
+  if (entries) {
+    status.devs.resize(entries->size());
+    for (size_t i = 0; i < entries->size(); i++) {
+      parseDevice((*entries)[i], status.devs[i]);
+    }
+  }
+
+  // Only the hashboards' entries are kept; cgminer may add others, e.g. for pools
+  entries = commandEntries(reply, "dashstats", "STATS");
+  status.hasStats = entries != nullptr;
+  status.boards.clear();
+  if (entries) {
+    for (size_t i = 0; i < entries->size(); i++) {
+      const json::rvalue &entry = (*entries)[i];
+      if (entry.t() == json::type::Object && entry.has("boardId")) {
+        status.boards.emplace_back();
+        parseBoard(entry, i, status.boards.back());
+      }
+    }
+  }
+  return true;
+}
+
+const DeviceStatus *MinerStatus::deviceFor(const BoardStats &board) const {
+  for (auto &dev : devs) {
+    if (dev.asc == board.statsIndex) {
+      return &dev;
+    }
+  }
+  return nullptr;
+}
+
 } // namespace CgMiner
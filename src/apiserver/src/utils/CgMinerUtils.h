@@ -4,11 +4,96 @@
 #define CGMINERUTILS_H
 
 #include "../CgMinerTypes.h"
+#include "../Crow.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
 
 using namespace std;
 
 namespace CgMiner {
-//
+
+// The typed form of cgminer's dashboard replies, so that a reply is parsed once and the handlers
+// read plain fields rather than walking the JSON again. Fields cgminer didn't send are left at
+// zero.
+
+// One entry of the 'dashpools' reply
+struct PoolStatus {
+  int pool;
+  string url;
+  string worker;
+  string status;
+  int priority;
+  int64_t accepted;
+  int64_t rejected;
+  int64_t works;
+  int64_t discarded;
+  int64_t stale;
+  int64_t lastShareTime;
+  int64_t diff1Shares;
+  int64_t duplicateShares;
+  int64_t currBlockHeight;
+  bool hasNotifyLatency;
+  double notifyLatencyP50;
+  double notifyLatencyP99;
+  double notifyLatencyMax;
+};
+
+// One entry of the 'dashdevs' reply
+struct DeviceStatus {
+  int asc;
+  string status;
+  double mhsAvg;
+  double mhs1m;
+  double mhs5m;
+  double mhs15m;
+  int64_t accepted;
+  int64_t rejected;
+  bool hasNotifyLatency;
+  double notifyLatencyP50;
+  double notifyLatencyP99;
+  double notifyLatencyMax;
+};
+
+// One hashboard's entry of the 'dashstats' reply
+struct BoardStats {
+  int statsIndex; // Position in the STATS array, which is the ASC number of its device
+  int boardId;
+  int numChips;
+  int numCores;
+  double boardTemp;
+  double chipTemp;
+  double hotChipTemp;
+  double powerSupplyTemp;
+  bool hasStringVoltage;
+  double stringVoltage;
+  int fanSpeed0;
+  int fanSpeed1;
+  bool hasSensorAge;
+  int sensorAgeMs;
+};
+
+// The reply to any of 'dashpools', 'dashstats' and 'dashdevs' joined together
+struct MinerStatus {
+  bool hasPools;
+  bool hasStats;
+  bool hasDevs;
+  vector<PoolStatus> pools;
+  vector<BoardStats> boards;
+  vector<DeviceStatus> devs;
+
+  // The device status for a board, or null if cgminer didn't send one
+  const DeviceStatus *deviceFor(const BoardStats &board) const;
+};
+
+// Parse a cgminer reply into 'status'. Returns false if the reply isn't valid JSON.
+bool parseMinerStatus(const string &text, MinerStatus &status);
+
+// The entries of one command's reply, e.g. 'POOLS' of 'dashpools', or null if it isn't there. A
+// joined reply has each command's reply in a one element array under the command's name.
+const crow::json::rvalue *commandEntries(const crow::json::rvalue &reply, const char *command,
+                                         const char *section);
+
 } // namespace CgMiner
 
 #endif
@@ -0,0 +1,145 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "FirmwareUpload.h"
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#define FIRMWARE_UPLOAD_READ_BLOCK (64 * 1024)
+
+FirmwareUpload::FirmwareUpload(string path) : path(path), fd(-1), received(0), totalSize(0) {}
+
+FirmwareUpload::~FirmwareUpload() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool FirmwareUpload::openFile(bool truncate) {
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  size_t slash = path.rfind('/');
+  if (slash != string::npos && slash > 0) {
+    mkdir(path.substr(0, slash).c_str(), 0755);
+  }
+
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+  return fd >= 0;
+}
+
+// Bring 'received' and the hash back in line with the file if something else has changed it, e.g.
+// the upgrade unpacking it, the old base64 upload action writing it, or apiserver restarting.
+void FirmwareUpload::resync() {
+  struct stat pathStat;
+  if (stat(path.c_str(), &pathStat) != 0) {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+    received = 0;
+    totalSize = 0;
+    hash.reset();
+    return;
+  }
+
+  struct stat fdStat;
+  if (fd >= 0 && fstat(fd, &fdStat) == 0 && fdStat.st_ino == pathStat.st_ino &&
+      (uint64_t)pathStat.st_size == received) {
+    return;
+  }
+
+  hash.reset();
+  received = 0;
+  if (!openFile(false)) {
+    return;
+  }
+  vector<uint8_t> block(FIRMWARE_UPLOAD_READ_BLOCK);
+  ssize_t n;
+  while ((n = pread(fd, &block[0], block.size(), received)) > 0) {
+    hash.update(&block[0], n);
+    received += n;
+  }
+  if (totalSize < received) {
+    totalSize = 0;
+  }
+}
+
+FirmwareUploadStatus FirmwareUpload::makeStatus() {
+  FirmwareUploadStatus status;
+  status.offset = received;
+  status.totalSize = totalSize;
+  status.sha256 = hash.hexDigest();
+  status.complete = totalSize > 0 && received == totalSize;
+  return status;
+}
+
+FirmwareUploadStatus FirmwareUpload::status() {
+  std::lock_guard<std::mutex> lock(m);
+  resync();
+  return makeStatus();
+}
+
+FirmwareUploadResult FirmwareUpload::write(uint64_t offset, uint64_t size, const char *data,
+                                           size_t len, const string &expectedSha256) {
+  std::lock_guard<std::mutex> lock(m);
+  if (len > FIRMWARE_UPLOAD_MAX_CHUNK || (size > 0 && offset + len > size)) {
+    return FirmwareUpload_TooLarge;
+  }
+
+  if (offset == 0) {
+    hash.reset();
+    received = 0;
+    if (!openFile(true)) {
+      return FirmwareUpload_IOError;
+    }
+  } else {
+    resync();
+    if (offset != received) {
+      return FirmwareUpload_OffsetMismatch;
+    }
+  }
+  if (fd < 0) {
+    return FirmwareUpload_IOError;
+  }
+  if (size > 0) {
+    totalSize = size;
+  }
+
+  size_t written = 0;
+  while (written < len) {
+    ssize_t n = pwrite(fd, data + written, len - written, offset + written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Whatever did get written is picked up by resync() next time
+      return FirmwareUpload_IOError;
+    }
+    written += n;
+  }
+  hash.update((const uint8_t *)data, len);
+  received += len;
+
+  if (!expectedSha256.empty() && totalSize > 0 && received == totalSize) {
+    string expected = expectedSha256;
+    transform(expected.begin(), expected.end(), expected.begin(), ::tolower);
+    if (hash.hexDigest() != expected) {
+      if (ftruncate(fd, 0) != 0) {
+        return FirmwareUpload_IOError;
+      }
+      hash.reset();
+      received = 0;
+      return FirmwareUpload_DigestMismatch;
+    }
+  }
+  return FirmwareUpload_OK;
+}
@@ -0,0 +1,63 @@
+// Copyright 2018 Obelisk Inc.
+
+#ifndef FIRMWAREUPLOAD_H
+#define FIRMWAREUPLOAD_H
+
+#include "Sha256.h"
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+// The largest chunk accepted in one request. Crow holds a request's whole body in memory, so this
+// is what bounds the memory an upload takes.
+#define FIRMWARE_UPLOAD_MAX_CHUNK (1024 * 1024)
+
+struct FirmwareUploadStatus {
+  uint64_t offset;    // Bytes received so far; the next chunk must start here
+  uint64_t totalSize; // As given by the client, or 0 if not known yet
+  string sha256;      // Of the bytes received so far
+  bool complete;
+};
+
+enum FirmwareUploadResult {
+  FirmwareUpload_OK,
+  FirmwareUpload_OffsetMismatch, // The chunk doesn't start where the last one ended
+  FirmwareUpload_TooLarge,       // The chunk runs past totalSize, or is over the chunk limit
+  FirmwareUpload_DigestMismatch, // The whole file is in, but its SHA-256 isn't the expected one
+  FirmwareUpload_IOError,
+};
+
+// Receives the firmware archive a chunk at a time. Each chunk is written at its offset and hashed
+// as it comes in, so a client that drops off can ask for the offset and carry on from there, and
+// the archive never has to be read back to be checked. A chunk at offset 0 starts over.
+//
+// The received bytes are whatever is in the file, so an upload survives apiserver restarting: if
+// the file isn't the size we expect, it's hashed again from disk before the next chunk.
+class FirmwareUpload {
+public:
+  FirmwareUpload(string path);
+  ~FirmwareUpload();
+
+  FirmwareUploadStatus status();
+
+  // Write a chunk. 'expectedSha256', if not empty, is checked once the last chunk is in; on a
+  // mismatch the upload is thrown away.
+  FirmwareUploadResult write(uint64_t offset, uint64_t totalSize, const char *data, size_t len,
+                             const string &expectedSha256);
+
+private:
+  bool openFile(bool truncate);
+  void resync();
+  FirmwareUploadStatus makeStatus();
+
+  string path;
+  int fd;
+  uint64_t received;
+  uint64_t totalSize;
+  Sha256 hash;
+  std::mutex m;
+};
+
+#endif
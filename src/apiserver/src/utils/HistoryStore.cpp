@@ -0,0 +1,310 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "HistoryStore.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define HISTORY_FILE_MAGIC "OBHS"
+#define HISTORY_FILE_VERSION 1
+#define HISTORY_HEADER_SIZE 5
+
+// level, time, fans, numBoards, boards, checksum
+#define HISTORY_BOARD_RECORD_SIZE 14
+#define HISTORY_RECORD_SIZE \
+  (1 + 4 + 2 * HISTORY_MAX_FANS + 1 + HISTORY_BOARD_RECORD_SIZE * HISTORY_MAX_BOARDS + 1)
+
+#define HISTORY_FLUSH_SECS 600
+
+static const uint32_t levelIntervals[HISTORY_LEVELS] = {5, 60, 15 * 60};
+static const uint32_t levelCapacities[HISTORY_LEVELS] = {60 * 60 / 5, 24 * 60, 30 * 24 * 4};
+
+uint32_t HistoryStore::levelInterval(int level) { return levelIntervals[level]; }
+
+uint32_t HistoryStore::levelCapacity(int level) { return levelCapacities[level]; }
+
+static void putU16(string &out, uint16_t v) {
+  out.push_back(v & 0xFF);
+  out.push_back(v >> 8);
+}
+
+static void putU32(string &out, uint32_t v) {
+  putU16(out, v & 0xFFFF);
+  putU16(out, v >> 16);
+}
+
+static uint16_t getU16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static uint32_t getU32(const uint8_t *p) { return getU16(p) | ((uint32_t)getU16(p + 2) << 16); }
+
+// Scale and round to fit in 16 bits, saturating rather than wrapping
+static uint16_t toFixedU16(double v, double scale) {
+  double scaled = round(v * scale);
+  return scaled < 0 ? 0 : scaled > UINT16_MAX ? UINT16_MAX : (uint16_t)scaled;
+}
+
+static uint16_t toFixedS16(double v, double scale) {
+  double scaled = round(v * scale);
+  return (uint16_t)(int16_t)(scaled < INT16_MIN ? INT16_MIN : scaled > INT16_MAX ? INT16_MAX : scaled);
+}
+
+static uint8_t checksum(const uint8_t *p, size_t len) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < len; i++) {
+    sum = (sum << 1 | sum >> 7) ^ p[i];
+  }
+  return sum;
+}
+
+static void encodeRecord(string &out, int level, const HistorySample &s) {
+  size_t start = out.length();
+  out.push_back(level);
+  putU32(out, s.time);
+  for (int i = 0; i < HISTORY_MAX_FANS; i++) {
+    putU16(out, s.fanSpeed[i]);
+  }
+  out.push_back(s.numBoards);
+  for (int i = 0; i < HISTORY_MAX_BOARDS; i++) {
+    const HistoryBoard &b = s.boards[i];
+    putU16(out, toFixedU16(b.hashrate, 10));
+    putU16(out, toFixedS16(b.boardTemp, 10));
+    putU16(out, toFixedS16(b.chipTemp, 10));
+    putU16(out, toFixedS16(b.hotChipTemp, 10));
+    putU16(out, toFixedU16(b.stringVoltage, 1000));
+    putU16(out, min<uint32_t>(b.accepted, UINT16_MAX));
+    putU16(out, min<uint32_t>(b.rejected, UINT16_MAX));
+  }
+  out.push_back(checksum((const uint8_t *)out.data() + start, out.length() - start));
+}
+
+static bool decodeRecord(const uint8_t *p, int &level, HistorySample &s) {
+  if (checksum(p, HISTORY_RECORD_SIZE - 1) != p[HISTORY_RECORD_SIZE - 1]) {
+    return false;
+  }
+  memset(&s, 0, sizeof(s));
+  level = *p++;
+  s.time = getU32(p);
+  p += 4;
+  for (int i = 0; i < HISTORY_MAX_FANS; i++, p += 2) {
+    s.fanSpeed[i] = getU16(p);
+  }
+  s.numBoards = *p++;
+  for (int i = 0; i < HISTORY_MAX_BOARDS; i++) {
+    HistoryBoard &b = s.boards[i];
+    b.hashrate = getU16(p) / 10.0;
+    b.boardTemp = (int16_t)getU16(p + 2) / 10.0;
+    b.chipTemp = (int16_t)getU16(p + 4) / 10.0;
+    b.hotChipTemp = (int16_t)getU16(p + 6) / 10.0;
+    b.stringVoltage = getU16(p + 8) / 1000.0;
+    b.accepted = getU16(p + 10);
+    b.rejected = getU16(p + 12);
+    p += HISTORY_BOARD_RECORD_SIZE;
+  }
+  return level > HISTORY_LEVEL_5S && level < HISTORY_LEVELS && s.numBoards <= HISTORY_MAX_BOARDS;
+}
+
+HistoryStore::HistoryStore(string p) : path(p), lastFlush(time(0)), fileSize(0) {
+  for (int i = 0; i < HISTORY_LEVELS; i++) {
+    levels[i].ring.resize(levelCapacities[i]);
+    levels[i].head = 0;
+    levels[i].count = 0;
+    resetAccumulator(levels[i], 0);
+  }
+}
+
+void HistoryStore::load() {
+  std::lock_guard<std::mutex> lock(m);
+  ifstream in(path, ios::binary);
+  string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  const uint8_t *p = (const uint8_t *)data.data();
+
+  if (data.length() < HISTORY_HEADER_SIZE || memcmp(p, HISTORY_FILE_MAGIC, 4) != 0 ||
+      p[4] != HISTORY_FILE_VERSION) {
+    // Missing or unusable, so start a new file
+    rewriteFile();
+    return;
+  }
+
+  size_t offset = HISTORY_HEADER_SIZE;
+  for (; offset + HISTORY_RECORD_SIZE <= data.length(); offset += HISTORY_RECORD_SIZE) {
+    int level;
+    HistorySample s;
+    if (!decodeRecord(p + offset, level, s)) {
+      continue;
+    }
+    Level &lvl = levels[level];
+    if (lvl.count > 0) {
+      const HistorySample &last = lvl.ring[(lvl.head + lvl.ring.size() - 1) % lvl.ring.size()];
+      if (s.time <= last.time) {
+        continue;
+      }
+    }
+    push(level, s);
+  }
+
+  fileSize = data.length();
+  if (offset != data.length()) {
+    // The last write was cut short
+    rewriteFile();
+  }
+}
+
+void HistoryStore::add(const HistorySample &sample) {
+  std::lock_guard<std::mutex> lock(m);
+  push(HISTORY_LEVEL_5S, sample);
+  accumulate(HISTORY_LEVEL_5S + 1, sample);
+}
+
+void HistoryStore::push(int level, const HistorySample &sample) {
+  Level &lvl = levels[level];
+  lvl.ring[lvl.head] = sample;
+  lvl.head = (lvl.head + 1) % lvl.ring.size();
+  if (lvl.count < lvl.ring.size()) {
+    lvl.count++;
+  }
+}
+
+void HistoryStore::resetAccumulator(Level &lvl, uint32_t bucket) {
+  lvl.bucket = bucket;
+  lvl.accumulated = 0;
+  memset(lvl.sums, 0, sizeof(lvl.sums));
+  memset(lvl.fanSums, 0, sizeof(lvl.fanSums));
+  memset(&lvl.pending, 0, sizeof(lvl.pending));
+}
+
+void HistoryStore::accumulate(int level, const HistorySample &s) {
+  if (level >= HISTORY_LEVELS) {
+    return;
+  }
+  Level &lvl = levels[level];
+  uint32_t bucket = s.time - s.time % levelIntervals[level];
+  if (lvl.accumulated > 0 && bucket != lvl.bucket) {
+    HistorySample done = finish(lvl);
+    push(level, done);
+    appendRecord(level, done);
+    accumulate(level + 1, done);
+  }
+  if (lvl.accumulated == 0 || bucket != lvl.bucket) {
+    resetAccumulator(lvl, bucket);
+  }
+
+  for (int i = 0; i < HISTORY_MAX_FANS; i++) {
+    lvl.fanSums[i] += s.fanSpeed[i];
+  }
+  lvl.pending.numBoards = max(lvl.pending.numBoards, s.numBoards);
+  for (int i = 0; i < s.numBoards && i < HISTORY_MAX_BOARDS; i++) {
+    const HistoryBoard &b = s.boards[i];
+    double *sums = lvl.sums[i];
+    sums[0] += b.hashrate;
+    sums[1] += b.boardTemp;
+    sums[2] += b.chipTemp;
+    sums[3] += b.hotChipTemp;
+    sums[4] += b.stringVoltage;
+    lvl.pending.boards[i].accepted += b.accepted;
+    lvl.pending.boards[i].rejected += b.rejected;
+  }
+  lvl.accumulated++;
+}
+
+HistorySample HistoryStore::finish(Level &lvl) {
+  HistorySample s = lvl.pending;
+  s.time = lvl.bucket;
+  for (int i = 0; i < HISTORY_MAX_FANS; i++) {
+    s.fanSpeed[i] = round(lvl.fanSums[i] / lvl.accumulated);
+  }
+  for (int i = 0; i < s.numBoards; i++) {
+    HistoryBoard &b = s.boards[i];
+    b.hashrate = lvl.sums[i][0] / lvl.accumulated;
+    b.boardTemp = lvl.sums[i][1] / lvl.accumulated;
+    b.chipTemp = lvl.sums[i][2] / lvl.accumulated;
+    b.hotChipTemp = lvl.sums[i][3] / lvl.accumulated;
+    b.stringVoltage = lvl.sums[i][4] / lvl.accumulated;
+  }
+  return s;
+}
+
+void HistoryStore::appendRecord(int level, const HistorySample &sample) {
+  encodeRecord(unwritten, level, sample);
+}
+
+vector<HistorySample> HistoryStore::get(int level, uint32_t since) {
+  std::lock_guard<std::mutex> lock(m);
+  vector<HistorySample> result;
+  if (level < 0 || level >= HISTORY_LEVELS) {
+    return result;
+  }
+  Level &lvl = levels[level];
+  size_t size = lvl.ring.size();
+  result.reserve(lvl.count);
+  for (size_t i = 0; i < lvl.count; i++) {
+    const HistorySample &s = lvl.ring[(lvl.head + size - lvl.count + i) % size];
+    if (s.time >= since) {
+      result.push_back(s);
+    }
+  }
+  return result;
+}
+
+void HistoryStore::flush(bool force) {
+  std::lock_guard<std::mutex> lock(m);
+  uint32_t now = time(0);
+  if (unwritten.empty() || (!force && now - lastFlush < HISTORY_FLUSH_SECS)) {
+    return;
+  }
+
+  size_t maxFileSize = HISTORY_HEADER_SIZE +
+                       2 * HISTORY_RECORD_SIZE *
+                           (levelCapacities[HISTORY_LEVEL_1M] + levelCapacities[HISTORY_LEVEL_15M]);
+  if (fileSize + unwritten.length() > maxFileSize) {
+    // The rings already hold everything that is unwritten
+    rewriteFile();
+  } else {
+    FILE *fp = fopen(path.c_str(), "ab");
+    if (fp != NULL) {
+      if (fwrite(unwritten.data(), 1, unwritten.length(), fp) == unwritten.length()) {
+        fileSize += unwritten.length();
+      }
+      fclose(fp);
+    }
+  }
+  unwritten.clear();
+  lastFlush = now;
+}
+
+// Write the saved levels out to a new file and swap it in, so a power cut leaves either the old
+// file or the new one.
+bool HistoryStore::rewriteFile() {
+  string data = HISTORY_FILE_MAGIC;
+  data.push_back(HISTORY_FILE_VERSION);
+  for (int level = HISTORY_LEVEL_1M; level < HISTORY_LEVELS; level++) {
+    Level &lvl = levels[level];
+    size_t size = lvl.ring.size();
+    for (size_t i = 0; i < lvl.count; i++) {
+      encodeRecord(data, level, lvl.ring[(lvl.head + size - lvl.count + i) % size]);
+    }
+  }
+
+  string tmpPath = path + ".tmp";
+  FILE *fp = fopen(tmpPath.c_str(), "wb");
+  if (fp == NULL) {
+    return false;
+  }
+  bool ok = fwrite(data.data(), 1, data.length(), fp) == data.length();
+  ok = fflush(fp) == 0 && ok;
+  ok = fsync(fileno(fp)) == 0 && ok;
+  fclose(fp);
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    remove(tmpPath.c_str());
+    return false;
+  }
+  fileSize = data.length();
+  unwritten.clear();
+  return true;
+}
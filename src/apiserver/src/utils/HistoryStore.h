@@ -0,0 +1,94 @@
+// Copyright 2018 Obelisk Inc.
+
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define HISTORY_MAX_BOARDS 3
+#define HISTORY_MAX_FANS 2
+
+// Resolutions kept, finest first. Each level is built by averaging the level below it.
+#define HISTORY_LEVEL_5S 0  // 5 seconds for an hour
+#define HISTORY_LEVEL_1M 1  // 1 minute for a day
+#define HISTORY_LEVEL_15M 2 // 15 minutes for 30 days
+#define HISTORY_LEVELS 3
+
+typedef struct HistoryBoard {
+  float hashrate; // GH/s
+  float boardTemp;
+  float chipTemp;
+  float hotChipTemp;
+  float stringVoltage;
+  uint32_t accepted; // Shares accepted during the interval
+  uint32_t rejected; // Shares rejected during the interval
+} HistoryBoard;
+
+typedef struct HistorySample {
+  uint32_t time; // Start of the interval (Unix time)
+  uint16_t fanSpeed[HISTORY_MAX_FANS];
+  uint8_t numBoards;
+  HistoryBoard boards[HISTORY_MAX_BOARDS];
+} HistorySample;
+
+// HistoryStore keeps per-board history at several resolutions in fixed-size rings, so adding a
+// sample never moves the older ones.
+//
+// The 1 minute and 15 minute levels are also appended to a file as compact fixed-point records.
+// Records are buffered and written at most once every HISTORY_FLUSH_SECS to keep flash writes
+// down, and the file is rewritten from the rings once it has grown to twice what they hold. The
+// 5 second level is not saved; it would be most of the writes and only covers the last hour.
+class HistoryStore {
+public:
+  HistoryStore(string path);
+
+  // Replay the history file into the rings. Records that don't check out are skipped.
+  void load();
+
+  // Add a sample at the finest resolution. Samples must come in time order.
+  void add(const HistorySample &sample);
+
+  // Write out buffered records if it's been long enough since the last write, or if 'force'.
+  void flush(bool force);
+
+  // Samples at the given level, oldest first, no older than 'since'.
+  vector<HistorySample> get(int level, uint32_t since);
+
+  static uint32_t levelInterval(int level);
+  static uint32_t levelCapacity(int level);
+
+private:
+  struct Level {
+    vector<HistorySample> ring;
+    size_t head; // Index the next sample goes in
+    size_t count;
+
+    // Running totals for the sample being built from the level below
+    uint32_t bucket;
+    uint32_t accumulated;
+    double sums[HISTORY_MAX_BOARDS][5]; // hashrate, the three temps and voltage
+    double fanSums[HISTORY_MAX_FANS];
+    HistorySample pending;
+  };
+
+  void push(int level, const HistorySample &sample);
+  void accumulate(int level, const HistorySample &sample);
+  HistorySample finish(Level &lvl);
+  void resetAccumulator(Level &lvl, uint32_t bucket);
+  void appendRecord(int level, const HistorySample &sample);
+  bool rewriteFile();
+
+  string path;
+  std::mutex m;
+  Level levels[HISTORY_LEVELS];
+  string unwritten;
+  uint32_t lastFlush;
+  size_t fileSize;
+};
+
+#endif
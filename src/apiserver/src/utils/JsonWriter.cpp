@@ -0,0 +1,119 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "JsonWriter.h"
+#include "../Crow.h"
+#include <math.h>
+#include <stdio.h>
+
+using namespace std;
+
+JsonWriter::JsonWriter(size_t reserve) : afterKey(false) { out.reserve(reserve); }
+
+void JsonWriter::beforeValue() {
+  if (afterKey) {
+    afterKey = false;
+    return;
+  }
+  if (!hasEntries.empty()) {
+    if (hasEntries.back()) {
+      out.push_back(',');
+    }
+    hasEntries.back() = true;
+  }
+}
+
+JsonWriter &JsonWriter::startObject() {
+  beforeValue();
+  out.push_back('{');
+  hasEntries.push_back(false);
+  return *this;
+}
+
+JsonWriter &JsonWriter::endObject() {
+  out.push_back('}');
+  hasEntries.pop_back();
+  return *this;
+}
+
+JsonWriter &JsonWriter::startArray() {
+  beforeValue();
+  out.push_back('[');
+  hasEntries.push_back(false);
+  return *this;
+}
+
+JsonWriter &JsonWriter::endArray() {
+  out.push_back(']');
+  hasEntries.pop_back();
+  return *this;
+}
+
+JsonWriter &JsonWriter::key(const char *k) { return key(string(k)); }
+
+JsonWriter &JsonWriter::key(const string &k) {
+  beforeValue();
+  out.push_back('"');
+  crow::json::escape(k, out);
+  out += "\":";
+  afterKey = true;
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(const string &s) {
+  beforeValue();
+  out.push_back('"');
+  crow::json::escape(s, out);
+  out.push_back('"');
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *s) { return value(string(s)); }
+
+JsonWriter &JsonWriter::value(bool b) {
+  beforeValue();
+  out += b ? "true" : "false";
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(double d) {
+  if (!isfinite(d)) {
+    return null();
+  }
+  beforeValue();
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.15g", d);
+  out += buf;
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(int n) { return value((long long)n); }
+
+JsonWriter &JsonWriter::value(unsigned n) { return value((unsigned long long)n); }
+
+JsonWriter &JsonWriter::value(long n) { return value((long long)n); }
+
+JsonWriter &JsonWriter::value(unsigned long n) { return value((unsigned long long)n); }
+
+JsonWriter &JsonWriter::value(long long n) {
+  beforeValue();
+  out += to_string(n);
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(unsigned long long n) {
+  beforeValue();
+  out += to_string(n);
+  return *this;
+}
+
+JsonWriter &JsonWriter::null() {
+  beforeValue();
+  out += "null";
+  return *this;
+}
+
+JsonWriter &JsonWriter::raw(const string &json) {
+  beforeValue();
+  out += json;
+  return *this;
+}
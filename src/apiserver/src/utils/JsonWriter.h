@@ -0,0 +1,66 @@
+// Copyright 2018 Obelisk Inc.
+
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// JsonWriter appends JSON text straight to a string as a response is built, rather than building
+// a json::wvalue and dumping it. Commas are put in as needed. Inside an object, each value must
+// follow a key(); field() does both.
+//
+//   JsonWriter w;
+//   w.startObject().field("freeMemory", 1024).key("boards").startArray();
+//   ...
+//   w.endArray().endObject();
+//   sendJson(w.str(), resp);
+class JsonWriter {
+public:
+  JsonWriter(size_t reserve = 1024);
+
+  JsonWriter &startObject();
+  JsonWriter &endObject();
+  JsonWriter &startArray();
+  JsonWriter &endArray();
+
+  JsonWriter &key(const char *k);
+  JsonWriter &key(const string &k);
+
+  JsonWriter &value(const string &s);
+  JsonWriter &value(const char *s);
+  JsonWriter &value(bool b);
+  // Up to 15 significant digits, so e.g. hashrates in MH/s survive; NaN and infinities, which JSON
+  // can't hold, are written as null
+  JsonWriter &value(double d);
+  JsonWriter &value(int n);
+  JsonWriter &value(unsigned n);
+  JsonWriter &value(long n);
+  JsonWriter &value(unsigned long n);
+  JsonWriter &value(long long n);
+  JsonWriter &value(unsigned long long n);
+  JsonWriter &null();
+
+  // Copy in a value that is already JSON text
+  JsonWriter &raw(const string &json);
+
+  template <typename T> JsonWriter &field(const char *k, const T &v) {
+    key(k);
+    return value(v);
+  }
+
+  const string &str() const { return out; }
+
+private:
+  void beforeValue();
+
+  string out;
+  // For each open object or array, whether anything has been written in it yet
+  vector<bool> hasEntries;
+  bool afterKey;
+};
+
+#endif
@@ -0,0 +1,31 @@
+// Copyright 2018 Obelisk Inc.
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+// Incremental SHA-256, so a file can be hashed as it arrives rather than read back afterwards
+class Sha256 {
+public:
+  Sha256();
+
+  void reset();
+  void update(const uint8_t *data, size_t len);
+
+  // The digest of everything so far as lowercase hex. Further updates can still be made.
+  string hexDigest() const;
+
+private:
+  void transform(const uint8_t *block);
+
+  uint32_t state[8];
+  uint8_t buffer[64];
+  size_t bufferLen;
+  uint64_t totalLen;
+};
+
+#endif
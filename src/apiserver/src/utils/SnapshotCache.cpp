@@ -0,0 +1,71 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "SnapshotCache.h"
+#include "HttpStatusCodes.h"
+
+using namespace std;
+
+SnapshotCache::SnapshotCache(SnapshotFetcher f, SnapshotRenderer r, int ttlMs)
+    : fetcher(f), renderer(r), ttl(ttlMs), fetchInFlight(false), version(0) {}
+
+void SnapshotCache::setTtl(int ttlMs) {
+  std::lock_guard<std::mutex> lock(m);
+  ttl = std::chrono::milliseconds(ttlMs);
+}
+
+void SnapshotCache::get(SnapshotCallback callback) {
+  SnapshotPtr fresh;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    if (current && std::chrono::steady_clock::now() - fetchedAt < ttl) {
+      fresh = current;
+    } else {
+      waiters.push_back(callback);
+      if (fetchInFlight) {
+        return;
+      }
+      fetchInFlight = true;
+    }
+  }
+
+  if (fresh) {
+    callback(fresh);
+    return;
+  }
+  fetcher([this](CgMiner::Response &resp) { complete(resp); });
+}
+
+void SnapshotCache::complete(CgMiner::Response &resp) {
+  uint64_t v;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    v = ++version;
+  }
+
+  Snapshot rendered(HttpStatus_InternalServerError,
+                    "{\"error\":\"Invalid response from mining app\"}", v);
+  try {
+    rendered = renderer(resp);
+    rendered.version = v;
+  } catch (...) {
+  }
+  SnapshotPtr snapshot = std::make_shared<const Snapshot>(std::move(rendered));
+
+  vector<SnapshotCallback> ready;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    // Failures aren't kept, so the next request asks cgminer again
+    if (!resp.error && snapshot->code == HttpStatus_OK) {
+      current = snapshot;
+      fetchedAt = std::chrono::steady_clock::now();
+    } else {
+      current.reset();
+    }
+    fetchInFlight = false;
+    ready.swap(waiters);
+  }
+
+  for (auto &callback : ready) {
+    callback(snapshot);
+  }
+}
@@ -0,0 +1,66 @@
+// Copyright 2018 Obelisk Inc.
+
+#ifndef SNAPSHOTCACHE_H
+#define SNAPSHOTCACHE_H
+
+#include "../CgMinerTypes.h"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// A ready-to-send reply built from one cgminer response.
+class Snapshot {
+public:
+  int code;
+  string body;
+  uint64_t version; // Bumped each time cgminer is queried; set by the cache
+  string hash;      // Short hash of the body for ETags, if the renderer makes one
+  string cbor;      // The body in CBOR, if the renderer makes one
+  Snapshot(int c, string b, uint64_t v) : code(c), body(b), version(v) {}
+};
+
+typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+typedef std::function<void(SnapshotPtr)> SnapshotCallback;
+
+// Turns a cgminer response into the reply body. It may throw, in which case the reply is an
+// internal error.
+typedef std::function<Snapshot(CgMiner::Response &)> SnapshotRenderer;
+
+// Queries cgminer and calls back with its response.
+typedef std::function<void(CgMiner::RequestCallback)> SnapshotFetcher;
+
+// SnapshotCache keeps the last reply to a cgminer query for a short time, so that any number of
+// browser tabs or pollers asking for the same thing cost one cgminer query per TTL. Requests that
+// arrive while a query is in flight wait for that query rather than starting another, and the
+// reply is rendered once per query and then shared as is.
+class SnapshotCache {
+public:
+  SnapshotCache(SnapshotFetcher fetcher, SnapshotRenderer renderer, int ttlMs);
+
+  // Calls back with a snapshot no older than the TTL. The callback may run on this thread, if
+  // the cached snapshot is fresh, or on the thread that completes the cgminer query.
+  void get(SnapshotCallback callback);
+
+  void setTtl(int ttlMs);
+
+private:
+  void complete(CgMiner::Response &resp);
+
+  SnapshotFetcher fetcher;
+  SnapshotRenderer renderer;
+  std::chrono::milliseconds ttl;
+
+  std::mutex m;
+  SnapshotPtr current;
+  std::chrono::steady_clock::time_point fetchedAt;
+  bool fetchInFlight;
+  vector<SnapshotCallback> waiters;
+  uint64_t version;
+};
+
+#endif
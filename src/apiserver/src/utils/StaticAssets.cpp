@@ -0,0 +1,246 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "StaticAssets.h"
+#include "Sha256.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fstream>
+#include <iterator>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Characters of the content hash used in ETags
+#define STATIC_ASSET_HASH_LEN 16
+
+static const struct {
+  const char *ext;
+  const char *contentType;
+} contentTypes[] = {
+    {".html", "text/html; charset=utf-8"},
+    {".js", "application/javascript; charset=utf-8"},
+    {".css", "text/css; charset=utf-8"},
+    {".json", "application/json"},
+    {".map", "application/json"},
+    {".txt", "text/plain; charset=utf-8"},
+    {".svg", "image/svg+xml"},
+    {".png", "image/png"},
+    {".jpg", "image/jpeg"},
+    {".gif", "image/gif"},
+    {".ico", "image/x-icon"},
+    {".woff", "font/woff"},
+    {".woff2", "font/woff2"},
+    {".ttf", "font/ttf"},
+    {".eot", "application/vnd.ms-fontobject"},
+};
+
+static bool endsWith(const string &s, const string &suffix) {
+  return s.length() >= suffix.length() &&
+         s.compare(s.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+static string contentTypeFor(const string &name) {
+  for (auto &type : contentTypes) {
+    if (endsWith(name, type.ext)) {
+      return type.contentType;
+    }
+  }
+  return "application/octet-stream";
+}
+
+static bool readWholeFile(const string &path, string &contents) {
+  ifstream in(path, ios::in | ios::binary);
+  if (!in) {
+    return false;
+  }
+  contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  return true;
+}
+
+const string &StaticAsset::body(ContentEncoding encoding) const {
+  switch (encoding) {
+  case Encoding_Brotli:
+    return brotli;
+  case Encoding_Gzip:
+    return gzip;
+  default:
+    return identity;
+  }
+}
+
+string StaticAsset::etag(ContentEncoding encoding) const {
+  switch (encoding) {
+  case Encoding_Brotli:
+    return "\"" + hash + "-br\"";
+  case Encoding_Gzip:
+    return "\"" + hash + "-gz\"";
+  default:
+    return "\"" + hash + "\"";
+  }
+}
+
+StaticAssets::StaticAssets(string root) : root(root) {}
+
+size_t StaticAssets::load() {
+  assets.clear();
+  loadDir(root, "/");
+  return assets.size();
+}
+
+void StaticAssets::loadDir(const string &dir, const string &urlPrefix) {
+  DIR *d = opendir(dir.c_str());
+  if (!d) {
+    return;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(d)) != nullptr) {
+    string name = entry->d_name;
+    if (name.empty() || name[0] == '.') {
+      continue;
+    }
+    string path = dir + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      loadDir(path, urlPrefix + name + "/");
+      continue;
+    }
+    // The compressed forms are picked up along with the file they were made from
+    if (!S_ISREG(st.st_mode) || endsWith(name, ".gz") || endsWith(name, ".br")) {
+      continue;
+    }
+
+    StaticAsset asset;
+    if (!readWholeFile(path, asset.identity)) {
+      continue;
+    }
+    asset.contentType = contentTypeFor(name);
+    asset.immutable = isHashedName(name);
+
+    Sha256 sha;
+    sha.update((const uint8_t *)asset.identity.data(), asset.identity.size());
+    asset.hash = sha.hexDigest().substr(0, STATIC_ASSET_HASH_LEN);
+
+    // Keep a compressed form only if it actually saves something
+    if (readWholeFile(path + ".gz", asset.gzip) && asset.gzip.size() >= asset.identity.size()) {
+      asset.gzip.clear();
+    }
+    if (readWholeFile(path + ".br", asset.brotli) && asset.brotli.size() >= asset.identity.size()) {
+      asset.brotli.clear();
+    }
+
+    assets.emplace(urlPrefix + name, std::move(asset));
+  }
+  closedir(d);
+}
+
+const StaticAsset *StaticAssets::find(const string &path) const {
+  auto it = assets.find(path.empty() || path == "/" ? "/index.html" : path);
+  return it == assets.end() ? nullptr : &it->second;
+}
+
+ContentEncoding StaticAssets::chooseEncoding(const string &acceptEncoding,
+                                             const StaticAsset &asset) {
+  // q values; -1 means not mentioned
+  double brQ = -1, gzipQ = -1, anyQ = -1;
+  size_t pos = 0;
+  while (pos < acceptEncoding.length()) {
+    size_t end = acceptEncoding.find(',', pos);
+    if (end == string::npos) {
+      end = acceptEncoding.length();
+    }
+    string item = acceptEncoding.substr(pos, end - pos);
+    pos = end + 1;
+
+    double q = 1;
+    size_t semi = item.find(';');
+    if (semi != string::npos) {
+      size_t qPos = item.find("q=", semi);
+      if (qPos != string::npos) {
+        q = atof(item.c_str() + qPos + 2);
+      }
+      item = item.substr(0, semi);
+    }
+    string coding;
+    for (char c : item) {
+      if (!isspace((unsigned char)c)) {
+        coding.push_back(tolower((unsigned char)c));
+      }
+    }
+
+    if (coding == "br") {
+      brQ = q;
+    } else if (coding == "gzip" || coding == "x-gzip") {
+      gzipQ = q;
+    } else if (coding == "*") {
+      anyQ = q;
+    }
+  }
+  if (brQ < 0) {
+    brQ = anyQ;
+  }
+  if (gzipQ < 0) {
+    gzipQ = anyQ;
+  }
+
+  // Prefer brotli, which is smaller, unless the client says it would rather have gzip
+  if (!asset.brotli.empty() && brQ > 0 && (asset.gzip.empty() || brQ >= gzipQ)) {
+    return Encoding_Brotli;
+  }
+  if (!asset.gzip.empty() && gzipQ > 0) {
+    return Encoding_Gzip;
+  }
+  return Encoding_Identity;
+}
+
+bool StaticAssets::etagMatches(const string &ifNoneMatch, const string &etag) {
+  size_t pos = 0;
+  while (pos < ifNoneMatch.length()) {
+    size_t end = ifNoneMatch.find(',', pos);
+    if (end == string::npos) {
+      end = ifNoneMatch.length();
+    }
+    string tag = ifNoneMatch.substr(pos, end - pos);
+    pos = end + 1;
+
+    size_t first = tag.find_first_not_of(" \t");
+    size_t last = tag.find_last_not_of(" \t");
+    if (first == string::npos) {
+      continue;
+    }
+    tag = tag.substr(first, last - first + 1);
+    // If-None-Match uses the weak comparison
+    if (tag.compare(0, 2, "W/") == 0) {
+      tag = tag.substr(2);
+    }
+    if (tag == "*" || tag == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool StaticAssets::isHashedName(const string &name) {
+  // The build names files like main.1a2b3c4d.js or main.1a2b3c4d.chunk.js
+  size_t start = name.find('.');
+  while (start != string::npos) {
+    size_t end = name.find('.', start + 1);
+    if (end == string::npos) {
+      break;
+    }
+    size_t len = end - start - 1;
+    bool allHex = len >= 8;
+    for (size_t i = start + 1; allHex && i < end; i++) {
+      allHex = isxdigit((unsigned char)name[i]) != 0;
+    }
+    if (allHex) {
+      return true;
+    }
+    start = end;
+  }
+  return false;
+}
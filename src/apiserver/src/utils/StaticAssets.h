@@ -0,0 +1,56 @@
+// Copyright 2018 Obelisk Inc.
+
+#ifndef STATICASSETS_H
+#define STATICASSETS_H
+
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+enum ContentEncoding { Encoding_Identity, Encoding_Gzip, Encoding_Brotli };
+
+// One file of the web bundle, with whichever precompressed forms of it the build made
+struct StaticAsset {
+  string contentType;
+  string hash;    // Of the uncompressed content; the ETag is made from it
+  bool immutable; // The filename has a content hash in it, so the file can be cached forever
+  string identity;
+  string gzip;   // Empty if there's no smaller .gz beside it
+  string brotli; // Empty if there's no smaller .br beside it
+
+  const string &body(ContentEncoding encoding) const;
+  // A strong ETag, different for each encoding since the bytes differ
+  string etag(ContentEncoding encoding) const;
+};
+
+// The web bundle, read into memory once at startup so that each request is a lookup. The build
+// (webclient/optimize-build.sh) puts foo.js.gz and foo.js.br beside foo.js; they're served as foo.js
+// to browsers that accept them.
+class StaticAssets {
+public:
+  StaticAssets(string root);
+
+  // Read every file under the root. Returns the number of assets loaded.
+  size_t load();
+
+  // The asset for a URL path, or null. "/" is index.html.
+  const StaticAsset *find(const string &path) const;
+
+  // The best encoding of 'asset' that the Accept-Encoding header allows
+  static ContentEncoding chooseEncoding(const string &acceptEncoding, const StaticAsset &asset);
+
+  // Whether the If-None-Match header matches 'etag'
+  static bool etagMatches(const string &ifNoneMatch, const string &etag);
+
+  // Whether a filename has a build hash in it, e.g. main.1a2b3c4d.js
+  static bool isHashedName(const string &name);
+
+private:
+  void loadDir(const string &dir, const string &urlPrefix);
+
+  string root;
+  unordered_map<string, StaticAsset> assets;
+};
+
+#endif
@@ -0,0 +1,100 @@
+// Copyright 2018 Obelisk Inc.
+
+#include "StatusStream.h"
+#include "HttpStatusCodes.h"
+#include <thread>
+
+using namespace std;
+
+StatusStream::StatusStream(SnapshotCache &c, int periodMs)
+    : cache(c), period(periodMs), publishedVersion(0) {}
+
+void StatusStream::start() {
+  std::thread publisher(&StatusStream::run, this);
+  publisher.detach();
+}
+
+void StatusStream::run() {
+  while (true) {
+    std::this_thread::sleep_for(period);
+
+    bool wanted;
+    {
+      std::lock_guard<std::mutex> lock(m);
+      wanted = !subscribers.empty() || !waitingForFull.empty();
+    }
+    if (wanted) {
+      cache.get([this](SnapshotPtr snapshot) { publish(snapshot); });
+    }
+  }
+}
+
+void StatusStream::subscribe(crow::websocket::connection &conn) {
+  std::lock_guard<std::mutex> lock(m);
+  // Catch the new subscriber up straight away rather than at the next publish
+  if (!fullMessage.empty()) {
+    subscribers.insert(&conn);
+    conn.send_text(fullMessage);
+  } else {
+    waitingForFull.insert(&conn);
+  }
+}
+
+void StatusStream::unsubscribe(crow::websocket::connection &conn) {
+  std::lock_guard<std::mutex> lock(m);
+  subscribers.erase(&conn);
+  waitingForFull.erase(&conn);
+}
+
+string StatusStream::makeMessage(uint64_t version, bool full, const string &fields) {
+  return "{\"version\":" + to_string(version) + ",\"full\":" + (full ? "true" : "false") +
+         ",\"status\":{" + fields + "}}";
+}
+
+void StatusStream::publish(SnapshotPtr snapshot) {
+  if (snapshot->code != HttpStatus_OK) {
+    return;
+  }
+
+  json::rvalue status = json::load(snapshot->body);
+  if (!status || status.t() != json::type::Object) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m);
+  if (snapshot->version == publishedVersion) {
+    return;
+  }
+
+  string allFields;
+  string changedFields;
+  map<string, string> fields;
+  for (auto &field : status) {
+    string key = field.key();
+    string value = json::dump(json::wvalue(field));
+    string entry = "\"" + key + "\":" + value;
+
+    allFields += (allFields.empty() ? "" : ",") + entry;
+    auto it = published.find(key);
+    if (it == published.end() || it->second != value) {
+      changedFields += (changedFields.empty() ? "" : ",") + entry;
+    }
+    fields[key] = value;
+  }
+
+  publishedVersion = snapshot->version;
+  published.swap(fields);
+  fullMessage = makeMessage(publishedVersion, true, allFields);
+  for (auto conn : waitingForFull) {
+    conn->send_text(fullMessage);
+  }
+
+  if (!changedFields.empty()) {
+    string delta = makeMessage(publishedVersion, false, changedFields);
+    for (auto conn : subscribers) {
+      conn->send_text(delta);
+    }
+  }
+  subscribers.insert(waitingForFull.begin(), waitingForFull.end());
+  waitingForFull.clear();
+}
@@ -0,0 +1,56 @@
+// Copyright 2018 Obelisk Inc.
+
+#ifndef STATUSSTREAM_H
+#define STATUSSTREAM_H
+
+#include "../Crow.h"
+#include "SnapshotCache.h"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+using namespace std;
+
+// StatusStream pushes a status snapshot to every websocket subscriber at a fixed cadence, so
+// one cgminer query serves all of them however many there are.
+//
+// Each message is a JSON object:
+//   {"version": <snapshot version>, "full": <bool>, "status": {...}}
+//
+// A subscriber gets the whole status first ("full": true). After that, "status" only holds the
+// top-level fields whose value changed since the last message; a field that is missing is
+// unchanged. Nothing is sent if the snapshot hasn't changed.
+class StatusStream {
+public:
+  StatusStream(SnapshotCache &cache, int periodMs);
+
+  // Start the thread that fetches and publishes snapshots while there are subscribers.
+  void start();
+
+  void subscribe(crow::websocket::connection &conn);
+  void unsubscribe(crow::websocket::connection &conn);
+
+  // Send whatever changed in 'snapshot' to the subscribers.
+  void publish(SnapshotPtr snapshot);
+
+private:
+  void run();
+  string makeMessage(uint64_t version, bool full, const string &fields);
+
+  SnapshotCache &cache;
+  std::chrono::milliseconds period;
+
+  std::mutex m;
+  set<crow::websocket::connection *> subscribers;
+  // Subscribers that joined before anything was published
+  set<crow::websocket::connection *> waitingForFull;
+  uint64_t publishedVersion;
+  // Serialized value of each field as last published
+  map<string, string> published;
+  // The whole of the last published status, for new subscribers
+  string fullMessage;
+};
+
+#endif
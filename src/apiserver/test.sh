@@ -2,8 +2,25 @@
 g++ --std=c++14 \
  src/test/testAuth.cpp \
  src/test/testSystem.cpp \
+ src/test/testSnapshotCache.cpp \
+ src/test/testHistoryStore.cpp \
+ src/test/testStatusStream.cpp \
+ src/test/testJsonWriter.cpp \
+ src/test/testCborWriter.cpp \
+ src/test/testCgMinerUtils.cpp \
+ src/test/testFirmwareUpload.cpp \
+ src/test/testStaticAssets.cpp \
  src/utils/utils.cpp \
  src/utils/CgMinerUtils.cpp \
+ src/utils/SnapshotCache.cpp \
+ src/utils/HistoryStore.cpp \
+ src/utils/StatusStream.cpp \
+ src/utils/JsonWriter.cpp \
+ src/utils/CborWriter.cpp \
+ src/utils/Sha256.cpp \
+ src/utils/FirmwareUpload.cpp \
+ src/utils/StaticAssets.cpp \
  -lcrypt \
  -lboost_system \
+ -lpthread \
  -o ./bin/test
\ No newline at end of file
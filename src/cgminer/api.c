@@ -11,6 +11,7 @@
 
 #include "config.h"
 #include "obelisk/Ob1API.h"
+#include "obelisk/Ob1Utils.h"
 
 #include <stdio.h>
 #include <ctype.h>
@@ -21,6 +22,10 @@
 #include <unistd.h>
 #include <limits.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "compat.h"
 #include "miner.h"
@@ -273,6 +278,8 @@ static const char *OSINFO =
 #define _SETCONFIG	"SETCONFIG"
 #define _USBSTATS	"USBSTATS"
 #define _LCD		"LCD"
+#define _PROXY		"PROXY"
+#define _LATENCY	"LATENCY"
 
 static const char ISJSON = '{';
 #define JSON0		"{"
@@ -316,6 +323,8 @@ static const char ISJSON = '{';
 #define JSON_SETCONFIG	JSON1 _SETCONFIG JSON2
 #define JSON_USBSTATS	JSON1 _USBSTATS JSON2
 #define JSON_LCD	JSON1 _LCD JSON2
+#define JSON_PROXY	JSON1 _PROXY JSON2
+#define JSON_LATENCY	JSON1 _LATENCY JSON2
 #define JSON_END	JSON4 JSON5
 #define JSON_END_TRUNCATED	JSON4_TRUNCATED JSON5
 #define JSON_BETWEEN_JOIN	","
@@ -446,6 +455,10 @@ static const char *JSON_PARAMETER = "parameter";
 #define MSG_LCD 125
 
 #define MSG_DEPRECATED 126
+#define MSG_SPROXY 127
+#define MSG_NOSPROXY 128
+#define MSG_LATENCY 129
+#define MSG_METRICSJSON 130
 
 enum code_severity {
 	SEVERITY_ERR,
@@ -568,7 +581,7 @@ struct CODES {
  { SEVERITY_SUCC,  MSG_SETCONFIG,PARAM_SET,	"Set config '%s' to %d" },
  { SEVERITY_ERR,   MSG_UNKCON,	PARAM_STR,	"Unknown config '%s'" },
  { SEVERITY_ERR,   MSG_DEPRECATED, PARAM_STR,	"Deprecated config option '%s'" },
- { SEVERITY_ERR,   MSG_INVNUM,	PARAM_BOTH,	"Invalid number (%d) for '%s' range is 0-9999" },
+ { SEVERITY_ERR,   MSG_INVNUM,	PARAM_BOTH,	"Invalid number (%d) for '%s'" },
  { SEVERITY_ERR,   MSG_INVNEG,	PARAM_BOTH,	"Invalid negative number (%d) for '%s'" },
  { SEVERITY_SUCC,  MSG_SETQUOTA,PARAM_SET,	"Set pool '%s' to quota %d'" },
  { SEVERITY_ERR,   MSG_CONPAR,	PARAM_NONE,	"Missing config parameters 'name,N'" },
@@ -615,6 +628,10 @@ struct CODES {
  { SEVERITY_SUCC,  MSG_LCD,	PARAM_NONE,	"LCD" },
  { SEVERITY_SUCC,  MSG_LOCKOK,	PARAM_NONE,	"Lock stats created" },
  { SEVERITY_WARN,  MSG_LOCKDIS,	PARAM_NONE,	"Lock stats not enabled" },
+ { SEVERITY_SUCC,  MSG_SPROXY,	PARAM_NONE,	"Stratum proxy" },
+ { SEVERITY_WARN,  MSG_NOSPROXY,	PARAM_NONE,	"Stratum proxy not enabled" },
+ { SEVERITY_SUCC,  MSG_LATENCY,	PARAM_NONE,	"Latency" },
+ { SEVERITY_ERR,   MSG_METRICSJSON, PARAM_NONE,	"Metrics are only available as plain text" },
  { SEVERITY_FAIL, 0, 0, NULL }
 };
 
@@ -2074,6 +2091,23 @@ static void ascstatus(struct io_data *io_data, int asc, bool isjson, bool precom
 	}
 }
 
+/* p50/p99/max notify to hardware latency in ms for the dashboard */
+static struct api_data *api_add_notify_latency(struct api_data *root, struct latency_hist *total)
+{
+	double p50, p99, max;
+
+	mutex_lock(&latency_lock);
+	p50 = latency_percentile(total, 0.50);
+	p99 = latency_percentile(total, 0.99);
+	max = total->max_ms;
+	mutex_unlock(&latency_lock);
+
+	root = api_add_double(root, "notifyLatencyP50", &p50, true);
+	root = api_add_double(root, "notifyLatencyP99", &p99, true);
+	root = api_add_double(root, "notifyLatencyMax", &max, true);
+	return root;
+}
+
 static void dashboard_ascstatus(struct io_data *io_data, int asc, bool isjson, bool precom)
 {
 	struct api_data *root = NULL;
@@ -2118,6 +2152,7 @@ static void dashboard_ascstatus(struct io_data *io_data, int asc, bool isjson, b
 		root = api_add_mhtotal(root, "totalMhs", &(cgpu->total_mhashes), false);
 		root = api_add_int64(root, "diff1Work", &(cgpu->diff1), false);
 		root = api_add_diff(root, "lastShareDifficulty", &(cgpu->last_share_diff), false);
+		root = api_add_notify_latency(root, &(cgpu->latency[LATENCY_TOTAL]));
 
 		root = print_data(io_data, root, isjson, precom);
 	}
@@ -2666,6 +2701,9 @@ static void poolstatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __m
 				(double)(pool->diff_stale) / (double)(pool->diff_accepted + pool->diff_rejected + pool->diff_stale) : 0;
 		root = api_add_percent(root, "Pool Stale%", &stalep, false);
 		root = api_add_uint64(root, "Bad Work", &(pool->bad_work), true);
+		uint64_t dupchecked, dupshares;
+		sharedupcounters(pool, &dupchecked, &dupshares);
+		root = api_add_uint64(root, "Duplicate Shares", &dupshares, true);
 		root = api_add_uint32(root, "Current Block Height", &(pool->current_height), true);
 		uint32_t nversion = (uint32_t)strtoul(pool->bbversion, NULL, 16);
 		root = api_add_uint32(root, "Current Block Version", &nversion, true);
@@ -2732,7 +2770,11 @@ static void dashboard_poolstatus(struct io_data *io_data, __maybe_unused SOCKETT
 		root = api_add_uint(root, "stale", &(pool->stale_shares), false);
 		root = api_add_time(root, "lastShareTime", &(pool->last_share_time), false);
 		root = api_add_int64(root, "diff1Shares", &(pool->diff1), false);
+		uint64_t dupchecked, dupshares;
+		sharedupcounters(pool, &dupchecked, &dupshares);
+		root = api_add_uint64(root, "duplicateShares", &dupshares, true);
 		root = api_add_uint32(root, "currBlockHeight", &(pool->current_height), true);
+		root = api_add_notify_latency(root, &(pool->latency[LATENCY_TOTAL]));
 
 		root = print_data(io_data, root, isjson, isjson && (i > 0));
 	}
@@ -3386,6 +3428,9 @@ static int itemstats(struct io_data *io_data, int i, char *id, struct cgminer_st
 		root = api_add_uint64(root, "Bytes Recv", &(pool_stats->bytes_received), false);
 		root = api_add_uint64(root, "Net Bytes Sent", &(pool_stats->net_bytes_sent), false);
 		root = api_add_uint64(root, "Net Bytes Recv", &(pool_stats->net_bytes_received), false);
+		root = api_add_uint64(root, "Send Blocked us", &(pool_stats->send_blocked_us), false);
+		root = api_add_uint64(root, "Send Blocked Max us", &(pool_stats->send_blocked_max_us), false);
+		root = api_add_uint64(root, "Recv Blocked us", &(pool_stats->recv_blocked_us), false);
 	}
 
 	if (extra)
@@ -3469,6 +3514,9 @@ static int dashboard_itemstats(struct io_data *io_data, int i, char *id, struct
 		root = api_add_uint64(root, "bytesRecv", &(pool_stats->bytes_received), false);
 		root = api_add_uint64(root, "netBytesSent", &(pool_stats->net_bytes_sent), false);
 		root = api_add_uint64(root, "netBytesRecv", &(pool_stats->net_bytes_received), false);
+		root = api_add_uint64(root, "sendBlockedUs", &(pool_stats->send_blocked_us), false);
+		root = api_add_uint64(root, "sendBlockedMaxUs", &(pool_stats->send_blocked_max_us), false);
+		root = api_add_uint64(root, "recvBlockedUs", &(pool_stats->recv_blocked_us), false);
 	}
 
 	if (extra) {
@@ -3514,6 +3562,9 @@ static int driverstats(struct io_data *io_data, int i, char *id, struct cgminer_
 		root = api_add_uint64(root, "Bytes Recv", &(pool_stats->bytes_received), false);
 		root = api_add_uint64(root, "Net Bytes Sent", &(pool_stats->net_bytes_sent), false);
 		root = api_add_uint64(root, "Net Bytes Recv", &(pool_stats->net_bytes_received), false);
+		root = api_add_uint64(root, "Send Blocked us", &(pool_stats->send_blocked_us), false);
+		root = api_add_uint64(root, "Send Blocked Max us", &(pool_stats->send_blocked_max_us), false);
+		root = api_add_uint64(root, "Recv Blocked us", &(pool_stats->recv_blocked_us), false);
 	}
 
 	if (extra)
@@ -3847,6 +3898,36 @@ static void setconfig(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char
 		} else {
 			applog(LOG_ERR, "Enabling genetic algo");
 		}
+
+	} else if (strcasecmp(paramName, "ob-optimization-mode") == 0) {
+		if (paramValue < OBELISK_OPTIMIZATION_MODE_EFFICIENT || paramValue > OBELISK_OPTIMIZATION_MODE_MAX_HASHRATE) {
+			message(io_data, MSG_INVNUM, paramValue, paramName, isjson);
+			return;
+		}
+		if (paramValue != opt_ob_optimization_mode) {
+			opt_ob_optimization_mode = paramValue;
+			objectiveChanged();
+		}
+		applog(LOG_ERR, "Setting optimization mode to %d", paramValue);
+
+	} else if (strcasecmp(paramName, "ob-power-limit-watts") == 0) {
+		if (paramValue < 0 || paramValue > 9999) {
+			message(io_data, MSG_INVNUM, paramValue, paramName, isjson);
+			return;
+		}
+		if (paramValue != opt_ob_power_limit_watts) {
+			opt_ob_power_limit_watts = paramValue;
+			objectiveChanged();
+		}
+		applog(LOG_ERR, "Setting power limit to %dW", paramValue);
+
+	} else if (strcasecmp(paramName, "ob-disable-chip-tuning") == 0) {
+		opt_ob_disable_chip_tuning = paramValue;
+		if (opt_ob_disable_chip_tuning) {
+			applog(LOG_ERR, "Disabling per-chip tuning");
+		} else {
+			applog(LOG_ERR, "Enabling per-chip tuning");
+		}
 	}
 
 	message(io_data, MSG_UNKCON, 0, param, isjson);
@@ -4364,6 +4445,242 @@ static void lcddata(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __mayb
 		io_close(io_data);
 }
 
+static void proxystatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __maybe_unused char *param, bool isjson, __maybe_unused char group)
+{
+	struct proxy_client_info info[64];
+	struct api_data *root = NULL;
+	uint64_t accepted, rejected;
+	bool io_open;
+	int i, n;
+
+	if (!opt_ob_proxy_port) {
+		message(io_data, MSG_NOSPROXY, 0, NULL, isjson);
+		return;
+	}
+
+	n = proxy_client_info(info, 64);
+	proxy_counters(&accepted, &rejected);
+
+	message(io_data, MSG_SPROXY, 0, NULL, isjson);
+	io_open = io_add(io_data, isjson ? COMSTR JSON_PROXY : _PROXY COMSTR);
+
+	root = api_add_int(root, "Port", &opt_ob_proxy_port, false);
+	root = api_add_int(root, "Clients", &n, true);
+	root = api_add_uint64(root, "Accepted", &accepted, true);
+	root = api_add_uint64(root, "Rejected", &rejected, true);
+	root = print_data(io_data, root, isjson, false);
+
+	for (i = 0; i < n; i++) {
+		root = api_add_int(root, "Slot", &(info[i].slot), true);
+		root = api_add_escape(root, "Address", info[i].addr, true);
+		root = api_add_escape(root, "Worker", info[i].worker, true);
+		root = api_add_escape(root, "Extranonce1", info[i].nonce1, true);
+		root = api_add_time(root, "Connected", &(info[i].connected), true);
+		root = api_add_uint64(root, "Accepted", &(info[i].accepted), true);
+		root = api_add_uint64(root, "Rejected", &(info[i].rejected), true);
+		root = print_data(io_data, root, isjson, isjson);
+	}
+
+	if (isjson && io_open)
+		io_close(io_data);
+}
+
+static struct api_data *api_add_latency(struct api_data *root, struct latency_hist *hist)
+{
+	struct latency_hist copy[LATENCY_STAGES];
+	char buf[64];
+	double ms;
+	int i;
+
+	mutex_lock(&latency_lock);
+	memcpy(copy, hist, sizeof(copy));
+	mutex_unlock(&latency_lock);
+
+	root = api_add_uint64(root, "Samples", &(copy[LATENCY_TOTAL].count), true);
+	for (i = 0; i < LATENCY_STAGES; i++) {
+		snprintf(buf, sizeof(buf), "%s P50", latency_stage_names[i]);
+		ms = latency_percentile(&copy[i], 0.50);
+		root = api_add_double(root, buf, &ms, true);
+		snprintf(buf, sizeof(buf), "%s P99", latency_stage_names[i]);
+		ms = latency_percentile(&copy[i], 0.99);
+		root = api_add_double(root, buf, &ms, true);
+		snprintf(buf, sizeof(buf), "%s Max", latency_stage_names[i]);
+		root = api_add_double(root, buf, &(copy[i].max_ms), true);
+	}
+	return root;
+}
+
+/* Time in ms from a pool notify to the first engine hashing the new job, by
+ * pipeline stage, for each pool and then for each device */
+static void latencystatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __maybe_unused char *param, bool isjson, __maybe_unused char group)
+{
+	struct api_data *root = NULL;
+	bool io_open;
+	bool first = true;
+	int i;
+
+	message(io_data, MSG_LATENCY, 0, NULL, isjson);
+	io_open = io_add(io_data, isjson ? COMSTR JSON_LATENCY : _LATENCY COMSTR);
+
+	for (i = 0; i < total_pools; i++) {
+		struct pool *pool = pools[i];
+
+		if (pool->removed)
+			continue;
+
+		root = api_add_int(root, "POOL", &i, true);
+		root = api_add_escape(root, "URL", pool->rpc_url, false);
+		root = api_add_latency(root, pool->latency);
+		root = print_data(io_data, root, isjson, isjson && !first);
+		first = false;
+	}
+
+	for (i = 0; i < total_devices; i++) {
+		struct cgpu_info *cgpu = get_devices(i);
+
+		root = api_add_int(root, "DEV", &i, true);
+		root = api_add_string(root, "Name", cgpu->drv->name, false);
+		root = api_add_int(root, "ID", &(cgpu->device_id), false);
+		root = api_add_latency(root, cgpu->latency);
+		root = print_data(io_data, root, isjson, isjson && !first);
+		first = false;
+	}
+
+	if (isjson && io_open)
+		io_close(io_data);
+}
+
+// Big enough for every chip on three boards, so it is allocated once up front
+#define METRICS_BUFSIZ 65536
+
+static char metrics_buf[METRICS_BUFSIZ];
+
+static void metrics_append(int *len, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (*len < METRICS_BUFSIZ)
+		*len += vsnprintf(metrics_buf + *len, METRICS_BUFSIZ - *len, fmt, ap);
+	else
+		*len += vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+}
+
+static void metrics_family(int *len, const char *name, const char *type, const char *help)
+{
+	metrics_append(len, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Pool, device and driver counters in the Prometheus text format. The reply
+ * is only the metrics - there is no STATUS section - and they are written
+ * straight into a preallocated buffer rather than going through api_data,
+ * so that frequent scrapes stay cheap */
+static void metricsstatus(struct io_data *io_data, __maybe_unused SOCKETTYPE c, __maybe_unused char *param, bool isjson, __maybe_unused char group)
+{
+	struct latency_hist latency[LATENCY_STAGES];
+	bool drv_done[DRIVER_MAX];
+	int len = 0;
+	int i, j;
+
+	if (isjson) {
+		message(io_data, MSG_METRICSJSON, 0, NULL, isjson);
+		return;
+	}
+
+	metrics_family(&len, "cgminer_pool_accepted_total", "counter", "Shares accepted by each pool.");
+	for (i = 0; i < total_pools; i++)
+		if (!pools[i]->removed)
+			metrics_append(&len, "cgminer_pool_accepted_total{pool=\"%d\"} %"PRId64"\n", i, pools[i]->accepted);
+
+	metrics_family(&len, "cgminer_pool_rejected_total", "counter", "Shares rejected by each pool.");
+	for (i = 0; i < total_pools; i++)
+		if (!pools[i]->removed)
+			metrics_append(&len, "cgminer_pool_rejected_total{pool=\"%d\"} %"PRId64"\n", i, pools[i]->rejected);
+
+	metrics_family(&len, "cgminer_pool_stale_total", "counter", "Stale shares for each pool.");
+	for (i = 0; i < total_pools; i++)
+		if (!pools[i]->removed)
+			metrics_append(&len, "cgminer_pool_stale_total{pool=\"%d\"} %u\n", i, pools[i]->stale_shares);
+
+	metrics_family(&len, "cgminer_pool_difficulty_accepted_total", "counter", "Difficulty of the shares accepted by each pool.");
+	for (i = 0; i < total_pools; i++)
+		if (!pools[i]->removed)
+			metrics_append(&len, "cgminer_pool_difficulty_accepted_total{pool=\"%d\"} %f\n", i, pools[i]->diff_accepted);
+
+	metrics_family(&len, "cgminer_pool_difficulty_rejected_total", "counter", "Difficulty of the shares rejected by each pool.");
+	for (i = 0; i < total_pools; i++)
+		if (!pools[i]->removed)
+			metrics_append(&len, "cgminer_pool_difficulty_rejected_total{pool=\"%d\"} %f\n", i, pools[i]->diff_rejected);
+
+	metrics_family(&len, "cgminer_pool_failures_total", "counter", "Failed work requests and share submissions for each pool.");
+	for (i = 0; i < total_pools; i++) {
+		if (pools[i]->removed)
+			continue;
+		metrics_append(&len, "cgminer_pool_failures_total{pool=\"%d\",kind=\"getwork\"} %u\n", i, pools[i]->getfail_occasions);
+		metrics_append(&len, "cgminer_pool_failures_total{pool=\"%d\",kind=\"remote\"} %u\n", i, pools[i]->remotefail_occasions);
+	}
+
+	metrics_family(&len, "cgminer_pool_up", "gauge", "Whether each pool is alive.");
+	for (i = 0; i < total_pools; i++)
+		if (!pools[i]->removed)
+			metrics_append(&len, "cgminer_pool_up{pool=\"%d\"} %d\n", i, pools[i]->idle ? 0 : 1);
+
+	// See the 'latency' command for what the stages are
+	metrics_family(&len, "cgminer_pool_job_latency_seconds", "summary", "Time from each pool's notify to the first engine hashing the job, by stage.");
+	for (i = 0; i < total_pools; i++) {
+		if (pools[i]->removed)
+			continue;
+		mutex_lock(&latency_lock);
+		memcpy(latency, pools[i]->latency, sizeof(latency));
+		mutex_unlock(&latency_lock);
+		for (j = 0; j < LATENCY_STAGES; j++) {
+			metrics_append(&len, "cgminer_pool_job_latency_seconds{pool=\"%d\",stage=\"%s\",quantile=\"0.5\"} %f\n",
+				       i, latency_stage_names[j], latency_percentile(&latency[j], 0.50) / 1000);
+			metrics_append(&len, "cgminer_pool_job_latency_seconds{pool=\"%d\",stage=\"%s\",quantile=\"0.99\"} %f\n",
+				       i, latency_stage_names[j], latency_percentile(&latency[j], 0.99) / 1000);
+			metrics_append(&len, "cgminer_pool_job_latency_seconds_count{pool=\"%d\",stage=\"%s\"} %"PRIu64"\n",
+				       i, latency_stage_names[j], latency[j].count);
+		}
+	}
+
+	metrics_family(&len, "cgminer_device_accepted_total", "counter", "Shares accepted from each device.");
+	for (i = 0; i < total_devices; i++)
+		metrics_append(&len, "cgminer_device_accepted_total{device=\"%d\"} %"PRId64"\n", i, get_devices(i)->accepted);
+
+	metrics_family(&len, "cgminer_device_rejected_total", "counter", "Shares rejected from each device.");
+	for (i = 0; i < total_devices; i++)
+		metrics_append(&len, "cgminer_device_rejected_total{device=\"%d\"} %"PRId64"\n", i, get_devices(i)->rejected);
+
+	metrics_family(&len, "cgminer_device_hardware_errors_total", "counter", "Hardware errors on each device.");
+	for (i = 0; i < total_devices; i++)
+		metrics_append(&len, "cgminer_device_hardware_errors_total{device=\"%d\"} %d\n", i, get_devices(i)->hw_errors);
+
+	metrics_family(&len, "cgminer_device_megahashes_total", "counter", "Megahashes done by each device.");
+	for (i = 0; i < total_devices; i++)
+		metrics_append(&len, "cgminer_device_megahashes_total{device=\"%d\"} %f\n", i, get_devices(i)->total_mhashes);
+
+	// Then whatever each driver has to add, once for all of its devices
+	memset(drv_done, 0, sizeof(drv_done));
+	for (i = 0; i < total_devices && len < METRICS_BUFSIZ; i++) {
+		struct device_drv *drv = get_devices(i)->drv;
+
+		if (!drv->get_metrics || drv_done[drv->drv_id])
+			continue;
+		drv_done[drv->drv_id] = true;
+		len += drv->get_metrics(metrics_buf + len, METRICS_BUFSIZ - len);
+	}
+
+	if (len >= METRICS_BUFSIZ) {
+		applog(LOG_ERR, "API: metrics need %d bytes, more than the %d allocated", len + 1, METRICS_BUFSIZ);
+		// Don't send half a line, drop back to the last whole one
+		metrics_buf[METRICS_BUFSIZ - 1] = '\0';
+		*(strrchr(metrics_buf, '\n') + 1) = '\0';
+	}
+
+	io_add(io_data, metrics_buf);
+}
+
 static void checkcommand(struct io_data *io_data, __maybe_unused SOCKETTYPE c, char *param, bool isjson, char group);
 
 struct CMDS {
@@ -4424,6 +4741,9 @@ struct CMDS {
 	{ "asccount",		asccount,	false,	true },
 	{ "lcd",		lcddata,	false,	true },
 	{ "lockstats",		lockstats,	true,	true },
+	{ "proxy",		proxystatus,	false,	true },
+	{ "latency",		latencystatus,	false,	true },
+	{ "metrics",		metricsstatus,	false,	false },
 	{ NULL,			NULL,		false,	false }
 };
 
@@ -4508,12 +4828,78 @@ static void tail_join(struct io_data *io_data, bool isjson)
 	}
 }
 
-static void send_result(struct io_data *io_data, SOCKETTYPE c, bool isjson)
+/*
+ * The API server is a single epoll loop, so that a slow or idle client
+ * can't hold up the others. Each connection gets one of API_MAX_CLIENTS
+ * preallocated slots, with its own input buffer and io_data for replies.
+ *
+ * A connection may stay open and send any number of requests, each ended
+ * by a newline. A client that doesn't end its request with a newline must
+ * send it in one write, as before; it is taken as a request as it arrives,
+ * and the connection is closed once the reply has gone, as older clients
+ * read until the socket closes.
+ * Requests are run one at a time on this thread, taking one request from
+ * each ready connection in turn, and a connection's next request is only
+ * looked at once its last reply has gone.
+ */
+#define API_MAX_CLIENTS 16
+#define API_CLIENT_IDLE_SECS 300
+// A reply the client hasn't taken any of for this long is given up on
+#define API_CLIENT_SEND_STALL_SECS 30
+#define API_POLL_MS 1000
+
+struct api_client {
+	SOCKETTYPE sock;	// INVSOCK when the slot is free
+	char group;
+	char *connectaddr;
+	char inbuf[TMPBUFSIZ];
+	size_t inlen;
+	bool framed;		// It has ended a request with a newline
+	bool eof;		// It has finished sending
+	bool failed;
+	bool once;		// Close once the reply has gone
+	uint32_t events;	// What it's registered with epoll for
+	time_t last_active;
+	struct io_data *io_data;
+	size_t outlen;		// Length of the reply to send, including the NUL
+	size_t outsent;
+};
+
+static struct api_client *api_clients = NULL;
+static int api_epoll = -1;
+
+// Send what the socket will take of the pending reply, without blocking
+static void api_client_flush(struct api_client *client)
 {
-	int count, sendc, res, tosend, len, n;
-	char *buf = io_data->ptr;
+	ssize_t n;
 
-	strcpy(buf, io_data->ptr);
+	while (client->outsent < client->outlen) {
+		n = send(client->sock, client->io_data->ptr + client->outsent,
+			 client->outlen - client->outsent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				applog(LOG_WARNING, "API: send to %s failed: %s",
+				       client->connectaddr, SOCKERRMSG);
+				client->failed = true;
+			}
+			return;
+		}
+		client->outsent += n;
+		client->last_active = time(NULL);
+	}
+
+	applog(LOG_DEBUG, "API: sent all of %d", (int)client->outlen);
+	client->outlen = client->outsent = 0;
+}
+
+// Finish the reply in io_data and start sending it. Whatever the socket
+// won't take now goes when it drains.
+static void send_result(struct io_data *io_data, struct api_client *client, bool isjson)
+{
+	char *buf = io_data->ptr;
+	int len;
 
 	if (io_data->close)
 		strcat(buf, JSON_CLOSE);
@@ -4522,58 +4908,31 @@ static void send_result(struct io_data *io_data, SOCKETTYPE c, bool isjson)
 		strcat(buf, JSON_END);
 
 	len = strlen(buf);
-	tosend = len+1;
-
-	applog(LOG_DEBUG, "API: send reply: (%d) '%.10s%s'", tosend, buf, len > 10 ? "..." : BLANK);
-
-	count = sendc = 0;
-	while (count < 5 && tosend > 0) {
-		// allow 50ms per attempt
-		struct timeval timeout = {0, 50000};
-		fd_set wd;
-
-		FD_ZERO(&wd);
-		FD_SET(c, &wd);
-		if ((res = select(c + 1, NULL, &wd, NULL, &timeout)) < 1) {
-			applog(LOG_WARNING, "API: send select failed (%d)", res);
-			return;
-		}
 
-		n = send(c, buf, tosend, 0);
-		sendc++;
+	applog(LOG_DEBUG, "API: send reply: (%d) '%.10s%s'", len+1, buf, len > 10 ? "..." : BLANK);
 
-		if (SOCKETFAIL(n)) {
-			count++;
-			if (sock_blocks())
-				continue;
-
-			applog(LOG_WARNING, "API: send (%d:%d) failed: %s", len+1, (len+1 - tosend), SOCKERRMSG);
-
-			return;
-		} else {
-			if (sendc <= 1) {
-				if (n == tosend)
-					applog(LOG_DEBUG, "API: sent all of %d first go", tosend);
-				else
-					applog(LOG_DEBUG, "API: sent %d of %d first go", n, tosend);
-			} else {
-				if (n == tosend)
-					applog(LOG_DEBUG, "API: sent all of remaining %d (sendc=%d)", tosend, sendc);
-				else
-					applog(LOG_DEBUG, "API: sent %d of remaining %d (sendc=%d)", n, tosend, sendc);
-			}
+	client->outlen = len + 1;
+	client->outsent = 0;
+	api_client_flush(client);
+}
 
-			tosend -= n;
-			buf += n;
+static void api_client_close(struct api_client *client)
+{
+	if (client->sock == INVSOCK)
+		return;
 
-			if (n == 0)
-				count++;
-		}
-	}
+	applog(LOG_DEBUG, "API: closing connection from %s", client->connectaddr);
+	shutdown(client->sock, SHUT_RDWR);
+	CLOSESOCKET(client->sock);
+	client->sock = INVSOCK;
+	free(client->connectaddr);
+	client->connectaddr = NULL;
 }
 
 static void tidyup(__maybe_unused void *arg)
 {
+	int i;
+
 	mutex_lock(&quit_restart_lock);
 
 	SOCKETTYPE *apisock = (SOCKETTYPE *)arg;
@@ -4586,6 +4945,18 @@ static void tidyup(__maybe_unused void *arg)
 		*apisock = INVSOCK;
 	}
 
+	if (api_clients != NULL) {
+		for (i = 0; i < API_MAX_CLIENTS; i++)
+			api_client_close(&api_clients[i]);
+		free(api_clients);
+		api_clients = NULL;
+	}
+
+	if (api_epoll >= 0) {
+		close(api_epoll);
+		api_epoll = -1;
+	}
+
 	if (ipaccess != NULL) {
 		free(ipaccess);
 		ipaccess = NULL;
@@ -5172,39 +5543,358 @@ void mcast_init()
 		quit(1, "API mcast thread create failed");
 }
 
-void api(int api_thr_id)
+// Run one request from a client and queue its reply
+static void api_process(struct api_client *client, char *buf, int n)
 {
-	struct io_data *io_data;
-	struct thr_info bye_thr;
-	char buf[TMPBUFSIZ];
+	struct io_data *io_data = client->io_data;
+	SOCKETTYPE c = client->sock;
+	char group = client->group;
+	char *connectaddr = client->connectaddr;
 	char param_buf[TMPBUFSIZ];
-	SOCKETTYPE c;
-	int n, bound;
-	char *connectaddr;
-	char *binderror;
-	time_t bindstart;
-	short int port = opt_api_port;
-	char port_s[10];
-	struct sockaddr_storage cli;
-	socklen_t clisiz;
 	char cmdbuf[100];
 	char *cmd = NULL;
 	char *param;
-	bool addrok;
-	char group;
 	json_error_t json_err;
 	json_t *json_config;
 	json_t *json_val;
 	bool isjson;
 	bool did, isjoin, firstjoin;
 	int i;
+
+	json_config = NULL;
+	isjoin = false;
+
+	if (opt_debug)
+		applog(LOG_DEBUG, "API: recv command: (%d) '%s'", n, buf);
+
+	// the time of the request in now
+	when = time(NULL);
+	io_reinit(io_data);
+
+	did = false;
+
+	if (*buf != ISJSON) {
+		isjson = false;
+
+		// A plain command may come newline terminated
+		buf[strcspn(buf, "\r\n")] = '\0';
+
+		param = strchr(buf, SEPARATOR);
+		if (param != NULL)
+			*(param++) = '\0';
+
+		cmd = buf;
+	}
+	else {
+		isjson = true;
+
+		param = NULL;
+
+		json_config = json_loadb(buf, n, 0, &json_err);
+
+		if (!json_is_object(json_config)) {
+			message(io_data, MSG_INVJSON, 0, NULL, isjson);
+			send_result(io_data, client, isjson);
+			did = true;
+		} else {
+			json_val = json_object_get(json_config, JSON_COMMAND);
+			if (json_val == NULL) {
+				message(io_data, MSG_MISCMD, 0, NULL, isjson);
+				send_result(io_data, client, isjson);
+				did = true;
+			} else {
+				if (!json_is_string(json_val)) {
+					message(io_data, MSG_INVCMD, 0, NULL, isjson);
+					send_result(io_data, client, isjson);
+					did = true;
+				} else {
+					cmd = (char *)json_string_value(json_val);
+					json_val = json_object_get(json_config, JSON_PARAMETER);
+					if (json_is_string(json_val))
+						param = (char *)json_string_value(json_val);
+					else if (json_is_integer(json_val)) {
+						sprintf(param_buf, "%d", (int)json_integer_value(json_val));
+						param = param_buf;
+					} else if (json_is_real(json_val)) {
+						sprintf(param_buf, "%f", (double)json_real_value(json_val));
+						param = param_buf;
+					}
+				}
+			}
+		}
+	}
+
+	if (!did) {
+		char *cmdptr, *cmdsbuf = NULL;
+
+		if (strchr(cmd, CMDJOIN)) {
+			firstjoin = isjoin = true;
+			// cmd + leading+tailing '|' + '\0'
+			cmdsbuf = cgmalloc(strlen(cmd) + 3);
+			strcpy(cmdsbuf, "|");
+			param = NULL;
+		} else
+			firstjoin = isjoin = false;
+
+		cmdptr = cmd;
+		do {
+			did = false;
+			if (isjoin) {
+				cmd = strchr(cmdptr, CMDJOIN);
+				if (cmd)
+					*(cmd++) = '\0';
+				if (!*cmdptr)
+					goto inochi;
+			}
+
+			for (i = 0; cmds[i].name != NULL; i++) {
+				if (strcmp(cmdptr, cmds[i].name) == 0) {
+					sprintf(cmdbuf, "|%s|", cmdptr);
+					if (isjoin) {
+						if (strstr(cmdsbuf, cmdbuf)) {
+							did = true;
+							break;
+						}
+						strcat(cmdsbuf, cmdptr);
+						strcat(cmdsbuf, "|");
+						head_join(io_data, cmdptr, isjson, &firstjoin);
+						if (!cmds[i].joinable) {
+							message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
+							did = true;
+							tail_join(io_data, isjson);
+							break;
+						}
+					}
+					if (ISPRIVGROUP(group) || strstr(COMMANDS(group), cmdbuf))
+						// Call the actual API function
+						(cmds[i].func)(io_data, c, param, isjson, group);
+					else {
+						message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
+						applog(LOG_DEBUG, "API: access denied to '%s' for '%s' command", connectaddr, cmds[i].name);
+					}
+
+					did = true;
+					if (!isjoin)
+						send_result(io_data, client, isjson);
+					else
+						tail_join(io_data, isjson);
+					break;
+				}
+			}
+
+			if (!did) {
+				if (isjoin)
+					head_join(io_data, cmdptr, isjson, &firstjoin);
+				message(io_data, MSG_INVCMD, 0, NULL, isjson);
+				if (isjoin)
+					tail_join(io_data, isjson);
+				else
+					send_result(io_data, client, isjson);
+			}
+inochi:
+			if (isjoin)
+				cmdptr = cmd;
+		} while (isjoin && cmdptr);
+
+		free(cmdsbuf);
+	}
+
+	if (isjoin)
+		send_result(io_data, client, isjson);
+
+	if (isjson && json_is_object(json_config))
+		json_decref(json_config);
+}
+
+// Read what the client has sent, up to what its input buffer holds
+static void api_client_read(struct api_client *client)
+{
+	ssize_t n;
+
+	while (!client->eof && client->inlen < sizeof(client->inbuf) - 1) {
+		n = recv(client->sock, client->inbuf + client->inlen,
+			 sizeof(client->inbuf) - 1 - client->inlen, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				applog(LOG_DEBUG, "API: recv from %s failed: %s",
+				       client->connectaddr, SOCKERRMSG);
+				client->failed = true;
+			}
+			return;
+		}
+		if (n == 0)
+			client->eof = true;
+		else {
+			client->inlen += n;
+			client->last_active = time(NULL);
+		}
+	}
+}
+
+/*
+ * Find the client's next whole request: up to a newline or, for a client
+ * that hasn't used newlines, everything it has sent (a JSON request only
+ * once it parses, in case it came in pieces). Sets *len to the request's
+ * length and *used to the input it takes up.
+ */
+static bool api_client_next(struct api_client *client, size_t *len, size_t *used)
+{
+	char *nl;
+	json_error_t json_err;
+	json_t *json;
+	bool full;
+
+	nl = memchr(client->inbuf, '\n', client->inlen);
+	if (nl) {
+		client->framed = true;
+		*len = nl - client->inbuf;
+		*used = *len + 1;
+		if (*len > 0 && client->inbuf[*len - 1] == '\r')
+			(*len)--;
+		return true;
+	}
+
+	if (client->inlen == 0)
+		return false;
+
+	full = client->inlen >= sizeof(client->inbuf) - 1;
+	if (!client->eof && !full) {
+		if (client->framed)
+			return false;
+		if (*client->inbuf == ISJSON) {
+			json = json_loadb(client->inbuf, client->inlen, 0, &json_err);
+			if (!json)
+				return false;
+			json_decref(json);
+		}
+	}
+
+	*len = *used = client->inlen;
+	return true;
+}
+
+// Only read while there's room for more input, and only wait to write
+// while a reply is waiting to go
+static void api_client_watch(struct api_client *client)
+{
+	struct epoll_event ev;
+	uint32_t events = 0;
+
+	if (!client->eof && client->inlen < sizeof(client->inbuf) - 1)
+		events |= EPOLLIN;
+	if (client->outlen)
+		events |= EPOLLOUT;
+
+	if (events == client->events)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = client;
+	if (epoll_ctl(api_epoll, EPOLL_CTL_MOD, client->sock, &ev) != 0)
+		client->failed = true;
+	client->events = events;
+}
+
+// Take every waiting connection. Returns false if the socket has failed.
+static bool api_accept(SOCKETTYPE apisock)
+{
+	struct sockaddr_storage cli;
+	socklen_t clisiz;
+	struct api_client *client;
+	struct epoll_event ev;
+	char *connectaddr;
+	char group;
+	SOCKETTYPE c;
+	bool addrok;
+	int i;
+
+	while (true) {
+		clisiz = sizeof(cli);
+		c = accept(apisock, (struct sockaddr *)(&cli), &clisiz);
+		if (SOCKETFAIL(c)) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			applog(LOG_ERR, "API failed (%s)%s (%d)", SOCKERRMSG, UNAVAILABLE, (int)apisock);
+			// Out of descriptors or memory is worth waiting out
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				cgsleep_ms(100);
+				return true;
+			}
+			return false;
+		}
+
+		addrok = check_connect(&cli, &connectaddr, &group);
+		applog(LOG_DEBUG, "API: connection from %s - %s",
+					connectaddr, addrok ? "Accepted" : "Ignored");
+
+		client = NULL;
+		if (addrok) {
+			for (i = 0; i < API_MAX_CLIENTS; i++) {
+				if (api_clients[i].sock == INVSOCK) {
+					client = &api_clients[i];
+					break;
+				}
+			}
+			if (!client)
+				applog(LOG_WARNING, "API: too many connections, dropping %s", connectaddr);
+		}
+
+		if (client && fcntl(c, F_SETFL, fcntl(c, F_GETFL, 0) | O_NONBLOCK) == 0) {
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = client;
+			if (epoll_ctl(api_epoll, EPOLL_CTL_ADD, c, &ev) != 0) {
+				applog(LOG_WARNING, "API: epoll add failed: %s", SOCKERRMSG);
+				client = NULL;
+			}
+		} else
+			client = NULL;
+
+		if (!client) {
+			CLOSESOCKET(c);
+			free(connectaddr);
+			continue;
+		}
+
+		client->sock = c;
+		client->group = group;
+		client->connectaddr = connectaddr;
+		client->inlen = 0;
+		client->framed = false;
+		client->eof = false;
+		client->failed = false;
+		client->once = false;
+		client->events = EPOLLIN;
+		client->last_active = time(NULL);
+		client->outlen = client->outsent = 0;
+		io_reinit(client->io_data);
+	}
+}
+
+void api(int api_thr_id)
+{
+	struct thr_info bye_thr;
+	struct api_client *client;
+	struct epoll_event ev, events[API_MAX_CLIENTS + 1];
+	char buf[TMPBUFSIZ];
+	int bound, nev, next;
+	char *binderror;
+	time_t bindstart, now;
+	short int port = opt_api_port;
+	char port_s[10];
+	size_t len, used;
+	bool waiting;
+	int i, j;
 	struct addrinfo hints, *res, *host;
 	SOCKETTYPE *apisock;
 
 	apisock = cgmalloc(sizeof(*apisock));
 	*apisock = INVSOCK;
-	json_config = NULL;
-	isjoin = false;
 
 	if (!opt_api_listen) {
 		applog(LOG_DEBUG, "API not running%s", UNAVAILABLE);
@@ -5212,8 +5902,6 @@ void api(int api_thr_id)
 		return;
 	}
 
-	io_data = sock_io_new();
-
 	mutex_init(&quit_restart_lock);
 
 	pthread_cleanup_push(tidyup, (void *)apisock);
@@ -5316,167 +6004,106 @@ void api(int api_thr_id)
 
 	strbufs = k_new_list("StrBufs", sizeof(SBITEM), ALLOC_SBITEMS, LIMIT_SBITEMS, false);
 
-	while (!bye) {
-		clisiz = sizeof(cli);
-		if (SOCKETFAIL(c = accept(*apisock, (struct sockaddr *)(&cli), &clisiz))) {
-			applog(LOG_ERR, "API failed (%s)%s (%d)", SOCKERRMSG, UNAVAILABLE, (int)*apisock);
-			goto die;
-		}
-
-		addrok = check_connect((struct sockaddr_storage *)&cli, &connectaddr, &group);
-		applog(LOG_DEBUG, "API: connection from %s - %s",
-					connectaddr, addrok ? "Accepted" : "Ignored");
+	api_clients = cgcalloc(API_MAX_CLIENTS, sizeof(*api_clients));
+	for (i = 0; i < API_MAX_CLIENTS; i++) {
+		api_clients[i].sock = INVSOCK;
+		api_clients[i].io_data = sock_io_new();
+	}
 
-		if (addrok) {
-			n = recv(c, &buf[0], TMPBUFSIZ-1, 0);
-			if (SOCKETFAIL(n))
-				buf[0] = '\0';
-			else
-				buf[n] = '\0';
+	api_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (api_epoll < 0 || fcntl(*apisock, F_SETFL, fcntl(*apisock, F_GETFL, 0) | O_NONBLOCK) != 0) {
+		applog(LOG_ERR, "API epoll initialisation failed (%s)%s", SOCKERRMSG, UNAVAILABLE);
+		goto die;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(api_epoll, EPOLL_CTL_ADD, *apisock, &ev) != 0) {
+		applog(LOG_ERR, "API epoll initialisation failed (%s)%s", SOCKERRMSG, UNAVAILABLE);
+		goto die;
+	}
 
-			if (opt_debug) {
-				if (SOCKETFAIL(n))
-					applog(LOG_DEBUG, "API: recv failed: %s", SOCKERRMSG);
-				else
-					applog(LOG_DEBUG, "API: recv command: (%d) '%s'", n, buf);
+	next = 0;
+	while (!bye) {
+		// Don't wait if a request is already in hand
+		waiting = false;
+		for (i = 0; i < API_MAX_CLIENTS; i++) {
+			client = &api_clients[i];
+			if (client->sock != INVSOCK && !client->outlen &&
+			    api_client_next(client, &len, &used)) {
+				waiting = true;
+				break;
 			}
+		}
 
-			if (!SOCKETFAIL(n)) {
-				// the time of the request in now
-				when = time(NULL);
-				io_reinit(io_data);
-
-				did = false;
-
-				if (*buf != ISJSON) {
-					isjson = false;
-
-					param = strchr(buf, SEPARATOR);
-					if (param != NULL)
-						*(param++) = '\0';
-
-					cmd = buf;
-				}
-				else {
-					isjson = true;
-
-					param = NULL;
+		nev = epoll_wait(api_epoll, events, API_MAX_CLIENTS + 1, waiting ? 0 : API_POLL_MS);
+		if (nev < 0) {
+			if (errno == EINTR)
+				continue;
+			applog(LOG_ERR, "API epoll failed (%s)%s", SOCKERRMSG, UNAVAILABLE);
+			goto die;
+		}
 
-					json_config = json_loadb(buf, n, 0, &json_err);
+		for (i = 0; i < nev; i++) {
+			client = events[i].data.ptr;
+			if (client == NULL) {
+				if (!api_accept(*apisock))
+					goto die;
+				continue;
+			}
+			if (client->sock == INVSOCK)
+				continue;
+			if (events[i].events & EPOLLOUT)
+				api_client_flush(client);
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				api_client_read(client);
+		}
 
-					if (!json_is_object(json_config)) {
-						message(io_data, MSG_INVJSON, 0, NULL, isjson);
-						send_result(io_data, c, isjson);
-						did = true;
-					} else {
-						json_val = json_object_get(json_config, JSON_COMMAND);
-						if (json_val == NULL) {
-							message(io_data, MSG_MISCMD, 0, NULL, isjson);
-							send_result(io_data, c, isjson);
-							did = true;
-						} else {
-							if (!json_is_string(json_val)) {
-								message(io_data, MSG_INVCMD, 0, NULL, isjson);
-								send_result(io_data, c, isjson);
-								did = true;
-							} else {
-								cmd = (char *)json_string_value(json_val);
-								json_val = json_object_get(json_config, JSON_PARAMETER);
-								if (json_is_string(json_val))
-									param = (char *)json_string_value(json_val);
-								else if (json_is_integer(json_val)) {
-									sprintf(param_buf, "%d", (int)json_integer_value(json_val));
-									param = param_buf;
-								} else if (json_is_real(json_val)) {
-									sprintf(param_buf, "%f", (double)json_real_value(json_val));
-									param = param_buf;
-								}
-							}
-						}
-					}
-				}
+		// One request from each client in turn, so none of them can
+		// keep the others waiting
+		for (j = 0; j < API_MAX_CLIENTS && !bye; j++) {
+			client = &api_clients[(next + j) % API_MAX_CLIENTS];
+			if (client->sock == INVSOCK || client->failed || client->outlen)
+				continue;
+			if (!api_client_next(client, &len, &used))
+				continue;
 
-				if (!did) {
-					char *cmdptr, *cmdsbuf = NULL;
-
-					if (strchr(cmd, CMDJOIN)) {
-						firstjoin = isjoin = true;
-						// cmd + leading+tailing '|' + '\0'
-						cmdsbuf = cgmalloc(strlen(cmd) + 3);
-						strcpy(cmdsbuf, "|");
-						param = NULL;
-					} else
-						firstjoin = isjoin = false;
-
-					cmdptr = cmd;
-					do {
-						did = false;
-						if (isjoin) {
-							cmd = strchr(cmdptr, CMDJOIN);
-							if (cmd)
-								*(cmd++) = '\0';
-							if (!*cmdptr)
-								goto inochi;
-						}
+			memcpy(buf, client->inbuf, len);
+			buf[len] = '\0';
+			client->inlen -= used;
+			memmove(client->inbuf, client->inbuf + used, client->inlen);
+			client->once = !client->framed;
 
-						for (i = 0; cmds[i].name != NULL; i++) {
-							if (strcmp(cmdptr, cmds[i].name) == 0) {
-								sprintf(cmdbuf, "|%s|", cmdptr);
-								if (isjoin) {
-									if (strstr(cmdsbuf, cmdbuf)) {
-										did = true;
-										break;
-									}
-									strcat(cmdsbuf, cmdptr);
-									strcat(cmdsbuf, "|");
-									head_join(io_data, cmdptr, isjson, &firstjoin);
-									if (!cmds[i].joinable) {
-										message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
-										did = true;
-										tail_join(io_data, isjson);
-										break;
-									}
-								}
-								if (ISPRIVGROUP(group) || strstr(COMMANDS(group), cmdbuf))
-  								// Call the actual API function
-									(cmds[i].func)(io_data, c, param, isjson, group);
-								else {
-									message(io_data, MSG_ACCDENY, 0, cmds[i].name, isjson);
-									applog(LOG_DEBUG, "API: access denied to '%s' for '%s' command", connectaddr, cmds[i].name);
-								}
-
-								did = true;
-								if (!isjoin)
-									send_result(io_data, c, isjson);
-								else
-									tail_join(io_data, isjson);
-								break;
-							}
-						}
+			if (len > 0)
+				api_process(client, buf, (int)len);
+		}
+		next = (next + 1) % API_MAX_CLIENTS;
 
-						if (!did) {
-							if (isjoin)
-								head_join(io_data, cmdptr, isjson, &firstjoin);
-							message(io_data, MSG_INVCMD, 0, NULL, isjson);
-							if (isjoin)
-								tail_join(io_data, isjson);
-							else
-								send_result(io_data, c, isjson);
-						}
-inochi:
-						if (isjoin)
-							cmdptr = cmd;
-					} while (isjoin && cmdptr);
-				}
+		now = time(NULL);
+		for (i = 0; i < API_MAX_CLIENTS; i++) {
+			client = &api_clients[i];
+			if (client->sock == INVSOCK)
+				continue;
+			if (client->failed ||
+			    (client->eof && !client->outlen && !client->inlen) ||
+			    (client->once && !client->outlen) ||
+			    (!client->outlen && now - client->last_active > API_CLIENT_IDLE_SECS) ||
+			    (client->outlen && now - client->last_active > API_CLIENT_SEND_STALL_SECS))
+				api_client_close(client);
+			else
+				api_client_watch(client);
+		}
+	}
 
-				if (isjoin)
-					send_result(io_data, c, isjson);
+	// Let the reply to a quit or restart go before the connections close
+	for (i = 0; i < API_MAX_CLIENTS; i++) {
+		client = &api_clients[i];
+		for (j = 0; j < 5 && client->sock != INVSOCK && !client->failed && client->outlen; j++) {
+			struct pollfd pfd = { client->sock, POLLOUT, 0 };
 
-				if (isjson && json_is_object(json_config))
-					json_decref(json_config);
-			}
+			if (poll(&pfd, 1, 50) > 0)
+				api_client_flush(client);
 		}
-		CLOSESOCKET(c);
 	}
 die:
 	/* Blank line fix for older compilers since pthread_cleanup_pop is a
@@ -368,6 +368,19 @@ int opt_ob_max_hot_chip_temp_c = 105;
 int opt_ob_optimization_mode = OBELISK_OPTIMIZATION_MODE_MAX_HASHRATE;
 int opt_ob_reboot_min_hashrate = 150;  // DCR1 should be higher - user can override
 int opt_ob_disable_genetic_algo = false;
+int opt_ob_disable_chip_tuning = false;
+int opt_ob_tune_accept_confidence = 95;
+int opt_ob_tune_reject_confidence = 95;
+float opt_ob_fan_kp = 5.0;
+float opt_ob_fan_ki = 0.05;
+float opt_ob_fan_kd = 0.0;
+float opt_ob_fan_kff = 0.5;
+int opt_ob_power_limit_watts = 0;
+int opt_ob_dup_share_window = 600;
+int opt_ob_target_share_rate = 6;
+int opt_ob_proxy_port = 0;
+int opt_ob_proxy_batch_ms = 50;
+bool opt_ob_low_latency = false;
 
 #if defined(USE_BITFORCE)
 bool opt_bfl_noncerange;
@@ -399,6 +412,7 @@ pthread_mutex_t lockstat_lock;
 #endif
 
 pthread_mutex_t hash_lock;
+pthread_mutex_t latency_lock;
 static pthread_mutex_t* stgd_lock;
 pthread_mutex_t console_lock;
 cglock_t ch_lock;
@@ -444,7 +458,7 @@ static struct pool* currentpool = NULL;
 int total_pools, enabled_pools;
 enum pool_strategy pool_strategy = POOL_FAILOVER;
 int opt_rotate_period;
-static int total_urls, total_users, total_passes, total_userpasses;
+static int total_urls, total_users, total_passes, total_userpasses, total_pool_diffs;
 
 static
 #ifndef HAVE_CURSES
@@ -854,6 +868,11 @@ static char* set_int_0_to_9999(const char* arg, int* i)
     return set_int_range(arg, i, 0, 9999);
 }
 
+static char* set_int_0_to_2(const char* arg, int* i)
+{
+    return set_int_range(arg, i, 0, 2);
+}
+
 static char* set_int_1_to_65535(const char* arg, int* i)
 {
     return set_int_range(arg, i, 1, 65535);
@@ -1114,6 +1133,20 @@ static char* set_userpass(const char* arg)
     return NULL;
 }
 
+static char* set_pool_diff(const char* arg)
+{
+    struct pool* pool;
+
+    total_pool_diffs++;
+    if (total_pool_diffs > total_pools)
+        add_pool();
+
+    pool = pools[total_pool_diffs - 1];
+    pool->fixed_diff = atof(arg);
+
+    return NULL;
+}
+
 static char* enable_debug(bool* flag)
 {
     *flag = true;
@@ -1847,18 +1880,57 @@ static struct opt_table opt_config_table[] = {
     OPT_WITH_ARG("--ob-min-fan-speed-percent",
         opt_set_intval, NULL, &opt_ob_min_fan_speed_percent,
         "Maximum fan speed in percent: 10-100, default: 10"),
+    OPT_WITH_ARG("--ob-fan-kp",
+        opt_set_floatval, NULL, &opt_ob_fan_kp,
+        "Fan percent added per degree C the hottest chip is above its ideal temperature, default: 5"),
+    OPT_WITH_ARG("--ob-fan-ki",
+        opt_set_floatval, NULL, &opt_ob_fan_ki,
+        "Fan percent added per degree C second the hottest chip has spent above its ideal temperature, default: 0.05"),
+    OPT_WITH_ARG("--ob-fan-kd",
+        opt_set_floatval, NULL, &opt_ob_fan_kd,
+        "Fan percent added per degree C per second the hottest chip is heating up, default: 0"),
+    OPT_WITH_ARG("--ob-fan-kff",
+        opt_set_floatval, NULL, &opt_ob_fan_kff,
+        "Fan percent added per percent more power the strings are set to draw, default: 0.5"),
     OPT_WITH_ARG("--ob-max-hot-chip-temp-c",
         opt_set_intval, NULL, &opt_ob_max_hot_chip_temp_c,
         "Maximum temperature for the hottest chip in the board (in degrees C), default: 105"),
     OPT_WITH_ARG("--ob-optimization-mode",
-        opt_set_intval, NULL, &opt_ob_optimization_mode,
-        "Optimization mode: 0=Max hashrate, 1=Balanced, 2=Efficient, default: 0"),
+        set_int_0_to_2, NULL, &opt_ob_optimization_mode,
+        "Optimization mode: 0=Efficient (hashes per watt), 1=Balanced, 2=Max hashrate, default: 2"),
+    OPT_WITH_ARG("--ob-power-limit-watts",
+        set_int_0_to_9999, NULL, &opt_ob_power_limit_watts,
+        "Estimated power the hashing strings may draw in total, 0 for no limit, default: 0"),
     OPT_WITH_ARG("--ob-reboot-min-hashrate",
         opt_set_intval, NULL, &opt_ob_reboot_min_hashrate,
         "Min. hashrate in GH/s below which to reboot the miner (measured per board), default: 300 for DCR1, 150 for SC1"),
     OPT_WITH_ARG("--ob-disable-genetic-algo",
         opt_set_intval, NULL, &opt_ob_disable_genetic_algo,
         "Disable attempts to optimize hashrate with the built-in genetic algo, default: 0"),
+    OPT_WITH_ARG("--ob-disable-chip-tuning",
+        opt_set_intval, NULL, &opt_ob_disable_chip_tuning,
+        "Disable tuning the clock of each chip from its own nonce yield, leaving chip biases to the genetic algo, default: 0"),
+    OPT_WITH_ARG("--ob-tune-accept-confidence",
+        opt_set_intval, NULL, &opt_ob_tune_accept_confidence,
+        "Confidence in percent needed to keep a genetic algo child before its evaluation period ends, 0 to disable, default: 95"),
+    OPT_WITH_ARG("--ob-tune-reject-confidence",
+        opt_set_intval, NULL, &opt_ob_tune_reject_confidence,
+        "Confidence in percent needed to drop a genetic algo child before its evaluation period ends, 0 to disable, default: 95"),
+    OPT_WITH_ARG("--ob-dup-share-window",
+        opt_set_intval, NULL, &opt_ob_dup_share_window,
+        "Seconds to remember submitted shares when filtering duplicates, 0 to disable, default: 600"),
+    OPT_WITH_ARG("--ob-target-share-rate",
+        opt_set_intval, NULL, &opt_ob_target_share_rate,
+        "Shares per minute to aim for when suggesting a difficulty to the pool, 0 to disable, default: 6"),
+    OPT_WITHOUT_ARG("--ob-low-latency",
+        opt_set_bool, &opt_ob_low_latency,
+        "Detect dead pool connections faster and read all pool sockets from one epoll thread"),
+    OPT_WITH_ARG("--ob-proxy-port",
+        opt_set_intval, NULL, &opt_ob_proxy_port,
+        "Port to serve other miners from the current pool's stratum session on, 0 to disable, default: 0"),
+    OPT_WITH_ARG("--ob-proxy-batch-ms",
+        opt_set_intval, NULL, &opt_ob_proxy_batch_ms,
+        "Milliseconds to collect proxied shares before sending them to the pool together, default: 50"),
 
 #ifdef USE_BITFURY
     OPT_WITH_ARG("--osm-led-mode",
@@ -1871,6 +1943,9 @@ static struct opt_table opt_config_table[] = {
     OPT_WITHOUT_ARG("--per-device-stats",
         opt_set_bool, &want_per_device_stats,
         "Force verbose mode and output per-device statistics"),
+    OPT_WITH_ARG("--pool-diff",
+        set_pool_diff, NULL, &opt_set_null,
+        "Share difficulty to ask each pool for in order, 0 to pick from the hashrate, -1 for none"),
     OPT_WITH_ARG("--pools",
         opt_set_bool, NULL, &opt_set_null, opt_hidden),
     OPT_WITHOUT_ARG("--protocol-dump|-P",
@@ -2330,6 +2405,47 @@ int get_total_work(void)
     return ret;
 }
 
+const char* latency_stage_names[LATENCY_STAGES] = {
+    "Generate", "Staged", "Queued", "Load", "Start", "Total"
+};
+
+/* Drivers call this when work first starts hashing on the hardware, having
+ * stamped work->tv_buffered and work->tv_loaded on the way. Only the first
+ * work from each notify is counted per device, so the samples show how long
+ * a new job takes to reach the chips. */
+void work_latency_record(struct cgpu_info* cgpu, struct work* work)
+{
+    struct pool* pool = work->pool;
+    double ms[LATENCY_STAGES];
+    cgtimer_t now;
+    int i;
+
+    if (!pool || !work->notify_seq)
+        return;
+
+    mutex_lock(&latency_lock);
+    if (cgpu->latency_pool == pool && cgpu->latency_seq == work->notify_seq) {
+        mutex_unlock(&latency_lock);
+        return;
+    }
+    cgpu->latency_pool = pool;
+    cgpu->latency_seq = work->notify_seq;
+
+    cgtimer_time(&now);
+    ms[LATENCY_GENERATE] = cgtimer_ms_diff(&work->tv_generated, &work->tv_notify);
+    ms[LATENCY_STAGED] = cgtimer_ms_diff(&work->tv_dispatched, &work->tv_generated);
+    ms[LATENCY_QUEUED] = cgtimer_ms_diff(&work->tv_buffered, &work->tv_dispatched);
+    ms[LATENCY_LOAD] = cgtimer_ms_diff(&work->tv_loaded, &work->tv_buffered);
+    ms[LATENCY_START] = cgtimer_ms_diff(&now, &work->tv_loaded);
+    ms[LATENCY_TOTAL] = cgtimer_ms_diff(&now, &work->tv_notify);
+
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        latency_add(&cgpu->latency[i], ms[i]);
+        latency_add(&pool->latency[i], ms[i]);
+    }
+    mutex_unlock(&latency_lock);
+}
+
 static struct work* make_work(void)
 {
     struct work* work = cgcalloc(1, sizeof(struct work));
@@ -6419,6 +6535,23 @@ static bool parse_stratum_response(struct pool* pool, char* s)
 
     id = json_integer_value(id_val);
 
+    /* Share forwarded for a miner behind our stratum proxy */
+    if (proxy_share_result(pool, id, res_val, err_val)) {
+        ret = true;
+        goto out;
+    }
+
+    /* Not a share, but the reply to our mining.suggest_difficulty */
+    if (pool->suggest_diff_id && id == pool->suggest_diff_id) {
+        pool->suggest_diff_id = 0;
+        if (!res_val || json_is_false(res_val) || (err_val && !json_is_null(err_val))) {
+            applog(LOG_NOTICE, "Pool %d does not support suggesting a difficulty", pool->pool_no);
+            pool->suggest_diff_unsupported = true;
+        }
+        ret = true;
+        goto out;
+    }
+
     mutex_lock(&sshare_lock);
     HASH_FIND_INT(stratum_shares, &id, sshare);
     if (sshare) {
@@ -6593,6 +6726,29 @@ static bool supports_resume(struct pool* pool)
     return ret;
 }
 
+/* Act on one message from the pool's stratum connection, and free it */
+void stratum_parse(struct pool* pool, char* s)
+{
+    /* Check this pool hasn't died while being a backup pool and
+	 * has not had its idle flag cleared */
+    stratum_resumed(pool);
+
+    if (!parse_method(pool, s) && !parse_stratum_response(pool, s))
+        applog(LOG_INFO, "Unknown stratum msg: %s", s);
+    else if (pool->swork.clean) {
+        struct work* work = make_work();
+
+        /* Generate a single work item to update the current
+		 * block database */
+        gen_stratum_work(pool, work);
+        /* Return value doesn't matter. We're just informing
+		 * that we may need to restart. */
+        test_work_current(work);
+        free_work(work);
+    }
+    free(s);
+}
+
 /* One stratum receive thread per pool that has stratum waits on the socket
  * checking for new messages and for the integrity of the socket connection. We
  * reset the connection based on the integrity of the receive side only as the
@@ -6608,10 +6764,8 @@ static void* stratum_rthread(void* userdata)
     RenameThread(threadname);
 
     while (42) {
-        struct timeval timeout;
-        int sel_ret;
-        fd_set rd;
         char* s;
+        int poll;
 
         if (unlikely(pool->removed)) {
             suspend_stratum(pool);
@@ -6635,17 +6789,20 @@ static void* stratum_rthread(void* userdata)
             }
         }
 
-        FD_ZERO(&rd);
-        FD_SET(pool->sock, &rd);
-        timeout.tv_sec = 90;
-        timeout.tv_usec = 0;
-
         /* The protocol specifies that notify messages should be sent
 		 * every minute so if we fail to receive any for 90 seconds we
 		 * assume the connection has been dropped and treat this pool
-		 * as dead */
-        if (!sock_full(pool) && (sel_ret = select(pool->sock + 1, &rd, NULL, NULL, &timeout)) < 1) {
-            applog(LOG_DEBUG, "Stratum select failed on pool %d with value %d", pool->pool_no, sel_ret);
+		 * as dead. With --ob-low-latency the poll thread reads and
+		 * parses messages itself while the connection is healthy. */
+        poll = stratum_poll(pool, 90, cnx_needed);
+        if (poll == STRATUM_POLL_RECONNECT && reconnect_stratum(pool))
+            continue;
+        if (poll == STRATUM_POLL_RECHECK)
+            continue;
+        if (poll == STRATUM_POLL_FAILED || poll == STRATUM_POLL_RECONNECT)
+            s = NULL;
+        else if (!sock_full(pool) && !stratum_wait(pool, 90)) {
+            applog(LOG_DEBUG, "Stratum wait timed out on pool %d", pool->pool_no);
             s = NULL;
         } else
             s = recv_line(pool);
@@ -6672,24 +6829,7 @@ static void* stratum_rthread(void* userdata)
             continue;
         }
 
-        /* Check this pool hasn't died while being a backup pool and
-		 * has not had its idle flag cleared */
-        stratum_resumed(pool);
-
-        if (!parse_method(pool, s) && !parse_stratum_response(pool, s))
-            applog(LOG_INFO, "Unknown stratum msg: %s", s);
-        else if (pool->swork.clean) {
-            struct work* work = make_work();
-
-            /* Generate a single work item to update the current
-			 * block database */
-            gen_stratum_work(pool, work);
-            /* Return value doesn't matter. We're just informing
-			 * that we may need to restart. */
-            test_work_current(work);
-            free_work(work);
-        }
-        free(s);
+        stratum_parse(pool, s);
     }
 
 out:
@@ -6702,8 +6842,6 @@ out:
 static void* stratum_sthread(void* userdata)
 {
     struct pool* pool = (struct pool*)userdata;
-    uint32_t last_nonce2 = 0;
-    Nonce last_nonce = 0;
     char threadname[16];
 
     pthread_detach(pthread_self());
@@ -6715,6 +6853,9 @@ static void* stratum_sthread(void* userdata)
     if (!pool->stratum_q)
         quit(1, "Failed to create stratum_q in stratum_sthread");
 
+    if (opt_ob_dup_share_window > 0 && !pool->sharedup_data)
+        sharedupalloc(pool, opt_ob_dup_share_window);
+
     while (42) {
         char noncehex[12], nonce2hex[20], s[1024];
         struct stratum_share* sshare;
@@ -6746,19 +6887,13 @@ static void* stratum_sthread(void* userdata)
         extranonce2 = work->extranonce2_to_submit;
 
         /* Filter out duplicate shares */
+        if (unlikely(isdupshare(pool, work, nonce, extranonce2))) {
+            applog(LOG_ERR, "Filtering duplicate share to pool %d: job_id=%s ntime=%s en2=0x%08X",
+                pool->pool_no, work->job_id, work->ntime, extranonce2);
+            free_work(work);
+            continue;
+        }
 
-        // TODO: Add this back in once the rest of pool code is working - should check the combination of
-        //       nonce, ntime, extranonce2, jobid
-
-        // if (unlikely(nonce == last_nonce && pool->nonce2 == last_nonce2)) {
-        //     applog(LOG_ERR, "Filtering duplicate share to pool %d",
-        //         pool->pool_no);
-        //     free_work(work);
-        //     continue;
-        // }
-
-        last_nonce = nonce;
-        last_nonce2 = extranonce2;
         __bin2hex(noncehex, (const unsigned char*)&nonce, NONCE_SIZE);
         __bin2hex(nonce2hex, (const unsigned char*)&(extranonce2), work->nonce2_len);
 
@@ -6857,6 +6992,8 @@ static void init_stratum_threads(struct pool* pool)
 {
     have_longpoll = true;
 
+    cgsem_init(&pool->stratum_rsem);
+    mutex_init(&pool->stratum_poll_lock);
     if (unlikely(pthread_create(&pool->stratum_sthread, NULL, stratum_sthread, (void*)pool)))
         quit(1, "Failed to create stratum sthread");
     if (unlikely(pthread_create(&pool->stratum_rthread, NULL, stratum_rthread, (void*)pool)))
@@ -7328,8 +7465,9 @@ static void gen_stratum_work(struct pool* pool, struct work* work)
 #endif
 
 
-    // Update nonce2
-    work->nonce2 = pool->nonce2 += 10000;
+    // Update nonce2, keeping clear of the extranonce2 space the proxy hands out
+    pool->nonce2 = proxy_local_nonce2(pool->nonce2 + 10000);
+    work->nonce2 = pool->nonce2;
     work->nonce2_len = pool->n2size;
 
     /* Downgrade to a read lock to read off the pool variables */
@@ -7384,10 +7522,13 @@ typedef struct SiaStratumInput {
     input.Coinbase2Size = pool->coinbase2_len;
     memcpy(input.Coinbase2, pool->coinbase2, input.Coinbase2Size);
 
-    input.ExtraNonce1Size = 4;
+    // Sizes come from the pool, a stratum proxy hands out a longer extranonce1.
+    // initiate_stratum() refuses sizes that don't fit, these are only a backstop.
+    input.ExtraNonce1Size = MIN(pool->n1_len, sizeof(input.ExtraNonce1));
     memcpy(input.ExtraNonce1, pool->nonce1bin,  input.ExtraNonce1Size);
-    input.ExtraNonce2Size = 4;
-    memcpy(input.ExtraNonce2, &(work->nonce2), input.ExtraNonce2Size);
+    // Bytes of extranonce2 beyond the 32 bit work->nonce2 stay zero
+    input.ExtraNonce2Size = MIN((size_t)pool->n2size, sizeof(input.ExtraNonce2));
+    memcpy(input.ExtraNonce2, &(work->nonce2), MIN(input.ExtraNonce2Size, sizeof(work->nonce2)));
 
     siaCalculateStratumHeader(work->midstate, input);
 
@@ -7477,6 +7618,9 @@ typedef struct SiaStratumInput {
 	 * stratum diff when submitting shares */
     work->sdiff = pool->sdiff;
 
+    work->notify_seq = pool->notify_seq;
+    work->tv_notify = pool->tv_notify;
+
     cg_runlock(&pool->data_lock);
 
     calc_midstate(work);
@@ -7493,6 +7637,7 @@ typedef struct SiaStratumInput {
     calc_diff(work, work->sdiff);
 
     cgtime(&work->tv_staged);
+    cgtimer_time(&work->tv_generated);
 }
 
 #ifdef HAVE_LIBCURL
@@ -7692,6 +7837,7 @@ struct work* get_work(struct thr_info* thr, const int thr_id)
     work->mined = true;
     work->device_diff = MIN(cgpu->drv->max_diff, work->work_difficulty);
     work->device_diff = MAX(cgpu->drv->min_diff, work->device_diff);
+    cgtimer_time(&work->tv_dispatched);
 
     return work;
 }
@@ -8826,6 +8972,50 @@ static void prune_stratum_shares(struct pool* pool)
     }
 }
 
+/* Hashes needed on average to find a difficulty 1 share, for both Sia and
+ * Decred stratum difficulty */
+#define HASHES_PER_DIFF1 4294967296.0
+
+/* Don't change the suggested difficulty more often than this */
+#define SUGGEST_DIFF_INTERVAL 600
+
+/* Ask the current pool for the difficulty that gives roughly
+ * opt_ob_target_share_rate shares a minute at the hashrate the devices have
+ * confirmed over the last 5 minutes. The difficulty is rounded down to a power
+ * of two and only suggested when the pool's own difficulty is more than a
+ * factor of two away from it, so normal hashrate wobble sends nothing. */
+static void update_suggested_diff(struct pool* pool)
+{
+    double hashrate, diff, sdiff;
+
+    if (!opt_ob_target_share_rate || opt_suggest_diff || pool->fixed_diff)
+        return;
+    if (pool != current_pool() || !pool->stratum_active || pool->suggest_diff_unsupported)
+        return;
+    if (time(NULL) - pool->suggest_diff_time < SUGGEST_DIFF_INTERVAL)
+        return;
+
+    mutex_lock(&hash_lock);
+    hashrate = total_secs > 300 ? rolling5 * 1000000 : 0;
+    mutex_unlock(&hash_lock);
+    if (hashrate <= 0)
+        return;
+
+    diff = hashrate * 60 / opt_ob_target_share_rate / HASHES_PER_DIFF1;
+    diff = diff < 1 ? 1 : pow(2, floor(log2(diff)));
+
+    cg_rlock(&pool->data_lock);
+    sdiff = pool->sdiff;
+    cg_runlock(&pool->data_lock);
+
+    if (sdiff <= 0 || diff == pool->suggested_diff || (sdiff >= diff / 2 && sdiff <= diff * 2))
+        return;
+
+    applog(LOG_NOTICE, "Pool %d difficulty %.0f gives %.1f shares/min at %.0f GH/s",
+        pool->pool_no, sdiff, hashrate * 60 / (sdiff * HASHES_PER_DIFF1), hashrate / 1000000000);
+    suggest_stratum_diff(pool, diff);
+}
+
 static void* watchpool_thread(void __maybe_unused* userdata)
 {
     int intervals = 0;
@@ -8866,6 +9056,8 @@ static void* watchpool_thread(void __maybe_unused* userdata)
             if (pool->enabled == POOL_DISABLED)
                 continue;
 
+            update_suggested_diff(pool);
+
             /* Don't start testing a pool if its test thread
 			 * from startup is still doing its first attempt. */
             if (unlikely(pool->testing))
@@ -9615,6 +9807,7 @@ void null_device_drv(struct device_drv* drv)
     drv->get_stats = &noop_get_stats;
     drv->identify_device = &noop_identify_device;
     drv->set_device = NULL;
+    drv->get_metrics = NULL;
 
     drv->thread_prepare = &noop_thread_prepare;
     drv->can_limit_work = &noop_can_limit_work;
@@ -10022,6 +10215,7 @@ int main(int argc, char* argv[])
     initial_args[argc] = NULL;
 
     mutex_init(&hash_lock);
+    mutex_init(&latency_lock);
     mutex_init(&console_lock);
     cglock_init(&control_lock);
     mutex_init(&stats_lock);
@@ -10210,7 +10404,8 @@ int main(int argc, char* argv[])
         applog(LOG_WARNING, "Waiting for USB hotplug devices or press q to quit");
     }
 #else
-    if (!total_devices) {
+    /* A dedicated stratum proxy has nothing to mine with itself */
+    if (!total_devices && !opt_ob_proxy_port) {
         applog(LOG_ERR, "-E- All devices disabled, cannot mine!");
         early_quit(1, "All devices disabled, cannot mine!");
     }
@@ -10314,6 +10509,8 @@ int main(int argc, char* argv[])
         pool->idle = true;
     }
 
+    stratum_poll_init();
+
     /* Look for at least one active pool before starting */
     applog(LOG_NOTICE, "Probing for an alive pool");
     probe_pools();
@@ -10382,6 +10579,8 @@ begin_bench:
     if (thr_info_create(thr, NULL, api_thread, thr))
         early_quit(1, "API thread create failed");
 
+    proxy_init();
+
 #ifdef USE_USBUTILS
     hotplug_thr_id = 6;
     thr = &control_thr[hotplug_thr_id];
@@ -27,6 +27,8 @@ DCR1:
 #include "obelisk/gpio_bsp.h"
 #include "obelisk/multicast.h"
 #include "obelisk/Ob1Utils.h"
+#include "obelisk/Ob1Hashboard.h"
+#include "obelisk/SPI_Support.h"
 #include "compat.h"
 #include "config.h"
 #include "klist.h"
@@ -36,6 +38,8 @@ DCR1:
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <math.h>
+#include <inttypes.h>
 
 
 // HACK:
@@ -43,13 +47,27 @@ extern void dump(unsigned char* p, int len, char* label);
 
 extern int opt_ob_reboot_min_hashrate;
 extern int opt_ob_disable_genetic_algo;
+extern int opt_ob_disable_chip_tuning;
+extern int opt_ob_tune_accept_confidence;
+extern int opt_ob_tune_reject_confidence;
+extern float opt_ob_fan_kp;
+extern float opt_ob_fan_ki;
+extern float opt_ob_fan_kd;
+extern float opt_ob_fan_kff;
+extern int opt_ob_power_limit_watts;
 
 #include "obelisk/siahash/siaverify.h"
 #include "obelisk/dcrhash/dcrverify.h"
 
 static int num_chains = 0;
 static ob_chain chains[MAX_CHAIN_NUM];
-static void control_loop(ob_chain* ob);
+static fanController fanPid;
+static ScheduledTask fanTask;
+
+// The fan task runs on a thread of its own, so the per-board values it reads,
+// hotChipTemp and stringPower, are written and read under fanInputLock.
+static pthread_mutex_t fanInputLock = PTHREAD_MUTEX_INITIALIZER;
+static void scheduleControlTasks(ob_chain* ob);
 
 static void wq_enqueue(struct thr_info* thr, ob_chain* ob)
 {
@@ -205,8 +223,80 @@ static void commitBoardBias(ob_chain* ob) {
 	state->prevBiasChangeTime = state->currentTime;
 	state->goodNoncesUponLastBiasChange = state->currentGoodNonces;
 
-	// Write the new biases to disk.
-	saveThermalConfig(model->name, ob->chain_id, state);
+	// Mark the new biases to be written to disk.
+	state->tuningDirty = true;
+}
+
+// commitChipBias writes the bias of a single chip. Unlike commitBoardBias,
+// this is not treated as a string-wide change, so the measurements of the
+// other chips carry on.
+static void commitChipBias(ob_chain* ob, int chipNum) {
+	ControlLoopState *state = &ob->control_loop_state;
+	ob1SetClockDividerAndBias(ob->staticBoardNumber, chipNum, state->chipDividers[chipNum], state->chipBiases[chipNum]);
+
+	// Keep the saved child in step so the tuned biases survive a restart.
+	state->curChild.chipBiases[chipNum] = state->chipBiases[chipNum];
+	state->curChild.chipDividers[chipNum] = state->chipDividers[chipNum];
+}
+
+// estimateChipPower returns the estimated watts drawn by one chip. Switching
+// power follows the chip's clock, which doubles every 11 bias levels, and
+// both switching and leakage power follow the square of the string voltage.
+static double estimateChipPower(ob_chain* ob, int chipNum) {
+	hashBoardModel *model = &ob->staticBoardModel;
+	ControlLoopState *state = &ob->control_loop_state;
+	double v = state->currentStringVoltage / model->referenceStringVoltage;
+	int level = biasToLevel(state->chipBiases[chipNum], state->chipDividers[chipNum]);
+	double clock = pow(2, (level - model->referenceBiasLevel) / 11.0);
+	return v * v * (model->dynamicStringWatts * clock + model->staticStringWatts) / model->chipsPerBoard;
+}
+
+// estimateStringPower returns the estimated watts drawn by the whole string,
+// from the measured string voltage and the chip clock settings.
+static double estimateStringPower(ob_chain* ob) {
+	double watts = 0;
+	for (int i = 0; i < ob->staticBoardModel.chipsPerBoard; i++) {
+		watts += estimateChipPower(ob, i);
+	}
+	return watts;
+}
+
+// stringPowerBudget returns this string's share of --ob-power-limit-watts, or
+// 0 if there is no limit.
+static double stringPowerBudget(ob_chain* ob) {
+	if (opt_ob_power_limit_watts <= 0) {
+		return 0;
+	}
+	return (double)opt_ob_power_limit_watts / ob->staticTotalBoards;
+}
+
+// getAmbientBand returns the band of ambient temperature the string is in,
+// as estimated by its thermal model, or TUNING_BAND_UNKNOWN if the model has
+// not learned enough yet.
+static int8_t getAmbientBand(ob_chain* ob, double fanSpeed) {
+	double ambient;
+	if (!thermalModelAmbient(&ob->control_loop_state.thermalModel, fanSpeed, &ambient)) {
+		return TUNING_BAND_UNKNOWN;
+	}
+	return ambientToBand(ambient, ob->control_loop_state.ambientBand);
+}
+
+// captureTuningStore records the current tuning as the profile of the current
+// ambient band and copies the store into 'snapshot' to be written out. It is
+// called with ob->lock held.
+static void captureTuningStore(ob_chain* ob, TuningStore *snapshot) {
+	ControlLoopState *state = &ob->control_loop_state;
+	tuningStoreCapture(state, time(0));
+	*snapshot = state->tuningStore;
+	state->tuningDirty = false;
+}
+
+// writeTuningStore writes a snapshot taken by captureTuningStore to disk. It
+// is called without ob->lock, so work dispatch doesn't wait on the file.
+static void writeTuningStore(ob_chain* ob, TuningStore *snapshot) {
+	if (saveTuningStore(ob->staticBoardModel.name, ob->staticBoardNumber, snapshot) != SUCCESS) {
+		applog(LOG_ERR, "Board %u: failed to save tuning settings", ob->staticBoardNumber);
+	}
 }
 
 // decrease the clock bias of every chip on the string.
@@ -220,6 +310,10 @@ static void decreaseStringBias(ob_chain* ob) {
 
 // increase the clock bias of every chip on the string.
 static void increaseStringBias(ob_chain* ob) {
+	double budget = stringPowerBudget(ob);
+	if (budget > 0 && ob->control_loop_state.stringPower >= budget) {
+		return;
+	}
 	for (int i = 0; i < ob->staticBoardModel.chipsPerBoard; i++) {
 		if (biasToLevel(ob->control_loop_state.chipBiases[i], ob->control_loop_state.chipDividers[i]) >= ob->control_loop_state.curChild.maxBiasLevel) {
 			return;
@@ -246,6 +340,8 @@ static void setVoltageLevel(ob_chain* ob, uint8_t level) {
 	state->currentVoltageLevel = level;
 	state->goodNoncesUponLastVoltageChange = state->currentGoodNonces;
 	state->prevVoltageChangeTime = state->currentTime;
+	state->powerSinceVoltageChange = 0;
+	state->powerSamplesSinceVoltageChange = 0;
 
 	for (int i = 0; i < ob->staticBoardModel.chipsPerBoard; i++) {
 		ob->chipBadNonces[i] = 0;
@@ -258,25 +354,8 @@ static void setVoltageLevel(ob_chain* ob, uint8_t level) {
 	state->goodNoncesUponLastBiasChange = state->currentGoodNonces;
 	state->prevBiasChangeTime = state->currentTime;
 
-	// Write the new voltage level to disk.
-	saveThermalConfig(model->name, ob->chain_id, state);
-}
-
-// Separate thread to handle the control loop so we can react quickly to temp changes
-static void* ob_control_thread(void* arg) {
-	struct cgpu_info* cgpu = arg;
-	ob_chain* ob = cgpu->device_data;
-	char tname[16];
-
-	sprintf(tname, "ob_control_%d", ob->chain_id);
-	RenameThread(tname);
-
-	while (true) {
-		control_loop(ob);
-		cgsleep_ms(250);
-	}
-
-	return NULL;
+	// Mark the new voltage level to be written to disk.
+	state->tuningDirty = true;
 }
 
 // bufferGlobalChipJob will send a job to all chips for work.
@@ -287,10 +366,13 @@ ApiError bufferGlobalChipJob(ob_chain* ob) {
 		applog(LOG_ERR, "bufferedWork is NULL: %u", ob->staticBoardNumber);
 		return GENERIC_ERROR;
 	}
+	cgtimer_time(&ob->bufferedWork->tv_buffered);
 
 	// Prepare a job and load it onto the chip.
 	Job job = ob->prepareNextChipJob(ob);
-	return ob1LoadJob(&(ob->spiLoadJobTime), ob->chain_id, ALL_CHIPS, ALL_ENGINES, &job);
+	ApiError error = ob1LoadJob(&(ob->spiLoadJobTime), ob->chain_id, ALL_CHIPS, ALL_ENGINES, &job);
+	cgtimer_time(&ob->bufferedWork->tv_loaded);
+	return error;
 }
 
 // siaPrepareNextChipJob will prepare the next job for a sia chip.
@@ -517,7 +599,6 @@ static void obelisk_detect(bool hotplug)
 		ob->staticBoardNumber = i;
 		ob->staticTotalBoards = numHashboards;
 		ob->fanSpeed = 100;
-		ob->fanAdjustmentInterval = 20;
 		cgtimer_time(&ob->startTime);
 
 		// Determine the type of board.
@@ -536,8 +617,6 @@ static void obelisk_detect(bool hotplug)
 
 		ob->control_loop_state.currentTime = time(0);
 		ob->control_loop_state.initTime = ob->control_loop_state.currentTime;
-		ob->control_loop_state.lastHashrateCheckTime = ob->control_loop_state.currentTime;
-		ob->control_loop_state.lastFanAdjustmentTime = ob->control_loop_state.currentTime;
 		ob->control_loop_state.bootTime = ob->control_loop_state.currentTime;
 		ob->control_loop_state.stringAdjustmentTime = ob->control_loop_state.currentTime+60;
 		ob->control_loop_state.prevVoltageChangeTime = ob->control_loop_state.currentTime;
@@ -547,15 +626,36 @@ static void obelisk_detect(bool hotplug)
 		ob->chipWork = calloc(ob->staticBoardModel.chipsPerBoard, sizeof(struct work*));
 		ob->chipGoodNonces = calloc(ob->staticBoardModel.chipsPerBoard, sizeof(uint64_t));
 		ob->chipBadNonces = calloc(ob->staticBoardModel.chipsPerBoard, sizeof(uint64_t));
+		ob->chipTotalGoodNonces = calloc(ob->staticBoardModel.chipsPerBoard, sizeof(uint64_t));
+		ob->chipTotalBadNonces = calloc(ob->staticBoardModel.chipsPerBoard, sizeof(uint64_t));
+		ob->chipNonceRates = calloc(ob->staticBoardModel.chipsPerBoard, sizeof(NonceRate));
+		ob->chipEngineJobs = calloc(ob->staticBoardModel.chipsPerBoard, sizeof(uint64_t));
 		ob->chipStartTimes = calloc(ob->staticBoardModel.chipsPerBoard, sizeof(cgtimer_t));
 		ob->chipResetTimes = calloc(ob->staticBoardModel.chipsPerBoard, sizeof(cgtimer_t));
 		ob->chipCheckTimes = calloc(ob->staticBoardModel.chipsPerBoard, sizeof(cgtimer_t));
 
-		// Load the thermal configuration for this machine. If that fails (no
-		// configuration file, or boards changed), fallback to default values
+		// Load what has been learned about how this board heats up. The model
+		// follows the board, so it is keyed by the board's unique id.
+		if (loadThermalModel(getBoardUniqueId(ob->staticBoardNumber), &ob->control_loop_state.thermalModel) != SUCCESS) {
+			thermalModelInit(&ob->control_loop_state.thermalModel);
+		}
+
+		// Load the stored tuning profiles for this machine and start from the
+		// one closest to the current ambient temperature. If there are none
+		// (no settings file, or boards changed), fallback to default values
 		// based on our thermal models.
-		ApiError error = loadThermalConfig(ob->staticBoardModel.name, ob->staticBoardNumber, &ob->control_loop_state);
-		if (error != SUCCESS) {
+		loadTuningStore(ob->staticBoardModel.name, ob->staticBoardNumber, &ob->control_loop_state.tuningStore);
+		ob->control_loop_state.ambientBand = TUNING_BAND_UNKNOWN;
+		ob->control_loop_state.ambientBand = getAmbientBand(ob, ob->fanSpeed);
+		int profile = tuningStoreFind(&ob->control_loop_state.tuningStore, ob->control_loop_state.ambientBand, true);
+		if (profile >= 0) {
+			tuningStoreApply(&ob->control_loop_state, profile);
+			TuningProfile *loaded = &ob->control_loop_state.tuningStore.profiles[profile];
+			if (ob->control_loop_state.ambientBand == TUNING_BAND_UNKNOWN) {
+				ob->control_loop_state.ambientBand = loaded->band;
+			}
+			applog(LOG_ERR, "Board %u: using stored tuning profile (ambient band %d)", ob->staticBoardNumber, loaded->band);
+		} else {
 			// Start the chip biases at 3 levels above minimum, so there is room to
 			// decrease them via the startup logic.
 			int8_t baseBias = MIN_BIAS;
@@ -607,6 +707,7 @@ static void obelisk_detect(bool hotplug)
 			memcpy(ob->control_loop_state.curChild.chipDividers, ob->control_loop_state.chipDividers, ob->staticBoardModel.chipsPerBoard);
 			ob->control_loop_state.populationSize = 0;
 		}
+
 		setVoltageLevel(ob, ob->control_loop_state.currentVoltageLevel);
 		commitBoardBias(ob);
 
@@ -622,15 +723,20 @@ static void obelisk_detect(bool hotplug)
         chains[i].cgpu = cgpu;
         add_cgpu(cgpu);
         cgpu->device_id = i;
+        num_chains = i + 1;
 
         mutex_init(&ob->lock);
         pthread_cond_init(&ob->work_cond, NULL);
         pthread_create(&pth, NULL, ob_gen_work_thread, cgpu);
 
         pthread_cond_init(&ob->nonce_cond, NULL);
-        pthread_create(&pth, NULL, ob_control_thread, cgpu);
+        scheduleControlTasks(ob);
     }
 
+    // One thread runs the control tasks of every board, each at its own
+    // cadence.
+    ob1StartScheduler();
+
     applog(LOG_ERR, "***** obelisk_detect() DONE\n");
 }
 
@@ -653,6 +759,20 @@ static bool obelisk_thread_prepare(struct thr_info* thr)
 static void obelisk_shutdown(struct thr_info* thr)
 {
     applog(LOG_ERR, "***** obelisk_shutdown()");
+
+    // Don't lose the tuning done since the last periodic flush.
+    ob_chain* ob = thr->cgpu->device_data;
+    TuningStore snapshot;
+    bool dirty;
+    mutex_lock(&ob->lock);
+    dirty = ob->control_loop_state.tuningDirty;
+    if (dirty) {
+        captureTuningStore(ob, &snapshot);
+    }
+    mutex_unlock(&ob->lock);
+    if (dirty) {
+        writeTuningStore(ob, &snapshot);
+    }
 }
 
 static bool obelisk_queue_full(struct cgpu_info* cgpu)
@@ -675,14 +795,39 @@ static void update_temp(temp_stats_t* temps, double curr_temp)
 // Status display variables.
 #define StatusOutputFrequency 60 
 
+// Chip hashrate variables.
+#define ChipHashrateConfidenceZ 1.96 // 95% bounds for display.
+#define ChipResetConfidenceZ 2.326   // One-sided 99% bound for chip resets.
+
+// cgtimerSeconds returns a cgtimer as seconds.
+static double cgtimerSeconds(cgtimer_t* t) {
+	return t->tv_sec + t->tv_nsec / 1e9;
+}
+
 // Overtemp variables.
 #define TempDeviationAcceptable 2.0 // The amount the temperature is allowed to vary from the target temperature.
 #define TempDeviationUrgent 3.0 // Temp above acceptable where rapid bias reductions begin.
-#define OvertempCheckFrequency 1
 
 // Undertemp variables.
-#define TempRiseSpeedHot 1
-#define UndertempCheckFrequency 1
+#define TempRiseSpeedHot 1 // Degrees per check above which the string is still heating up.
+
+// Thermal model variables.
+#define ThermalSaveFrequency 600
+
+// Tuning store variables.
+#define TuningFlushFrequency 600
+
+// How often each control task runs. The thermal task also runs straight away
+// when the sensor sampler sees the string cross its overtemp threshold.
+#define StatusPeriodMs         60000
+#define ThermalControlPeriodMs 2000
+#define PowerLimitPeriodMs     2000
+#define FanControlPeriodMs     2000
+#define ThermalModelPeriodMs   1000
+#define TuningStorePeriodMs    60000
+#define ChipTuningPeriodMs     1000
+#define StringTuningPeriodMs   1000
+#define HashrateCheckPeriodMs  1800000
 
 // targetTemp returns the target temperature for the chip we want.
 static double getHottestDelta(ob_chain* ob) {
@@ -691,17 +836,24 @@ static double getHottestDelta(ob_chain* ob) {
 	// determine the delta between that chip and the measured chip.
 	//
 	// Chip 0 has the temp sensor, so we skip chip 0.
-	int hottestDelta = 0;
+	//
+	// Once the thermal model has learned how much a chip heats up per bias
+	// level, that replaces the assumed 2 degrees per level.
+	double selfHeat = thermalModelSelfHeat(&ob->control_loop_state.thermalModel, ob->staticBoardModel.chipsPerBoard);
+	if (selfHeat < 0) {
+		selfHeat = 2;
+	}
+	double hottestDelta = 0;
 	int baseBiasLevel = biasToLevel(ob->control_loop_state.chipBiases[0], ob->control_loop_state.chipDividers[0]);
 	for (int i = 1; i < 15; i++) {
 		// Determine how much to adjust the expected temp based on the chip's
 		// bias level.
 		int biasLevel = biasToLevel(ob->control_loop_state.chipBiases[i], ob->control_loop_state.chipDividers[i]);
-		int biasDelta = 0;
+		double biasDelta = 0;
 		if (biasLevel > baseBiasLevel) {
-			biasDelta = (biasLevel-baseBiasLevel)*2;
+			biasDelta = (biasLevel-baseBiasLevel)*selfHeat;
 		} else {
-			biasDelta = (baseBiasLevel-biasLevel)*1;
+			biasDelta = (baseBiasLevel-biasLevel)*selfHeat/2;
 		}
 
 		// If there's only one board, assume a delta of 25. We don't have
@@ -721,7 +873,7 @@ static double getHottestDelta(ob_chain* ob) {
 
 		// Compute the full delta for the chip and see if it's the new hottest
 		// delta.
-		int fullDelta = biasDelta + chipDelta;
+		double fullDelta = biasDelta + chipDelta;
 		if (fullDelta > hottestDelta) {
 			hottestDelta = fullDelta;
 		}
@@ -732,8 +884,10 @@ static double getHottestDelta(ob_chain* ob) {
 // updateControlState will update fields that depend on external factors.
 // Things like the time and string temperature.
 static void updateControlState(ob_chain* ob) {
-	// Fetch some status variables about the hashing board.
-	HashboardStatus hbStatus = ob1GetHashboardStatus(ob->staticBoardNumber);
+	// Fetch some status variables about the hashing board. This is the latest
+	// sample from the sensor sampler thread, so it doesn't wait on I2C.
+	HashboardSnapshot snapshot = ob1GetHashboardSnapshot(ob->staticBoardNumber);
+	HashboardStatus hbStatus = snapshot.status;
 
 	// TODO: Update some API level stuffs. This may not be the best place for
 	// these.
@@ -742,20 +896,34 @@ static void updateControlState(ob_chain* ob) {
     update_temp(&ob->board_temp, hbStatus.boardTemp);
     update_temp(&ob->chip_temp, hbStatus.chipTemp);
     update_temp(&ob->psu_temp, hbStatus.powerSupplyTemp);
-    ob->fan_speed[0] = (int32_t)ob1GetFanRPM(0);
-    ob->fan_speed[1] = (int32_t)ob1GetFanRPM(1);
+    ob->fan_speed[0] = (int32_t)snapshot.fanRPM[0];
+    ob->fan_speed[1] = (int32_t)snapshot.fanRPM[1];
     ob->num_chips = ob->staticBoardModel.chipsPerBoard;
     ob->num_cores = ob->staticBoardModel.chipsPerBoard * ob->staticBoardModel.enginesPerChip;
 
 	// Update the current hotChipTemp for this board, under lock.
 	double hottestDelta = getHottestDelta(ob);
 	double hotChipTemp = hottestDelta + ob->control_loop_state.currentStringTemp;
+	mutex_lock(&fanInputLock);
 	ob->hotChipTemp = hotChipTemp;
+	mutex_unlock(&fanInputLock);
+
+	// Scores taken before the objective was changed through the API are
+	// dropped. Forgetting the band makes the next tuning store check pick up
+	// the stored profile for the new objective, if there is one.
+	if (objectiveResetIfChanged(&ob->control_loop_state)) {
+		ob->control_loop_state.ambientBand = TUNING_BAND_UNKNOWN;
+		applog(LOG_ERR, "Board %u: optimization objective changed, restarting tuning", ob->staticBoardNumber);
+	}
 
 	// Update status values.
 	ob->control_loop_state.currentTime = time(0);
 	ob->control_loop_state.currentStringTemp = hbStatus.chipTemp;
 	ob->control_loop_state.currentStringVoltage = hbStatus.asicV15;
+	double stringPower = estimateStringPower(ob);
+	mutex_lock(&fanInputLock);
+	ob->control_loop_state.stringPower = stringPower;
+	mutex_unlock(&fanInputLock);
 
 	// Fetch nonce count updates.
 	mutex_lock(&ob->lock);
@@ -778,16 +946,27 @@ static uint64_t computeHashRate(ob_chain *ob) {
 	return ob->staticBoardModel.chipDifficulty * goodNonces / secondsElapsed;
 }
 
+// chipHashrate returns the hashrate of a chip in GH/s over one of the nonce
+// rate windows, with its 95% confidence bounds. The scanwork thread updates
+// the estimate, so it is copied out under the lock first.
+static double chipHashrate(ob_chain* ob, int chipNum, int window, double now, double* low, double* high) {
+	NonceRate snapshot;
+	mutex_lock(&ob->lock);
+	snapshot = ob->chipNonceRates[chipNum];
+	mutex_unlock(&ob->lock);
+
+	double scale = ob->staticBoardModel.chipDifficulty / 1e9;
+	double rate = nonceRateEstimate(&snapshot, window, now, ChipHashrateConfidenceZ, low, high);
+	*low *= scale;
+	*high *= scale;
+	return rate * scale;
+}
+
 // displayControlState will check if enough time has passed, and then display
 // the current state of the hashing board to the user.
 static void displayControlState(ob_chain* ob) {
-	time_t lastStatus = ob->control_loop_state.lastStatusOutput;
-	time_t currentTime = ob->control_loop_state.currentTime;
 	time_t totalTime = (ob->control_loop_state.currentTime - ob->control_loop_state.initTime) + 1;
 	uint64_t goodNonces = ob->control_loop_state.currentGoodNonces;
-	if (currentTime - lastStatus <= StatusOutputFrequency) {
-		return;
-	}
 
 	// Display some string-wide stats.
 	applog(LOG_ERR, "");
@@ -803,22 +982,37 @@ static void displayControlState(ob_chain* ob) {
 	applog(LOG_ERR, "");
 
 	// Display some individual chip stats.
+	cgtimer_t now;
+	cgtimer_time(&now);
 	for (int chipNum = 0; chipNum < ob->staticBoardModel.chipsPerBoard; chipNum++) {
 		uint64_t goodNonces = ob->chipGoodNonces[chipNum];
 		uint64_t badNonces = ob->chipBadNonces[chipNum];
 		uint8_t divider = ob->control_loop_state.chipDividers[chipNum];
 		int8_t bias = ob->control_loop_state.chipBiases[chipNum];
-		applog(LOG_ERR, "Chip %i: bias=%u.%i  good=%lld  bad=%lld", chipNum, divider, bias, goodNonces, badNonces);
+		ChipTuneState *tune = &ob->control_loop_state.chipTune[chipNum];
+		double low, high;
+		double hashrate = chipHashrate(ob, chipNum, NONCE_RATE_1H, cgtimerSeconds(&now), &low, &high);
+		applog(LOG_ERR, "Chip %i: bias=%u.%i  good=%" PRIu64 "  bad=%" PRIu64 "  tuned=%" PRIu64 "/%" PRIu64 "  1h=%.1f GH/s (%.1f-%.1f)", chipNum, divider, bias, goodNonces, badNonces, tune->trialsKept, tune->trials, hashrate, low, high);
 	}
-
-	ob->control_loop_state.lastStatusOutput = currentTime;
 }
 
 // handleOvertemps will clock down the string if the string is overheating.
 static void handleOvertemps(ob_chain* ob, double targetTemp) {
-	time_t timeElapsed = ob->control_loop_state.currentTime - ob->control_loop_state.prevOvertempCheck;
 	double currentTemp = ob->control_loop_state.currentStringTemp;
-	if (timeElapsed > OvertempCheckFrequency) {
+	double stringHeat = thermalModelStringHeat(&ob->control_loop_state.thermalModel);
+	if (stringHeat > 0) {
+		// The thermal model knows how much each level is worth, so take
+		// enough steps to get back to the target, up to three at once.
+		if (currentTemp > targetTemp + TempDeviationAcceptable) {
+			int steps = (int)ceil((currentTemp - targetTemp) / stringHeat);
+			if (steps > 3) {
+				steps = 3;
+			}
+			for (int i = 0; i < steps; i++) {
+				decreaseStringBias(ob);
+			}
+		}
+	} else {
 		// Reduce the string bias if we are overtemp.
 		if (currentTemp > targetTemp + TempDeviationAcceptable) {
 			decreaseStringBias(ob);
@@ -829,75 +1023,209 @@ static void handleOvertemps(ob_chain* ob, double targetTemp) {
 			decreaseStringBias(ob);
 			decreaseStringBias(ob);
 		}
-		ob->control_loop_state.prevOvertempCheck = ob->control_loop_state.currentTime;
 	}
 }
 
 // handleUndertemps will clock up the string if the string is too cold.
 static void handleUndertemps(ob_chain* ob, double targetTemp) {
-	time_t timeElapsed = ob->control_loop_state.currentTime - ob->control_loop_state.prevUndertempCheck;
 	double currentTemp = ob->control_loop_state.currentStringTemp;
 	double prevTemp = ob->control_loop_state.prevUndertempStringTemp;
-	if (timeElapsed > UndertempCheckFrequency) {
-		if (currentTemp < targetTemp - TempDeviationAcceptable && currentTemp - prevTemp < TempRiseSpeedHot * UndertempCheckFrequency) {
-			increaseStringBias(ob);
-		}
-		ob->control_loop_state.prevUndertempCheck = ob->control_loop_state.currentTime;
-		ob->control_loop_state.prevUndertempStringTemp = ob->control_loop_state.currentStringTemp;
+
+	// Don't step up if the thermal model expects the step to overshoot
+	// into the overtemp band, which would only be undone again.
+	double stringHeat = thermalModelStringHeat(&ob->control_loop_state.thermalModel);
+	bool overshoots = stringHeat > 0 && currentTemp + stringHeat > targetTemp + TempDeviationAcceptable;
+	if (currentTemp < targetTemp - TempDeviationAcceptable && currentTemp - prevTemp < TempRiseSpeedHot && !overshoots) {
+		increaseStringBias(ob);
 	}
+	ob->control_loop_state.prevUndertempStringTemp = ob->control_loop_state.currentStringTemp;
 }
 
-// handleFanChange will adjust the fans based on the current temperatures of all
-// the boards.
-static void handleFanChange(ob_chain* ob) {
-	// Only board 0 manipulates the fans.
-	//
-	// NOTE: This means that fan control is not in place if there is no board in
-	// slot zero.
-	if (ob->staticBoardNumber != 0) {
-		return;
+// handlePowerLimit will clock down the string if it is estimated to draw more
+// than its share of the power limit.
+static void handlePowerLimit(ob_chain* ob) {
+	ControlLoopState *state = &ob->control_loop_state;
+	double budget = stringPowerBudget(ob);
+	if (budget > 0 && state->stringPower > budget) {
+		decreaseStringBias(ob);
+		double stringPower = estimateStringPower(ob);
+		mutex_lock(&fanInputLock);
+		state->stringPower = stringPower;
+		mutex_unlock(&fanInputLock);
 	}
+}
+
+// samplePower adds the string's power to its average since the last voltage
+// change. It is called once per PowerLimitPeriodMs, however many tasks ran in
+// between, so every sample stands for the same length of time.
+static void samplePower(ob_chain* ob) {
+	ControlLoopState *state = &ob->control_loop_state;
+	state->powerSinceVoltageChange += state->stringPower;
+	state->powerSamplesSinceVoltageChange++;
+}
 
-	// Check that enough time has elapsed since the last fan speed adjustment,
-	// only happens once every 20 seconds.
-	if (ob->control_loop_state.currentTime - ob->control_loop_state.lastFanAdjustmentTime < ob->fanAdjustmentInterval) {
+// handleThermalModel feeds the latest string temperature into the learned
+// thermal model, and saves the model every so often.
+static void handleThermalModel(ob_chain* ob) {
+	ControlLoopState *state = &ob->control_loop_state;
+
+	// Skip readings from a sensor that isn't answering.
+	if (state->currentStringTemp <= 0) {
 		return;
 	}
+	double x[THERMAL_MODEL_TERMS];
+	thermalModelFeatures(state, ob->staticBoardModel.chipsPerBoard, chains[0].fanSpeed, x);
+	thermalModelUpdate(&state->thermalModel, x, state->currentStringTemp);
 
-	// Check for conditions where we change the fan speed.
-	bool anyHot = false;
-	bool allBelowIdeal = true;
-	bool anyCool = false;
-	for (int i = 0; i < ob->staticTotalBoards; i++) {
-		double chainTemp = chains[i].hotChipTemp;
-		if (chainTemp > chains[i].staticBoardModel.boardHotTemp) {
-			anyHot = true;
+	if (state->currentTime - state->prevThermalSaveTime >= ThermalSaveFrequency) {
+		saveThermalModel(getBoardUniqueId(ob->staticBoardNumber), &state->thermalModel);
+		state->prevThermalSaveTime = state->currentTime;
+	}
+}
+
+// handleTuningStore writes out the tuning when it has changed, at most every
+// TuningFlushFrequency seconds. When the ambient temperature moves into a band
+// that a profile was stored for, the string switches straight to that
+// profile instead of re-learning.
+static void handleTuningStore(ob_chain* ob) {
+	ControlLoopState *state = &ob->control_loop_state;
+	TuningStore snapshot;
+	int8_t band = getAmbientBand(ob, chains[0].fanSpeed);
+	if (band != TUNING_BAND_UNKNOWN && band != state->ambientBand) {
+		mutex_lock(&ob->lock);
+		bool flush = state->ambientBand != TUNING_BAND_UNKNOWN;
+		if (flush) {
+			captureTuningStore(ob, &snapshot);
 		}
-		if (chainTemp >= chains[i].staticBoardModel.boardIdealTemp) {
-			allBelowIdeal = false;
+		int8_t prevBand = state->ambientBand;
+		state->ambientBand = band;
+		int profile = tuningStoreFind(&state->tuningStore, band, false);
+		if (profile >= 0) {
+			tuningStoreApply(state, profile);
 		}
-		if (chainTemp < chains[i].staticBoardModel.boardCoolTemp) {
-			anyCool = true;
+		mutex_unlock(&ob->lock);
+		if (flush) {
+			writeTuningStore(ob, &snapshot);
+		}
+
+		applog(LOG_ERR, "Board %u: ambient band %d -> %d%s", ob->staticBoardNumber, prevBand, band,
+			profile >= 0 ? ", using stored tuning profile" : "");
+		if (profile >= 0) {
+			setVoltageLevel(ob, state->currentVoltageLevel);
+			commitBoardBias(ob);
+			state->hasReset = false;
 		}
 	}
 
-	uint64_t maxSpeed = ob->staticRigModel.fanSpeedMax;
-	uint64_t minSpeed = ob->staticRigModel.fanSpeedMin;
-	uint64_t increment = ob->staticRigModel.fanSpeedIncrement;
-	if (anyHot && ob->fanSpeed != maxSpeed) {
-		ob->fanSpeed += increment;
-		ob1SetFanSpeeds(ob->fanSpeed);
-		ob->fanAdjustmentInterval = 5;  // Check again sooner to see if we need to crank it up again
-	} else {
-		ob->fanAdjustmentInterval = 20;
+	if (state->tuningDirty && state->currentTime - state->prevTuningFlush >= TuningFlushFrequency) {
+		mutex_lock(&ob->lock);
+		captureTuningStore(ob, &snapshot);
+		mutex_unlock(&ob->lock);
+		writeTuningStore(ob, &snapshot);
+		state->prevTuningFlush = state->currentTime;
 	}
+}
 
-	if ((allBelowIdeal || anyCool) && ob->fanSpeed >= (minSpeed + increment)) {
-		ob->fanSpeed -= increment;
-		ob1SetFanSpeeds(ob->fanSpeed);
+// handleChipTuning will hill climb the bias of each chip independently, based
+// on the nonces that chip has produced. Chips are only sped up while the string
+// is below its target temperature.
+static void handleChipTuning(ob_chain* ob, double targetTemp) {
+	ControlLoopState *state = &ob->control_loop_state;
+	state->chipTuning = opt_ob_disable_chip_tuning == 0;
+	if (!state->chipTuning) {
+		return;
+	}
+
+	double budget = stringPowerBudget(ob);
+	bool allowIncrease = state->currentStringTemp < targetTemp && (budget <= 0 || state->stringPower < budget);
+	bool changed = false;
+	for (int i = 0; i < ob->staticBoardModel.chipsPerBoard; i++) {
+		double weight = objectiveWeight(estimateChipPower(ob, i), 0);
+		if (chipTuneIter(state, i, ob->chipTotalGoodNonces[i], ob->chipTotalBadNonces[i], allowIncrease, weight)) {
+			commitChipBias(ob, i);
+			changed = true;
+		}
+	}
+	if (changed) {
+		state->tuningDirty = true;
+	}
+}
+
+// handleFanChange will adjust the fans based on the current temperatures of all
+// the boards. A PID loop drives the hottest board's hotChipTemp to the ideal
+// temperature. A feed-forward term reacts straight away to the tuner raising or
+// lowering the power of the strings, rather than waiting for the heat to show
+// up on the sensors.
+//
+// The fans are shared by the whole rig, so this runs once for all the boards.
+// The fan state is kept on the first chain.
+static void handleFanChange(void) {
+	ob_chain* ob = &chains[0];
+	cgtimer_t now;
+	cgtimer_time(&now);
+
+	// Find the hottest board and the total heat being put out.
+	double temp = 0;
+	double power = 0;
+	mutex_lock(&fanInputLock);
+	for (int i = 0; i < ob->staticTotalBoards; i++) {
+		if (chains[i].hotChipTemp > temp) {
+			temp = chains[i].hotChipTemp;
+		}
+		power += chains[i].control_loop_state.stringPower;
+	}
+	mutex_unlock(&fanInputLock);
+
+	double maxSpeed = ob->staticRigModel.fanSpeedMax;
+	double minSpeed = ob->staticRigModel.fanSpeedMin;
+	if (minSpeed < opt_ob_min_fan_speed_percent) {
+		minSpeed = opt_ob_min_fan_speed_percent;
 	}
 
-	ob->control_loop_state.lastFanAdjustmentTime = ob->control_loop_state.currentTime;
+	fanController *pid = &fanPid;
+	pid->setpoint = ob->staticBoardModel.boardIdealTemp;
+	double err = temp - pid->setpoint;
+	if (!pid->initialized) {
+		// Start from the current fan speed so the first step doesn't jump.
+		pid->powerRef = power;
+		pid->temp = temp;
+		pid->iTerm = ob->fanSpeed - opt_ob_fan_kp * err;
+		pid->lastTime = cgtimerSeconds(&now) - FanControlPeriodMs / 1000.0;
+		pid->initialized = true;
+	}
+
+	// A run triggered by a sensor alarm can come sooner than the period.
+	double dt = cgtimerSeconds(&now) - pid->lastTime;
+	if (dt < 0.1) {
+		dt = 0.1;
+	}
+	pid->lastTime = cgtimerSeconds(&now);
+
+	// The feed-forward is the relative change in heat since the loop started;
+	// the integral term takes care of whatever that leaves over.
+	pid->ffTerm = pid->powerRef > 0 ? opt_ob_fan_kff * 100 * (power / pid->powerRef - 1) : 0;
+	pid->pTerm = opt_ob_fan_kp * err;
+	pid->dTerm = opt_ob_fan_kd * (temp - pid->temp) / dt;
+	pid->iTerm += opt_ob_fan_ki * err * dt;
+	pid->output = pid->pTerm + pid->iTerm + pid->dTerm + pid->ffTerm;
+
+	// Anti-windup: when the fans are pinned at a limit, pull the integral back
+	// to what keeps them exactly at the limit so it can't keep accumulating.
+	if (pid->output > maxSpeed) {
+		pid->iTerm -= pid->output - maxSpeed;
+		pid->output = maxSpeed;
+	} else if (pid->output < minSpeed) {
+		pid->iTerm += minSpeed - pid->output;
+		pid->output = minSpeed;
+	}
+	pid->temp = temp;
+	pid->power = power;
+
+	uint8_t speed = (uint8_t)(pid->output + 0.5);
+	if (speed != ob->fanSpeed) {
+		ob->fanSpeed = speed;
+		ob1SetFanSpeeds(ob->fanSpeed);
+	}
 }
 
 // handleLowHashrateExit will exit if the hashrate of a board drops below the specified amount.
@@ -909,18 +1237,51 @@ static void handleLowHashrateExit(ob_chain* ob) {
 		return;
 	}
 
-	if (ob->control_loop_state.currentTime - ob->control_loop_state.lastHashrateCheckTime > 1800) {
-		uint64_t actualHashrate = ob->cgpu->rolling5;
-		uint64_t hashrateLimit = ((uint64_t)opt_ob_reboot_min_hashrate) * 1000LL;
-		if (actualHashrate < hashrateLimit) {
-			applog(LOG_ERR, "$$$$$$$$$$ REBOOTING BECAUSE HASHRATE OF HB%d IS %lld, WHICH IS BELOW THE LIMIT OF=%lld",
-				ob->chain_id + 1, actualHashrate, hashrateLimit);
-			exit(0);
-		}
+	uint64_t actualHashrate = ob->cgpu->rolling5;
+	uint64_t hashrateLimit = ((uint64_t)opt_ob_reboot_min_hashrate) * 1000LL;
+	if (actualHashrate < hashrateLimit) {
+		applog(LOG_ERR, "$$$$$$$$$$ REBOOTING BECAUSE HASHRATE OF HB%d IS %lld, WHICH IS BELOW THE LIMIT OF=%lld",
+			ob->chain_id + 1, actualHashrate, hashrateLimit);
+		exit(0);
+	}
+}
 
-		// Reset the time so we check again in another 30 minutes
-		ob->control_loop_state.lastHashrateCheckTime = ob->control_loop_state.currentTime;
+// childObjectiveWeight returns the objectiveWeight of the current genetic algo
+// child, from the average power the string has drawn while running it.
+static double childObjectiveWeight(ob_chain* ob) {
+	ControlLoopState *state = &ob->control_loop_state;
+	double watts = state->stringPower;
+	if (state->powerSamplesSinceVoltageChange > 0) {
+		watts = state->powerSinceVoltageChange / state->powerSamplesSinceVoltageChange;
+	}
+	return objectiveWeight(watts, stringPowerBudget(ob));
+}
+
+// childDecidedEarly runs a sequential test on the nonces found by the current
+// genetic algo child, so that a child that is clearly losing stops costing
+// hashrate after tens of seconds instead of the full evaluation period.
+static bool childDecidedEarly(ob_chain* ob, time_t timeElapsed) {
+	ControlLoopState *state = &ob->control_loop_state;
+
+	// The evaluation window only starts once the post-change reset is done.
+	if (!state->hasReset || opt_ob_disable_genetic_algo != 0) {
+		return false;
+	}
+	if (opt_ob_tune_accept_confidence <= 0 || opt_ob_tune_accept_confidence >= 100 ||
+		opt_ob_tune_reject_confidence <= 0 || opt_ob_tune_reject_confidence >= 100) {
+		return false;
+	}
+
+	double alpha = (100 - opt_ob_tune_accept_confidence) / 100.0;
+	double beta = (100 - opt_ob_tune_reject_confidence) / 100.0;
+	int decision = geneticAlgoEarlyDecision(state, state->goodNoncesSinceVoltageChange, timeElapsed,
+		ob->staticBoardModel.chipDifficulty, childObjectiveWeight(ob), alpha, beta);
+	if (decision == 0) {
+		return false;
 	}
+	applog(LOG_ERR, "HB%d: child %s after %ds with %lld nonces", ob->staticBoardNumber,
+		decision > 0 ? "accepted" : "rejected", (int)timeElapsed, state->goodNoncesSinceVoltageChange);
+	return true;
 }
 
 // handleVoltageAndBiasTuning will adjust the voltage of the string and the
@@ -941,17 +1302,20 @@ static void handleVoltageAndBiasTuning(ob_chain* ob) {
 		}
 		ob->control_loop_state.prevVoltageChangeTime = ob->control_loop_state.currentTime;
 		ob->control_loop_state.goodNoncesUponLastVoltageChange = ob->control_loop_state.currentGoodNonces;
+		ob->control_loop_state.powerSinceVoltageChange = 0;
+		ob->control_loop_state.powerSamplesSinceVoltageChange = 0;
 		return;
 	}
 
 	// If we haven't found enough nonces and also not too much time has passed,
-	// no changes are made to voltage or bias.
-	if (timeElapsed < requiredTime) {
+	// no changes are made to voltage or bias, unless the child is already
+	// clearly better or clearly worse than the child it would replace.
+	if (timeElapsed < requiredTime && !childDecidedEarly(ob, timeElapsed)) {
 		return;
 	}
 
 	// Set the fitness of the current child.
-	ob->control_loop_state.curChild.fitness = computeHashRate(ob);
+	ob->control_loop_state.curChild.fitness = computeHashRate(ob) * childObjectiveWeight(ob);
 
 	// Set the curChild voltage and bias levels to equal what they've been
 	// changed to by the temp regulation and any other external factors.
@@ -962,13 +1326,26 @@ static void handleVoltageAndBiasTuning(ob_chain* ob) {
 	// Run the genetic algorithm, recording the performance of the current
 	// settings and breeding the population to produce new settings.
 	// Only run the genetic algo if the user has not disabled it
+	uint8_t prevVoltageLevel = ob->control_loop_state.currentVoltageLevel;
 	if (opt_ob_disable_genetic_algo == 0) {
 		geneticAlgoIter(&ob->control_loop_state);
 	}
 
 	// Commit the new settings and mark that an adjustment has taken place.
-	setVoltageLevel(ob, ob->control_loop_state.currentVoltageLevel);
-	commitBoardBias(ob);
+	//
+	// With per-chip tuning the chip biases are left alone by the genetic algo,
+	// so if the voltage did not change either, only a new evaluation of the
+	// string is started. Recommitting would restart every chip's measurement.
+	if (ob->control_loop_state.chipTuning && ob->control_loop_state.currentVoltageLevel == prevVoltageLevel) {
+		ob->control_loop_state.prevVoltageChangeTime = ob->control_loop_state.currentTime;
+		ob->control_loop_state.goodNoncesUponLastVoltageChange = ob->control_loop_state.currentGoodNonces;
+		ob->control_loop_state.powerSinceVoltageChange = 0;
+		ob->control_loop_state.powerSamplesSinceVoltageChange = 0;
+		ob->control_loop_state.tuningDirty = true;
+	} else {
+		setVoltageLevel(ob, ob->control_loop_state.currentVoltageLevel);
+		commitBoardBias(ob);
+	}
 
 	// Set the curChild voltage and bias levels to equal what they've been
 	// changed to by any no-ops that occurred after the voltage was updated.
@@ -976,27 +1353,103 @@ static void handleVoltageAndBiasTuning(ob_chain* ob) {
 	ob->control_loop_state.hasReset = false;
 }
 
-// control_loop runs the hashing boards and attempts to work towards an optimal
-// hashrate.
-static void control_loop(ob_chain* ob) {
-	// Get a static view of the current state of the hashing board.
+// getTargetTemp returns the temperature the string's sensor should be kept at
+// so that its hottest chip stays at --ob-max-hot-chip-temp-c.
+static double getTargetTemp(ob_chain* ob) {
+	return opt_ob_max_hot_chip_temp_c - ob->staticBoardModel.chipTempVariance - getHottestDelta(ob);
+}
+
+// The control tasks below are run by the control thread for every board, with
+// the thermal tasks ahead of the rest; the fan task has a thread of its own.
+// Each board task starts from a fresh view of the board, which only copies
+// the latest sensor sample so is cheap.
+
+static void runStatusTask(void* arg) {
+	ob_chain* ob = arg;
 	updateControlState(ob);
 	displayControlState(ob);
+}
 
-	// Determine the target temperature for the temperature chip.
-	double hottestDelta = getHottestDelta(ob);
-	double targetTemp = opt_ob_max_hot_chip_temp_c - ob->staticBoardModel.chipTempVariance - hottestDelta;
+// onSensorAlarm runs on the sensor sampler thread when the string rises
+// through its overtemp threshold, and brings the thermal and fan tasks
+// forward.
+static void onSensorAlarm(uint8_t boardNum, void* arg) {
+	ob_chain* ob = arg;
+	ob1TriggerTask(&ob->thermalTask);
+	ob1TriggerTask(&fanTask);
+}
+
+static void runThermalTask(void* arg) {
+	ob_chain* ob = arg;
+	updateControlState(ob);
+	double targetTemp = getTargetTemp(ob);
 	handleOvertemps(ob, targetTemp);
 	handleUndertemps(ob, targetTemp);
-	handleFanChange(ob);
 
-	// Perform any adjustments to the voltage and bias that may be required.
+	// The threshold follows the target, which moves with the chip biases.
+	ob1SetSensorAlarm(ob->staticBoardNumber, getTargetTemp(ob) + TempDeviationAcceptable, onSensorAlarm, ob);
+}
+
+static void runPowerLimitTask(void* arg) {
+	ob_chain* ob = arg;
+	updateControlState(ob);
+	samplePower(ob);
+	handlePowerLimit(ob);
+}
+
+static void runThermalModelTask(void* arg) {
+	ob_chain* ob = arg;
+	updateControlState(ob);
+	handleThermalModel(ob);
+}
+
+static void runTuningStoreTask(void* arg) {
+	ob_chain* ob = arg;
+	updateControlState(ob);
+	handleTuningStore(ob);
+}
+
+static void runChipTuningTask(void* arg) {
+	ob_chain* ob = arg;
+	updateControlState(ob);
+	handleChipTuning(ob, getTargetTemp(ob));
+}
+
+// Perform any adjustments to the voltage and bias that may be required.
+static void runStringTuningTask(void* arg) {
+	ob_chain* ob = arg;
+	updateControlState(ob);
 	handleVoltageAndBiasTuning(ob);
+}
 
-	// Exit if hashrate drops too low, as this usually means we have lost several chips.
+// Exit if hashrate drops too low, as this usually means we have lost several chips.
+static void runHashrateCheckTask(void* arg) {
+	ob_chain* ob = arg;
+	updateControlState(ob);
 	handleLowHashrateExit(ob);
 }
 
+static void runFanTask(void* arg) {
+	handleFanChange();
+}
+
+// scheduleControlTasks adds the control tasks of a board to the scheduler.
+// The fan task is shared, and added with the first board.
+static void scheduleControlTasks(ob_chain* ob) {
+	if (ob == &chains[0]) {
+		ob1ScheduleTask(&fanTask, runFanTask, NULL, FanControlPeriodMs, TASK_FAN);
+	}
+	ob1ScheduleTask(&ob->statusTask, runStatusTask, ob, StatusPeriodMs, TASK_CONTROL);
+	ob1ScheduleTask(&ob->thermalTask, runThermalTask, ob, ThermalControlPeriodMs, TASK_THERMAL);
+	ob1ScheduleTask(&ob->powerLimitTask, runPowerLimitTask, ob, PowerLimitPeriodMs, TASK_CONTROL);
+	ob1ScheduleTask(&ob->thermalModelTask, runThermalModelTask, ob, ThermalModelPeriodMs, TASK_CONTROL);
+	ob1ScheduleTask(&ob->tuningStoreTask, runTuningStoreTask, ob, TuningStorePeriodMs, TASK_CONTROL);
+	ob1ScheduleTask(&ob->chipTuningTask, runChipTuningTask, ob, ChipTuningPeriodMs, TASK_CONTROL);
+	ob1ScheduleTask(&ob->stringTuningTask, runStringTuningTask, ob, StringTuningPeriodMs, TASK_CONTROL);
+	ob1ScheduleTask(&ob->hashrateCheckTask, runHashrateCheckTask, ob, HashrateCheckPeriodMs, TASK_CONTROL);
+	ob1SetSensorAlarm(ob->staticBoardNumber, getTargetTemp(ob) + TempDeviationAcceptable, onSensorAlarm, ob);
+}
+
 ///////////////////////////////////////////////////
 // Scanwork specific helper functions start here //
 ///////////////////////////////////////////////////
@@ -1079,15 +1532,28 @@ static bool resetChipIfRequired(ob_chain* ob, uint64_t chipNum) {
 		return false;
 	}
 
-	// The chip does not need a reset if there are enough good nonces.
-	uint64_t goodNonces = ob->chipGoodNonces[chipNum];
-	uint64_t expectedNonces = msLastReset * ob->staticBoardModel.chipSpeed / 1000 / ob->staticBoardModel.nonceRange;
-	if (goodNonces >= expectedNonces) {
+	// The 5 minute rate estimate only covers the time since the last reset,
+	// so that a reset, or a voltage change, starts a fresh judgement.
+	NonceRate *rate = &ob->chipNonceRates[chipNum];
+	double now = cgtimerSeconds(&currentTime);
+	if (rate->windowStart[NONCE_RATE_5M] < cgtimerSeconds(&ob->chipResetTimes[chipNum])) {
+		mutex_lock(&ob->lock);
+		nonceRateRestart(rate, NONCE_RATE_5M, now);
+		mutex_unlock(&ob->lock);
+	}
+
+	// The chip does not need a reset unless it is confidently finding nonces
+	// slower than a working chip would. A handful of unlucky minutes is not
+	// enough to cross the upper bound.
+	double low, high;
+	double goodRate = nonceRateEstimate(rate, NONCE_RATE_5M, now, ChipResetConfidenceZ, &low, &high);
+	double minRate = (double)ob->staticBoardModel.chipSpeed / ob->staticBoardModel.nonceRange;
+	if (high >= minRate) {
 		return false;
 	}
 
 	// Reset the chip.
-	applog(LOG_ERR, "Performing a chip reset due to performance issues: %u.%u.%lld.%lld.%i", ob->staticBoardNumber, chipNum, goodNonces, expectedNonces, msLastReset);
+	applog(LOG_ERR, "Performing a chip reset due to performance issues: %u.%u.%f.%f.%f.%i", ob->staticBoardNumber, chipNum, goodRate, high, minRate, msLastReset);
 	ob->setChipNonceRange(ob, chipNum, 1);
 	for (uint8_t engineNum = 0; engineNum < ob->staticBoardModel.enginesPerChip; engineNum++) {
 		ob->startNextEngineJob(ob, chipNum, engineNum);
@@ -1096,6 +1562,9 @@ static bool resetChipIfRequired(ob_chain* ob, uint64_t chipNum) {
 	cgtimer_time(&ob->chipStartTimes[chipNum]);
 	cgtimer_time(&ob->chipResetTimes[chipNum]);
 	ob->chipGoodNonces[chipNum] = 0;
+	mutex_lock(&ob->lock);
+	nonceRateRestart(rate, NONCE_RATE_5M, cgtimerSeconds(&ob->chipResetTimes[chipNum]));
+	mutex_unlock(&ob->lock);
 
 	return true;
 }
@@ -1124,7 +1593,11 @@ static int64_t obelisk_scanwork(__maybe_unused struct thr_info* thr) {
 			cgtimer_time(&ob->chipStartTimes[chipNum]);
 			cgtimer_time(&ob->chipResetTimes[chipNum]);
 			ob->chipGoodNonces[chipNum] = 0;
+			mutex_lock(&ob->lock);
+			nonceRateStart(&ob->chipNonceRates[chipNum], cgtimerSeconds(&ob->chipResetTimes[chipNum]));
+			mutex_unlock(&ob->lock);
 		}
+		work_latency_record(cgpu, ob->bufferedWork);
 		ob->chipsStarted = true;
 	}
 
@@ -1186,6 +1659,7 @@ static int64_t obelisk_scanwork(__maybe_unused struct thr_info* thr) {
 		cgtimer_time(&ob->chipStartTimes[chipNum]);
 
 		// Check all the engines on the chip.
+		uint64_t chipGoodNoncesRead = 0;
 		for (uint8_t engineNum = 0; engineNum < ob->staticBoardModel.enginesPerChip; engineNum++) {
 			// Read any nonces that the engine found.
 			NonceSet nonceSet;
@@ -1195,6 +1669,7 @@ static int64_t obelisk_scanwork(__maybe_unused struct thr_info* thr) {
 				applog(LOG_ERR, "error reading nonces: %u.%u.%u", ob->staticBoardNumber, chipNum, engineNum);
 				continue;
 			}
+			ob->chipEngineJobs[chipNum]++;
 
 			// Check the nonces and submit them to a pool if valid.
 			for (uint8_t i = 0; i < nonceSet.count; i++) {
@@ -1210,11 +1685,14 @@ static int64_t obelisk_scanwork(__maybe_unused struct thr_info* thr) {
 				int nonceResult = ob->validNonce(ob, chipNum, engineNum, nonce);
 				if (nonceResult == 0) {
 					ob->chipBadNonces[chipNum]++;
+					ob->chipTotalBadNonces[chipNum]++;
 					applog(LOG_ERR, "HB%u: %u:%u: BAD NONCE = 0x%016llX", ob->chain_id, chipNum, engineNum, nonce);
 				}
 				if (nonceResult > 0) {
 					ob->goodNoncesFound++;
 					ob->chipGoodNonces[chipNum]++;
+					ob->chipTotalGoodNonces[chipNum]++;
+					chipGoodNoncesRead++;
 					hashesConfirmed += ob->staticBoardModel.chipDifficulty;
 				}
 				if (nonceResult == 2) {
@@ -1247,11 +1725,15 @@ static int64_t obelisk_scanwork(__maybe_unused struct thr_info* thr) {
 		cgtimer_time(&readEnd);
 		cgtimer_sub(&readEnd, &readStart, &readDuration);
 		readTotal += cgtimer_to_ms(&readDuration);
+		mutex_lock(&ob->lock);
+		nonceRateAdd(&ob->chipNonceRates[chipNum], cgtimerSeconds(&readEnd), chipGoodNoncesRead);
+		mutex_unlock(&ob->lock);
 
 		// Mark that we need a new global chip job buffered.
 		cgtimer_time(&ob->chipCheckTimes[chipNum]);
 		ob->chipWork[chipNum] = ob->bufferedWork;
 		ob->bufferWork = true;
+		work_latency_record(cgpu, ob->chipWork[chipNum]);
 	}
 
 	if (loadTotal > 500) {
@@ -1281,6 +1763,51 @@ static struct api_data* obelisk_api_stats(struct cgpu_info* cgpu)
     stats = api_add_double(stats, "chipTemp", &ob->chip_temp.curr, false);
     stats = api_add_double(stats, "hotChipTemp", &ob->hotChipTemp, false);
     stats = api_add_double(stats, "powerSupplyTemp", &ob->psu_temp.curr, false);
+    stats = api_add_double(stats, "powerEstimate", &ob->control_loop_state.stringPower, false);
+    stats = api_add_double(stats, "stringVoltage", &ob->control_loop_state.currentStringVoltage, false);
+
+    // How old the sensor values above are.
+    HashboardSnapshot snapshot = ob1GetHashboardSnapshot(ob->staticBoardNumber);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int sensorAgeMs = (now.tv_sec - snapshot.sampleTime.tv_sec) * 1000 + (now.tv_nsec - snapshot.sampleTime.tv_nsec) / 1000000;
+    stats = api_add_int(stats, "sensorAgeMs", &sensorAgeMs, true);
+    stats = api_add_uint64(stats, "sensorSamples", &snapshot.samples, true);
+
+    // What the thermal model has learned so far, -1 where it doesn't know yet.
+    ThermalModel* model = &ob->control_loop_state.thermalModel;
+    double selfHeat = thermalModelSelfHeat(model, ob->staticBoardModel.chipsPerBoard);
+    double stringHeat = thermalModelStringHeat(model);
+    double fanHeat = thermalModelFanHeat(model);
+    stats = api_add_double(stats, "thermalChipHeatPerLevel", &selfHeat, true);
+    stats = api_add_double(stats, "thermalStringHeatPerLevel", &stringHeat, true);
+    stats = api_add_double(stats, "thermalFanHeatPerPercent", &fanHeat, true);
+    stats = api_add_uint64(stats, "thermalSamples", &model->samples, false);
+
+    // Which stored tuning profile is in use.
+    int ambientBand = ob->control_loop_state.ambientBand;
+    int tuningProfiles = ob->control_loop_state.tuningStore.count;
+    stats = api_add_int(stats, "ambientBand", &ambientBand, true);
+    stats = api_add_int(stats, "tuningProfiles", &tuningProfiles, true);
+
+    // Per-chip hashrates in GH/s over each window, as "rate:low:high" per
+    // chip separated by commas. The bounds are 95% confidence.
+    static const char* windowNames[NONCE_RATE_WINDOWS] = { "chipHashrate5m", "chipHashrate1h", "chipHashrate24h" };
+    cgtimer_t statsTime;
+    cgtimer_time(&statsTime);
+    for (int window = 0; window < NONCE_RATE_WINDOWS; window++) {
+        char rates[15 * 24];
+        int len = 0;
+        for (int chipNum = 0; chipNum < ob->staticBoardModel.chipsPerBoard; chipNum++) {
+            double low, high;
+            double hashrate = chipHashrate(ob, chipNum, window, cgtimerSeconds(&statsTime), &low, &high);
+            len += snprintf(rates + len, sizeof(rates) - len, "%s%.1f:%.1f:%.1f", chipNum ? "," : "", hashrate, low, high);
+            if (len >= (int)sizeof(rates)) {
+                break;
+            }
+        }
+        stats = api_add_string(stats, (char*)windowNames[window], rates, true);
+    }
 
     // These stats are per-cgpu, but the fans are global.  cgminer has
     // no support for global stats, so just repeat the fan speeds here
@@ -1292,14 +1819,133 @@ static struct api_data* obelisk_api_stats(struct cgpu_info* cgpu)
         stats = api_add_int(stats, buffer, &ob->fan_speed[i], false);
     }
 
+    // The fan controller is global too, so it is repeated the same way.
+    double kp = opt_ob_fan_kp, ki = opt_ob_fan_ki, kd = opt_ob_fan_kd, kff = opt_ob_fan_kff;
+    stats = api_add_double(stats, "fanKp", &kp, true);
+    stats = api_add_double(stats, "fanKi", &ki, true);
+    stats = api_add_double(stats, "fanKd", &kd, true);
+    stats = api_add_double(stats, "fanKff", &kff, true);
+    stats = api_add_double(stats, "fanSetpoint", &fanPid.setpoint, false);
+    stats = api_add_double(stats, "fanControlTemp", &fanPid.temp, false);
+    stats = api_add_double(stats, "fanP", &fanPid.pTerm, false);
+    stats = api_add_double(stats, "fanI", &fanPid.iTerm, false);
+    stats = api_add_double(stats, "fanD", &fanPid.dTerm, false);
+    stats = api_add_double(stats, "fanFF", &fanPid.ffTerm, false);
+    stats = api_add_double(stats, "fanOutput", &fanPid.output, false);
+
     return stats;
 }
 
+// Append to the metrics buffer. Once it is full nothing more is written, but
+// len keeps growing so the caller can see the output was cut short.
+#define METRICS_APPEND(...)                                                    \
+	do {                                                                       \
+		if (len < (int)bufsiz) {                                               \
+			len += snprintf(buf + len, bufsiz - len, __VA_ARGS__);             \
+		} else {                                                               \
+			len += snprintf(NULL, 0, __VA_ARGS__);                             \
+		}                                                                      \
+	} while (0)
+
+#define METRICS_FAMILY(name, type, help) \
+	METRICS_APPEND("# HELP " name " " help "\n# TYPE " name " " type "\n")
+
+// Prometheus metrics for every board, for the 'metrics' API command. This
+// runs on the API thread while the boards are mining, so it only reads the
+// counters - like the stats above it takes no locks, and a value that is
+// being written at the same time may be slightly off.
+static int obelisk_get_metrics(char* buf, size_t bufsiz)
+{
+	int len = 0;
+
+	METRICS_FAMILY("obelisk_chip_good_nonces_total", "counter", "Good nonces found by each chip.");
+	for (int i = 0; i < num_chains; i++) {
+		ob_chain* ob = &chains[i];
+		for (int chipNum = 0; chipNum < ob->staticBoardModel.chipsPerBoard; chipNum++) {
+			METRICS_APPEND("obelisk_chip_good_nonces_total{board=\"%d\",chip=\"%d\"} %llu\n", i, chipNum, (unsigned long long)ob->chipTotalGoodNonces[chipNum]);
+		}
+	}
+
+	METRICS_FAMILY("obelisk_chip_bad_nonces_total", "counter", "Nonces from each chip that failed validation.");
+	for (int i = 0; i < num_chains; i++) {
+		ob_chain* ob = &chains[i];
+		for (int chipNum = 0; chipNum < ob->staticBoardModel.chipsPerBoard; chipNum++) {
+			METRICS_APPEND("obelisk_chip_bad_nonces_total{board=\"%d\",chip=\"%d\"} %llu\n", i, chipNum, (unsigned long long)ob->chipTotalBadNonces[chipNum]);
+		}
+	}
+
+	METRICS_FAMILY("obelisk_chip_engine_jobs_total", "counter", "Engine jobs each chip has finished and had read back.");
+	for (int i = 0; i < num_chains; i++) {
+		ob_chain* ob = &chains[i];
+		for (int chipNum = 0; chipNum < ob->staticBoardModel.chipsPerBoard; chipNum++) {
+			METRICS_APPEND("obelisk_chip_engine_jobs_total{board=\"%d\",chip=\"%d\"} %llu\n", i, chipNum, (unsigned long long)ob->chipEngineJobs[chipNum]);
+		}
+	}
+
+	METRICS_FAMILY("obelisk_chip_bias", "gauge", "Clock bias of each chip.");
+	for (int i = 0; i < num_chains; i++) {
+		ob_chain* ob = &chains[i];
+		for (int chipNum = 0; chipNum < ob->staticBoardModel.chipsPerBoard; chipNum++) {
+			METRICS_APPEND("obelisk_chip_bias{board=\"%d\",chip=\"%d\"} %d\n", i, chipNum, ob->control_loop_state.chipBiases[chipNum]);
+		}
+	}
+
+	METRICS_FAMILY("obelisk_chip_divider", "gauge", "Clock divider of each chip.");
+	for (int i = 0; i < num_chains; i++) {
+		ob_chain* ob = &chains[i];
+		for (int chipNum = 0; chipNum < ob->staticBoardModel.chipsPerBoard; chipNum++) {
+			METRICS_APPEND("obelisk_chip_divider{board=\"%d\",chip=\"%d\"} %u\n", i, chipNum, ob->control_loop_state.chipDividers[chipNum]);
+		}
+	}
+
+	METRICS_FAMILY("obelisk_board_work_queue_depth", "gauge", "Work items queued for each board.");
+	for (int i = 0; i < num_chains; i++) {
+		METRICS_APPEND("obelisk_board_work_queue_depth{board=\"%d\"} %d\n", i, chains[i].active_wq.num_elems);
+	}
+
+	METRICS_FAMILY("obelisk_board_voltage_level", "gauge", "String voltage level setting of each board.");
+	for (int i = 0; i < num_chains; i++) {
+		METRICS_APPEND("obelisk_board_voltage_level{board=\"%d\"} %u\n", i, chains[i].control_loop_state.currentVoltageLevel);
+	}
+
+	METRICS_FAMILY("obelisk_board_string_voltage_volts", "gauge", "Measured string voltage of each board.");
+	for (int i = 0; i < num_chains; i++) {
+		METRICS_APPEND("obelisk_board_string_voltage_volts{board=\"%d\"} %.3f\n", i, chains[i].control_loop_state.currentStringVoltage);
+	}
+
+	METRICS_FAMILY("obelisk_board_temperature_celsius", "gauge", "Temperatures of each board.");
+	for (int i = 0; i < num_chains; i++) {
+		METRICS_APPEND("obelisk_board_temperature_celsius{board=\"%d\",sensor=\"board\"} %.1f\n", i, chains[i].board_temp.curr);
+		METRICS_APPEND("obelisk_board_temperature_celsius{board=\"%d\",sensor=\"chip\"} %.1f\n", i, chains[i].chip_temp.curr);
+		METRICS_APPEND("obelisk_board_temperature_celsius{board=\"%d\",sensor=\"hotchip\"} %.1f\n", i, chains[i].hotChipTemp);
+	}
+
+	// The SPI bus is shared by all of the boards.
+	S_SPI_STATS spi;
+	GetSPIStats(&spi);
+	METRICS_FAMILY("obelisk_spi_transfers_total", "counter", "SPI transfers to the hashboards.");
+	METRICS_APPEND("obelisk_spi_transfers_total %llu\n", (unsigned long long)spi.uiTransfers);
+	METRICS_FAMILY("obelisk_spi_bytes_total", "counter", "Bytes sent over SPI to the hashboards.");
+	METRICS_APPEND("obelisk_spi_bytes_total %llu\n", (unsigned long long)spi.uiBytes);
+	METRICS_FAMILY("obelisk_spi_transfer_seconds", "histogram", "How long each SPI transfer took.");
+	uint64_t cumulative = 0;
+	for (int bucket = 0; bucket < SPI_LATENCY_BUCKETS - 1; bucket++) {
+		cumulative += spi.uiaLatencyBuckets[bucket];
+		METRICS_APPEND("obelisk_spi_transfer_seconds_bucket{le=\"%g\"} %llu\n", uiaSPILatencyBoundsUs[bucket] / 1e6, (unsigned long long)cumulative);
+	}
+	METRICS_APPEND("obelisk_spi_transfer_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)spi.uiTransfers);
+	METRICS_APPEND("obelisk_spi_transfer_seconds_sum %.6f\n", spi.uiTotalNs / 1e9);
+	METRICS_APPEND("obelisk_spi_transfer_seconds_count %llu\n", (unsigned long long)spi.uiTransfers);
+
+	return len;
+}
+
 struct device_drv obelisk_drv = {
     .drv_id = DRIVER_obelisk,
     .dname = "Obelisk SC1/DCR1",
     .name = "Obelisk",
     .drv_detect = obelisk_detect,
+    .get_metrics = obelisk_get_metrics,
     .get_api_stats = obelisk_api_stats,
     //.get_statline_before = obelisk_get_statline_before,
     .identify_device = obelisk_identify,
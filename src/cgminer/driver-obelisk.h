@@ -8,6 +8,7 @@
 #include "obelisk/Ob1Models.h"
 #include "obelisk/Ob1Utils.h"
 #include "obelisk/Ob1FanCtrl.h"
+#include "obelisk/Ob1Scheduler.h"
 #include "obelisk/err_codes.h"
 
 #define MAX_CHAIN_NUM 3
@@ -90,6 +91,22 @@ struct stringSettings {
 	uint8_t voltageLevel;
 };
 
+// fanController is the state of the PID loop that sets the fan duty from the
+// hottest board's hotChipTemp. There is one for the whole rig.
+typedef struct fanController {
+	bool   initialized;
+	double setpoint;  // Target hotChipTemp.
+	double temp;      // Hottest hotChipTemp at the last step.
+	double powerRef;  // Heat index that the feed-forward is measured from.
+	double power;     // Heat index at the last step.
+	double pTerm;
+	double iTerm;
+	double dTerm;
+	double ffTerm;
+	double output;    // Fan duty in percent, before rounding.
+	double lastTime;  // Monotonic seconds of the last step.
+} fanController;
+
 // ob_chain is essentially the global state variable for a hashboard. Each
 // hashing board has its own ob_chain.
 struct ob_chain {
@@ -117,6 +134,11 @@ struct ob_chain {
 	struct work** chipWork;           // The work structures for each chip.
 	uint64_t*     chipGoodNonces;     // The good nonce counts for each chip.
 	uint64_t*     chipBadNonces;      // The bad nonce counts for each chip.
+	uint64_t*     chipTotalGoodNonces; // Good nonce counts for each chip, never reset.
+	uint64_t*     chipTotalBadNonces;  // Bad nonce counts for each chip, never reset.
+	NonceRate*    chipNonceRates;     // Good nonce rate estimates for each chip. Written by
+	                                  // the scanwork thread under the lock; copied out to read.
+	uint64_t*     chipEngineJobs;     // Engine jobs read back from each chip, never reset.
 	uint32_t      decredEN2[15][128]; // ExtraNonce2 for decred chips.
 
 	// Work spacing timers.
@@ -164,7 +186,6 @@ struct ob_chain {
 	// Hot temp and fan speed.
 	double  hotChipTemp;
 	uint8_t fanSpeed;
-	uint8_t fanAdjustmentInterval;
 
     struct work_queue active_wq;
 
@@ -181,6 +202,16 @@ struct ob_chain {
 
     ControlLoopState control_loop_state;
 
+	// Control tasks, run by the shared scheduler thread.
+	ScheduledTask statusTask;
+	ScheduledTask thermalTask;
+	ScheduledTask powerLimitTask;
+	ScheduledTask thermalModelTask;
+	ScheduledTask tuningStoreTask;
+	ScheduledTask chipTuningTask;
+	ScheduledTask stringTuningTask;
+	ScheduledTask hashrateCheckTask;
+
     // Stats
     // This number is added to when a job completes, and the scanwork function
     // reads it, clears this and returns the number so that the hashmeter works.
@@ -371,6 +371,9 @@ struct device_drv {
 
     // DRV-global functions
     void (*drv_detect)(bool);
+    /* Write Prometheus text format metrics covering all of the driver's
+     * devices into buf, returning the length like snprintf. May be NULL. */
+    int (*get_metrics)(char*, size_t);
 
     // Device-specific functions
     void (*reinit_device)(struct cgpu_info*);
@@ -490,6 +493,9 @@ struct cgminer_pool_stats {
     uint64_t times_received;
     uint64_t bytes_received;
     uint64_t net_bytes_received;
+    uint64_t send_blocked_us;
+    uint64_t send_blocked_max_us;
+    uint64_t recv_blocked_us;
 };
 
 typedef struct temp_stats_t {
@@ -498,6 +504,18 @@ typedef struct temp_stats_t {
     double high;
 } temp_stats_t;
 
+/* Stages a new job goes through from the pool's notify arriving to the first
+ * engine hashing it, see work_latency_record() */
+enum latency_stage {
+    LATENCY_GENERATE, /* notify received -> work generated */
+    LATENCY_STAGED, /* generated -> handed to the device by get_work() */
+    LATENCY_QUEUED, /* handed to the device -> taken off its queue for the chips */
+    LATENCY_LOAD, /* buffered -> loaded onto the chips */
+    LATENCY_START, /* loaded -> first engine started */
+    LATENCY_TOTAL, /* notify received -> first engine started */
+    LATENCY_STAGES
+};
+
 struct cgpu_info {
     int cgminer_id;
     struct device_drv* drv;
@@ -574,6 +592,11 @@ struct cgpu_info {
 
     struct timeval dev_start_tv;
 
+    /* Notify to hardware latency, protected by latency_lock */
+    struct latency_hist latency[LATENCY_STAGES];
+    struct pool* latency_pool;
+    uint32_t latency_seq;
+
     /* For benchmarking only */
     int hidiff;
     int lodiff;
@@ -1127,6 +1150,18 @@ extern int opt_ob_max_hot_chip_temp_c;
 extern int opt_ob_optimization_mode;
 extern int opt_ob_reboot_min_hashrate;
 extern int opt_ob_disable_genetic_algo;
+extern int opt_ob_disable_chip_tuning;
+extern int opt_ob_tune_accept_confidence;
+extern int opt_ob_tune_reject_confidence;
+extern float opt_ob_fan_kp;
+extern float opt_ob_fan_ki;
+extern float opt_ob_fan_kd;
+extern float opt_ob_fan_kff;
+extern int opt_ob_power_limit_watts;
+extern int opt_ob_target_share_rate;
+extern int opt_ob_proxy_port;
+extern int opt_ob_proxy_batch_ms;
+extern bool opt_ob_low_latency;
 
 #define OBELISK_OPTIMIZATION_MODE_EFFICIENT    0
 #define OBELISK_OPTIMIZATION_MODE_BALANCED     1
@@ -1353,9 +1388,15 @@ struct pool {
     struct stratum_work swork;
     pthread_t stratum_sthread;
     pthread_t stratum_rthread;
+    cgsem_t stratum_rsem; /* posted by the stratum poller, see stratum_poll() */
+    pthread_mutex_t stratum_poll_lock;
+    bool stratum_polled; /* the poll thread is reading the socket */
+    time_t stratum_lastmsg;
+    bool stratum_reconnect; /* client.reconnect left for the rthread to do */
     pthread_mutex_t stratum_lock;
     struct thread_q* stratum_q;
     int sshares; /* stratum shares submitted waiting on response */
+    void* sharedup_data; /* shares already sent, see noncedup.c */
 
     /* GBT  variables */
     bool has_gbt;
@@ -1407,6 +1448,18 @@ struct pool {
     double sdiff;
     uint32_t current_height;
 
+    /* Share difficulty hints sent to the pool, see suggest_stratum_diff() */
+    double fixed_diff; /* --pool-diff: 0 lets the controller choose, < 0 never hints */
+    double suggested_diff;
+    time_t suggest_diff_time;
+    int suggest_diff_id;
+    bool suggest_diff_unsupported;
+
+    /* When the current job's notify arrived, and a count of notifies */
+    cgtimer_t tv_notify;
+    uint32_t notify_seq;
+    struct latency_hist latency[LATENCY_STAGES]; /* protected by latency_lock */
+
     struct timeval tv_lastwork;
 };
 
@@ -1493,6 +1546,14 @@ struct work {
     struct timeval tv_work_found;
     char getwork_mode;
 
+    // Monotonic times this work passed each stage on its way to the hardware
+    uint32_t notify_seq;
+    cgtimer_t tv_notify;
+    cgtimer_t tv_generated;
+    cgtimer_t tv_dispatched;
+    cgtimer_t tv_buffered;
+    cgtimer_t tv_loaded;
+
     // Fields used to pass the nonce in the copied work struct when submitting a nonce
     Nonce nonce_to_submit;
     uint32_t extranonce2_to_submit;
@@ -1677,7 +1738,35 @@ extern struct api_data* api_add_avg(struct api_data* root, char* name, float* da
 extern void dupalloc(struct cgpu_info* cgpu, int timelimit);
 extern void dupcounters(struct cgpu_info* cgpu, uint64_t* checked, uint64_t* dups);
 extern bool isdupnonce(struct cgpu_info* cgpu, struct work* work, Nonce nonce);
+extern void sharedupalloc(struct pool* pool, int timelimit);
+extern void sharedupcounters(struct pool* pool, uint64_t* checked, uint64_t* dups);
+extern bool isdupshare(struct pool* pool, struct work* work, Nonce nonce, uint32_t extranonce2);
+
+/* Stratum proxy, see proxy.c */
+struct proxy_client_info {
+    int slot;
+    char addr[46];
+    char worker[64];
+    char nonce1[64];
+    time_t connected;
+    uint64_t accepted;
+    uint64_t rejected;
+};
+
+extern void stratum_parse(struct pool* pool, char* s);
+
+extern void proxy_init(void);
+extern void proxy_notify(struct pool* pool, const char* s);
+extern void proxy_diff(struct pool* pool, const char* s);
+extern bool proxy_share_result(struct pool* pool, int id, json_t* res_val, json_t* err_val);
+extern int proxy_client_info(struct proxy_client_info* info, int max);
+extern void proxy_counters(uint64_t* accepted, uint64_t* rejected);
+extern uint64_t proxy_local_nonce2(uint64_t nonce2);
 
 extern int get_total_work(void);
 
+extern const char* latency_stage_names[LATENCY_STAGES];
+extern pthread_mutex_t latency_lock;
+extern void work_latency_record(struct cgpu_info* cgpu, struct work* work);
+
 #endif /* __MINER_H__ */
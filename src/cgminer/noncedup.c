@@ -97,3 +97,122 @@ bool isdupnonce(struct cgpu_info* cgpu, struct work* work, Nonce nonce)
 
     return !unique;
 }
+
+/* Shares already sent to a pool. Unlike the nonce list above, which only
+ * catches a device returning the same nonce for the same work item, this is
+ * keyed on everything that makes a share unique to the pool: job id, ntime,
+ * extranonce2 and nonce. A chip that is reset and handed the same job again
+ * will rediscover the same shares with a different work item, and only this
+ * check can see that.
+ *
+ * The table is open addressed with a short bounded probe. Each slot holds a
+ * 64 bit fingerprint of the share and when it was recorded, slots older than
+ * the time limit are treated as empty, and when a probe finds no free slot
+ * the oldest one in the probe is reused, so memory never grows. */
+#define SHAREDUP_SLOTS 4096
+#define SHAREDUP_PROBE 16
+
+typedef struct sitem {
+    uint64_t key;
+    time_t when;
+} SITEM;
+
+struct sharedupdata {
+    int timelimit;
+    SITEM slots[SHAREDUP_SLOTS];
+    uint64_t checked;
+    uint64_t dups;
+};
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t len)
+{
+    const unsigned char* p = data;
+
+    while (len--) {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t sharekey(struct work* work, Nonce nonce, uint32_t extranonce2)
+{
+    uint64_t key = 0xcbf29ce484222325ULL;
+
+    if (work->job_id)
+        key = fnv1a(key, work->job_id, strlen(work->job_id) + 1);
+    if (work->ntime)
+        key = fnv1a(key, work->ntime, strlen(work->ntime) + 1);
+    key = fnv1a(key, &extranonce2, sizeof(extranonce2));
+    key = fnv1a(key, &nonce, sizeof(nonce));
+
+    /* Zero marks an unused slot */
+    return key ? key : 1;
+}
+
+void sharedupalloc(struct pool* pool, int timelimit)
+{
+    struct sharedupdata* dup;
+
+    dup = calloc(1, sizeof(*dup));
+    if (unlikely(!dup))
+        quithere(1, "Failed to calloc sharedupdata");
+
+    dup->timelimit = timelimit;
+
+    pool->sharedup_data = dup;
+}
+
+void sharedupcounters(struct pool* pool, uint64_t* checked, uint64_t* dups)
+{
+    struct sharedupdata* dup = (struct sharedupdata*)(pool->sharedup_data);
+
+    if (!dup) {
+        *checked = 0;
+        *dups = 0;
+    } else {
+        *checked = dup->checked;
+        *dups = dup->dups;
+    }
+}
+
+/* Returns true if the share has already been seen within the time limit,
+ * otherwise records it and returns false. Only the pool's stratum send thread
+ * calls this, so the table itself needs no locking. */
+bool isdupshare(struct pool* pool, struct work* work, Nonce nonce, uint32_t extranonce2)
+{
+    struct sharedupdata* dup = (struct sharedupdata*)(pool->sharedup_data);
+    SITEM *slot, *freeslot = NULL;
+    uint64_t key;
+    time_t now;
+    int i, home;
+
+    if (!dup)
+        return false;
+
+    now = time(NULL);
+    key = sharekey(work, nonce, extranonce2);
+    home = key % SHAREDUP_SLOTS;
+    dup->checked++;
+
+    for (i = 0; i < SHAREDUP_PROBE; i++) {
+        slot = &dup->slots[(home + i) % SHAREDUP_SLOTS];
+        if (!slot->key || now - slot->when > dup->timelimit) {
+            if (!freeslot || freeslot->key)
+                freeslot = slot;
+            slot->key = 0;
+            continue;
+        }
+        if (slot->key == key) {
+            dup->dups++;
+            return true;
+        }
+        if (!freeslot || (freeslot->key && slot->when < freeslot->when))
+            freeslot = slot;
+    }
+
+    freeslot->key = key;
+    freeslot->when = now;
+
+    return false;
+}
@@ -382,8 +382,7 @@ static int iMCP9903ReadReg(uint8_t uiBoard, uint8_t uiReg)
     sMPC9903TwiXferBuf.uiCount = MCP9903_READ_BUFF_SIZE;
     sMPC9903TwiXferBuf.puiaData = ucaMCP990XInBuf;
 
-    iResult = iTWIInitXFer(&sMPC9903TwiXferBuf);
-    usleep(1000);  // TODO: Reduce this sleep
+    iResult = iTWIInitXFer(&sMPC9903TwiXferBuf); // completes before returning
 
     return (iResult);
 
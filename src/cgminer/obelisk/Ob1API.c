@@ -639,6 +639,8 @@ bool ob1IsMasterHashClockEnabled(uint8_t boardNum)
 // Miner/Board-level API
 //==================================================================================================
 
+static void ob1StartSensorSampler();
+
 // Run a basic initialization process for the system.
 // Checks that each board is working and are all of the same type and saves the type into
 // gHashboardModel (HashboardModel::SC1 or HashboardModel::DCR1).
@@ -666,23 +668,34 @@ ApiError ob1Initialize()
         ob1SetRedLEDOn();
     }
 
+    // Sensors are read in the background from here on.
+    ob1StartSensorSampler();
+
 	// Leave the LEDs off if initialization is successful.
     return SUCCESS;
 }
 
 // If there is an error reading any of the values, the returned object's error
-// field will contain an error code.
-HashboardStatus ob1GetHashboardStatus(uint8_t boardNum)
+// field will contain an error code. A faulted temperature sensor reads as
+// TEMP_SENSOR_FAULT_VALUE or above rather than failing, so that counts too.
+HashboardStatus ob1ReadHashboardStatus(uint8_t boardNum)
 {
     LOCK(&statusLock);
-    // TODO: Wrap in a mutex to control access to the temp/voltage sensors
     HashboardStatus status;
-    iUpdateTempSensors(boardNum);
+    status.error = SUCCESS;
+    if (iUpdateTempSensors(boardNum) != ERR_NONE) {
+        status.error = GENERIC_ERROR;
+    }
     status.boardTemp = (double)getBoardTempInt(boardNum);
     status.chipTemp = (double)getAsicTempInt(boardNum);
     status.powerSupplyTemp = (double)getPSTempInt(boardNum);
+    if (status.chipTemp >= TEMP_SENSOR_FAULT_VALUE) {
+        status.error = GENERIC_ERROR;
+    }
 
-    iADS1015ReadVoltages(boardNum); // Update the voltages
+    if (iADS1015ReadVoltages(boardNum) != ERR_NONE) { // Update the voltages
+        status.error = GENERIC_ERROR;
+    }
     status.asicV1 = getASIC_V1(boardNum);
     status.asicV15 = getASIC_V15(boardNum);
     status.asicV15IO = getASIC_V15IO(boardNum);
@@ -691,6 +704,128 @@ HashboardStatus ob1GetHashboardStatus(uint8_t boardNum)
     return status;
 }
 
+// The sensors are sampled by a single thread, one board per slot in turn, so
+// every board is sampled once per SENSOR_SAMPLE_PERIOD_MS whether or not the
+// other boards are present.
+#define SENSOR_SAMPLE_PERIOD_MS 500
+
+// Each board's latest sample is published under a sequence lock. The sampler
+// thread is the only writer; readers copy the snapshot and retry if the
+// sequence number was odd or changed while they were copying, so they never
+// wait on the I2C bus.
+typedef struct {
+    volatile uint32_t seq;
+    HashboardSnapshot snapshot;
+} SensorSlot;
+
+static SensorSlot sensorSlots[MAX_NUMBER_OF_HASH_BOARDS];
+
+// A board's alarm fires from the sampler thread when its chip temperature
+// rises through the threshold, so the control loop can react to it right away
+// rather than at its next scheduled check.
+typedef struct {
+    volatile double threshold;
+    SensorAlarmHandler handler;
+    void* arg;
+    bool above;
+} SensorAlarm;
+
+static SensorAlarm sensorAlarms[MAX_NUMBER_OF_HASH_BOARDS];
+
+void ob1SetSensorAlarm(uint8_t boardNum, double chipTempAbove, SensorAlarmHandler handler, void* arg)
+{
+    SensorAlarm* alarm = &sensorAlarms[boardNum];
+    alarm->arg = arg;
+    alarm->handler = handler;
+    alarm->threshold = chipTempAbove;
+}
+
+static void checkSensorAlarm(uint8_t boardNum, HashboardStatus* status)
+{
+    SensorAlarm* alarm = &sensorAlarms[boardNum];
+    if (alarm->handler == NULL || status->error != SUCCESS) {
+        return;
+    }
+    bool above = status->chipTemp > alarm->threshold;
+    if (above && !alarm->above) {
+        alarm->handler(boardNum, alarm->arg);
+    }
+    alarm->above = above;
+}
+
+static void sampleHashboard(uint8_t boardNum)
+{
+    SensorSlot* slot = &sensorSlots[boardNum];
+    HashboardSnapshot snapshot;
+    snapshot.status = ob1ReadHashboardStatus(boardNum);
+    snapshot.fanRPM[0] = ob1GetFanRPM(0);
+    snapshot.fanRPM[1] = ob1GetFanRPM(1);
+    clock_gettime(CLOCK_MONOTONIC, &snapshot.sampleTime);
+    snapshot.samples = slot->snapshot.samples + 1;
+
+    slot->seq++;
+    __sync_synchronize();
+    memcpy((void*)&slot->snapshot, &snapshot, sizeof(snapshot));
+    __sync_synchronize();
+    slot->seq++;
+
+    checkSensorAlarm(boardNum, &snapshot.status);
+}
+
+HashboardSnapshot ob1GetHashboardSnapshot(uint8_t boardNum)
+{
+    SensorSlot* slot = &sensorSlots[boardNum];
+    HashboardSnapshot snapshot;
+    uint32_t seq;
+    do {
+        seq = slot->seq;
+        __sync_synchronize();
+        memcpy(&snapshot, (void*)&slot->snapshot, sizeof(snapshot));
+        __sync_synchronize();
+    } while ((seq & 1) != 0 || seq != slot->seq);
+    return snapshot;
+}
+
+HashboardStatus ob1GetHashboardStatus(uint8_t boardNum)
+{
+    return ob1GetHashboardSnapshot(boardNum).status;
+}
+
+static void* ob1SensorThread(void* arg)
+{
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (uint8_t boardNum = 0;; boardNum = (boardNum + 1) % MAX_NUMBER_OF_HASH_BOARDS) {
+        if (isBoardPresent(boardNum)) {
+            sampleHashboard(boardNum);
+        }
+
+        // Sleep until the next slot on an absolute schedule, so the time
+        // spent reading doesn't push the cadence out.
+        next.tv_nsec += SENSOR_SAMPLE_PERIOD_MS / MAX_NUMBER_OF_HASH_BOARDS * 1000000L;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+// Take a first sample of every board so that readers never see an empty
+// snapshot, then start the sampler thread.
+static void ob1StartSensorSampler()
+{
+    for (uint8_t boardNum = 0; boardNum < MAX_NUMBER_OF_HASH_BOARDS; boardNum++) {
+        sensorSlots[boardNum].snapshot.status.error = GENERIC_ERROR;
+        if (isBoardPresent(boardNum)) {
+            sampleHashboard(boardNum);
+        }
+    }
+    pthread_t pth;
+    pthread_create(&pth, NULL, ob1SensorThread, NULL);
+}
+
 // Valid values for voltage range from 8.5 to 10.0.  Since voltage is actually
 // controlled in a discrete, stepwise fashion, the code will select the
 // nearest value without going over the specified voltage.
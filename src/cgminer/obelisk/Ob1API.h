@@ -79,10 +79,25 @@ bool ob1IsMasterHashClockEnabled(uint8_t boardNum);
 // installed, or fatal error of some sort).
 ApiError ob1Initialize();
 
-// If there is an error reading any of the values, the returned object's error
-// field will contain an error code.
+// Returns the board's sensor values from the latest sample. This does not
+// touch the I2C bus, so it never blocks. If there was an error reading any of
+// the values, the returned object's error field will contain an error code.
 HashboardStatus ob1GetHashboardStatus(uint8_t boardNum);
 
+// Returns the latest sample of the board's sensors, along with the fan speeds
+// and the time it was taken.
+HashboardSnapshot ob1GetHashboardSnapshot(uint8_t boardNum);
+
+// Called from the sensor sampler thread when a board's chip temperature rises
+// above the alarm threshold. Handlers must not block.
+typedef void (*SensorAlarmHandler)(uint8_t boardNum, void* arg);
+void ob1SetSensorAlarm(uint8_t boardNum, double chipTempAbove, SensorAlarmHandler handler, void* arg);
+
+// Reads the board's temperature and voltage sensors directly. This blocks on
+// the I2C bus for several milliseconds, and is normally only called by the
+// sensor sampler thread.
+HashboardStatus ob1ReadHashboardStatus(uint8_t boardNum);
+
 // Values for voltage are about 12 to 127, and 127 is the lowest voltage.
 ApiError ob1SetStringVoltage(uint8_t boardNum, uint8_t voltage);
 
@@ -3,6 +3,7 @@
 #include "obelisk-model.h"
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 #include "CSS_SC1Defines.h"
 #include "CSS_DCR1Defines.h"
 
@@ -61,6 +62,15 @@ typedef struct {
     double powerSupply12V;
 } HashboardStatus;
 
+// HashboardSnapshot is the latest sensor sample of a board, as published by
+// the sensor sampler thread.
+typedef struct {
+    HashboardStatus status;
+    uint32_t fanRPM[2];
+    struct timespec sampleTime; // CLOCK_MONOTONIC time the sample was taken
+    uint64_t samples;           // Number of samples taken of this board
+} HashboardSnapshot;
+
 #define MAX_NONCE_FIFO_LENGTH 8
 
 #if (ALGO == BLAKE2B)
@@ -33,6 +33,14 @@ typedef struct hashBoardModel {
 	uint8_t  defaultMaxBiasLevel;
 	uint8_t  defaultStringIncrements;
 	uint64_t nonceRange;
+
+	// Power information. A string at referenceStringVoltage with every chip at
+	// referenceBiasLevel draws about dynamicStringWatts for switching plus
+	// staticStringWatts of leakage.
+	double  referenceStringVoltage;
+	uint8_t referenceBiasLevel;
+	double  dynamicStringWatts;
+	double  staticStringWatts;
 } hashBoardModel;
 
 // miningRigModel defines a few of the physical, unchanging parameters of a
@@ -69,7 +77,12 @@ struct hashBoardModel HASHBOARD_MODEL_SC1A = {
 	.chipSpeed               = 100000000ULL, // 100 MHz
 	.defaultMaxBiasLevel     = 22,           // Corresponds to a /2.-4
 	.defaultStringIncrements = 16,
-	.nonceRange              = 4294967296ULL // 2^32
+	.nonceRange              = 4294967296ULL, // 2^32
+
+	.referenceStringVoltage = 9.0,
+	.referenceBiasLevel     = 22,
+	.dynamicStringWatts     = 130,
+	.staticStringWatts      = 20
 };
 
 // HASHBOARD_MODEL_DCR1A defines the parameters for our DCR1A hashing card.
@@ -98,7 +111,12 @@ struct hashBoardModel HASHBOARD_MODEL_DCR1A = {
 	.chipSpeed               = 100000000ULL, // 100 MHz
 	.defaultMaxBiasLevel     = 22,           // Corresponds to a /2.-4
 	.defaultStringIncrements = 16,
-	.nonceRange              = 4294967296ULL // 2^32
+	.nonceRange              = 4294967296ULL, // 2^32
+
+	.referenceStringVoltage = 9.0,
+	.referenceBiasLevel     = 22,
+	.dynamicStringWatts     = 130,
+	.staticStringWatts      = 20
 };
 
 // MINING_RIG_MODEL_OB1 defines the parameters for our OB1 mining rig.
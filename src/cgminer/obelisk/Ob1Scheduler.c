@@ -0,0 +1,239 @@
+// Obelisk control task scheduler
+//
+// A single-level timer wheel. Each task sits in the slot of the tick it is due
+// at; a task due more than WHEEL_SLOTS ticks out simply stays in its slot
+// until the wheel has come round enough times. The thread sleeps until the
+// next due tick instead of waking every tick, and is woken early when a task
+// is triggered. Each scheduler thread has a wheel of its own.
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "Ob1Scheduler.h"
+#include "miner.h"
+
+#define SCHEDULER_TICK_MS 250
+#define WHEEL_SLOTS 64
+
+typedef struct Scheduler {
+    const char* threadName;
+    pthread_cond_t cond;
+    ScheduledTask* wheel[WHEEL_SLOTS];
+    uint64_t processedTick;
+    bool triggerPending;
+} Scheduler;
+
+// One lock covers both schedulers; it is never held while a task runs.
+static pthread_mutex_t schedulerLock = PTHREAD_MUTEX_INITIALIZER;
+static bool schedulerInitialized;
+static struct timespec schedulerEpoch;
+static Scheduler controlScheduler = { .threadName = "ob_control" };
+static Scheduler fanScheduler = { .threadName = "ob_fan" };
+
+// Must be called with schedulerLock held.
+static void schedulerInit()
+{
+    if (schedulerInitialized) {
+        return;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&controlScheduler.cond, &attr);
+    pthread_cond_init(&fanScheduler.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    clock_gettime(CLOCK_MONOTONIC, &schedulerEpoch);
+    schedulerInitialized = true;
+}
+
+static uint64_t currentTick()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ms = (now.tv_sec - schedulerEpoch.tv_sec) * 1000 + (now.tv_nsec - schedulerEpoch.tv_nsec) / 1000000;
+    return ms / SCHEDULER_TICK_MS;
+}
+
+static void wheelInsert(ScheduledTask* task)
+{
+    ScheduledTask** slot = &task->scheduler->wheel[task->dueTick % WHEEL_SLOTS];
+    task->next = *slot;
+    *slot = task;
+}
+
+// Move the tasks of one slot that are ready to run onto 'ready', or onto
+// 'urgent' for the tasks that go first.
+static void collectSlot(Scheduler* s, int slot, uint64_t now, ScheduledTask** ready, ScheduledTask** urgent)
+{
+    ScheduledTask** p = &s->wheel[slot];
+    while (*p != NULL) {
+        ScheduledTask* task = *p;
+        if (task->dueTick <= now || task->triggered) {
+            ScheduledTask** list = task->urgent ? urgent : ready;
+            *p = task->next;
+            task->next = *list;
+            *list = task;
+        } else {
+            p = &task->next;
+        }
+    }
+}
+
+// Returns the earliest tick any task is due at, or UINT64_MAX if there are no
+// tasks.
+static uint64_t nextDueTick(Scheduler* s, uint64_t now)
+{
+    // Nearly every task is due within one turn of the wheel, so look at the
+    // slots ahead first.
+    for (uint64_t tick = now + 1; tick <= now + WHEEL_SLOTS; tick++) {
+        for (ScheduledTask* task = s->wheel[tick % WHEEL_SLOTS]; task != NULL; task = task->next) {
+            if (task->dueTick == tick) {
+                return tick;
+            }
+        }
+    }
+    uint64_t next = UINT64_MAX;
+    for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+        for (ScheduledTask* task = s->wheel[slot]; task != NULL; task = task->next) {
+            if (task->dueTick < next) {
+                next = task->dueTick;
+            }
+        }
+    }
+    return next;
+}
+
+static void* ob1SchedulerThread(void* arg)
+{
+    Scheduler* s = arg;
+    RenameThread(s->threadName);
+
+    pthread_mutex_lock(&schedulerLock);
+    while (true) {
+        uint64_t now = currentTick();
+
+        // Gather every task that is due, plus any that were triggered. After
+        // a stall longer than a turn of the wheel, every slot is looked at.
+        ScheduledTask* ready = NULL;
+        ScheduledTask* urgent = NULL;
+        if (s->triggerPending || now - s->processedTick >= WHEEL_SLOTS) {
+            for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+                collectSlot(s, slot, now, &ready, &urgent);
+            }
+        } else {
+            for (uint64_t tick = s->processedTick + 1; tick <= now; tick++) {
+                collectSlot(s, tick % WHEEL_SLOTS, now, &ready, &urgent);
+            }
+        }
+        s->processedTick = now;
+        s->triggerPending = false;
+
+        while (urgent != NULL || ready != NULL) {
+            // A task triggered while the others ran may be urgent, so put
+            // back what is left and gather again. The tasks put back are
+            // still due, so they are picked up straight away.
+            if (s->triggerPending) {
+                while (urgent != NULL) {
+                    ScheduledTask* task = urgent;
+                    urgent = task->next;
+                    wheelInsert(task);
+                }
+                while (ready != NULL) {
+                    ScheduledTask* task = ready;
+                    ready = task->next;
+                    wheelInsert(task);
+                }
+                break;
+            }
+
+            ScheduledTask* task;
+            if (urgent != NULL) {
+                task = urgent;
+                urgent = task->next;
+            } else {
+                task = ready;
+                ready = task->next;
+            }
+            bool triggered = task->triggered && task->dueTick > now;
+            task->triggered = false;
+
+            pthread_mutex_unlock(&schedulerLock);
+            task->fn(task->arg);
+            pthread_mutex_lock(&schedulerLock);
+
+            // Keep to the task's cadence, but don't try to catch up on runs
+            // that were missed. A triggered run starts a new period.
+            task->runs++;
+            task->dueTick += task->periodTicks;
+            if (triggered || task->dueTick <= now) {
+                task->dueTick = now + task->periodTicks;
+            }
+            wheelInsert(task);
+        }
+
+        if (s->triggerPending) {
+            continue;
+        }
+        uint64_t next = nextDueTick(s, now);
+        if (next == UINT64_MAX) {
+            pthread_cond_wait(&s->cond, &schedulerLock);
+            continue;
+        }
+        uint64_t ms = next * SCHEDULER_TICK_MS;
+        struct timespec wake = schedulerEpoch;
+        wake.tv_sec += ms / 1000;
+        wake.tv_nsec += (ms % 1000) * 1000000;
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_nsec -= 1000000000L;
+            wake.tv_sec++;
+        }
+        pthread_cond_timedwait(&s->cond, &schedulerLock, &wake);
+    }
+    pthread_mutex_unlock(&schedulerLock);
+    return NULL;
+}
+
+void ob1ScheduleTask(ScheduledTask* task, ScheduledFn fn, void* arg, uint32_t periodMs, TaskClass taskClass)
+{
+    pthread_mutex_lock(&schedulerLock);
+    schedulerInit();
+    memset(task, 0, sizeof(*task));
+    task->fn = fn;
+    task->arg = arg;
+    task->scheduler = taskClass == TASK_FAN ? &fanScheduler : &controlScheduler;
+    task->urgent = taskClass == TASK_THERMAL;
+    task->periodTicks = (periodMs + SCHEDULER_TICK_MS - 1) / SCHEDULER_TICK_MS;
+    if (task->periodTicks == 0) {
+        task->periodTicks = 1;
+    }
+    task->dueTick = currentTick() + task->periodTicks;
+    wheelInsert(task);
+    pthread_cond_signal(&task->scheduler->cond);
+    pthread_mutex_unlock(&schedulerLock);
+}
+
+void ob1TriggerTask(ScheduledTask* task)
+{
+    pthread_mutex_lock(&schedulerLock);
+    if (task->scheduler == NULL) {
+        // Not scheduled yet.
+        pthread_mutex_unlock(&schedulerLock);
+        return;
+    }
+    task->triggered = true;
+    task->scheduler->triggerPending = true;
+    pthread_cond_signal(&task->scheduler->cond);
+    pthread_mutex_unlock(&schedulerLock);
+}
+
+void ob1StartScheduler()
+{
+    pthread_mutex_lock(&schedulerLock);
+    schedulerInit();
+    controlScheduler.processedTick = currentTick();
+    fanScheduler.processedTick = controlScheduler.processedTick;
+    pthread_mutex_unlock(&schedulerLock);
+
+    pthread_t pth;
+    pthread_create(&pth, NULL, ob1SchedulerThread, &controlScheduler);
+    pthread_create(&pth, NULL, ob1SchedulerThread, &fanScheduler);
+}
@@ -0,0 +1,46 @@
+// Obelisk control task scheduler
+#ifndef __OB1SCHEDULER__
+#define __OB1SCHEDULER__
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef void (*ScheduledFn)(void* arg);
+
+// TaskClass decides where a task runs. Control and thermal tasks share the
+// control thread, one at a time, with due thermal tasks run ahead of due
+// control tasks. Fan tasks have a thread of their own, so the fans keep their
+// cadence however long a board's control task blocks on the hardware.
+typedef enum TaskClass {
+    TASK_CONTROL = 0,
+    TASK_THERMAL,
+    TASK_FAN,
+} TaskClass;
+
+struct Scheduler;
+
+// ScheduledTask is a periodic task run by a scheduler thread. The struct is
+// owned by the caller and must stay valid for as long as it is scheduled.
+typedef struct ScheduledTask {
+    ScheduledFn fn;
+    void* arg;
+    uint32_t periodTicks;
+    uint64_t dueTick;  // Tick the task next runs at
+    bool triggered;    // Run at the next wakeup rather than waiting for dueTick
+    bool urgent;       // Run ahead of the other due tasks on its thread
+    uint64_t runs;
+    struct Scheduler* scheduler;
+    struct ScheduledTask* next;
+} ScheduledTask;
+
+// ob1ScheduleTask adds a task that runs every 'periodMs', the first time one
+// period from now. Tasks may be added before or after the scheduler starts.
+void ob1ScheduleTask(ScheduledTask* task, ScheduledFn fn, void* arg, uint32_t periodMs, TaskClass taskClass);
+
+// ob1TriggerTask makes a task run as soon as its scheduler thread is free,
+// and restarts its period from then. It is safe to call from any thread.
+void ob1TriggerTask(ScheduledTask* task);
+
+// ob1StartScheduler starts the threads that run the scheduled tasks.
+void ob1StartScheduler();
+
+#endif
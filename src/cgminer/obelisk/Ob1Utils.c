@@ -12,7 +12,10 @@
 #include "multicast.h"
 #include "miner.h"
 #include <string.h>
+#include <stdlib.h>
 #include <pthread.h>
+#include <math.h>
+#include <inttypes.h>
 
 // Locks for thread safety of the API
 pthread_mutex_t spiLock;
@@ -660,6 +663,13 @@ static GenChild breedChild(ControlLoopState *state)
     } else if (mutationFrequency == 1) {
         child.voltageLevel--;
     }
+    // When the chips are tuned individually, the child carries the current
+    // chip settings forward untouched and only the voltage is searched.
+    if (state->chipTuning) {
+        memcpy(child.chipBiases, state->chipBiases, sizeof(child.chipBiases));
+        memcpy(child.chipDividers, state->chipDividers, sizeof(child.chipDividers));
+        return child;
+    }
     for (uint8_t i = 0; i < sizeof(child.chipBiases); i++) {
         r = *randByte++;
         if (mutationFrequency == 0) {
@@ -734,59 +744,828 @@ void geneticAlgoIter(ControlLoopState *state)
     memcpy(state->chipDividers, state->curChild.chipDividers, sizeof(state->chipDividers));
 }
 
-ApiError loadThermalConfig(char *name, int boardID, ControlLoopState *state)
+// Every objective is a hashrate times a weight that depends only on power, so
+// a setting's score stays proportional to the nonces it finds. That keeps the
+// nonce statistics in the tuners valid whatever the objective.
+double objectiveWeight(double watts, double wattBudget)
+{
+    double weight = 1;
+    if (watts > 0) {
+        if (opt_ob_optimization_mode == OBELISK_OPTIMIZATION_MODE_EFFICIENT) {
+            weight = 1 / watts;
+        } else if (opt_ob_optimization_mode == OBELISK_OPTIMIZATION_MODE_BALANCED) {
+            weight = 1 / sqrt(watts);
+        }
+    }
+
+    // A setting over the power budget is only kept until the power limit
+    // pulls it back, so score it as if its hashrate were cut down to fit.
+    if (wattBudget > 0 && watts > wattBudget) {
+        double fit = wattBudget / watts;
+        weight *= fit * fit;
+    }
+    return weight;
+}
+
+// Bumped whenever the objective changes at runtime.
+static volatile uint32_t objectiveGeneration;
+
+// objectiveChanged is called after --ob-optimization-mode or
+// --ob-power-limit-watts has been changed at runtime. It is safe to call from
+// any thread.
+void objectiveChanged()
+{
+    __sync_fetch_and_add(&objectiveGeneration, 1);
+}
+
+// objectiveResetIfChanged drops every score the tuners hold if the objective
+// has changed since they were taken, as they are in the old objective's
+// units. The genetic algo starts a new population from the current child, and
+// each chip re-measures its current setting as its baseline. 'true' is
+// returned if anything was reset.
+bool objectiveResetIfChanged(ControlLoopState *state)
+{
+    uint32_t generation = objectiveGeneration;
+    if (state->objectiveGeneration == generation) {
+        return false;
+    }
+    state->objectiveGeneration = generation;
+    state->populationSize = 0;
+    for (size_t i = 0; i < sizeof(state->chipTune) / sizeof(state->chipTune[0]); i++) {
+        ChipTuneState *t = &state->chipTune[i];
+        t->startTime = 0;
+        t->baselineScore = 0;
+        t->baselineSigma = 0;
+    }
+    return true;
+}
+
+// The genetic algo's early decision treats a child within this fraction of the
+// reference rate as a tie, to be settled by the full evaluation period.
+#define SprtIndifferenceMargin 0.05
+
+// sprtPoisson runs a sequential probability ratio test on a Poisson process
+// that has produced 'events' arrivals in 'seconds', weighing a rate of
+// 'rateHigh' against a rate of 'rateLow'. 'alpha' is the accepted chance of
+// wrongly picking the high rate and 'beta' of wrongly picking the low rate.
+// 1 is returned once the high rate is accepted, -1 once the low rate is
+// accepted, and 0 while more samples are needed.
+int sprtPoisson(uint64_t events, double seconds, double rateLow, double rateHigh, double alpha, double beta)
+{
+    double llr = events * log(rateHigh / rateLow) - (rateHigh - rateLow) * seconds;
+    if (llr >= log((1 - beta) / alpha)) {
+        return 1;
+    }
+    if (llr <= log(beta / (1 - alpha))) {
+        return -1;
+    }
+    return 0;
+}
+
+// geneticAlgoEarlyDecision tests whether the current child has already shown
+// itself to be clearly better or clearly worse than the weakest member of the
+// population, which is the one it would replace. 'goodNonces' nonces of
+// 'chipDifficulty' were found in the 'seconds' the child has been running, and
+// 'weight' is the child's objectiveWeight. The result is that of sprtPoisson;
+// 0 means keep evaluating.
+int geneticAlgoEarlyDecision(ControlLoopState *state, uint64_t goodNonces, double seconds, uint64_t chipDifficulty, double weight, double alpha, double beta)
+{
+    // Until the population is full every child is kept, so there is nothing
+    // to decide early.
+    if (state->populationSize < POPULATION_SIZE) {
+        return 0;
+    }
+    if (weight <= 0) {
+        return 0;
+    }
+    double refRate = state->population[findWorstChild(state)].fitness / weight / chipDifficulty;
+    if (refRate <= 0 || seconds <= 0) {
+        return 0;
+    }
+    return sprtPoisson(goodNonces, seconds, refRate * (1 - SprtIndifferenceMargin), refRate * (1 + SprtIndifferenceMargin), alpha, beta);
+}
+
+// Minimum and maximum length of a per-chip measurement window, in seconds.
+// The window closes once ChipTuneMinNonces good nonces have been seen, so fast
+// chips settle in about a minute while slow chips are capped at half an hour.
+#define ChipTuneMinSeconds 60
+#define ChipTuneMaxSeconds 1800
+#define ChipTuneMinNonces 200
+
+// A bad nonce is work the chip did for nothing and is usually the first sign
+// of a chip clocked past what it can sustain, so it is weighed against the
+// chip's good nonces.
+#define ChipTuneBadNoncePenalty 4
+
+// Above this fraction of bad nonces a chip is only ever stepped down.
+#define ChipTuneMaxBadRatio 0.02
+
+// How many standard deviations a trial has to beat its baseline by to be kept.
+// A window of ChipTuneMinNonces nonces has about 7% Poisson noise, more than a
+// single bias step gains, so without a margin the climb would follow the noise.
+#define ChipTuneSignificance 2.0
+
+static void chipTuneRestart(ChipTuneState *t, time_t now, uint64_t goodNonces, uint64_t badNonces)
+{
+    t->startTime = now;
+    t->startGood = goodNonces;
+    t->startBad = badNonces;
+}
+
+// chipTuneIter advances the hill climb of a single chip, given the chip's
+// running totals of good and bad nonces. 'allowIncrease' is false when the
+// string has no thermal or power headroom left for faster clocks, and 'weight'
+// is the objectiveWeight of the chip at its current setting. 'true' is
+// returned if the chip's bias or divider changed and needs to be written to
+// the chip.
+bool chipTuneIter(ControlLoopState *state, uint8_t chipNum, uint64_t goodNonces, uint64_t badNonces, bool allowIncrease, double weight)
+{
+    ChipTuneState *t = &state->chipTune[chipNum];
+    int8_t *bias = &state->chipBiases[chipNum];
+    uint8_t *divider = &state->chipDividers[chipNum];
+    time_t now = state->currentTime;
+
+    // A string-wide bias or voltage change moves every chip at once, which
+    // invalidates whatever this chip was measuring. Keep the setting the
+    // string gave us and measure it from scratch.
+    if (t->startTime == 0 || t->startTime <= state->prevBiasChangeTime) {
+        if (t->direction == 0) {
+            t->direction = 1;
+        }
+        t->phase = CHIP_TUNE_BASELINE;
+        chipTuneRestart(t, now, goodNonces, badNonces);
+        return false;
+    }
+
+    time_t elapsed = now - t->startTime;
+    uint64_t good = goodNonces - t->startGood;
+    uint64_t bad = badNonces - t->startBad;
+    if (elapsed < ChipTuneMinSeconds || (good < ChipTuneMinNonces && elapsed < ChipTuneMaxSeconds)) {
+        return false;
+    }
+    double score = ((double)good - ChipTuneBadNoncePenalty * (double)bad) / elapsed * weight;
+    // Good and bad counts are each Poisson, so their variances are the counts.
+    double sigma = sqrt((double)good + ChipTuneBadNoncePenalty * ChipTuneBadNoncePenalty * (double)bad) / elapsed * weight;
+    bool erroring = bad > (good + bad) * ChipTuneMaxBadRatio;
+
+    if (t->phase == CHIP_TUNE_TRIAL) {
+        double margin = ChipTuneSignificance * sqrt(sigma * sigma + t->baselineSigma * t->baselineSigma);
+        // A trial that is ahead, but not yet by enough to tell it from noise,
+        // keeps measuring so its own share of the noise shrinks.
+        if (score > t->baselineScore && score <= t->baselineScore + margin && !erroring && elapsed < ChipTuneMaxSeconds) {
+            return false;
+        }
+        if (score > t->baselineScore + margin && !(erroring && t->direction > 0)) {
+            // The trial wins. It becomes the new baseline, and the next step
+            // continues in the same direction straight away.
+            t->baselineScore = score;
+            t->baselineSigma = sigma;
+            t->trialsKept++;
+        } else {
+            // The trial loses. Go back, try the other direction next, and
+            // re-measure the old setting so a lucky baseline can't block
+            // every future trial.
+            *bias = t->prevBias;
+            *divider = t->prevDivider;
+            t->direction = -t->direction;
+            t->phase = CHIP_TUNE_BASELINE;
+            chipTuneRestart(t, now, goodNonces, badNonces);
+            return true;
+        }
+    } else {
+        t->baselineScore = score;
+        t->baselineSigma = sigma;
+    }
+
+    // Pick the direction of the next step within the string's limits.
+    int level = biasToLevel(*bias, *divider);
+    bool canIncrease = allowIncrease && !erroring && level < state->curChild.maxBiasLevel;
+    bool canDecrease = level > 0;
+    if (erroring) {
+        t->direction = -1;
+    }
+    if (t->direction > 0 && !canIncrease) {
+        t->direction = -1;
+    }
+    if (t->direction < 0 && !canDecrease) {
+        t->direction = 1;
+    }
+    if ((t->direction > 0 && !canIncrease) || (t->direction < 0 && !canDecrease)) {
+        t->phase = CHIP_TUNE_BASELINE;
+        chipTuneRestart(t, now, goodNonces, badNonces);
+        return false;
+    }
+
+    t->prevBias = *bias;
+    t->prevDivider = *divider;
+    if (t->direction > 0) {
+        increaseBias(bias, divider);
+    } else {
+        decreaseBias(bias, divider);
+    }
+    t->phase = CHIP_TUNE_TRIAL;
+    t->trials++;
+    chipTuneRestart(t, now, goodNonces, badNonces);
+    return true;
+}
+
+// poissonRateBounds returns in 'low' and 'high' the two-sided confidence
+// bounds on the rate of a Poisson process that produced 'events' in 'seconds',
+// for a normal quantile of 'z'. It uses the Wilson-Hilferty approximation to
+// the exact chi-square bounds, which is within a few percent even for a
+// handful of events.
+void poissonRateBounds(double events, double seconds, double z, double *low, double *high)
+{
+    if (seconds <= 0) {
+        *low = 0;
+        *high = 0;
+        return;
+    }
+    *low = 0;
+    if (events > 0) {
+        double c = 1 - 1 / (9 * events) - z / (3 * sqrt(events));
+        if (c > 0) {
+            *low = events * c * c * c / seconds;
+        }
+    }
+    double n = events + 1;
+    double c = 1 - 1 / (9 * n) + z / (3 * sqrt(n));
+    *high = n * c * c * c / seconds;
+}
+
+static const double nonceRateWindowSeconds[NONCE_RATE_WINDOWS] = { 300, 3600, 86400 };
+
+void nonceRateStart(NonceRate *rate, double now)
+{
+    memset(rate, 0, sizeof(*rate));
+    rate->lastUpdate = now;
+    for (int i = 0; i < NONCE_RATE_WINDOWS; i++) {
+        rate->windowStart[i] = now;
+    }
+}
+
+// nonceRateRestart forgets what one window has seen so far, so that it only
+// covers the time from 'now'.
+void nonceRateRestart(NonceRate *rate, int window, double now)
+{
+    nonceRateAdd(rate, now, 0);
+    rate->events[window] = 0;
+    rate->exposure[window] = 0;
+    rate->windowStart[window] = now;
+}
+
+// nonceRateAdd decays every window up to 'now' and adds the nonces found
+// since the last update. It is cheap enough to call each time a chip is read.
+void nonceRateAdd(NonceRate *rate, double now, uint64_t events)
+{
+    double dt = now - rate->lastUpdate;
+    if (dt < 0) {
+        dt = 0;
+    }
+    for (int i = 0; i < NONCE_RATE_WINDOWS; i++) {
+        double tau = nonceRateWindowSeconds[i];
+        double decay = exp(-dt / tau);
+        rate->events[i] = rate->events[i] * decay + events;
+        rate->exposure[i] = rate->exposure[i] * decay + tau * (1 - decay);
+    }
+    rate->lastUpdate = now;
+}
+
+// nonceRateEstimate returns the nonces per second seen by one window as of
+// 'now', with its confidence bounds for a normal quantile of 'z'.
+double nonceRateEstimate(NonceRate *rate, int window, double now, double z, double *low, double *high)
+{
+    double tau = nonceRateWindowSeconds[window];
+    double decay = exp(-(now - rate->lastUpdate) / tau);
+    double events = rate->events[window] * decay;
+    double exposure = rate->exposure[window] * decay + tau * (1 - decay);
+    poissonRateBounds(events, exposure, z, low, high);
+    if (exposure <= 0) {
+        return 0;
+    }
+    return events / exposure;
+}
+
+// The tuning store keeps one genetic algo state per band of ambient
+// temperature. The file is a header, the profiles with every field written
+// out explicitly so the layout does not follow the structs, and a CRC32 of
+// everything before it.
+#define TuningStoreMagic 0x5431424f // "OB1T"
+// Length of the GenChild chip arrays, which each child stores in full.
+#define TuningStoreChips (sizeof(((GenChild *)0)->chipBiases) / sizeof(((GenChild *)0)->chipBiases[0]))
+_Static_assert(sizeof(((GenChild *)0)->chipDividers) / sizeof(((GenChild *)0)->chipDividers[0]) == TuningStoreChips,
+    "GenChild chipBiases and chipDividers must be the same length");
+_Static_assert(TuningStoreChips <= UINT8_MAX, "the tuning store header keeps the chip count in a byte");
+#define TuningBandHysteresis 1.0
+#define TuningStoreHeaderSize 8
+#define TuningStoreChildSize (sizeof(double) + 3 + 2 * TuningStoreChips)
+#define TuningStoreProfileSize (1 + sizeof(uint32_t) + 1 + sizeof(int32_t) + 1 + (POPULATION_SIZE + 1) * TuningStoreChildSize)
+#define TuningStoreMaxSize (TuningStoreHeaderSize + TUNING_PROFILES * TuningStoreProfileSize + sizeof(uint32_t))
+
+static uint32_t crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static void putField(uint8_t **p, const void *src, size_t size)
+{
+    memcpy(*p, src, size);
+    *p += size;
+}
+
+static void getField(const uint8_t **p, void *dst, size_t size)
+{
+    memcpy(dst, *p, size);
+    *p += size;
+}
+
+static void putChild(uint8_t **p, GenChild *child)
+{
+    putField(p, &child->fitness, sizeof(child->fitness));
+    putField(p, &child->maxBiasLevel, 1);
+    putField(p, &child->initStringIncrements, 1);
+    putField(p, &child->voltageLevel, 1);
+    putField(p, child->chipBiases, TuningStoreChips);
+    putField(p, child->chipDividers, TuningStoreChips);
+}
+
+static void getChild(const uint8_t **p, GenChild *child)
+{
+    getField(p, &child->fitness, sizeof(child->fitness));
+    getField(p, &child->maxBiasLevel, 1);
+    getField(p, &child->initStringIncrements, 1);
+    getField(p, &child->voltageLevel, 1);
+    getField(p, child->chipBiases, TuningStoreChips);
+    getField(p, child->chipDividers, TuningStoreChips);
+}
+
+// loadLegacyThermalConfig reads the raw GenChild file written by earlier
+// firmware into a single profile whose band is not known yet.
+static ApiError loadLegacyThermalConfig(char *name, int boardID, TuningStore *store)
 {
     char path[64];
     snprintf(path, sizeof(path), "/root/.cgminer/settings_v1.6_%s_%d.bin", name, boardID);
-	applog(LOG_ERR, "Loading: %s", path);
     FILE *file = fopen(path, "r");
     if (file == NULL) {
-		applog(LOG_ERR, "load file err");
         return GENERIC_ERROR;
     }
-    fread(&state->populationSize, sizeof(uint8_t), 1, file);
-    if (state->populationSize > POPULATION_SIZE) {
-		applog(LOG_ERR, "read file error - read1");
+    TuningProfile *profile = &store->profiles[0];
+    memset(profile, 0, sizeof(*profile));
+    bool ok = fread(&profile->populationSize, sizeof(uint8_t), 1, file) == 1
+        && profile->populationSize <= POPULATION_SIZE
+        && fread(profile->population, sizeof(GenChild), profile->populationSize, file) == profile->populationSize
+        && fread(&profile->curChild, sizeof(GenChild), 1, file) == 1;
+    fclose(file);
+    if (!ok) {
+        applog(LOG_ERR, "Ignoring tuning settings in %s", path);
         return GENERIC_ERROR;
     }
-    if (fread(state->population, sizeof(GenChild), state->populationSize, file) != state->populationSize) {
-		applog(LOG_ERR, "read file error - read2");
+    // Earlier firmware only ever tuned for the maximum hashrate.
+    profile->band = TUNING_BAND_UNKNOWN;
+    profile->optimizationMode = OBELISK_OPTIMIZATION_MODE_MAX_HASHRATE;
+    profile->powerLimitWatts = 0;
+    store->count = 1;
+    applog(LOG_ERR, "Loaded tuning settings from %s", path);
+    return SUCCESS;
+}
+
+ApiError loadTuningStore(char *name, int boardID, TuningStore *store)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/root/.cgminer/tuning_%s_%d.bin", name, boardID);
+    memset(store, 0, sizeof(*store));
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return loadLegacyThermalConfig(name, boardID, store);
+    }
+    uint8_t buf[TuningStoreMaxSize + 1];
+    size_t len = fread(buf, 1, sizeof(buf), file);
+    fclose(file);
+
+    const uint8_t *p = buf;
+    uint32_t magic;
+    uint16_t version;
+    uint8_t count;
+    uint8_t chips;
+    uint32_t crc;
+    if (len < TuningStoreHeaderSize + sizeof(crc)) {
+        goto invalid;
+    }
+    getField(&p, &magic, sizeof(magic));
+    getField(&p, &version, sizeof(version));
+    getField(&p, &count, sizeof(count));
+    getField(&p, &chips, sizeof(chips));
+    if (magic != TuningStoreMagic || version != TUNING_STORE_VERSION || chips != TuningStoreChips || count > TUNING_PROFILES
+        || len != TuningStoreHeaderSize + count * TuningStoreProfileSize + sizeof(crc)) {
+        goto invalid;
+    }
+    memcpy(&crc, buf + len - sizeof(crc), sizeof(crc));
+    if (crc != crc32(buf, len - sizeof(crc))) {
+        goto invalid;
+    }
+
+    for (int i = 0; i < count; i++) {
+        TuningProfile *profile = &store->profiles[i];
+        getField(&p, &profile->band, sizeof(profile->band));
+        getField(&p, &profile->lastUsed, sizeof(profile->lastUsed));
+        getField(&p, &profile->optimizationMode, sizeof(profile->optimizationMode));
+        getField(&p, &profile->powerLimitWatts, sizeof(profile->powerLimitWatts));
+        getField(&p, &profile->populationSize, sizeof(profile->populationSize));
+        for (int j = 0; j < POPULATION_SIZE; j++) {
+            getChild(&p, &profile->population[j]);
+        }
+        getChild(&p, &profile->curChild);
+        if (profile->populationSize > POPULATION_SIZE) {
+            goto invalid;
+        }
+    }
+    store->count = count;
+    return SUCCESS;
+
+invalid:
+    applog(LOG_ERR, "Ignoring tuning settings in %s", path);
+    memset(store, 0, sizeof(*store));
+    return GENERIC_ERROR;
+}
+
+ApiError saveTuningStore(char *name, int boardID, TuningStore *store)
+{
+    char path[64];
+    char tmppath[64];
+    snprintf(path, sizeof(path), "/root/.cgminer/tuning_%s_%d.bin", name, boardID);
+    snprintf(tmppath, sizeof(tmppath), "/root/.cgminer/tuning_%s_%d.bin_tmp", name, boardID);
+
+    uint8_t buf[TuningStoreMaxSize];
+    uint8_t *p = buf;
+    uint32_t magic = TuningStoreMagic;
+    uint16_t version = TUNING_STORE_VERSION;
+    uint8_t chips = TuningStoreChips;
+    putField(&p, &magic, sizeof(magic));
+    putField(&p, &version, sizeof(version));
+    putField(&p, &store->count, sizeof(store->count));
+    putField(&p, &chips, sizeof(chips));
+    for (int i = 0; i < store->count; i++) {
+        TuningProfile *profile = &store->profiles[i];
+        putField(&p, &profile->band, sizeof(profile->band));
+        putField(&p, &profile->lastUsed, sizeof(profile->lastUsed));
+        putField(&p, &profile->optimizationMode, sizeof(profile->optimizationMode));
+        putField(&p, &profile->powerLimitWatts, sizeof(profile->powerLimitWatts));
+        putField(&p, &profile->populationSize, sizeof(profile->populationSize));
+        for (int j = 0; j < POPULATION_SIZE; j++) {
+            putChild(&p, &profile->population[j]);
+        }
+        putChild(&p, &profile->curChild);
+    }
+    uint32_t crc = crc32(buf, p - buf);
+    putField(&p, &crc, sizeof(crc));
+
+    FILE *file = fopen(tmppath, "wb");
+    if (file == NULL) {
         return GENERIC_ERROR;
     }
-    if (fread(&state->curChild, sizeof(GenChild), 1, file) != 1) {
-		applog(LOG_ERR, "read file error - read3");
+    size_t n = fwrite(buf, p - buf, 1, file);
+    if (fclose(file) != 0 || n != 1) {
         return GENERIC_ERROR;
     }
-    fclose(file);
-    if (ferror(file) != 0) {
-		applog(LOG_ERR, "read file error - fclose");
+    if (rename(tmppath, path) != 0) {
         return GENERIC_ERROR;
     }
+    return SUCCESS;
+}
+
+// tuningProfileCurrent returns whether a profile was tuned for the objective
+// now in use.
+static bool tuningProfileCurrent(TuningProfile *profile)
+{
+    return profile->optimizationMode == opt_ob_optimization_mode && profile->powerLimitWatts == opt_ob_power_limit_watts;
+}
+
+// tuningStoreFind returns the index of the profile for 'band', or -1 if there
+// is none. With 'nearest' set, the profile of the closest band is returned
+// instead, or the most recently used one if 'band' is unknown. Profiles tuned
+// for a different objective are passed over.
+int tuningStoreFind(TuningStore *store, int8_t band, bool nearest)
+{
+    int best = -1;
+    int bestDistance = 0;
+    for (int i = 0; i < store->count; i++) {
+        TuningProfile *profile = &store->profiles[i];
+        if (!tuningProfileCurrent(profile)) {
+            continue;
+        }
+        if (profile->band == band) {
+            return i;
+        }
+        if (!nearest) {
+            continue;
+        }
+        int distance;
+        if (band == TUNING_BAND_UNKNOWN || profile->band == TUNING_BAND_UNKNOWN) {
+            distance = INT8_MAX - INT8_MIN;
+        } else {
+            distance = abs(profile->band - band);
+        }
+        if (best < 0 || distance < bestDistance || (distance == bestDistance && profile->lastUsed > store->profiles[best].lastUsed)) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
 
-    // set voltage and chip biases according to curChild
+// tuningStoreCapture records the current genetic algo state as the profile of
+// the current ambient band. A new band takes the slot of the least recently
+// used profile once the store is full.
+void tuningStoreCapture(ControlLoopState *state, time_t now)
+{
+    TuningStore *store = &state->tuningStore;
+    int i = tuningStoreFind(store, state->ambientBand, false);
+    if (i < 0) {
+        // Settings saved before the band was known belong to the first band
+        // that becomes known.
+        i = tuningStoreFind(store, TUNING_BAND_UNKNOWN, false);
+    }
+    if (i < 0 && store->count < TUNING_PROFILES) {
+        i = store->count++;
+    } else if (i < 0) {
+        i = 0;
+        for (int j = 1; j < store->count; j++) {
+            if (store->profiles[j].lastUsed < store->profiles[i].lastUsed) {
+                i = j;
+            }
+        }
+    }
+    TuningProfile *profile = &store->profiles[i];
+    profile->band = state->ambientBand;
+    profile->lastUsed = now;
+    profile->optimizationMode = opt_ob_optimization_mode;
+    profile->powerLimitWatts = opt_ob_power_limit_watts;
+    profile->populationSize = state->populationSize;
+    memcpy(profile->population, state->population, sizeof(profile->population));
+    profile->curChild = state->curChild;
+}
+
+// tuningStoreApply makes a stored profile the current genetic algo state, and
+// sets the voltage and chip biases to its current child.
+void tuningStoreApply(ControlLoopState *state, int index)
+{
+    TuningProfile *profile = &state->tuningStore.profiles[index];
+    state->populationSize = profile->populationSize;
+    memcpy(state->population, profile->population, sizeof(state->population));
+    state->curChild = profile->curChild;
     state->currentVoltageLevel = state->curChild.voltageLevel;
     memcpy(state->chipBiases, state->curChild.chipBiases, sizeof(state->chipBiases));
     memcpy(state->chipDividers, state->curChild.chipDividers, sizeof(state->chipDividers));
+}
+
+// ambientToBand maps an ambient temperature to its band. A reading within a
+// degree of the current band is kept in it, so the unit does not flip between
+// profiles at a band edge.
+int8_t ambientToBand(double ambient, int8_t currentBand)
+{
+    if (currentBand != TUNING_BAND_UNKNOWN
+        && ambient >= currentBand * TUNING_BAND_WIDTH - TuningBandHysteresis
+        && ambient < (currentBand + 1) * TUNING_BAND_WIDTH + TuningBandHysteresis) {
+        return currentBand;
+    }
+    return (int8_t)floor(ambient / TUNING_BAND_WIDTH);
+}
+
+// The thermal model starts from what the simulation tables assume, with a
+// prior variance per term. A term is trusted once its variance has shrunk to
+// a quarter of the prior, which only happens once the string has actually
+// been seen at different fan speeds or bias levels.
+static const double thermalModelPrior[THERMAL_MODEL_TERMS] = { 45.0, -20.0, 1.5, 2.0 };
+static const double thermalModelPriorVariance[THERMAL_MODEL_TERMS] = { 400.0, 400.0, 1.0, 1.0 };
+#define ThermalModelForgetting 0.9995 // Older samples fade over about half an hour at 1 Hz.
+#define ThermalModelTrusted 0.25
+#define ThermalModelAmbientSamples 600
+
+void thermalModelInit(ThermalModel *model)
+{
+    memset(model, 0, sizeof(*model));
+    model->version = THERMAL_MODEL_VERSION;
+    for (int i = 0; i < THERMAL_MODEL_TERMS; i++) {
+        model->theta[i] = thermalModelPrior[i];
+        model->covariance[i][i] = thermalModelPriorVariance[i];
+    }
+}
+
+// thermalModelFeatures fills 'x' with the model terms for the string's
+// current settings.
+void thermalModelFeatures(ControlLoopState *state, int chips, double fanSpeed, double x[THERMAL_MODEL_TERMS])
+{
+    double meanLevel = 0;
+    for (int i = 0; i < chips; i++) {
+        meanLevel += biasToLevel(state->chipBiases[i], state->chipDividers[i]);
+    }
+    meanLevel /= chips;
+
+    x[0] = 1;
+    x[1] = fanSpeed / 100;
+    x[2] = meanLevel;
+    x[3] = biasToLevel(state->chipBiases[0], state->chipDividers[0]) - meanLevel;
+}
+
+// thermalModelUpdate folds one temperature reading into the model.
+void thermalModelUpdate(ThermalModel *model, double x[THERMAL_MODEL_TERMS], double temp)
+{
+    double px[THERMAL_MODEL_TERMS];
+    double denom = ThermalModelForgetting;
+    double predicted = 0;
+    for (int i = 0; i < THERMAL_MODEL_TERMS; i++) {
+        px[i] = 0;
+        for (int j = 0; j < THERMAL_MODEL_TERMS; j++) {
+            px[i] += model->covariance[i][j] * x[j];
+        }
+        denom += x[i] * px[i];
+        predicted += model->theta[i] * x[i];
+    }
+
+    double err = temp - predicted;
+    for (int i = 0; i < THERMAL_MODEL_TERMS; i++) {
+        model->theta[i] += px[i] / denom * err;
+    }
+
+    // Forgetting lets the model follow changes in ambient temperature, but a
+    // term that is never excited would see its variance grow without bound.
+    // Forgetting is paused while any variance is above its prior.
+    bool forget = true;
+    for (int i = 0; i < THERMAL_MODEL_TERMS; i++) {
+        for (int j = 0; j < THERMAL_MODEL_TERMS; j++) {
+            model->covariance[i][j] -= px[i] * px[j] / denom;
+        }
+        if (model->covariance[i][i] / ThermalModelForgetting > thermalModelPriorVariance[i]) {
+            forget = false;
+        }
+    }
+    if (forget) {
+        for (int i = 0; i < THERMAL_MODEL_TERMS; i++) {
+            for (int j = 0; j < THERMAL_MODEL_TERMS; j++) {
+                model->covariance[i][j] /= ThermalModelForgetting;
+            }
+        }
+    }
+    model->samples++;
+}
+
+static bool thermalModelTermTrusted(ThermalModel *model, int term)
+{
+    return model->covariance[term][term] < thermalModelPriorVariance[term] * ThermalModelTrusted;
+}
+
+// thermalModelSelfHeat returns how many degrees a chip heats up per bias level
+// it is raised by on its own, or -1 if the model has not learned that yet.
+double thermalModelSelfHeat(ThermalModel *model, int chips)
+{
+    if (!thermalModelTermTrusted(model, 2) || !thermalModelTermTrusted(model, 3)) {
+        return -1;
+    }
+    double heat = model->theta[2] / chips + model->theta[3] * (chips - 1) / chips;
+    return heat > 0 ? heat : -1;
+}
+
+// thermalModelStringHeat returns how many degrees the string heats up when
+// every chip is raised by one bias level, or -1 if it is not known yet.
+double thermalModelStringHeat(ThermalModel *model)
+{
+    if (!thermalModelTermTrusted(model, 2) || model->theta[2] <= 0) {
+        return -1;
+    }
+    return model->theta[2];
+}
+
+// thermalModelFanHeat returns how many degrees the string heats up for each
+// percent of fan duty taken away, or -1 if it is not known yet.
+double thermalModelFanHeat(ThermalModel *model)
+{
+    if (!thermalModelTermTrusted(model, 1) || model->theta[1] >= 0) {
+        return -1;
+    }
+    return -model->theta[1] / 100;
+}
+
+// thermalModelAmbient estimates the ambient temperature as what the model
+// predicts for the string at the given fan speed with its chips at the lowest
+// clock. It returns false until the model has seen enough samples.
+bool thermalModelAmbient(ThermalModel *model, double fanSpeed, double *ambient)
+{
+    if (model->samples < ThermalModelAmbientSamples) {
+        return false;
+    }
+    *ambient = model->theta[0] + model->theta[1] * fanSpeed / 100;
+    return true;
+}
+
+// The thermal model belongs to the hashboard rather than the slot it is in, so
+// it is stored under the board's unique id. The file is laid out like the
+// tuning store: a header, every field written out explicitly, and a CRC32 of
+// everything before it.
+#define ThermalModelMagic 0x4d31424f // "OB1M"
+#define ThermalModelHeaderSize 8
+#define ThermalModelFileSize (ThermalModelHeaderSize + sizeof(uint64_t) \
+    + (THERMAL_MODEL_TERMS + THERMAL_MODEL_TERMS * THERMAL_MODEL_TERMS) * sizeof(double) + sizeof(uint32_t))
 
+ApiError loadThermalModel(uint64_t boardUID, ThermalModel *model)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/root/.cgminer/thermal_%016" PRIx64 ".bin", boardUID);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return GENERIC_ERROR;
+    }
+    uint8_t buf[ThermalModelFileSize + 1];
+    size_t len = fread(buf, 1, sizeof(buf), file);
+    fclose(file);
+
+    const uint8_t *p = buf;
+    uint32_t magic;
+    uint16_t version;
+    uint8_t terms;
+    uint8_t reserved;
+    uint32_t crc;
+    ThermalModel loaded;
+    if (len != ThermalModelFileSize) {
+        goto invalid;
+    }
+    getField(&p, &magic, sizeof(magic));
+    getField(&p, &version, sizeof(version));
+    getField(&p, &terms, sizeof(terms));
+    getField(&p, &reserved, sizeof(reserved));
+    if (magic != ThermalModelMagic || version != THERMAL_MODEL_VERSION || terms != THERMAL_MODEL_TERMS) {
+        goto invalid;
+    }
+    memcpy(&crc, buf + len - sizeof(crc), sizeof(crc));
+    if (crc != crc32(buf, len - sizeof(crc))) {
+        goto invalid;
+    }
+
+    loaded.version = version;
+    getField(&p, &loaded.samples, sizeof(loaded.samples));
+    for (int i = 0; i < THERMAL_MODEL_TERMS; i++) {
+        getField(&p, &loaded.theta[i], sizeof(double));
+        if (!isfinite(loaded.theta[i])) {
+            goto invalid;
+        }
+    }
+    for (int i = 0; i < THERMAL_MODEL_TERMS; i++) {
+        for (int j = 0; j < THERMAL_MODEL_TERMS; j++) {
+            getField(&p, &loaded.covariance[i][j], sizeof(double));
+            if (!isfinite(loaded.covariance[i][j])) {
+                goto invalid;
+            }
+        }
+    }
+    *model = loaded;
     return SUCCESS;
+
+invalid:
+    applog(LOG_ERR, "Ignoring thermal model in %s", path);
+    return GENERIC_ERROR;
 }
 
-ApiError saveThermalConfig(char *name, int boardID, ControlLoopState *state)
+ApiError saveThermalModel(uint64_t boardUID, ThermalModel *model)
 {
     char path[64];
     char tmppath[64];
-    snprintf(path, sizeof(path), "/root/.cgminer/settings_v1.6_%s_%d.bin", name, boardID);
-    snprintf(tmppath, sizeof(tmppath), "/root/.cgminer/settings_v1.6_%s_%d.bin_tmp", name, boardID);
+    snprintf(path, sizeof(path), "/root/.cgminer/thermal_%016" PRIx64 ".bin", boardUID);
+    snprintf(tmppath, sizeof(tmppath), "/root/.cgminer/thermal_%016" PRIx64 ".bin_tmp", boardUID);
+
+    uint8_t buf[ThermalModelFileSize];
+    uint8_t *p = buf;
+    uint32_t magic = ThermalModelMagic;
+    uint16_t version = THERMAL_MODEL_VERSION;
+    uint8_t terms = THERMAL_MODEL_TERMS;
+    uint8_t reserved = 0;
+    putField(&p, &magic, sizeof(magic));
+    putField(&p, &version, sizeof(version));
+    putField(&p, &terms, sizeof(terms));
+    putField(&p, &reserved, sizeof(reserved));
+    putField(&p, &model->samples, sizeof(model->samples));
+    for (int i = 0; i < THERMAL_MODEL_TERMS; i++) {
+        putField(&p, &model->theta[i], sizeof(double));
+    }
+    for (int i = 0; i < THERMAL_MODEL_TERMS; i++) {
+        for (int j = 0; j < THERMAL_MODEL_TERMS; j++) {
+            putField(&p, &model->covariance[i][j], sizeof(double));
+        }
+    }
+    uint32_t crc = crc32(buf, p - buf);
+    putField(&p, &crc, sizeof(crc));
+
     FILE *file = fopen(tmppath, "wb");
     if (file == NULL) {
         return GENERIC_ERROR;
     }
-    fwrite(&state->populationSize, sizeof(uint8_t), 1, file);
-    fwrite(state->population, sizeof(GenChild), state->populationSize, file);
-    fwrite(&state->curChild, sizeof(GenChild), 1, file);
-    fflush(file);
-    fclose(file);
-    if (ferror(file) != 0) {
+    size_t n = fwrite(buf, p - buf, 1, file);
+    if (fclose(file) != 0 || n != 1) {
         return GENERIC_ERROR;
     }
     if (rename(tmppath, path) != 0) {
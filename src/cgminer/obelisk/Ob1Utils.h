@@ -50,6 +50,79 @@ typedef struct GenChild {
 	uint8_t chipDividers[15];
 } GenChild;
 
+#define CHIP_TUNE_BASELINE 0
+#define CHIP_TUNE_TRIAL    1
+
+// ChipTuneState tracks the hill climb of a single chip. Each chip alternates
+// between measuring its current setting (the baseline) and measuring a setting
+// one bias level away (the trial), keeping the trial only if it yields more.
+typedef struct ChipTuneState {
+	uint8_t  phase;         // CHIP_TUNE_BASELINE or CHIP_TUNE_TRIAL
+	int8_t   direction;     // +1 to try a faster clock next, -1 for slower
+	time_t   startTime;     // Start of the current measurement window
+	uint64_t startGood;     // Chip nonce totals at the start of the window
+	uint64_t startBad;
+	double   baselineScore; // Scored nonces per second at the baseline setting
+	double   baselineSigma; // Poisson standard deviation of baselineScore
+	int8_t   prevBias;      // Setting to return to if the trial loses
+	uint8_t  prevDivider;
+	uint64_t trials;
+	uint64_t trialsKept;
+} ChipTuneState;
+
+#define THERMAL_MODEL_VERSION 2
+#define THERMAL_MODEL_TERMS 4
+
+// ThermalModel is a linear model of the temperature read by a string's sensor
+// chip, fitted online with recursive least squares. The terms are a constant,
+// the fan duty (0-1), the mean bias level of the string, and the sensor chip's
+// own bias level relative to that mean.
+typedef struct ThermalModel {
+	uint32_t version;
+	uint64_t samples;
+	double   theta[THERMAL_MODEL_TERMS];
+	double   covariance[THERMAL_MODEL_TERMS][THERMAL_MODEL_TERMS];
+} ThermalModel;
+
+#define NONCE_RATE_5M  0
+#define NONCE_RATE_1H  1
+#define NONCE_RATE_24H 2
+#define NONCE_RATE_WINDOWS 3
+
+// NonceRate estimates how fast a chip finds nonces, as exponentially weighted
+// averages over 5 minutes, 1 hour and 24 hours. Each window keeps a decayed
+// count of nonces and the matching decayed time, so the estimate is their
+// ratio and the count sizes its Poisson confidence bounds.
+typedef struct NonceRate {
+	double lastUpdate;                    // Monotonic seconds of the last update
+	double windowStart[NONCE_RATE_WINDOWS];
+	double events[NONCE_RATE_WINDOWS];
+	double exposure[NONCE_RATE_WINDOWS];  // Seconds
+} NonceRate;
+
+#define TUNING_STORE_VERSION 2
+#define TUNING_PROFILES 6
+#define TUNING_BAND_WIDTH 5 // Degrees C of ambient temperature covered by one profile.
+#define TUNING_BAND_UNKNOWN INT8_MIN
+
+// TuningProfile is the genetic algo state that was reached while the ambient
+// temperature was in one band. Its fitness values are in the units of the
+// objective it was tuned for, so it is only used under that same objective.
+typedef struct TuningProfile {
+	int8_t   band;     // Ambient band, or TUNING_BAND_UNKNOWN
+	uint32_t lastUsed; // Time the profile was last captured
+	uint8_t  optimizationMode; // --ob-optimization-mode it was tuned for
+	int32_t  powerLimitWatts;  // --ob-power-limit-watts it was tuned for
+	uint8_t  populationSize;
+	GenChild population[POPULATION_SIZE];
+	GenChild curChild;
+} TuningProfile;
+
+typedef struct TuningStore {
+	uint8_t       count;
+	TuningProfile profiles[TUNING_PROFILES];
+} TuningStore;
+
 typedef struct ControlLoopState {
 	// Determine if we need to initialize the control state.
 	bool initialized;
@@ -59,10 +132,7 @@ typedef struct ControlLoopState {
 	double currentStringVoltage;
 	uint8_t currentVoltageLevel;
 	time_t initTime;
-	time_t lastHashrateCheckTime;
 	time_t bootTime;
-	time_t lastFanAdjustmentTime;
-	time_t lastStatusOutput;
 	uint64_t stringTimeouts;
 
 	// Chip settings.
@@ -77,8 +147,6 @@ typedef struct ControlLoopState {
 	// Temperature management variables.
 	double currentStringTemp;
 	time_t prevBiasChangeTime;
-	time_t prevOvertempCheck;
-	time_t prevUndertempCheck;
 	double prevUndertempStringTemp;
 
 	// Voltage management variables.
@@ -97,6 +165,32 @@ typedef struct ControlLoopState {
 	GenChild curChild; // same values as currentVoltageLevel, chipBiases, and chipDividers
 	bool hasReset;
 
+	// Per-chip tuning. When enabled, chip biases are owned by the per-chip
+	// hill climb and the genetic algo only searches the string voltage.
+	bool chipTuning;
+	ChipTuneState chipTune[15];
+
+	// Learned thermal model of the string.
+	ThermalModel thermalModel;
+	time_t prevThermalSaveTime;
+
+	// Power estimate of the string, and its running total since the last
+	// voltage change for scoring the current genetic algo child.
+	double   stringPower;
+	double   powerSinceVoltageChange;
+	uint64_t powerSamplesSinceVoltageChange;
+
+	// Stored tuning profiles, one per band of ambient temperature. Changes
+	// mark the store dirty and are written out periodically, to spare the
+	// flash.
+	TuningStore tuningStore;
+	int8_t ambientBand;
+	bool   tuningDirty;
+	time_t prevTuningFlush;
+
+	// Which objective the scores above were taken under; see objectiveChanged.
+	uint32_t objectiveGeneration;
+
 } ControlLoopState;
 
 // Functions for adding/subtracting bias and dividers and formatting
@@ -106,10 +200,45 @@ void decreaseBias(int8_t* currentBias, uint8_t* currentDivider);
 void formatControlLoopState(char* buffer, ControlLoopState* clState);
 void formatDividerAndBias(char* buffer, ControlLoopState* clState);
 
+// objectiveWeight returns what one hash per second is worth to the tuning
+// objective selected by --ob-optimization-mode, at the given power draw.
+double objectiveWeight(double watts, double wattBudget);
+void objectiveChanged();
+bool objectiveResetIfChanged(ControlLoopState *state);
+
 // Functions for executing the genetic algorithm.
 void geneticAlgoIter(ControlLoopState *state);
-ApiError saveThermalConfig(char *name, int boardID, ControlLoopState *state);
-ApiError loadThermalConfig(char *name, int boardID, ControlLoopState *state);
+int  sprtPoisson(uint64_t events, double seconds, double rateLow, double rateHigh, double alpha, double beta);
+int  geneticAlgoEarlyDecision(ControlLoopState *state, uint64_t goodNonces, double seconds, uint64_t chipDifficulty, double weight, double alpha, double beta);
+
+// Functions for executing the per-chip tuner.
+bool chipTuneIter(ControlLoopState *state, uint8_t chipNum, uint64_t goodNonces, uint64_t badNonces, bool allowIncrease, double weight);
+
+// Functions for estimating nonce rates.
+void   poissonRateBounds(double events, double seconds, double z, double *low, double *high);
+void   nonceRateStart(NonceRate *rate, double now);
+void   nonceRateRestart(NonceRate *rate, int window, double now);
+void   nonceRateAdd(NonceRate *rate, double now, uint64_t events);
+double nonceRateEstimate(NonceRate *rate, int window, double now, double z, double *low, double *high);
+
+// Functions for the stored tuning profiles.
+ApiError loadTuningStore(char *name, int boardID, TuningStore *store);
+ApiError saveTuningStore(char *name, int boardID, TuningStore *store);
+int  tuningStoreFind(TuningStore *store, int8_t band, bool nearest);
+void tuningStoreCapture(ControlLoopState *state, time_t now);
+void tuningStoreApply(ControlLoopState *state, int index);
+int8_t ambientToBand(double ambient, int8_t currentBand);
+
+// Functions for the learned thermal model.
+void thermalModelInit(ThermalModel *model);
+void thermalModelFeatures(ControlLoopState *state, int chips, double fanSpeed, double x[THERMAL_MODEL_TERMS]);
+void thermalModelUpdate(ThermalModel *model, double x[THERMAL_MODEL_TERMS], double temp);
+double thermalModelSelfHeat(ThermalModel *model, int chips);
+double thermalModelStringHeat(ThermalModel *model);
+double thermalModelFanHeat(ThermalModel *model);
+bool thermalModelAmbient(ThermalModel *model, double fanSpeed, double *ambient);
+ApiError loadThermalModel(uint64_t boardUID, ThermalModel *model);
+ApiError saveThermalModel(uint64_t boardUID, ThermalModel *model);
 
 bool runCmd(char* cmd, char* output, int outputSize);
 void getIpV4(char* intfName, char* ipBuffer, int bufferSize);
@@ -29,6 +29,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "Usermain.h"
@@ -60,10 +62,15 @@ static bool bSPI5WriteOne(uint8_t uiValue, bool bLastWrite);
 /***    LOCAL DATA DECLARATIONS     ***/
 static struct io_descriptor *pio_SPI5;    // descriptor for io write and io read methods associated with SPI
 static volatile bool bSPI5_CBOccurred = false;    // SPI transfer callback occurred flag
+static S_SPI_STATS sSPIStats;    // totals for every transfer; protected by SPIStatsLock
+static pthread_mutex_t SPIStatsLock = PTHREAD_MUTEX_INITIALIZER;
 
 /***    LOCAL DEFINITIONS     ***/
 #define STARTUP_SPI_MSG "-I- SPI Initialized\r\n"
 
+/***    GLOBAL DATA DECLARATIONS     ***/
+const uint32_t uiaSPILatencyBoundsUs[SPI_LATENCY_BUCKETS - 1] = { 10, 20, 50, 100, 200, 500, 1000 };
+
 /***    LOCAL STRUCTURES/ENUMS      ***/
 
 /***    LOCAL FUNCTION PROTOTYPES   ***/
@@ -95,8 +102,26 @@ static volatile bool bSPI5_CBOccurred = false;    // SPI transfer callback occur
 bool bSPI5StartDataXfer(E_SPI_XFER_TYPE eSPIXferType, uint8_t const *pucaTxBuf, uint8_t *const pucaRxBuf, const uint16_t uiLength)
 {
     bool bError = false;
-        
+    struct timespec sStart, sEnd;
+    uint64_t uiNs;
+    int ix;
+
+    clock_gettime(CLOCK_MONOTONIC, &sStart);
     transfer(fileSPI, pucaTxBuf, pucaRxBuf, uiLength);
+    clock_gettime(CLOCK_MONOTONIC, &sEnd);
+
+    uiNs = (uint64_t)(sEnd.tv_sec - sStart.tv_sec) * 1000000000ULL + sEnd.tv_nsec - sStart.tv_nsec;
+    for (ix = 0; ix < SPI_LATENCY_BUCKETS - 1; ix++) {
+        if (uiNs <= uiaSPILatencyBoundsUs[ix] * 1000ULL) {
+            break;
+        }
+    }
+    pthread_mutex_lock(&SPIStatsLock);
+    sSPIStats.uiTransfers++;
+    sSPIStats.uiBytes += uiLength;
+    sSPIStats.uiTotalNs += uiNs;
+    sSPIStats.uiaLatencyBuckets[ix]++;
+    pthread_mutex_unlock(&SPIStatsLock);
     
     // Only sleep for reads
     if (eSPIXferType == E_SPI_XFER_READ) {
@@ -106,6 +131,18 @@ bool bSPI5StartDataXfer(E_SPI_XFER_TYPE eSPIXferType, uint8_t const *pucaTxBuf,
     return(bError); // return true if error; else false
 }  // end of bSPI5StartDataXfer()
 
+/** *************************************************************
+ *  \brief Copy out the SPI transfer totals.
+ *  \param psStats; filled in with the totals since startup
+ *  \return none
+ */
+void GetSPIStats(S_SPI_STATS *psStats)
+{
+    pthread_mutex_lock(&SPIStatsLock);
+    *psStats = sSPIStats;
+    pthread_mutex_unlock(&SPIStatsLock);
+}  // end of GetSPIStats()
+
 /** *************************************************************
  *  \brief Support function to wait for an active SPI transfer process to complete.
  *  Here this is checking that none of the hash boards have its SPI slave selects asserted low.
@@ -31,7 +31,20 @@ typedef enum  {
     E_SPI_XFER_WRITE  = 3   // write only spi transfer; 8 bits at a time
 } E_SPI_XFER_TYPE;
 
+// Running totals for every SPI transfer, for the metrics API command. Latencies are counted in
+// buckets of at most uiaSPILatencyBoundsUs[i] microseconds; the last bucket is everything slower.
+#define SPI_LATENCY_BUCKETS 8
+
+typedef struct {
+    uint64_t uiTransfers;
+    uint64_t uiBytes;
+    uint64_t uiTotalNs;
+    uint64_t uiaLatencyBuckets[SPI_LATENCY_BUCKETS];
+} S_SPI_STATS;
+
 /***   GLOBAL DATA DECLARATIONS     ***/
+extern const uint32_t uiaSPILatencyBoundsUs[SPI_LATENCY_BUCKETS - 1];
+
 // Task pending globals; for ISR callbacks, etc
 #define SPI_READ_RATE_MHZ  1000000  // 1 MHz read/write transfers
 #define SPI_WRITE_RATE_MHZ 1000000  // 1 MHz write only transfers; may change later to 5MHz for writes
@@ -55,6 +68,8 @@ extern bool bSPI5StartDataXfer(E_SPI_XFER_TYPE eSPIXferType, uint8_t const *puca
 
 extern int iIsHBSpiBusy(bool bWait);
 
+extern void GetSPIStats(S_SPI_STATS *psStats);
+
 extern void SPITimeOutError(void);
 
 //extern void HBSetSpiMux(void);
@@ -57,6 +57,7 @@ static uint8_t ucaTWIOutBuf[DEV_WRITE_BUFF_SIZE];    // buffer for sending out
 // static uint8_t ucaTWIInBuf[DEV_READ_BUFF_SIZE];      // buffer for reading in
 
 static E_TWI_SWITCH_PORTS_T eMaskMemory = E_TWI_PORT_DISABLE;    // temporary memory until we get readback working
+static bool bMaskKnown = false;    // true once eMaskMemory is known to match the switch
 
 /***    GLOBAL DATA DECLARATIONS   ***/
 /***********************************/
@@ -76,6 +77,16 @@ int iSetTwiSwitch(uint8_t uiBoard)
     return( iWriteTwiSwitch(iHashBoardToTwiSwitch(uiBoard)) );
 }       // iSetTwiSwitch()
 
+/** *************************************************************
+ * \brief Forget the remembered switch setting so the next transfer rewrites it.
+ * Used after anything that may have reset the switch, such as a general call reset.
+ * \return none
+ */
+void vForgetTwiSwitch(void)
+{
+    bMaskKnown = false;
+}   // vForgetTwiSwitch()
+
 /** *************************************************************
  * \brief Sets the TWI/I2C bus switch to one of the four downstream ports.
  * Allows only single port connection.  Abstracts slightly away from the bit mask.
@@ -123,11 +134,18 @@ static int iWriteTwiSwitchMask(E_TWI_SWITCH_PORTS_T eSwitchMask)
 {
     int iRetval;
 
+    // Every transfer selects its board first, so skip the write when the switch is
+    // already set that way.
+    if (bMaskKnown && (eSwitchMask == eMaskMemory)) {
+        return(ERR_NONE);
+    }
+
     iRetval = iSetTWISlaveAdr(TWI_PORT0_NUM,TWI_SA_TCA9546A);
     if (ERR_NONE == iRetval) {
         ucaTWIOutBuf[0] = (uint8_t)eSwitchMask;
         iRetval = iTWIWriteBuf(TWI_PORT0_NUM, ucaTWIOutBuf, 1, true); // waits for completion
         eMaskMemory = eSwitchMask;
+        bMaskKnown = (ERR_NONE == iRetval);
     }
 
     return(iRetval);
@@ -35,5 +35,6 @@
 
 /***   GLOBAL FUNCTION PROTOTYPES   ***/
 extern int iSetTwiSwitch(uint8_t uiBoard);    // set switch mask reg based on hashing board (0 to 2)
+extern void vForgetTwiSwitch(void);          // force the next iSetTwiSwitch() to rewrite the switch
 
 #endif /* ifndef _TCA9546A_HAL_H_INCLUDED */
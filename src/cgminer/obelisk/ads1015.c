@@ -110,6 +110,7 @@
 
 #include "Usermain.h"
 #include "TWI_Support.h"
+#include "TCA9546A_hal.h"
 #include "Ob1Hashboard.h"
 #include "ads1015.h"
 #include "MiscSupport.h"
@@ -450,6 +451,7 @@ static int iADS1015Reset(uint8_t uiBoard)
     sADS1015TwiXferBuf.puiaData = ucaTWIOutBuf;
 
     iResult = iTWIInitXFer(&sADS1015TwiXferBuf);
+    vForgetTwiSwitch(); // the general call may have reset the bus switch too
     delay_ms(1); // without this delay the I2C bus doesn't work properly; #TODO figure out why
     //	usleep(1000);
 
@@ -477,9 +479,7 @@ static int iADS1015ReadReg(uint8_t uiBoard, uint8_t uiReg)
     sADS1015TwiXferBuf.uiReg = uiReg;
     sADS1015TwiXferBuf.uiCount = CONVERSION_REGISTER_SIZE;
     sADS1015TwiXferBuf.puiaData = ucaTWIInBuf;
-    iResult = iTWIInitXFer(&sADS1015TwiXferBuf);
-
-    usleep(1000);
+    iResult = iTWIInitXFer(&sADS1015TwiXferBuf); // completes before returning
 
     return (iResult);
 
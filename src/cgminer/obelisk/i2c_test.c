@@ -7,6 +7,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
@@ -22,6 +23,45 @@ static int i2c_dev_open(int i2cbus)
     return fd;
 }
 
+/*
+ * The bus is opened once and kept open. Every transfer goes through
+ * I2C_RDWR, which carries the slave address in each message, so no
+ * I2C_SLAVE state is kept on the fd and transfers from different threads
+ * can't pick up each other's address. A failed open is retried on the next
+ * transfer.
+ */
+static pthread_mutex_t i2c_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+static int i2c_fd = -1;
+
+static int i2c_get_fd(void)
+{
+    int fd;
+
+    pthread_mutex_lock(&i2c_fd_lock);
+    if(i2c_fd < 0)
+        i2c_fd = i2c_dev_open(2);
+    fd = i2c_fd;
+    pthread_mutex_unlock(&i2c_fd_lock);
+    return fd;
+}
+
+static int i2c_transfer(struct i2c_msg *msgs, int num_msgs)
+{
+    struct i2c_rdwr_ioctl_data data;
+    int fd;
+
+    if((fd = i2c_get_fd()) < 0)
+    {
+        printf("-E- i2c Error opening i2c device %d:%s\n", errno, strerror(errno));
+        return -1;
+    }
+    data.msgs = msgs;
+    data.nmsgs = num_msgs;
+    if(ioctl(fd, I2C_RDWR, &data) != num_msgs)
+        return -1;
+    return 0;
+}
+
 /*
  * i2cget()
  *
@@ -30,65 +70,55 @@ static int i2c_dev_open(int i2cbus)
 //int i2cget(int device_addr, int num_bytes, u_int8_t *buffer);
 int i2cget(int device_addr, int num_bytes, u_int8_t *buffer)
 {
-    int status = 0;
-    int fd;
+    struct i2c_msg msg;
 
-    if((fd = i2c_dev_open(2)) > 0)
+    if((num_bytes <= 0) || (buffer == NULL))
     {
-        if((num_bytes <= 0) || (buffer == NULL))
-        {
-            printf("-E- i2cget Invalid arguments\n");
-            return -1;
-        }
-        ioctl(fd, I2C_SLAVE, device_addr);
-        if(read(fd, buffer, num_bytes) != num_bytes)
-        {
-            printf("-E- i2cget Error reading from i2c %d:%s\n", errno, strerror(errno));
-            status = -1;
-        }
+        printf("-E- i2cget Invalid arguments\n");
+        return -1;
     }
-    else
+    msg.addr = device_addr;
+    msg.flags = I2C_M_RD;
+    msg.len = num_bytes;
+    msg.buf = buffer;
+    if(i2c_transfer(&msg, 1) != 0)
     {
-        printf("-E- i2cget Error opening i2c device %d:%s\n", errno, strerror(errno));
-        status = -1;
+        printf("-E- i2cget Error reading from i2c %d:%s\n", errno, strerror(errno));
+        return -1;
     }
-    close(fd);
-    return status;
+    return 0;
 }
 
 /*
  * i2cget_reg()
  *
- * For SC1Miner:
+ * For SC1Miner: the register write and the read go out as one combined
+ * transaction with a repeated start between them.
  */
 //int i2cget_reg(int device_addr, u_int8_t reg, int num_bytes, u_int8_t *buffer);
 int i2cget_reg(int device_addr, u_int8_t reg, int num_bytes, u_int8_t *buffer)
 {
-    int status = 0;
-    int fd;
+    struct i2c_msg msgs[2];
 
-    if((fd = i2c_dev_open(2)) > 0)
+    if((num_bytes <= 0) || (buffer == NULL))
     {
-        if((num_bytes <= 0) || (buffer == NULL))
-        {
-            printf("-E- i2cget_reg Invalid arguments\n");
-            return -1;
-        }
-        ioctl(fd, I2C_SLAVE, device_addr);
-        write(fd, &reg, 1);
-        if(read(fd, buffer, num_bytes) != num_bytes)
-        {
-            printf("-E- i2cget_reg Error reading from i2c %d:%s\n", errno, strerror(errno));
-            status = -1;
-        }
+        printf("-E- i2cget_reg Invalid arguments\n");
+        return -1;
     }
-    else
+    msgs[0].addr = device_addr;
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = &reg;
+    msgs[1].addr = device_addr;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = num_bytes;
+    msgs[1].buf = buffer;
+    if(i2c_transfer(msgs, 2) != 0)
     {
-        printf("-E- i2cget_reg Error opening i2c device %d:%s\n", errno, strerror(errno));
-        status = -1;
+        printf("-E- i2cget_reg Error reading from i2c %d:%s\n", errno, strerror(errno));
+        return -1;
     }
-    close(fd);
-    return status;
+    return 0;
 }
 
 /*
@@ -99,30 +129,23 @@ int i2cget_reg(int device_addr, u_int8_t reg, int num_bytes, u_int8_t *buffer)
 //int i2cset(int device_addr, int num_bytes, u_int8_t *buffer);
 int i2cset(int device_addr, int num_bytes, u_int8_t *buffer)
 {
-    int status = 0;
-    int fd;
+    struct i2c_msg msg;
 
-    if((fd = i2c_dev_open(2)) > 0)
+    if((num_bytes <= 0) || (buffer == NULL))
     {
-        if((num_bytes <= 0) || (buffer == NULL))
-        {
-            printf("-E- i2cset Invalid arguments\n");
-            return -1;
-        }
-        ioctl(fd, I2C_SLAVE, device_addr);
-        if(write(fd, buffer, num_bytes) != num_bytes)
-        {
-            printf("-E- i2cset Error writing to i2c %d: %s\n", errno, strerror(errno));
-            status = -1;
-        }
+        printf("-E- i2cset Invalid arguments\n");
+        return -1;
     }
-    else
+    msg.addr = device_addr;
+    msg.flags = 0;
+    msg.len = num_bytes;
+    msg.buf = buffer;
+    if(i2c_transfer(&msg, 1) != 0)
     {
-        printf("-E- i2cset Error opening i2c device %d: %s\n", errno, strerror(errno));
-        status = -1;
+        printf("-E- i2cset Error writing to i2c %d: %s\n", errno, strerror(errno));
+        return -1;
     }
-    close(fd);
-    return status;
+    return 0;
 }
 
 int i2c_test(void)
@@ -1,5 +1,8 @@
 #include <stdint.h>
 
+// Longest extranonce1 or extranonce2 a Sia header can be built with.
+#define SIA_EXTRANONCE_MAX 8
+
 // SiaStratumInput defines a list of inputs from a stratum server that can be
 // turned into a Sia header.
 typedef struct SiaStratumInput {
@@ -21,8 +24,8 @@ typedef struct SiaStratumInput {
 	// Extra nonce inputs.
 	uint16_t ExtraNonce1Size;
 	uint16_t ExtraNonce2Size;
-	uint8_t ExtraNonce1[8];
-	uint8_t ExtraNonce2[8];
+	uint8_t ExtraNonce1[SIA_EXTRANONCE_MAX];
+	uint8_t ExtraNonce2[SIA_EXTRANONCE_MAX];
 } SiaStratumInput;
 
 void siaCalculateStratumHeader(uint8_t* header, SiaStratumInput input);
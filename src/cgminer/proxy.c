@@ -0,0 +1,668 @@
+//===========================================================================
+// Copyright 2018 Obelisk Inc.
+//===========================================================================
+
+/*
+ * Local stratum proxy.
+ *
+ * One unit keeps the single upstream stratum session to its current pool and
+ * serves other miners on the farm from it. Each downstream connection gets a
+ * one byte slice of the upstream extranonce2 appended to its extranonce1, so
+ * downstream miners search disjoint spaces and their shares can be forwarded
+ * upstream unchanged apart from the worker name and the extranonce2 prefix.
+ *
+ * Notifies and difficulty changes are relayed to every subscribed client as
+ * they arrive from the pool. Shares are collected for up to
+ * opt_ob_proxy_batch_ms and written upstream in one send, and the pool's
+ * replies are routed back to the client that found the share.
+ *
+ * The unit usually hashes itself as well, from the same upstream extranonce2
+ * space. Downstream slots take the prefix bytes from PROXY_SLOT_BASE up, and
+ * while the proxy is enabled proxy_local_nonce2() keeps the first byte of
+ * every locally generated extranonce2 at zero, so the two never overlap.
+ */
+
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+
+#include "miner.h"
+
+#define PROXY_MAX_CLIENTS 64
+#define PROXY_BUFSIZE 4096
+#define PROXY_LINESIZE 512
+#define PROXY_MAX_BATCH 32
+#define PROXY_ROUTES 1024
+#define PROXY_QUEUE 16
+#define PROXY_SENDSIZE 16384
+
+/* Extranonce2 prefix byte of slot 0, prefix 0 is left for local work */
+#define PROXY_SLOT_BASE 1
+#define PROXY_PREFIX(slot) ((slot) + PROXY_SLOT_BASE)
+
+struct proxy_client {
+    SOCKETTYPE sock;
+    char addr[INET_ADDRSTRLEN];
+    char buf[PROXY_BUFSIZE];
+    size_t buflen;
+    unsigned int gen;
+    bool subscribed;
+    bool authorized;
+    char worker[64];
+    time_t connected;
+    uint64_t accepted;
+    uint64_t rejected;
+};
+
+/* Upstream share id -> client that submitted it */
+struct proxy_route {
+    int id;
+    int slot;
+    unsigned int gen;
+    char cid[32];
+};
+
+static pthread_mutex_t proxy_lock;
+static pthread_t proxy_thread_id;
+static struct proxy_client clients[PROXY_MAX_CLIENTS];
+static struct proxy_route routes[PROXY_ROUTES];
+
+static struct pool* proxy_pool;
+static char* proxy_nonce1;
+static int proxy_n2size;
+static char* last_notify;
+static char* last_diff;
+
+static char batch[PROXY_MAX_BATCH * PROXY_LINESIZE + 2];
+static size_t batch_len;
+static int batch_ids[PROXY_MAX_BATCH];
+static int batched;
+static struct timeval batch_start;
+
+static uint64_t proxy_accepted;
+static uint64_t proxy_rejected;
+
+/* Write a line to a client, appending \n. Called with proxy_lock held, which
+ * also protects the static line buffer. A client that can't take a line is
+ * dropped rather than stalling the pool. */
+static void __client_send(struct proxy_client* client, const char* s)
+{
+    static char line[PROXY_SENDSIZE];
+    size_t len = strlen(s);
+    ssize_t sent;
+
+    if (client->sock == INVSOCK || len + 2 > sizeof(line))
+        return;
+
+    memcpy(line, s, len);
+    line[len++] = '\n';
+
+    sent = send(client->sock, line, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent != (ssize_t)len) {
+        applog(LOG_NOTICE, "Proxy client %s not keeping up, disconnecting", client->addr);
+        CLOSESOCKET(client->sock);
+        client->sock = INVSOCK;
+    }
+}
+
+static void __client_close(struct proxy_client* client)
+{
+    if (client->sock != INVSOCK) {
+        CLOSESOCKET(client->sock);
+        client->sock = INVSOCK;
+    }
+    client->subscribed = false;
+    client->authorized = false;
+}
+
+/* Called with proxy_lock held */
+static void __drop_clients(const char* why)
+{
+    int i, dropped = 0;
+
+    for (i = 0; i < PROXY_MAX_CLIENTS; i++) {
+        if (clients[i].sock != INVSOCK) {
+            __client_close(&clients[i]);
+            dropped++;
+        }
+    }
+    if (dropped)
+        applog(LOG_NOTICE, "Proxy dropped %d clients: %s", dropped, why);
+}
+
+/* Make sure we are serving from the pool we are currently mining on, and that
+ * its extranonce1 has not changed under us. Clients that subscribed to an old
+ * session can't submit valid shares so they are made to reconnect. Called with
+ * proxy_lock held. */
+static bool __check_upstream(struct pool* pool)
+{
+    bool changed = false;
+
+    if (pool != current_pool())
+        return false;
+
+    cg_rlock(&pool->data_lock);
+    if (pool != proxy_pool || !proxy_nonce1 || !pool->nonce1 ||
+        strcmp(proxy_nonce1, pool->nonce1) || proxy_n2size != pool->n2size) {
+        free(proxy_nonce1);
+        proxy_nonce1 = pool->nonce1 ? strdup(pool->nonce1) : NULL;
+        proxy_n2size = pool->n2size;
+        proxy_pool = pool;
+        changed = true;
+    }
+    cg_runlock(&pool->data_lock);
+
+    if (changed) {
+        free(last_notify);
+        last_notify = NULL;
+        free(last_diff);
+        last_diff = NULL;
+        __drop_clients("upstream session changed");
+    }
+    return proxy_nonce1 != NULL;
+}
+
+void proxy_notify(struct pool* pool, const char* s)
+{
+    int i;
+
+    if (!opt_ob_proxy_port)
+        return;
+
+    mutex_lock(&proxy_lock);
+    if (__check_upstream(pool)) {
+        free(last_notify);
+        last_notify = strdup(s);
+        for (i = 0; i < PROXY_MAX_CLIENTS; i++) {
+            if (clients[i].authorized)
+                __client_send(&clients[i], s);
+        }
+    }
+    mutex_unlock(&proxy_lock);
+}
+
+void proxy_diff(struct pool* pool, const char* s)
+{
+    int i;
+
+    if (!opt_ob_proxy_port)
+        return;
+
+    mutex_lock(&proxy_lock);
+    if (__check_upstream(pool)) {
+        free(last_diff);
+        last_diff = strdup(s);
+        for (i = 0; i < PROXY_MAX_CLIENTS; i++) {
+            if (clients[i].authorized)
+                __client_send(&clients[i], s);
+        }
+    }
+    mutex_unlock(&proxy_lock);
+}
+
+/* Called from parse_stratum_response for every reply from the pool. Returns
+ * true if the reply was to a proxied share and has been dealt with. */
+bool proxy_share_result(struct pool* pool, int id, json_t* res_val, json_t* err_val)
+{
+    struct proxy_route* route;
+    struct proxy_client* client;
+    char s[PROXY_LINESIZE];
+    char *res, *err;
+    bool accepted;
+
+    if (!opt_ob_proxy_port)
+        return false;
+
+    mutex_lock(&proxy_lock);
+    route = &routes[(unsigned int)id % PROXY_ROUTES];
+    if (pool != proxy_pool || route->id != id || route->slot < 0) {
+        mutex_unlock(&proxy_lock);
+        return false;
+    }
+
+    accepted = res_val && json_is_true(res_val);
+    if (accepted)
+        proxy_accepted++;
+    else
+        proxy_rejected++;
+
+    client = &clients[route->slot];
+    if (client->sock != INVSOCK && client->gen == route->gen) {
+        if (accepted)
+            client->accepted++;
+        else
+            client->rejected++;
+
+        res = res_val ? json_dumps(res_val, JSON_ENCODE_ANY) : NULL;
+        err = err_val ? json_dumps(err_val, JSON_ENCODE_ANY) : NULL;
+        snprintf(s, sizeof(s), "{\"id\":%s,\"result\":%s,\"error\":%s}",
+            route->cid, res ? res : "false", err ? err : "null");
+        free(res);
+        free(err);
+        __client_send(client, s);
+    }
+    route->slot = -1;
+    mutex_unlock(&proxy_lock);
+
+    return true;
+}
+
+/* Send whatever shares have been batched up to the pool in a single write.
+ * Shares that can't be sent are rejected back to their clients straight
+ * away so they don't sit waiting for a reply that will never come. */
+static void flush_batch(void)
+{
+    char buf[sizeof(batch)];
+    int ids[PROXY_MAX_BATCH];
+    struct pool* pool;
+    int i, n;
+
+    mutex_lock(&proxy_lock);
+    n = batched;
+    pool = proxy_pool;
+    if (n)
+        memcpy(buf, batch, batch_len + 1);
+    memcpy(ids, batch_ids, sizeof(ids));
+    batched = 0;
+    batch_len = 0;
+    batch[0] = '\0';
+    mutex_unlock(&proxy_lock);
+
+    if (!n)
+        return;
+
+    /* stratum_send appends the final \n */
+    if (pool && stratum_send(pool, buf, strlen(buf)))
+        return;
+
+    applog(LOG_WARNING, "Proxy failed to forward %d shares upstream", n);
+    mutex_lock(&proxy_lock);
+    for (i = 0; i < n; i++) {
+        struct proxy_route* route = &routes[(unsigned int)ids[i] % PROXY_ROUTES];
+        struct proxy_client* client;
+        char s[PROXY_LINESIZE];
+
+        if (route->id != ids[i] || route->slot < 0)
+            continue;
+        client = &clients[route->slot];
+        if (client->sock != INVSOCK && client->gen == route->gen) {
+            client->rejected++;
+            snprintf(s, sizeof(s), "{\"id\":%s,\"result\":false,\"error\":[21,\"Upstream unavailable\",null]}", route->cid);
+            __client_send(client, s);
+        }
+        route->slot = -1;
+        proxy_rejected++;
+    }
+    mutex_unlock(&proxy_lock);
+}
+
+static void client_reply(struct proxy_client* client, const char* cid, const char* result)
+{
+    /* Room for a full line of result plus the id and wrapping */
+    char s[PROXY_LINESIZE * 2];
+
+    snprintf(s, sizeof(s), "{\"id\":%s,\"result\":%s,\"error\":null}", cid, result);
+    __client_send(client, s);
+}
+
+static void client_error(struct proxy_client* client, const char* cid, int code, const char* msg)
+{
+    char s[PROXY_LINESIZE];
+
+    snprintf(s, sizeof(s), "{\"id\":%s,\"result\":null,\"error\":[%d,\"%s\",null]}", cid, code, msg);
+    __client_send(client, s);
+}
+
+/* Rewrite a downstream mining.submit for the upstream session and queue it.
+ * Called with proxy_lock held. Returns false if the batch is full. */
+static bool __queue_submit(struct proxy_client* client, int slot, const char* cid, json_t* params)
+{
+    const char *job_id, *en2, *ntime, *nonce;
+    char line[PROXY_LINESIZE];
+    struct proxy_route* route;
+    int id, len;
+
+    job_id = json_string_value(json_array_get(params, 1));
+    en2 = json_string_value(json_array_get(params, 2));
+    ntime = json_string_value(json_array_get(params, 3));
+    nonce = json_string_value(json_array_get(params, 4));
+    if (!job_id || !en2 || !ntime || !nonce) {
+        client_error(client, cid, 20, "Invalid submit");
+        return true;
+    }
+    if ((int)strlen(en2) != (proxy_n2size - 1) * 2) {
+        client_error(client, cid, 20, "Invalid extranonce2 size");
+        return true;
+    }
+    if (batched >= PROXY_MAX_BATCH)
+        return false;
+
+    id = swork_id++;
+    len = snprintf(line, sizeof(line),
+        "{\"params\": [\"%s\", \"%s\", \"%02x%s\", \"%s\", \"%s\"], \"id\": %d, \"method\": \"mining.submit\"}",
+        proxy_pool->rpc_user, job_id, PROXY_PREFIX(slot), en2, ntime, nonce, id);
+    if (len >= (int)sizeof(line)) {
+        client_error(client, cid, 20, "Submit too long");
+        return true;
+    }
+
+    route = &routes[(unsigned int)id % PROXY_ROUTES];
+    route->id = id;
+    route->slot = slot;
+    route->gen = client->gen;
+    snprintf(route->cid, sizeof(route->cid), "%s", cid);
+
+    if (batched)
+        batch[batch_len++] = '\n';
+    else
+        cgtime(&batch_start);
+    memcpy(batch + batch_len, line, len + 1);
+    batch_len += len;
+    batch_ids[batched++] = id;
+
+    return true;
+}
+
+/* Handle one line from a downstream miner. Called with proxy_lock held.
+ * Returns false if the batch needs flushing before this line can be taken. */
+static bool __client_line(struct proxy_client* client, int slot, char* s)
+{
+    json_t *val, *method, *id_val, *params;
+    json_error_t err;
+    const char* buf;
+    char cid[32] = "null";
+    char result[PROXY_LINESIZE];
+    char* tmp;
+    bool ret = true;
+
+    val = JSON_LOADS(s, &err);
+    if (!val) {
+        applog(LOG_INFO, "Proxy client %s sent bad JSON: %s", client->addr, err.text);
+        return true;
+    }
+
+    method = json_object_get(val, "method");
+    id_val = json_object_get(val, "id");
+    params = json_object_get(val, "params");
+    buf = json_string_value(method);
+    if (id_val) {
+        tmp = json_dumps(id_val, JSON_ENCODE_ANY);
+        if (tmp && strlen(tmp) < sizeof(cid))
+            strcpy(cid, tmp);
+        free(tmp);
+    }
+    if (!buf)
+        goto out;
+
+    if (!strcasecmp(buf, "mining.subscribe")) {
+        if (!proxy_nonce1 || proxy_n2size < 2) {
+            client_error(client, cid, 20, "Upstream not ready");
+            goto out;
+        }
+        snprintf(result, sizeof(result),
+            "[[[\"mining.set_difficulty\",\"%d\"],[\"mining.notify\",\"%d\"]],\"%s%02x\",%d]",
+            slot, slot, proxy_nonce1, PROXY_PREFIX(slot), proxy_n2size - 1);
+        client_reply(client, cid, result);
+        client->subscribed = true;
+        goto out;
+    }
+
+    if (!strcasecmp(buf, "mining.authorize")) {
+        const char* worker = json_string_value(json_array_get(params, 0));
+
+        snprintf(client->worker, sizeof(client->worker), "%s", worker ? worker : "");
+        client_reply(client, cid, "true");
+        client->authorized = true;
+        applog(LOG_NOTICE, "Proxy client %s authorized as %s", client->addr, client->worker);
+        if (last_diff)
+            __client_send(client, last_diff);
+        if (last_notify)
+            __client_send(client, last_notify);
+        goto out;
+    }
+
+    if (!strcasecmp(buf, "mining.submit")) {
+        if (!client->authorized)
+            client_error(client, cid, 24, "Unauthorized worker");
+        else
+            ret = __queue_submit(client, slot, cid, params);
+        goto out;
+    }
+
+    if (!strcasecmp(buf, "mining.extranonce.subscribe") || !strcasecmp(buf, "mining.suggest_difficulty")) {
+        client_reply(client, cid, "false");
+        goto out;
+    }
+
+    client_error(client, cid, 20, "Unsupported method");
+out:
+    json_decref(val);
+    return ret;
+}
+
+/* Read what is waiting on a client socket and handle every complete line */
+static void client_read(int slot)
+{
+    struct proxy_client* client = &clients[slot];
+    char *line, *eol;
+    ssize_t n;
+
+    mutex_lock(&proxy_lock);
+    n = recv(client->sock, client->buf + client->buflen, PROXY_BUFSIZE - 1 - client->buflen, 0);
+    if (n <= 0) {
+        applog(LOG_NOTICE, "Proxy client %s disconnected", client->addr);
+        __client_close(client);
+        mutex_unlock(&proxy_lock);
+        return;
+    }
+    client->buflen += n;
+    client->buf[client->buflen] = '\0';
+
+    line = client->buf;
+    while (client->sock != INVSOCK && (eol = strchr(line, '\n'))) {
+        *eol = '\0';
+        if (*line && !__client_line(client, slot, line)) {
+            /* Batch is full, put the line back and flush first */
+            *eol = '\n';
+            mutex_unlock(&proxy_lock);
+            flush_batch();
+            mutex_lock(&proxy_lock);
+            continue;
+        }
+        line = eol + 1;
+    }
+
+    if (client->sock == INVSOCK) {
+        client->buflen = 0;
+    } else {
+        client->buflen = strlen(line);
+        memmove(client->buf, line, client->buflen + 1);
+        if (client->buflen >= PROXY_BUFSIZE - 1) {
+            applog(LOG_NOTICE, "Proxy client %s sent an overlong line, disconnecting", client->addr);
+            __client_close(client);
+            client->buflen = 0;
+        }
+    }
+    mutex_unlock(&proxy_lock);
+}
+
+static void client_accept(SOCKETTYPE listensock)
+{
+    struct sockaddr_in cli;
+    socklen_t clisiz = sizeof(cli);
+    SOCKETTYPE c;
+    int i;
+
+    c = accept(listensock, (struct sockaddr*)&cli, &clisiz);
+    if (SOCKETFAIL(c))
+        return;
+
+    mutex_lock(&proxy_lock);
+    for (i = 0; i < PROXY_MAX_CLIENTS; i++) {
+        if (clients[i].sock == INVSOCK)
+            break;
+    }
+    if (i == PROXY_MAX_CLIENTS) {
+        mutex_unlock(&proxy_lock);
+        applog(LOG_WARNING, "Proxy client limit of %d reached, refusing connection", PROXY_MAX_CLIENTS);
+        CLOSESOCKET(c);
+        return;
+    }
+
+    clients[i].sock = c;
+    clients[i].gen++;
+    clients[i].buflen = 0;
+    clients[i].subscribed = false;
+    clients[i].authorized = false;
+    clients[i].worker[0] = '\0';
+    clients[i].connected = time(NULL);
+    clients[i].accepted = 0;
+    clients[i].rejected = 0;
+    inet_ntop(AF_INET, &cli.sin_addr, clients[i].addr, sizeof(clients[i].addr));
+    mutex_unlock(&proxy_lock);
+
+    applog(LOG_NOTICE, "Proxy client %s connected in slot %d", clients[i].addr, i);
+}
+
+static void* proxy_thread(__maybe_unused void* userdata)
+{
+    struct sockaddr_in serv;
+    SOCKETTYPE listensock;
+    int optval = 1;
+
+    pthread_detach(pthread_self());
+    RenameThread("Proxy");
+
+    listensock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listensock == INVSOCK) {
+        applog(LOG_ERR, "Proxy failed to open socket: %s", SOCKERRMSG);
+        return NULL;
+    }
+    if (SOCKETFAIL(setsockopt(listensock, SOL_SOCKET, SO_REUSEADDR, (void*)&optval, sizeof(optval))))
+        applog(LOG_DEBUG, "Proxy setsockopt SO_REUSEADDR failed (ignored): %s", SOCKERRMSG);
+
+    memset(&serv, 0, sizeof(serv));
+    serv.sin_family = AF_INET;
+    serv.sin_addr.s_addr = htonl(INADDR_ANY);
+    serv.sin_port = htons(opt_ob_proxy_port);
+    if (SOCKETFAIL(bind(listensock, (struct sockaddr*)&serv, sizeof(serv))) ||
+        SOCKETFAIL(listen(listensock, PROXY_QUEUE))) {
+        applog(LOG_ERR, "Proxy failed to listen on port %d: %s", opt_ob_proxy_port, SOCKERRMSG);
+        CLOSESOCKET(listensock);
+        return NULL;
+    }
+    applog(LOG_NOTICE, "Stratum proxy listening on port %d", opt_ob_proxy_port);
+
+    while (42) {
+        struct timeval timeout, now;
+        SOCKETTYPE maxfd = listensock;
+        bool pending;
+        fd_set rd;
+        int i;
+
+        FD_ZERO(&rd);
+        FD_SET(listensock, &rd);
+
+        mutex_lock(&proxy_lock);
+        for (i = 0; i < PROXY_MAX_CLIENTS; i++) {
+            if (clients[i].sock == INVSOCK)
+                continue;
+            FD_SET(clients[i].sock, &rd);
+            if (clients[i].sock > maxfd)
+                maxfd = clients[i].sock;
+        }
+        pending = batched > 0;
+        mutex_unlock(&proxy_lock);
+
+        /* Wake up in time to flush a partial batch */
+        timeout.tv_sec = pending ? 0 : 1;
+        timeout.tv_usec = pending ? opt_ob_proxy_batch_ms * 1000 : 0;
+
+        if (select(maxfd + 1, &rd, NULL, NULL, &timeout) > 0) {
+            if (FD_ISSET(listensock, &rd))
+                client_accept(listensock);
+            for (i = 0; i < PROXY_MAX_CLIENTS; i++) {
+                if (clients[i].sock != INVSOCK && FD_ISSET(clients[i].sock, &rd))
+                    client_read(i);
+            }
+        }
+
+        mutex_lock(&proxy_lock);
+        cgtime(&now);
+        pending = batched > 0 && ms_tdiff(&now, &batch_start) >= opt_ob_proxy_batch_ms;
+        mutex_unlock(&proxy_lock);
+        if (pending)
+            flush_batch();
+    }
+
+    return NULL;
+}
+
+/* Move a locally generated nonce2 to the next value whose first submitted
+ * byte is zero. Sia submits work->nonce2 little endian, so that is its low
+ * byte. Decred submits each engine's nonce2 plus its engine index big endian,
+ * so that is the top byte, and the counter wraps early to keep it clear. */
+uint64_t proxy_local_nonce2(uint64_t nonce2)
+{
+    if (!opt_ob_proxy_port)
+        return nonce2;
+#if (ALGO == BLAKE2B)
+    return (nonce2 + 0xff) & ~(uint64_t)0xff;
+#else
+    return nonce2 % 0xff0000;
+#endif
+}
+
+/* Number of clients copied into info, up to max */
+int proxy_client_info(struct proxy_client_info* info, int max)
+{
+    int i, n = 0;
+
+    mutex_lock(&proxy_lock);
+    for (i = 0; i < PROXY_MAX_CLIENTS && n < max; i++) {
+        if (clients[i].sock == INVSOCK)
+            continue;
+        info[n].slot = i;
+        strcpy(info[n].addr, clients[i].addr);
+        strcpy(info[n].worker, clients[i].worker);
+        snprintf(info[n].nonce1, sizeof(info[n].nonce1), "%s%02x", proxy_nonce1 ? proxy_nonce1 : "", PROXY_PREFIX(i));
+        info[n].connected = clients[i].connected;
+        info[n].accepted = clients[i].accepted;
+        info[n].rejected = clients[i].rejected;
+        n++;
+    }
+    mutex_unlock(&proxy_lock);
+
+    return n;
+}
+
+void proxy_counters(uint64_t* accepted, uint64_t* rejected)
+{
+    mutex_lock(&proxy_lock);
+    *accepted = proxy_accepted;
+    *rejected = proxy_rejected;
+    mutex_unlock(&proxy_lock);
+}
+
+void proxy_init(void)
+{
+    int i;
+
+    if (!opt_ob_proxy_port)
+        return;
+
+    if (opt_ob_proxy_batch_ms < 0)
+        opt_ob_proxy_batch_ms = 0;
+
+    mutex_init(&proxy_lock);
+    for (i = 0; i < PROXY_MAX_CLIENTS; i++)
+        clients[i].sock = INVSOCK;
+    for (i = 0; i < PROXY_ROUTES; i++)
+        routes[i].slot = -1;
+
+    if (unlikely(pthread_create(&proxy_thread_id, NULL, proxy_thread, NULL)))
+        quit(1, "Failed to create stratum proxy thread");
+}
@@ -27,6 +27,7 @@
 #ifndef WIN32
 #include <fcntl.h>
 #ifdef __linux
+#include <sys/epoll.h>
 #include <sys/prctl.h>
 #endif
 #include <netdb.h>
@@ -44,6 +45,9 @@
 #include "elist.h"
 #include "miner.h"
 #include "util.h"
+#if (ALGO == BLAKE2B)
+#include "obelisk/siahash/siastratum.h"
+#endif
 
 #define DEFAULT_SOCKWAIT 60
 #ifndef STRATUM_USER_AGENT
@@ -59,12 +63,15 @@ int no_yield(void)
 
 int (*selective_yield)(void) = &no_yield;
 
+/* With --ob-low-latency a dead peer is noticed within ~25s by keepalives, or
+ * 15s after unacknowledged data, instead of after 75s or more */
 static void keep_sockalive(SOCKETTYPE fd)
 {
     const int tcp_one = 1;
 #ifndef WIN32
-    const int tcp_keepidle = 45;
-    const int tcp_keepintvl = 30;
+    const int tcp_keepidle = opt_ob_low_latency ? 10 : 45;
+    const int tcp_keepintvl = opt_ob_low_latency ? 5 : 30;
+    const int tcp_keepcnt = opt_ob_low_latency ? 3 : 1;
     int flags = fcntl(fd, F_GETFL, 0);
 
     fcntl(fd, F_SETFL, O_NONBLOCK | flags);
@@ -81,9 +88,16 @@ static void keep_sockalive(SOCKETTYPE fd)
 #else /* __linux */
         fcntl(fd, F_SETFD, FD_CLOEXEC);
     setsockopt(fd, SOL_TCP, TCP_NODELAY, (const void*)&tcp_one, sizeof(tcp_one));
-    setsockopt(fd, SOL_TCP, TCP_KEEPCNT, &tcp_one, sizeof(tcp_one));
+    setsockopt(fd, SOL_TCP, TCP_KEEPCNT, &tcp_keepcnt, sizeof(tcp_keepcnt));
     setsockopt(fd, SOL_TCP, TCP_KEEPIDLE, &tcp_keepidle, sizeof(tcp_keepidle));
     setsockopt(fd, SOL_TCP, TCP_KEEPINTVL, &tcp_keepintvl, sizeof(tcp_keepintvl));
+#ifdef TCP_USER_TIMEOUT
+    if (opt_ob_low_latency) {
+        const unsigned int tcp_user_timeout = 15000;
+
+        setsockopt(fd, SOL_TCP, TCP_USER_TIMEOUT, &tcp_user_timeout, sizeof(tcp_user_timeout));
+    }
+#endif
 #endif /* __linux */
 
 #ifdef __APPLE_CC__
@@ -1653,6 +1667,11 @@ int cgtimer_to_ms(cgtimer_t* cgt)
     return timespec_to_ms(cgt);
 }
 
+double cgtimer_to_msf(cgtimer_t* cgt)
+{
+    return (double)cgt->tv_sec * 1000.0 + (double)cgt->tv_nsec / 1000000.0;
+}
+
 /* Subtracts b from a and stores it in res. */
 void cgtimer_sub(cgtimer_t* a, cgtimer_t* b, cgtimer_t* res)
 {
@@ -1665,6 +1684,56 @@ void cgtimer_sub(cgtimer_t* a, cgtimer_t* b, cgtimer_t* res)
 }
 #endif /* WIN32 */
 
+/* Elapsed ms from start to end with sub ms resolution */
+double cgtimer_ms_diff(cgtimer_t* end, cgtimer_t* start)
+{
+    cgtimer_t diff;
+
+    cgtimer_sub(end, start, &diff);
+    return cgtimer_to_msf(&diff);
+}
+
+#define LATENCY_STEP 1.41421356
+
+void latency_add(struct latency_hist* hist, double ms)
+{
+    double top = LATENCY_MIN_MS;
+    int i = 0;
+
+    if (ms < 0)
+        ms = 0;
+    while (i < LATENCY_BUCKETS - 1 && ms > top) {
+        top *= LATENCY_STEP;
+        i++;
+    }
+    hist->bucket[i]++;
+    hist->count++;
+    if (ms > hist->max_ms)
+        hist->max_ms = ms;
+}
+
+/* Upper bound of the bucket holding the pct'th percentile, pct in 0..1 */
+double latency_percentile(struct latency_hist* hist, double pct)
+{
+    double top = LATENCY_MIN_MS;
+    uint64_t want, seen = 0;
+    int i;
+
+    if (!hist->count)
+        return 0;
+
+    want = (uint64_t)(pct * hist->count + 0.5);
+    if (want < 1)
+        want = 1;
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += hist->bucket[i];
+        if (seen >= want)
+            break;
+        top *= LATENCY_STEP;
+    }
+    return top < hist->max_ms ? top : hist->max_ms;
+}
+
 #if defined(CLOCK_MONOTONIC) && !defined(__FreeBSD__) && !defined(__APPLE__) && !defined(WIN32) /* Essentially just linux */
 //#ifdef CLOCK_MONOTONIC /* Essentially just linux */
 void cgtimer_time(cgtimer_t* ts_start)
@@ -1737,6 +1806,11 @@ int cgtimer_to_ms(cgtimer_t* cgt)
     return (int)(cgt->QuadPart / 10000LL);
 }
 
+double cgtimer_to_msf(cgtimer_t* cgt)
+{
+    return (double)cgt->QuadPart / 10000.0;
+}
+
 /* Subtracts b from a and stores it in res. */
 void cgtimer_sub(cgtimer_t* a, cgtimer_t* b, cgtimer_t* res)
 {
@@ -1977,13 +2051,22 @@ static enum send_ret __stratum_send(struct pool* pool, char* s, ssize_t len)
 bool stratum_send(struct pool* pool, char* s, ssize_t len)
 {
     enum send_ret ret = SEND_INACTIVE;
+    cgtimer_t start, end;
+    uint64_t us;
 
     if (opt_protocol)
         applog(LOG_DEBUG, "SEND: %s", s);
 
+    cgtimer_time(&start);
     mutex_lock(&pool->stratum_lock);
     if (pool->stratum_active)
         ret = __stratum_send(pool, s, len);
+    cgtimer_time(&end);
+    /* Time spent waiting for the lock and the socket, protected by the lock */
+    us = cgtimer_ms_diff(&end, &start) * 1000;
+    pool->cgminer_pool_stats.send_blocked_us += us;
+    if (us > pool->cgminer_pool_stats.send_blocked_max_us)
+        pool->cgminer_pool_stats.send_blocked_max_us = us;
     mutex_unlock(&pool->stratum_lock);
 
     /* This is to avoid doing applog under stratum_lock */
@@ -2023,6 +2106,13 @@ static bool socket_full(struct pool* pool, int wait)
     return false;
 }
 
+/* Wait up to secs for the pool's stratum socket to have something to read, or
+ * to have failed. Returns false on timeout. */
+bool stratum_wait(struct pool* pool, int secs)
+{
+    return socket_full(pool, secs);
+}
+
 /* Check to see if Santa's been good to you */
 bool sock_full(struct pool* pool)
 {
@@ -2093,12 +2183,14 @@ char* recv_line(struct pool* pool)
 
     if (!strstr(pool->sockbuf, "\n")) {
         struct timeval rstart, now;
+        cgtimer_t bstart, bend;
 
         cgtime(&rstart);
         if (!socket_full(pool, DEFAULT_SOCKWAIT)) {
             applog(LOG_DEBUG, "Timed out waiting for data on socket_full");
             goto out;
         }
+        cgtimer_time(&bstart);
 
         do {
             char s[RBUFSIZE];
@@ -2126,6 +2218,10 @@ char* recv_line(struct pool* pool)
                 strcat(pool->sockbuf, s);
             }
         } while (waited < DEFAULT_SOCKWAIT && !strstr(pool->sockbuf, "\n"));
+
+        /* Time from data arriving to having a whole line */
+        cgtimer_time(&bend);
+        pool->cgminer_pool_stats.recv_blocked_us += cgtimer_ms_diff(&bend, &bstart) * 1000;
     }
 
     buflen = strlen(pool->sockbuf);
@@ -2155,6 +2251,210 @@ out:
     return sret;
 }
 
+#ifdef __linux
+/* With --ob-low-latency one thread waits on every pool's stratum socket with
+ * epoll, reads what arrives and parses each message as soon as its line is
+ * complete, so messages don't take a second hop through the pool's rthread.
+ *
+ * The rthread keeps the socket while connecting, subscribing, authorising and
+ * failing over, all of which block per pool. Once the connection is up it
+ * hands the socket over in stratum_poll(), and gets it back when the
+ * connection fails, goes quiet or is no longer needed. stratum_poll_lock is
+ * held by whichever thread is reading, and stratum_polled says which one owns
+ * the socket. */
+static int stratum_epfd = -1;
+
+/* Take the next whole line out of the pool's sockbuf, NULL if there isn't one */
+static char* take_line(struct pool* pool)
+{
+    char *nl, *sret;
+    size_t len;
+
+    while ((nl = strchr(pool->sockbuf, '\n')) != NULL) {
+        len = nl - pool->sockbuf;
+        sret = len ? strndup(pool->sockbuf, len) : NULL;
+        memmove(pool->sockbuf, nl + 1, strlen(nl + 1) + 1);
+        if (!sret)
+            continue;
+
+        pool->cgminer_pool_stats.times_received++;
+        pool->cgminer_pool_stats.bytes_received += len;
+        pool->cgminer_pool_stats.net_bytes_received += len;
+        if (opt_protocol)
+            applog(LOG_DEBUG, "RECVD: %s", sret);
+        return sret;
+    }
+    return NULL;
+}
+
+/* Read everything waiting on a polled pool's socket and parse every whole line.
+ * Returns false if the rthread needs the socket back. Called with
+ * stratum_poll_lock held. */
+static bool stratum_poll_read(struct pool* pool)
+{
+    SOCKETTYPE sock = pool->sock;
+    struct epoll_event ev;
+    bool ok = true;
+    char* line;
+
+    while (42) {
+        char s[RBUFSIZE];
+        ssize_t n;
+
+        n = recv(sock, s, RECVSIZE, MSG_DONTWAIT);
+        if (n > 0) {
+            s[n] = '\0';
+            recalloc_sock(pool, strlen(s));
+            strcat(pool->sockbuf, s);
+            continue;
+        }
+        if (!n || !sock_blocks()) {
+            applog(LOG_DEBUG, "Pool %d stratum socket failed in poll", pool->pool_no);
+            ok = false;
+        }
+        break;
+    }
+
+    while ((line = take_line(pool)) != NULL) {
+        pool->stratum_lastmsg = time(NULL);
+        stratum_parse(pool, line);
+        /* A client.reconnect hands the connection back to the rthread */
+        if (pool->stratum_reconnect || pool->sock != sock || !pool->stratum_active) {
+            ok = false;
+            break;
+        }
+    }
+
+    if (ok) {
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.ptr = pool;
+        if (!epoll_ctl(stratum_epfd, EPOLL_CTL_MOD, sock, &ev))
+            return true;
+    }
+    epoll_ctl(stratum_epfd, EPOLL_CTL_DEL, sock, NULL);
+    return false;
+}
+
+static void* stratum_poll_thread(__maybe_unused void* userdata)
+{
+    struct epoll_event events[16];
+    int i, n;
+
+    pthread_detach(pthread_self());
+    RenameThread("StratumPoll");
+
+    while (42) {
+        n = epoll_wait(stratum_epfd, events, 16, -1);
+        if (n < 0) {
+            if (interrupted())
+                continue;
+            applog(LOG_ERR, "Stratum epoll_wait failed: %s", strerror(errno));
+            cgsleep_ms(1000);
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            struct pool* pool = events[i].data.ptr;
+
+            mutex_lock(&pool->stratum_poll_lock);
+            if (pool->stratum_polled && !stratum_poll_read(pool)) {
+                pool->stratum_polled = false;
+                cgsem_post(&pool->stratum_rsem);
+            }
+            mutex_unlock(&pool->stratum_poll_lock);
+        }
+    }
+
+    return NULL;
+}
+
+void stratum_poll_init(void)
+{
+    pthread_t pth;
+
+    if (!opt_ob_low_latency)
+        return;
+
+    stratum_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (stratum_epfd < 0) {
+        applog(LOG_WARNING, "Failed to create stratum epoll, falling back to select: %s", strerror(errno));
+        return;
+    }
+    if (unlikely(pthread_create(&pth, NULL, stratum_poll_thread, NULL)))
+        quit(1, "Failed to create stratum poll thread");
+}
+
+/* Take the socket back from the poll thread if it still has it */
+static void stratum_unpoll(struct pool* pool)
+{
+    mutex_lock(&pool->stratum_poll_lock);
+    if (pool->stratum_polled) {
+        pool->stratum_polled = false;
+        epoll_ctl(stratum_epfd, EPOLL_CTL_DEL, pool->sock, NULL);
+    }
+    mutex_unlock(&pool->stratum_poll_lock);
+}
+
+/* Hand a connected pool's socket to the poll thread and wait for it to come
+ * back. Returns STRATUM_POLL_OFF if there is no poll thread or the rthread
+ * still has buffered data to read itself, STRATUM_POLL_FAILED if the connection
+ * failed or had no message for secs, STRATUM_POLL_RECHECK if the rthread
+ * should check whether the connection is still needed, and
+ * STRATUM_POLL_RECONNECT if the pool asked for a reconnect. */
+int stratum_poll(struct pool* pool, int secs, bool (*needed)(struct pool*))
+{
+    struct epoll_event ev;
+    int wait;
+
+    if (stratum_epfd < 0 || sock_full(pool))
+        return STRATUM_POLL_OFF;
+
+    cgsem_reset(&pool->stratum_rsem);
+    pool->stratum_lastmsg = time(NULL);
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = pool;
+    mutex_lock(&pool->stratum_poll_lock);
+    if (epoll_ctl(stratum_epfd, EPOLL_CTL_ADD, pool->sock, &ev) &&
+        (errno != EEXIST || epoll_ctl(stratum_epfd, EPOLL_CTL_MOD, pool->sock, &ev))) {
+        mutex_unlock(&pool->stratum_poll_lock);
+        applog(LOG_DEBUG, "Pool %d epoll_ctl failed: %s", pool->pool_no, strerror(errno));
+        return STRATUM_POLL_OFF;
+    }
+    pool->stratum_polled = true;
+    mutex_unlock(&pool->stratum_poll_lock);
+
+    while (42) {
+        /* Messages are parsed on the poll thread, so only the connection's
+         * health and whether it is still wanted are checked here */
+        wait = secs - (int)(time(NULL) - pool->stratum_lastmsg);
+        if (wait <= 0) {
+            applog(LOG_DEBUG, "Stratum poll timed out on pool %d", pool->pool_no);
+            stratum_unpoll(pool);
+            return STRATUM_POLL_FAILED;
+        }
+        if (!cgsem_mswait(&pool->stratum_rsem, MIN(wait, STRATUM_POLL_CHECK_SECS) * 1000))
+            return pool->stratum_reconnect ? STRATUM_POLL_RECONNECT : STRATUM_POLL_FAILED;
+        if (!pool->sock) {
+            stratum_unpoll(pool);
+            return STRATUM_POLL_FAILED;
+        }
+        if (pool->removed || !needed(pool)) {
+            stratum_unpoll(pool);
+            return STRATUM_POLL_RECHECK;
+        }
+    }
+}
+#else
+void stratum_poll_init(void)
+{
+}
+
+int stratum_poll(__maybe_unused struct pool* pool, __maybe_unused int secs,
+    __maybe_unused bool (*needed)(struct pool*))
+{
+    return STRATUM_POLL_OFF;
+}
+#endif
+
 /* Extracts a string value from a json array with error checking. To be used
  * when the value of the string returned is only examined and not to be stored.
  * See json_array_string below */
@@ -2239,6 +2539,8 @@ static bool parse_notify(struct pool* pool, json_t* val)
     }
 
     cg_wlock(&pool->data_lock);
+    cgtimer_time(&pool->tv_notify);
+    pool->notify_seq++;
     free(pool->swork.job_id);
     pool->swork.job_id = job_id;
     if (memcmp(pool->prev_hash, prev_hash, 64)) {
@@ -2475,10 +2777,7 @@ static bool parse_reconnect(struct pool* pool, json_t* val)
 
     applog(LOG_WARNING, "Stratum reconnect requested from pool %d to %s", pool->pool_no, address);
 
-    clear_pool_work(pool);
-
     mutex_lock(&pool->stratum_lock);
-    __suspend_stratum(pool);
     tmp = pool->sockaddr_url;
     pool->sockaddr_url = sockaddr_url;
     pool->stratum_url = pool->sockaddr_url;
@@ -2488,6 +2787,21 @@ static bool parse_reconnect(struct pool* pool, json_t* val)
     free(tmp);
     mutex_unlock(&pool->stratum_lock);
 
+    /* Connecting blocks, and the poll thread reads every pool, so when it
+     * parsed this the rthread does the reconnect instead */
+    if (pool->stratum_polled) {
+        pool->stratum_reconnect = true;
+        return true;
+    }
+    return reconnect_stratum(pool);
+}
+
+/* Drop the pool's connection and connect to its current address */
+bool reconnect_stratum(struct pool* pool)
+{
+    pool->stratum_reconnect = false;
+    clear_pool_work(pool);
+    suspend_stratum(pool);
     return restart_stratum(pool);
 }
 
@@ -2578,15 +2892,18 @@ bool parse_method(struct pool* pool, char* s)
         goto out_decref;
 
     if (!strncasecmp(buf, "mining.notify", 13)) {
-        if (parse_notify(pool, params))
+        if (parse_notify(pool, params)) {
             pool->stratum_notify = ret = true;
-        else
+            proxy_notify(pool, s);
+        } else
             pool->stratum_notify = ret = false;
         goto out_decref;
     }
 
     if (!strncasecmp(buf, "mining.set_difficulty", 21)) {
         ret = parse_diff(pool, params);
+        if (ret)
+            proxy_diff(pool, s);
         goto out_decref;
     }
 
@@ -2616,21 +2933,75 @@ out:
     return ret;
 }
 
+/* Pools that don't take mining.suggest_difficulty but expect the difficulty to
+ * be appended to the worker name as "+diff". The diff here is used unless the
+ * pool has its own --pool-diff. */
+static const struct diff_suffix_pool {
+    const char* url;
+    const char* coin;
+    double diff;
+} diff_suffix_pools[] = {
+    /* Luxor's DCR vardiff behaves strangely, so pin the difficulty */
+    { "luxor.tech", "dcr", 1000 },
+    { NULL, NULL, 0 }
+};
+
+static const struct diff_suffix_pool* find_diff_suffix_pool(struct pool* pool)
+{
+    const struct diff_suffix_pool* dsp;
+
+    for (dsp = diff_suffix_pools; dsp->url; dsp++) {
+        if (strstr(pool->rpc_url, dsp->url) && strstr(pool->rpc_url, dsp->coin))
+            return dsp;
+    }
+    return NULL;
+}
+
+/* Ask the pool to send us shares at the given difficulty. Pools that don't
+ * support it reply with an error, which parse_stratum_response picks up by
+ * matching suggest_diff_id and then no more suggestions are made. */
+bool suggest_stratum_diff(struct pool* pool, double diff)
+{
+    char s[RBUFSIZE];
+    int id;
+
+    if (pool->suggest_diff_unsupported || diff < 1)
+        return false;
+
+    id = swork_id++;
+    sprintf(s, "{\"id\": %d, \"method\": \"mining.suggest_difficulty\", \"params\": [%.0f]}",
+        id, diff);
+    pool->suggest_diff_id = id;
+    if (!stratum_send(pool, s, strlen(s)))
+        return false;
+
+    pool->suggested_diff = diff;
+    pool->suggest_diff_time = time(NULL);
+    applog(LOG_NOTICE, "Pool %d suggested difficulty %.0f", pool->pool_no, diff);
+    return true;
+}
+
 bool auth_stratum(struct pool* pool)
 {
     json_t *val = NULL, *res_val, *err_val;
     char s[RBUFSIZE], *sret = NULL;
+    const struct diff_suffix_pool* dsp;
     json_error_t err;
     bool ret = false;
-
-    // Set a fixed difficulty of 256 for Luxor pool to prevent strange sdiff behavior
     char user[256];
-    // If the user contains "dcr" and "luxor.tech", but does not already contain a '+' character, then append "+256"
-    if (strstr(pool->rpc_url, "dcr") != NULL && strstr(pool->rpc_url, "luxor.tech") != NULL && strchr(pool->rpc_user, '+') == NULL) {
-        snprintf(user, 256, "%s+1000", pool->rpc_user);
-    } else {
-        strncpy(user, pool->rpc_user, 256);
-    }
+    double diff;
+
+    dsp = find_diff_suffix_pool(pool);
+    if (dsp) {
+        /* Respect a difficulty the user already put in the worker name */
+        diff = pool->fixed_diff > 0 ? pool->fixed_diff : dsp->diff;
+        if (pool->fixed_diff >= 0 && !strchr(pool->rpc_user, '+'))
+            snprintf(user, sizeof(user), "%s+%.0f", pool->rpc_user, diff);
+        else
+            snprintf(user, sizeof(user), "%s", pool->rpc_user);
+        pool->suggest_diff_unsupported = true;
+    } else
+        snprintf(user, sizeof(user), "%s", pool->rpc_user);
 
     sprintf(s, "{\"id\": %d, \"method\": \"mining.authorize\", \"params\": [\"%s\", \"%s\"]}",
         swork_id++, user, pool->rpc_pass);
@@ -2674,11 +3045,18 @@ bool auth_stratum(struct pool* pool)
     pool->probed = true;
     successful_connect = true;
 
-    if (opt_suggest_diff) {
-        sprintf(s, "{\"id\": %d, \"method\": \"mining.suggest_difficulty\", \"params\": [%d]}",
-            swork_id++, opt_suggest_diff);
-        stratum_send(pool, s, strlen(s));
-    }
+    /* A fixed difficulty for this pool wins over --suggest-diff, which wins
+     * over whatever the share rate controller last asked for. */
+    if (pool->fixed_diff > 0)
+        diff = pool->fixed_diff;
+    else if (pool->fixed_diff == 0 && opt_suggest_diff)
+        diff = opt_suggest_diff;
+    else if (pool->fixed_diff == 0)
+        diff = pool->suggested_diff;
+    else
+        diff = 0;
+    if (diff > 0)
+        suggest_stratum_diff(pool, diff);
 out:
     json_decref(val);
     return ret;
@@ -3181,6 +3559,16 @@ resend:
         free(nonce1);
         goto out;
     }
+#if (ALGO == BLAKE2B)
+    /* The Sia header is built with fixed size extranonce buffers */
+    if (strlen(nonce1) / 2 > SIA_EXTRANONCE_MAX || n2size > SIA_EXTRANONCE_MAX) {
+        applog(LOG_WARNING, "Pool %d extranonce sizes %d+%d are too long for Sia work",
+            pool->pool_no, (int)strlen(nonce1) / 2, n2size);
+        free(sessionid);
+        free(nonce1);
+        goto out;
+    }
+#endif
 
     if (sessionid && pool->sessionid && !strcmp(sessionid, pool->sessionid)) {
         applog(LOG_NOTICE, "Pool %d successfully negotiated resume with the same session ID",
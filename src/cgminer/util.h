@@ -103,6 +103,17 @@ typedef LARGE_INTEGER cgtimer_t;
 typedef struct timespec cgtimer_t;
 #endif
 
+/* Histogram of latencies in ms. Bucket i holds samples up to
+ * LATENCY_MIN_MS * sqrt(2)^i so percentiles are within ~40% of the truth
+ * over a range of 0.1ms to several minutes. */
+#define LATENCY_BUCKETS 48
+#define LATENCY_MIN_MS 0.1
+struct latency_hist {
+    uint64_t count;
+    uint64_t bucket[LATENCY_BUCKETS];
+    double max_ms;
+};
+
 extern int no_yield(void);
 extern int (*selective_yield)(void);
 void *_cgmalloc(size_t size, const char *file, const char *func, const int line);
@@ -143,19 +154,34 @@ void cgsleep_ms_r(cgtimer_t *ts_start, int ms);
 void cgsleep_us_r(cgtimer_t *ts_start, int64_t us);
 int cgtimer_to_ms(cgtimer_t *cgt);
 void cgtimer_sub(cgtimer_t *a, cgtimer_t *b, cgtimer_t *res);
+double cgtimer_to_msf(cgtimer_t *cgt);
+double cgtimer_ms_diff(cgtimer_t *end, cgtimer_t *start);
+void latency_add(struct latency_hist *hist, double ms);
+double latency_percentile(struct latency_hist *hist, double pct);
 double us_tdiff(struct timeval *end, struct timeval *start);
 int ms_tdiff(struct timeval *end, struct timeval *start);
 double tdiff(struct timeval *end, struct timeval *start);
 bool stratum_send(struct pool *pool, char *s, ssize_t len);
 bool sock_full(struct pool *pool);
+void stratum_poll_init(void);
+bool stratum_wait(struct pool *pool, int secs);
+#define STRATUM_POLL_OFF 0
+#define STRATUM_POLL_FAILED 1
+#define STRATUM_POLL_RECHECK 2
+#define STRATUM_POLL_RECONNECT 3
+/* How often a pool's rthread checks its polled connection is still needed */
+#define STRATUM_POLL_CHECK_SECS 5
+int stratum_poll(struct pool *pool, int secs, bool (*needed)(struct pool *));
 void ckrecalloc(void **ptr, size_t old, size_t new, const char *file, const char *func, const int line);
 #define recalloc(ptr, old, new) ckrecalloc((void *)&(ptr), old, new, __FILE__, __func__, __LINE__)
 char *recv_line(struct pool *pool);
 bool parse_method(struct pool *pool, char *s);
 bool extract_sockaddr(char *url, char **sockaddr_url, char **sockaddr_port);
+bool suggest_stratum_diff(struct pool *pool, double diff);
 bool auth_stratum(struct pool *pool);
 bool initiate_stratum(struct pool *pool);
 bool restart_stratum(struct pool *pool);
+bool reconnect_stratum(struct pool *pool);
 void suspend_stratum(struct pool *pool);
 void dev_error(struct cgpu_info *dev, enum dev_reason reason);
 void *realloc_strcat(char *ptr, char *s);
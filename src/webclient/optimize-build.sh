@@ -7,3 +7,12 @@ rm -f build/static/media/*.png
 rm -f build/static/media/*.ttf
 rm -f build/static/css/*.map
 rm -f build/static/js/*.map
+
+# Precompress the text assets; apiserver serves these to browsers that accept them
+find build -type f \( -name '*.html' -o -name '*.js' -o -name '*.css' -o -name '*.json' -o -name '*.svg' -o -name '*.txt' \) |
+while read -r f; do
+  gzip -9 -n -k -f "$f"
+  if command -v brotli > /dev/null; then
+    brotli -q 11 -k -f "$f"
+  fi
+done
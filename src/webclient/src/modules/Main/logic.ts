@@ -330,6 +330,27 @@ export const setMiningConfigLogic = createLogic({
   },
 })
 
+// Hex SHA-256 of a file, or '' where the browser can't compute it: crypto.subtle is only there
+// on https or localhost pages, and the server then takes the upload without checking it.
+const fileSha256 = async (file: Blob): Promise<string> => {
+  const subtle = window.crypto && window.crypto.subtle
+  if (!subtle) {
+    return ''
+  }
+  try {
+    const data = await new Promise<ArrayBuffer>((resolve, reject) => {
+      const reader = new FileReader()
+      reader.onload = () => resolve(reader.result as ArrayBuffer)
+      reader.onerror = () => reject(reader.error)
+      reader.readAsArrayBuffer(file)
+    })
+    const digest = await subtle.digest('SHA-256', data)
+    return Array.from(new Uint8Array(digest)).map(b => ('0' + b.toString(16)).slice(-2)).join('')
+  } catch (e) {
+    return ''
+  }
+}
+
 export const uploadFirmwareFileLogic = createLogic({
   type: uploadFirmwareFile.started.type,
 
@@ -345,51 +366,58 @@ export const uploadFirmwareFileLogic = createLogic({
     dispatch(setUploadFilename(uploadParams.file.name))
     dispatch(setUploadProgress(0))
     const fileSize = uploadParams.file.size
-    const FILE_BLOCK_SIZE = 4 * 1024
+    const FILE_BLOCK_SIZE = 512 * 1024
+    const MAX_RETRIES = 5
+    const sha256 = await fileSha256(uploadParams.file)
 
+    // Send the file as raw chunks. If a chunk fails, ask how much arrived and carry on from there.
+    // The last chunk carries the SHA-256, and the server rejects the file with a 422 if it differs.
     let offset = 0
-    let endOffset = Math.min(fileSize, FILE_BLOCK_SIZE)
-
-    const reader = new FileReader()
-
-    // If we use onloadend, we need to check the readyState.
-    reader.onloadend = async function(evt: any) {
-      if (evt.target.readyState === FileReader.DONE) {
-        const data = btoa(evt.target.result)
-
-        try {
-          await axios.post(`/api/action/uploadFirmwareFile`, { data, offset })
-        } catch (e) {
-          dispatch(setLastError(e.response.statusText))
+    let retries = 0
+    while (offset < fileSize) {
+      const endOffset = Math.min(offset + FILE_BLOCK_SIZE, fileSize)
+      const sha256Param = endOffset === fileSize && sha256 ? `&sha256=${sha256}` : ''
+      try {
+        const resp = await axios.put(
+          `/api/firmware/upload?offset=${offset}&totalSize=${fileSize}${sha256Param}`,
+          uploadParams.file.slice(offset, endOffset),
+          { headers: { 'Content-Type': 'application/octet-stream' } }
+        )
+        offset = resp.data.offset
+        retries = 0
+      } catch (e) {
+        if (e.response && e.response.status === 422) {
+          dispatch(
+            setLastError(
+              e.response.data && e.response.data.error
+                ? e.response.data.error
+                : e.response.statusText
+            )
+          )
           done()
           return
         }
-
-        // Read the next block
-        offset = endOffset
-
-        const p = Math.round((offset * 100) / fileSize)
-        // console.log('offset=' + offset + '  fileSize=' + fileSize + ' p=' + p)
-        dispatch(setUploadProgress(p))
-
-        if (offset < fileSize) {
-          endOffset = Math.min(offset + FILE_BLOCK_SIZE, fileSize)
-          const blob2 = uploadParams.file.slice(offset, endOffset)
-          reader.readAsBinaryString(blob2)
-        } else {
-          // Nothing else to send
-          dispatch(runUpgrade.started({}))
+        retries++
+        if (retries > MAX_RETRIES) {
+          dispatch(setLastError(e.response ? e.response.statusText : e.message))
           done()
+          return
+        }
+        try {
+          const status = await axios.get(`/api/firmware/upload`)
+          offset = status.data.offset
+        } catch (e2) {
+          // Try the same chunk again
         }
       }
-    }
 
-    // Kick off the initial read
-    const blob = uploadParams.file.slice(offset, endOffset)
-    reader.readAsBinaryString(blob)
+      const p = Math.round((offset * 100) / fileSize)
+      dispatch(setUploadProgress(p))
+    }
 
+    dispatch(runUpgrade.started({}))
+    done()
     return true
-    // return axios.post(`/api/action/uploadFirmwareFile`, action.payload)
   },
 })
 
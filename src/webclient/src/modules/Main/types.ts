@@ -94,6 +94,8 @@ export interface PoolStatus {
   status: string
   accepted: number
   rejected: number
+  notifyLatencyP50?: number
+  notifyLatencyP99?: number
 }
 
 export interface HashboardStatus {
@@ -108,6 +110,8 @@ export interface HashboardStatus {
   mhs1m: number
   mhs5m: number
   mhs15m: number
+  notifyLatencyP50?: number
+  notifyLatencyP99?: number
 }
 
 export interface DashboardStatus {
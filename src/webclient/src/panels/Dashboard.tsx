@@ -32,6 +32,14 @@ interface ConnectProps {
 
 type CombinedProps = ConnectProps & InjectedProps & DispatchProp<any>
 
+// Latencies come from cgminer in ms, older versions don't report them
+const formatLatency = (ms?: number) => (ms === undefined ? '-' : Number(ms).toFixed(0))
+
+// The dashboard follows the status stream, which only pushes what changed. It polls
+// status/dashboard instead until the stream is up, and again whenever the stream drops.
+const pollIntervalMs = 5000
+const streamRetryMs = 30000
+
 const chartColors = [
   '#FF6060', // board1
   '#FF4040', // board2
@@ -48,6 +56,9 @@ class Dashboard extends React.PureComponent<CombinedProps> {
   }
 
   timer: any
+  retryTimer: any
+  socket: WebSocket | null = null
+  streamStatus: any = {}
 
   refreshData = () => {
     const { dispatch } = this.props
@@ -56,14 +67,64 @@ class Dashboard extends React.PureComponent<CombinedProps> {
     }
   }
 
-  componentWillMount() {
-    this.timer = setInterval(this.refreshData, 5000)
-    this.refreshData()
+  startPolling = () => {
+    if (!this.timer) {
+      this.timer = setInterval(this.refreshData, pollIntervalMs)
+      this.refreshData()
+    }
   }
 
-  componentWillUnmount() {
+  stopPolling = () => {
     if (this.timer) {
       clearInterval(this.timer)
+      this.timer = null
+    }
+  }
+
+  openStream = () => {
+    this.retryTimer = null
+    if (typeof WebSocket === 'undefined') {
+      return
+    }
+    const protocol = window.location.protocol === 'https:' ? 'wss:' : 'ws:'
+    const socket = new WebSocket(`${protocol}//${window.location.host}/api/status/stream`)
+    socket.onmessage = (event: MessageEvent) => {
+      const message = JSON.parse(event.data)
+      // Only the first message is full; the rest carry just the top-level fields that changed
+      this.streamStatus = message.full ? message.status : { ...this.streamStatus, ...message.status }
+      this.stopPolling()
+      const { dispatch } = this.props
+      if (dispatch) {
+        // Same shape as the polled response, so the reducer handles both alike
+        dispatch(fetchDashboardStatus.done({ data: this.streamStatus } as any))
+      }
+    }
+    socket.onclose = () => {
+      // Closed by componentWillUnmount
+      if (this.socket !== socket) {
+        return
+      }
+      this.socket = null
+      this.startPolling()
+      this.retryTimer = setTimeout(this.openStream, streamRetryMs)
+    }
+    this.socket = socket
+  }
+
+  componentWillMount() {
+    this.startPolling()
+    this.openStream()
+  }
+
+  componentWillUnmount() {
+    this.stopPolling()
+    if (this.retryTimer) {
+      clearTimeout(this.retryTimer)
+    }
+    if (this.socket) {
+      const socket = this.socket
+      this.socket = null
+      socket.close()
     }
   }
 
@@ -152,6 +213,12 @@ class Dashboard extends React.PureComponent<CombinedProps> {
             {Number(h.mhs15m / 1000).toFixed(1)} GH/s
           </Table.Cell>
         )),
+      'JOB LATENCY P50/P99': (s: HashboardStatus[]) =>
+        _.map(s, (h, i) => (
+          <Table.Cell key={i} textAlign="center">
+            {formatLatency(h.notifyLatencyP50)}/{formatLatency(h.notifyLatencyP99)} ms
+          </Table.Cell>
+        )),
     }
 
     const poolTableMap = {
@@ -171,6 +238,11 @@ class Dashboard extends React.PureComponent<CombinedProps> {
           {s[i].accepted}/{s[i].rejected}
         </Table.Cell>
       ),
+      'JOB LATENCY P50/P99': (s: PoolStatus[], i: number) => (
+        <Table.Cell textAlign="center">
+          {formatLatency(s[i].notifyLatencyP50)}/{formatLatency(s[i].notifyLatencyP99)} ms
+        </Table.Cell>
+      ),
     }
 
     const mapPoolField = (i: number) =>